@@ -6,7 +6,9 @@
 #include <string.h>
 #include "ds.h"
 #include "quoftc.h"
+#include "lex.h"
 #include "ast.h"
+#include "match.h"
 
 /*
  * These functions take void pointers because they are passed to `alloc_vec()`
@@ -80,6 +82,12 @@ void *dup_type(void *p)
 	case VOLATILE_TYPE:
 		return ALLOC_VOLATILE_TYPE(src->lineno,
 				dup_type(src->u.volatile_.type));
+	case RESTRICT_TYPE:
+		return ALLOC_RESTRICT_TYPE(src->lineno,
+				dup_type(src->u.restrict_.type));
+	case VECTOR_TYPE:
+		return ALLOC_VECTOR_TYPE(src->lineno,
+				dup_type(src->u.vector.l), src->u.vector.len);
 	}
 	internal_error();
 }
@@ -137,6 +145,12 @@ void free_type(void *p)
 	case VOLATILE_TYPE:
 		free_type(type->u.volatile_.type);
 		break;
+	case RESTRICT_TYPE:
+		free_type(type->u.restrict_.type);
+		break;
+	case VECTOR_TYPE:
+		free_type(type->u.vector.l);
+		break;
 	}
 	free(type);
 }
@@ -157,6 +171,14 @@ void free_expr(void *p)
 	case STRING_LIT_EXPR:
 		free(expr->u.string_lit.val);
 		break;
+	case EMBED_EXPR:
+		free(expr->u.embed.name);
+		unmap_embedded_file(expr->u.embed.data, expr->u.embed.len);
+		break;
+	case BUILTIN_EXPR:
+		free_type(expr->u.builtin.type);
+		free_vec(expr->u.builtin.args);
+		break;
 	case UNARY_OP_EXPR:
 		free_expr(expr->u.unary_op.operand);
 		break;
@@ -167,6 +189,7 @@ void free_expr(void *p)
 	case LAMBDA_EXPR:
 		free_vec(expr->u.lambda.params);
 		free_expr(expr->u.lambda.body);
+		free_vec(expr->u.lambda.captures);
 		break;
 	case ARRAY_LIT_EXPR:
 		free_vec(expr->u.array_lit.val);
@@ -185,6 +208,7 @@ void free_expr(void *p)
 	case SWITCH_EXPR:
 		free_expr(expr->u.switch_.ctrl);
 		free_vec(expr->u.switch_.cases);
+		free_match_tree(expr->u.switch_.match);
 		break;
 	case TUPLE_EXPR:
 		free_vec(expr->u.tuple.items);
@@ -201,9 +225,13 @@ void free_expr(void *p)
 		free_expr(expr->u.index.array);
 		free_expr(expr->u.index.index);
 		break;
+	case SLICE_EXPR:
+		free_expr(expr->u.slice.array);
+		free_expr(expr->u.slice.start);
+		free_expr(expr->u.slice.end);
+		break;
 	}
-	free_type(expr->type); // TODO: Is this safe?
-	free(expr);
+	free(expr); // Its type is canonical, so it is not freed
 }
 
 void free_switch_pattern(void *p)
@@ -267,6 +295,7 @@ void free_decl(void *p)
 		free(decl->u.func.name);
 		free_vec(decl->u.func.param_names);
 		free_vec(decl->u.func.body_stmts);
+		free(decl->u.func.param_effects);
 		break;
 	}
 	free(decl);
@@ -312,6 +341,9 @@ void free_stmt(void *p)
 		break;
 	case CONTINUE_STMT:
 		break;
+	case DEFER_STMT:
+		free_stmt(stmt->u.defer.stmt);
+		break;
 	}
 	free(stmt);
 }
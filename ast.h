@@ -24,13 +24,16 @@
 
 struct type {
 	unsigned lineno;
-	enum {
+	size_t id; // Nonzero if the type is canonical; see types.c
+	enum type_kind {
 		UNSIZED_INT_TYPE, // Unused until semantic analysis
 		U8_TYPE, U16_TYPE, U32_TYPE, U64_TYPE,
 		I8_TYPE, I16_TYPE, I32_TYPE, I64_TYPE,
 		F32_TYPE, F64_TYPE, BOOL_TYPE, VOID_TYPE, CHAR_TYPE,
 		ALIAS_TYPE, PARAM_TYPE, ARRAY_TYPE, POINTER_TYPE,
-		TUPLE_TYPE, STRUCT_TYPE, FUNC_TYPE, CONST_TYPE, VOLATILE_TYPE
+		TUPLE_TYPE, STRUCT_TYPE, FUNC_TYPE, CONST_TYPE, VOLATILE_TYPE,
+		RESTRICT_TYPE,
+		VECTOR_TYPE
 	} kind;
 	union {
 		struct {
@@ -42,7 +45,7 @@ struct type {
 		} param;
 		struct {
 			struct type *l;
-			unsigned len; // Zero if unspecified
+			uint64_t len; // Zero if a slice
 		} array;
 		struct {
 			struct type *l;
@@ -59,10 +62,16 @@ struct type {
 		} func;
 		struct {
 			struct type *type;
-		} const_, volatile_;
+		} const_, volatile_, restrict_;
+		struct {
+			struct type *l; // A scalar type other than `char`
+			uint64_t len;
+		} vector;
 	} u;
 };
 
+#define MAX_VECTOR_LEN 64
+
 #define ALLOC_UNSIZED_INT_TYPE(lineno) \
 	ALLOC_UNION_KIND_ONLY(type, UNSIZED_INT_TYPE, lineno)
 #define ALLOC_U8_TYPE(lineno) \
@@ -109,6 +118,10 @@ struct type {
 	ALLOC_UNION(type, CONST_TYPE, const_, __VA_ARGS__)
 #define ALLOC_VOLATILE_TYPE(...) \
 	ALLOC_UNION(type, VOLATILE_TYPE, volatile_, __VA_ARGS__)
+#define ALLOC_RESTRICT_TYPE(...) \
+	ALLOC_UNION(type, RESTRICT_TYPE, restrict_, __VA_ARGS__)
+#define ALLOC_VECTOR_TYPE(...) \
+	ALLOC_UNION(type, VECTOR_TYPE, vector, __VA_ARGS__)
 
 void *dup_type(void *);
 
@@ -131,6 +144,14 @@ enum bin_op {
 	BIT_SHIFT_L_ASSIGN_OP, BIT_SHIFT_R_ASSIGN_OP
 };
 
+// Builtins called like `@splat(F32x8, x)`, mostly for vectors
+enum builtin {
+	SPLAT_BUILTIN, SHUFFLE_BUILTIN, REDUCE_ADD_BUILTIN, REDUCE_MUL_BUILTIN,
+	REDUCE_MIN_BUILTIN, REDUCE_MAX_BUILTIN, REDUCE_AND_BUILTIN,
+	REDUCE_OR_BUILTIN, REDUCE_XOR_BUILTIN, LOAD_BUILTIN, STORE_BUILTIN,
+	MASKED_LOAD_BUILTIN, MASKED_STORE_BUILTIN
+};
+
 struct expr {
 	struct type *type; // Uninitialized until semantic analysis
 	unsigned lineno;
@@ -138,7 +159,8 @@ struct expr {
 		BOOL_LIT_EXPR, INT_LIT_EXPR, FLOAT_LIT_EXPR, CHAR_LIT_EXPR,
 		STRING_LIT_EXPR, UNARY_OP_EXPR, BIN_OP_EXPR, LAMBDA_EXPR,
 		ARRAY_LIT_EXPR, IDENT_EXPR, BLOCK_EXPR, IF_EXPR, SWITCH_EXPR,
-		TUPLE_EXPR, FUNC_CALL_EXPR, FIELD_ACCESS_EXPR, INDEX_EXPR
+		TUPLE_EXPR, FUNC_CALL_EXPR, FIELD_ACCESS_EXPR, INDEX_EXPR,
+		SLICE_EXPR, EMBED_EXPR, BUILTIN_EXPR
 	} kind;
 	union {
 		struct {
@@ -155,7 +177,7 @@ struct expr {
 		} char_lit;
 		struct {
 			char *val;
-			unsigned len;
+			size_t len;
 		} string_lit;
 		struct {
 			enum unary_op op;
@@ -168,12 +190,16 @@ struct expr {
 		struct {
 			Vec *params;
 			struct expr *body;
+			size_t param_sym_id; // Set by check_ast()
+			// Of the enclosing locals it uses, set by check_ast()
+			Vec *captures;
 		} lambda;
 		struct {
 			Vec *val;
 		} array_lit;
 		struct {
 			char *name;
+			size_t sym_id; // Set by check_ast()
 		} ident;
 		struct {
 			Vec *stmts;
@@ -184,6 +210,8 @@ struct expr {
 		struct {
 			struct expr *ctrl;
 			Vec *cases;
+			// Set by check_ast() if `ctrl` is a tuple or array
+			struct match_tree *match;
 		} switch_;
 		struct {
 			Vec *items;
@@ -198,7 +226,22 @@ struct expr {
 		} field_access;
 		struct {
 			struct expr *array, *index;
+			bool is_in_bounds; // Set by prove_indices_in_bounds()
 		} index;
+		struct {
+			struct expr *array;
+			struct expr *start, *end; // NULL if omitted
+		} slice;
+		struct {
+			char *name;
+			char *data; // Mapped file contents, NULL if empty
+			size_t len;
+		} embed;
+		struct {
+			enum builtin builtin;
+			struct type *type; // Vector type argument, NULL if none
+			Vec *args;
+		} builtin;
 	} u;
 };
 
@@ -236,6 +279,12 @@ struct expr {
 	ALLOC_UNION(expr, FIELD_ACCESS_EXPR, field_access, __VA_ARGS__)
 #define ALLOC_INDEX_EXPR(...) \
 	ALLOC_UNION(expr, INDEX_EXPR, index, __VA_ARGS__)
+#define ALLOC_SLICE_EXPR(...) \
+	ALLOC_UNION(expr, SLICE_EXPR, slice, __VA_ARGS__)
+#define ALLOC_EMBED_EXPR(...) \
+	ALLOC_UNION(expr, EMBED_EXPR, embed, __VA_ARGS__)
+#define ALLOC_BUILTIN_EXPR(...) \
+	ALLOC_UNION(expr, BUILTIN_EXPR, builtin, __VA_ARGS__)
 
 void free_expr(void *);
 
@@ -279,6 +328,32 @@ struct switch_case {
 
 void free_switch_case(void *);
 
+// How a function uses a pointer parameter, as a set of flags
+enum param_effect {
+	READS_PARAM = 1 << 0, // Reads through it
+	WRITES_PARAM = 1 << 1, // Writes through it
+	PARAM_ESCAPES = 1 << 2, // Used other than by dereferencing it
+	// Of any parameter: assigned, or changed by a `become` of the function
+	PARAM_REBOUND = 1 << 3
+};
+
+// What a call to a function may do besides returning a value, as flags
+enum func_effect {
+	READS_MEMORY = 1 << 0, // Memory that outlives the call
+	WRITES_MEMORY = 1 << 1,
+	MAY_SYNC = 1 << 2, // Such as by a volatile access
+	MAY_NOT_RETURN = 1 << 3 // Loops, recurses or traps
+};
+
+// Annotations such as `@inline` on a function, as flags
+enum func_attr {
+	INLINE_ATTR = 1 << 0,
+	ALWAYS_INLINE_ATTR = 1 << 1,
+	NOINLINE_ATTR = 1 << 2,
+	HOT_ATTR = 1 << 3,
+	COLD_ATTR = 1 << 4
+};
+
 struct decl {
 	unsigned lineno;
 	enum {
@@ -290,6 +365,7 @@ struct decl {
 			struct type *type;
 			char *name;
 			struct expr *init;
+			size_t sym_id; // Set by check_ast()
 		} data;
 		struct {
 			char *name;
@@ -300,7 +376,19 @@ struct decl {
 			struct type *type;
 			char *name;
 			Vec *param_names;
-			Vec *body_stmts;
+			Vec *body_stmts; // NULL if prototype
+			// With those of earlier declarations after check_ast()
+			unsigned attrs;
+			// Set by check_ast(); the params have consecutive ids
+			size_t sym_id, param_sym_id;
+			// Set by infer_effects() unless a prototype
+			unsigned *param_effects;
+			unsigned func_effects;
+			/*
+			 * The next of the functions that call each other
+			 * with `become`, in a cycle, or NULL if none
+			 */
+			struct decl *become_next;
 		} func;
 	} u;
 };
@@ -314,11 +402,19 @@ struct decl {
 
 void free_decl(void *);
 
+// Annotations such as `@vectorize(width=8)` on a loop statement
+struct loop_hints {
+	enum loop_hint { DEFAULT_HINT, ENABLE_HINT, DISABLE_HINT }
+		vectorize, unroll;
+	unsigned vectorize_width, unroll_count; // Zero if not given
+};
+
 struct stmt {
 	unsigned lineno;
 	enum {
 		DECL_STMT, EXPR_STMT, IF_STMT, DO_STMT,
-		WHILE_STMT, FOR_STMT, RETURN_STMT, BREAK_STMT, CONTINUE_STMT
+		WHILE_STMT, FOR_STMT, RETURN_STMT, BREAK_STMT, CONTINUE_STMT,
+		DEFER_STMT
 	} kind;
 	union {
 		struct {
@@ -334,14 +430,20 @@ struct stmt {
 		struct {
 			Vec *stmts;
 			struct expr *cond;
+			struct loop_hints hints;
 		} do_, while_;
 		struct {
 			struct expr *init, *cond, *post;
 			Vec *stmts;
+			struct loop_hints hints;
 		} for_;
 		struct {
 			struct expr *expr; // NULL if no expr
+			bool is_tail; // Written as `become`, so a function call
 		} return_;
+		struct {
+			struct stmt *stmt; // Run when the scope is left
+		} defer;
 	} u;
 };
 
@@ -363,6 +465,8 @@ struct stmt {
 	ALLOC_UNION_KIND_ONLY(stmt, BREAK_STMT, lineno)
 #define ALLOC_CONTINUE_STMT(lineno) \
 	ALLOC_UNION_KIND_ONLY(stmt, CONTINUE_STMT, lineno)
+#define ALLOC_DEFER_STMT(...) \
+	ALLOC_UNION(stmt, DEFER_STMT, defer, __VA_ARGS__)
 
 void free_stmt(void *);
 
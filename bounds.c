@@ -0,0 +1,556 @@
+/*
+ * Finds array indices that are always in bounds, so that `-fbounds-check`
+ * doesn't need to check them at runtime. An index is proven in bounds if it is
+ * a constant less than the array length, or the induction variable of an
+ * enclosing loop of the form
+ *
+ *     for (i = c; i < n; i++) { ... }
+ *
+ * where `c` is an integer literal, `i` is not modified or shadowed in the loop
+ * body, and `n` is either an integer literal that is at most the array length,
+ * or `a.len` where `a` is the indexed array or slice and is not modified in the
+ * loop body. Both `i` and `a` must be locals that are never referenced with `&`
+ * or changed in a lambda, so that calls can't modify them either.
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ds.h"
+#include "quoftc.h"
+#include "ast.h"
+#include "bounds.h"
+
+// Loop variable known to be in `[0, bound)` in the current loop body
+struct induction_var {
+	char *name;
+	uint64_t bound;
+	char *array_name; // If not NULL, the bound is `array_name.len` instead
+};
+
+// What counts as modifying a variable
+enum modify_kind {
+	ANY_MODIFY, // Assignment, increment, decrement, `&` or shadowing
+	// Only `&` or changes in a lambda, which calls may make at any time
+	REF_MODIFY
+};
+
+static Vec *induction_vars;
+static Vec *cur_func_body_stmts;
+static size_t cur_func_first_param_id;
+
+static bool stmts_modify_var(Vec *, const char *, enum modify_kind);
+
+static bool is_ident(struct expr *expr, const char *name)
+{
+	return expr->kind == IDENT_EXPR &&
+		strcmp(expr->u.ident.name, name) == 0;
+}
+
+static bool exprs_modify_var(Vec *, const char *, enum modify_kind);
+
+static bool expr_modifies_var(struct expr *expr, const char *name,
+		enum modify_kind kind)
+{
+	struct expr *operand;
+	size_t i;
+
+	if (expr == NULL) {
+		return false;
+	}
+	switch (expr->kind) {
+	case BOOL_LIT_EXPR:
+	case INT_LIT_EXPR:
+	case FLOAT_LIT_EXPR:
+	case CHAR_LIT_EXPR:
+	case STRING_LIT_EXPR:
+	case EMBED_EXPR:
+	case IDENT_EXPR:
+		return false;
+	case UNARY_OP_EXPR:
+		operand = expr->u.unary_op.operand;
+		switch (expr->u.unary_op.op) {
+		case PRE_INC_OP:
+		case POST_INC_OP:
+		case PRE_DEC_OP:
+		case POST_DEC_OP:
+			if (kind == ANY_MODIFY && is_ident(operand, name)) {
+				return true;
+			}
+			break;
+		case REF_OP:
+			if (is_ident(operand, name)) {
+				return true;
+			}
+			break;
+		default:
+			break;
+		}
+		return expr_modifies_var(operand, name, kind);
+	case BIN_OP_EXPR:
+		if (kind == ANY_MODIFY && expr->u.bin_op.op >= ASSIGN_OP &&
+				is_ident(expr->u.bin_op.l, name)) {
+			return true;
+		}
+		return expr_modifies_var(expr->u.bin_op.l, name, kind) ||
+			expr_modifies_var(expr->u.bin_op.r, name, kind);
+	case LAMBDA_EXPR:
+		// The lambda may be called through a function value anywhere
+		return expr_modifies_var(expr->u.lambda.body, name,
+				ANY_MODIFY);
+	case ARRAY_LIT_EXPR:
+		return exprs_modify_var(expr->u.array_lit.val, name, kind);
+	case BLOCK_EXPR:
+		return stmts_modify_var(expr->u.block.stmts, name, kind);
+	case IF_EXPR:
+		return expr_modifies_var(expr->u.if_.cond, name, kind) ||
+			expr_modifies_var(expr->u.if_.then, name, kind) ||
+			expr_modifies_var(expr->u.if_.else_, name, kind);
+	case SWITCH_EXPR:
+		if (expr_modifies_var(expr->u.switch_.ctrl, name, kind)) {
+			return true;
+		}
+		for (i = 0; i < vec_len(expr->u.switch_.cases); i++) {
+			struct switch_case *case_ =
+				vec_get(expr->u.switch_.cases, i);
+
+			// Patterns are conditions if there is no value
+			if (case_->l->kind == EXPR_SWITCH_PATTERN &&
+					expr_modifies_var(case_->l->u.expr.expr,
+						name, kind)) {
+				return true;
+			}
+			if (expr_modifies_var(case_->r, name, kind)) {
+				return true;
+			}
+		}
+		return false;
+	case TUPLE_EXPR:
+		return exprs_modify_var(expr->u.tuple.items, name, kind);
+	case FUNC_CALL_EXPR:
+		return expr_modifies_var(expr->u.func_call.func, name,
+					kind) ||
+			exprs_modify_var(expr->u.func_call.args, name, kind);
+	case FIELD_ACCESS_EXPR:
+		return expr_modifies_var(expr->u.field_access.expr, name,
+				kind);
+	case INDEX_EXPR:
+		return expr_modifies_var(expr->u.index.array, name, kind) ||
+			expr_modifies_var(expr->u.index.index, name, kind);
+	case SLICE_EXPR:
+		return expr_modifies_var(expr->u.slice.array, name, kind) ||
+			expr_modifies_var(expr->u.slice.start, name, kind) ||
+			expr_modifies_var(expr->u.slice.end, name, kind);
+	case BUILTIN_EXPR:
+		return exprs_modify_var(expr->u.builtin.args, name, kind);
+	}
+	internal_error();
+}
+
+static bool exprs_modify_var(Vec *exprs, const char *name,
+		enum modify_kind kind)
+{
+	size_t i;
+
+	for (i = 0; i < vec_len(exprs); i++) {
+		if (expr_modifies_var(vec_get(exprs, i), name, kind)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool stmt_modifies_var(struct stmt *stmt, const char *name,
+		enum modify_kind kind)
+{
+	struct decl *decl;
+
+	switch (stmt->kind) {
+	case DECL_STMT:
+		decl = stmt->u.decl.decl;
+		assert(decl->kind == DATA_DECL);
+		return (kind == ANY_MODIFY &&
+				strcmp(decl->u.data.name, name) == 0) ||
+			expr_modifies_var(decl->u.data.init, name, kind);
+	case EXPR_STMT:
+		return expr_modifies_var(stmt->u.expr.expr, name, kind);
+	case IF_STMT:
+		return expr_modifies_var(stmt->u.if_.cond, name, kind) ||
+			stmts_modify_var(stmt->u.if_.then_stmts, name,
+					kind) ||
+			stmts_modify_var(stmt->u.if_.else_stmts, name, kind);
+	case DO_STMT:
+		return stmts_modify_var(stmt->u.do_.stmts, name, kind) ||
+			expr_modifies_var(stmt->u.do_.cond, name, kind);
+	case WHILE_STMT:
+		return expr_modifies_var(stmt->u.while_.cond, name, kind) ||
+			stmts_modify_var(stmt->u.while_.stmts, name, kind);
+	case FOR_STMT:
+		return expr_modifies_var(stmt->u.for_.init, name, kind) ||
+			expr_modifies_var(stmt->u.for_.cond, name, kind) ||
+			expr_modifies_var(stmt->u.for_.post, name, kind) ||
+			stmts_modify_var(stmt->u.for_.stmts, name, kind);
+	case RETURN_STMT:
+		return expr_modifies_var(stmt->u.return_.expr, name, kind);
+	case BREAK_STMT:
+	case CONTINUE_STMT:
+		return false;
+	case DEFER_STMT:
+		return stmt_modifies_var(stmt->u.defer.stmt, name, kind);
+	}
+	internal_error();
+}
+
+static bool stmts_modify_var(Vec *stmts, const char *name,
+		enum modify_kind kind)
+{
+	size_t i;
+
+	if (stmts == NULL) {
+		return false;
+	}
+	for (i = 0; i < vec_len(stmts); i++) {
+		if (stmt_modifies_var(vec_get(stmts, i), name, kind)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static uint64_t get_int_type_max(struct type *type)
+{
+	switch (type->kind) {
+	case U8_TYPE:
+		return UINT8_MAX;
+	case U16_TYPE:
+		return UINT16_MAX;
+	case U32_TYPE:
+		return UINT32_MAX;
+	case U64_TYPE:
+		return UINT64_MAX;
+	case I8_TYPE:
+		return INT8_MAX;
+	case I16_TYPE:
+		return INT16_MAX;
+	case I32_TYPE:
+		return INT32_MAX;
+	case I64_TYPE:
+		return INT64_MAX;
+	default:
+		return 0;
+	}
+}
+
+// Globals may be changed by any call, so only locals are considered
+static bool is_local_var(struct expr *expr)
+{
+	return expr->kind == IDENT_EXPR &&
+		expr->u.ident.sym_id >= cur_func_first_param_id &&
+		!stmts_modify_var(cur_func_body_stmts, expr->u.ident.name,
+				REF_MODIFY);
+}
+
+static bool is_inc_of_var(struct expr *expr, const char *name)
+{
+	switch (expr->kind) {
+	case UNARY_OP_EXPR:
+		return (expr->u.unary_op.op == PRE_INC_OP ||
+				expr->u.unary_op.op == POST_INC_OP) &&
+			is_ident(expr->u.unary_op.operand, name);
+	case BIN_OP_EXPR:
+		return expr->u.bin_op.op == ADD_ASSIGN_OP &&
+			is_ident(expr->u.bin_op.l, name) &&
+			expr->u.bin_op.r->kind == INT_LIT_EXPR &&
+			expr->u.bin_op.r->u.int_lit.val == 1;
+	default:
+		return false;
+	}
+}
+
+// Reads a loop bound of the form `n` or `a.len`, returning false otherwise
+static bool get_loop_bound(struct expr *expr, uint64_t *bound,
+		char **array_name)
+{
+	struct expr *array;
+
+	*array_name = NULL;
+	if (expr->kind == INT_LIT_EXPR) {
+		*bound = expr->u.int_lit.val;
+		return true;
+	}
+	if (expr->kind != FIELD_ACCESS_EXPR) {
+		return false;
+	}
+	array = expr->u.field_access.expr;
+	assert(strcmp(expr->u.field_access.field, "len") == 0);
+	if (array->type->kind == ARRAY_TYPE && array->type->u.array.len != 0) {
+		*bound = array->type->u.array.len;
+		return true;
+	}
+	if (!is_local_var(array)) {
+		return false;
+	}
+	*array_name = array->u.ident.name;
+	*bound = UINT64_MAX;
+	return true;
+}
+
+/*
+ * Returns the induction variable of a loop like `for (i = 0; i < 10; i++)`,
+ * or NULL if the loop doesn't have this form. Because `i` starts at a
+ * non-negative literal and only grows by one while less than the bound, it
+ * can't overflow and is in `[0, bound)` throughout the body.
+ */
+static struct induction_var *get_induction_var(struct stmt *stmt)
+{
+	struct induction_var *var;
+	struct expr *init, *cond, *post, *ident;
+	uint64_t bound;
+	char *name, *array_name;
+
+	assert(stmt->kind == FOR_STMT);
+	init = stmt->u.for_.init;
+	cond = stmt->u.for_.cond;
+	post = stmt->u.for_.post;
+	if (init->kind != BIN_OP_EXPR || init->u.bin_op.op != ASSIGN_OP ||
+			!is_local_var(init->u.bin_op.l) ||
+			init->u.bin_op.r->kind != INT_LIT_EXPR) {
+		return NULL;
+	}
+	ident = init->u.bin_op.l;
+	name = ident->u.ident.name;
+	if (cond->kind != BIN_OP_EXPR || cond->u.bin_op.op != LT_OP ||
+			!is_ident(cond->u.bin_op.l, name) ||
+			!get_loop_bound(cond->u.bin_op.r, &bound,
+				&array_name)) {
+		return NULL;
+	}
+	if (array_name != NULL && stmts_modify_var(stmt->u.for_.stmts,
+				array_name, ANY_MODIFY)) {
+		return NULL;
+	}
+	if (bound > get_int_type_max(ident->type) ||
+			!is_inc_of_var(post, name) ||
+			stmts_modify_var(stmt->u.for_.stmts, name,
+				ANY_MODIFY)) {
+		return NULL;
+	}
+	var = NEW(struct induction_var);
+	var->name = name;
+	var->bound = bound;
+	var->array_name = array_name;
+	return var;
+}
+
+static bool is_index_in_bounds(struct expr *expr)
+{
+	struct induction_var *var;
+	struct expr *array, *index;
+	uint64_t len;
+	size_t i;
+
+	assert(expr->kind == INDEX_EXPR);
+	array = expr->u.index.array;
+	index = expr->u.index.index;
+	if (array->type->kind == VECTOR_TYPE) {
+		len = array->type->u.vector.len;
+	} else {
+		len = array->type->u.array.len;
+	}
+	if (index->kind == INT_LIT_EXPR) {
+		return index->u.int_lit.val < len;
+	}
+	if (index->kind != IDENT_EXPR) {
+		return false;
+	}
+	for (i = vec_len(induction_vars); i-- > 0;) {
+		var = vec_get(induction_vars, i);
+		if (strcmp(var->name, index->u.ident.name) != 0) {
+			continue;
+		}
+		if (var->array_name != NULL) {
+			return is_ident(array, var->array_name);
+		}
+		return len != 0 && var->bound <= len;
+	}
+	return false;
+}
+
+static void prove_stmts(Vec *);
+
+static void prove_exprs(Vec *);
+
+static void prove_expr(struct expr *expr)
+{
+	Vec *outer_induction_vars;
+	size_t i;
+
+	if (expr == NULL) {
+		return;
+	}
+	switch (expr->kind) {
+	case BOOL_LIT_EXPR:
+	case INT_LIT_EXPR:
+	case FLOAT_LIT_EXPR:
+	case CHAR_LIT_EXPR:
+	case STRING_LIT_EXPR:
+	case EMBED_EXPR:
+	case IDENT_EXPR:
+		break;
+	case UNARY_OP_EXPR:
+		prove_expr(expr->u.unary_op.operand);
+		break;
+	case BIN_OP_EXPR:
+		prove_expr(expr->u.bin_op.l);
+		prove_expr(expr->u.bin_op.r);
+		break;
+	case LAMBDA_EXPR:
+		// The lambda may be called after the loop variable changes
+		outer_induction_vars = induction_vars;
+		induction_vars = alloc_vec(free);
+		prove_expr(expr->u.lambda.body);
+		free_vec(induction_vars);
+		induction_vars = outer_induction_vars;
+		break;
+	case ARRAY_LIT_EXPR:
+		prove_exprs(expr->u.array_lit.val);
+		break;
+	case BLOCK_EXPR:
+		prove_stmts(expr->u.block.stmts);
+		break;
+	case IF_EXPR:
+		prove_expr(expr->u.if_.cond);
+		prove_expr(expr->u.if_.then);
+		prove_expr(expr->u.if_.else_);
+		break;
+	case SWITCH_EXPR:
+		prove_expr(expr->u.switch_.ctrl);
+		for (i = 0; i < vec_len(expr->u.switch_.cases); i++) {
+			struct switch_case *case_ =
+				vec_get(expr->u.switch_.cases, i);
+
+			if (case_->l->kind == EXPR_SWITCH_PATTERN) {
+				prove_expr(case_->l->u.expr.expr);
+			}
+			prove_expr(case_->r);
+		}
+		break;
+	case TUPLE_EXPR:
+		prove_exprs(expr->u.tuple.items);
+		break;
+	case FUNC_CALL_EXPR:
+		prove_expr(expr->u.func_call.func);
+		prove_exprs(expr->u.func_call.args);
+		break;
+	case FIELD_ACCESS_EXPR:
+		prove_expr(expr->u.field_access.expr);
+		break;
+	case INDEX_EXPR:
+		prove_expr(expr->u.index.array);
+		prove_expr(expr->u.index.index);
+		expr->u.index.is_in_bounds = is_index_in_bounds(expr);
+		break;
+	case SLICE_EXPR:
+		prove_expr(expr->u.slice.array);
+		prove_expr(expr->u.slice.start);
+		prove_expr(expr->u.slice.end);
+		break;
+	case BUILTIN_EXPR:
+		prove_exprs(expr->u.builtin.args);
+		break;
+	}
+}
+
+static void prove_exprs(Vec *exprs)
+{
+	size_t i;
+
+	for (i = 0; i < vec_len(exprs); i++) {
+		prove_expr(vec_get(exprs, i));
+	}
+}
+
+static void prove_for_stmt(struct stmt *stmt)
+{
+	struct induction_var *var;
+
+	prove_expr(stmt->u.for_.init);
+	prove_expr(stmt->u.for_.cond);
+	prove_expr(stmt->u.for_.post);
+	var = get_induction_var(stmt);
+	if (var != NULL) {
+		vec_push(induction_vars, var);
+	}
+	prove_stmts(stmt->u.for_.stmts);
+	if (var != NULL) {
+		vec_pop(induction_vars);
+	}
+}
+
+static void prove_stmt(struct stmt *stmt)
+{
+	switch (stmt->kind) {
+	case DECL_STMT:
+		prove_expr(stmt->u.decl.decl->u.data.init);
+		break;
+	case EXPR_STMT:
+		prove_expr(stmt->u.expr.expr);
+		break;
+	case IF_STMT:
+		prove_expr(stmt->u.if_.cond);
+		prove_stmts(stmt->u.if_.then_stmts);
+		prove_stmts(stmt->u.if_.else_stmts);
+		break;
+	case DO_STMT:
+		prove_stmts(stmt->u.do_.stmts);
+		prove_expr(stmt->u.do_.cond);
+		break;
+	case WHILE_STMT:
+		prove_expr(stmt->u.while_.cond);
+		prove_stmts(stmt->u.while_.stmts);
+		break;
+	case FOR_STMT:
+		prove_for_stmt(stmt);
+		break;
+	case RETURN_STMT:
+		prove_expr(stmt->u.return_.expr);
+		break;
+	case BREAK_STMT:
+	case CONTINUE_STMT:
+		break;
+	case DEFER_STMT:
+		prove_stmt(stmt->u.defer.stmt);
+		break;
+	}
+}
+
+static void prove_stmts(Vec *stmts)
+{
+	size_t i;
+
+	if (stmts == NULL) {
+		return;
+	}
+	for (i = 0; i < vec_len(stmts); i++) {
+		prove_stmt(vec_get(stmts, i));
+	}
+}
+
+void prove_indices_in_bounds(struct ast ast)
+{
+	struct decl *decl;
+	size_t i;
+
+	induction_vars = alloc_vec(free);
+	for (i = 0; i < vec_len(ast.decls); i++) {
+		decl = vec_get(ast.decls, i);
+		if (decl->kind == FUNC_DECL) {
+			cur_func_body_stmts = decl->u.func.body_stmts;
+			cur_func_first_param_id = decl->u.func.param_sym_id;
+			prove_stmts(cur_func_body_stmts);
+		}
+	}
+	free_vec(induction_vars);
+}
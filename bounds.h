@@ -0,0 +1 @@
+void prove_indices_in_bounds(struct ast);
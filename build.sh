@@ -1,6 +1,9 @@
 #!/bin/sh
 cflags="-g -O0 -std=c99 -pedantic -Wall -Wextra -Werror -Wfatal-errors \
-	-Werror=missing-prototypes `llvm-config --cflags`"
+	-Werror=missing-prototypes"
 ldflags="`llvm-config --ldflags --libs`"
-args="$cflags $ldflags *.c -o quoftc"
-gcc $args && clang $args && ./run_tests.sh
+args="$cflags `llvm-config --cflags` $ldflags *.c -o quoftc"
+gcc $args && clang $args &&
+	gcc $cflags client/client.c -o quoftc-client &&
+	gcc $cflags tests/test_runner.c -o tests/test_runner &&
+	tests/test_runner "$@"
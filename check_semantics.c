@@ -12,30 +12,73 @@
 #include "quoftc.h"
 #include "ast.h"
 #include "symbol_table.h"
+#include "types.h"
+#include "eval.h"
 #include "check_semantics.h"
+#include "match.h"
 
 struct symbol_info {
 	enum { VALUE_SYM, TYPE_SYM } kind;
 	union {
 		struct {
 			bool is_let;
+			bool is_proto; // Function declared without a body
+			unsigned func_attrs; // Of all its declarations so far
 			struct type *type;
+			struct decl *decl; // NULL unless a data declaration
+			size_t id; // Index of the symbol within the AST
+			// May hold a closure whose environment is on the stack
+			bool is_stack_closure;
+			// May hold a slice of an array on the stack
+			bool is_stack_slice;
 		} value;
 		struct type *type;
 	} u;
 };
 
 static struct symbol_table sym_tbl;
+static size_t nsyms; // Value symbols declared so far
 static struct type *cur_func_type;
+static size_t cur_func_first_param_id; // Lower ids are globals
+static size_t cur_func_first_local_id; // Lower ids are params or globals
+static size_t npending_defers; // In the scopes enclosing the current one
+static bool in_defer;
+
+// A lambda being checked, and the lambdas enclosing it
+struct lambda_scope {
+	struct expr *lambda;
+	size_t first_capture_id; // Lower ids are globals
+	struct lambda_scope *outer;
+};
+
+static struct lambda_scope *cur_lambda;
+static struct expr *escape_ok_expr; // May be a closure on the stack
 
-static struct symbol_info *alloc_val_sym_info(bool is_let, struct type *type)
+static struct symbol_info *alloc_val_sym_info(bool is_let, struct type *type,
+		struct decl *decl)
 {
 	struct symbol_info *sym_info;
 
 	sym_info = NEW(struct symbol_info);
 	sym_info->kind = VALUE_SYM;
 	sym_info->u.value.is_let = is_let;
-	sym_info->u.value.type = type;
+	sym_info->u.value.is_proto = false;
+	sym_info->u.value.type = intern_type(type);
+	sym_info->u.value.decl = decl;
+	sym_info->u.value.id = nsyms++;
+	sym_info->u.value.is_stack_closure = false;
+	sym_info->u.value.is_stack_slice = false;
+	return sym_info;
+}
+
+// A function argument may be a lambda that captures the caller's locals
+static struct symbol_info *alloc_param_sym_info(struct type *type)
+{
+	struct symbol_info *sym_info;
+
+	sym_info = alloc_val_sym_info(true, type, NULL);
+	sym_info->u.value.is_stack_closure =
+		remove_const_and_volatile(type)->kind == FUNC_TYPE;
 	return sym_info;
 }
 
@@ -161,6 +204,7 @@ static bool is_pure_expr(struct expr *expr)
 	case FLOAT_LIT_EXPR:
 	case CHAR_LIT_EXPR:
 	case STRING_LIT_EXPR:
+	case EMBED_EXPR:
 	case LAMBDA_EXPR:
 		return true;
 	case IDENT_EXPR:
@@ -184,15 +228,33 @@ static bool is_pure_expr(struct expr *expr)
 	case FUNC_CALL_EXPR:
 		return false; // TODO
 	case FIELD_ACCESS_EXPR:
-		internal_error(); // TODO: Stub
+		return is_pure_expr(expr->u.field_access.expr);
 	case INDEX_EXPR:
+	case SLICE_EXPR:
 		return false;
+	case BUILTIN_EXPR:
+		switch (expr->u.builtin.builtin) {
+		case LOAD_BUILTIN:
+		case STORE_BUILTIN:
+		case MASKED_LOAD_BUILTIN:
+		case MASKED_STORE_BUILTIN:
+			return false;
+		default:
+			return vec_has_pure_items(expr->u.builtin.args);
+		}
 	}
 	internal_error();
 }
 
 static bool is_lvalue(struct expr *);
 
+// Captures are copies, so assigning them would not change the original
+static bool is_captured_id(size_t id)
+{
+	return cur_lambda != NULL && id >= cur_lambda->first_capture_id &&
+		id < cur_lambda->lambda->u.lambda.param_sym_id;
+}
+
 static bool is_lvalue_unary_op_expr(struct expr *expr)
 {
 	enum unary_op op = expr->u.unary_op.op;
@@ -214,14 +276,29 @@ static bool is_lvalue_ident_expr(struct expr *expr)
 	sym_info = lookup_symbol(sym_tbl, name);
 	assert(sym_info != NULL);
 	assert(sym_info->kind == VALUE_SYM);
-	return !sym_info->u.value.is_let;
+	return !sym_info->u.value.is_let &&
+		!is_captured_id(sym_info->u.value.id);
+}
+
+// Items of strings and embedded files may be in read-only memory
+static bool has_mutable_items(struct expr *array)
+{
+	return remove_const_and_volatile(array->type)->u.array.l->kind !=
+		CONST_TYPE && is_lvalue(array);
 }
 
 // TODO: Test what happens when an array is reassigned
 static bool is_lvalue_index_expr(struct expr *expr)
 {
+	struct type *array_type;
+
 	assert(expr->kind == INDEX_EXPR);
-	return is_lvalue(expr->u.index.array);
+	array_type = remove_const_and_volatile(expr->u.index.array->type);
+	// Lanes of vectors are read with indexing, but not written
+	if (array_type->kind == VECTOR_TYPE) {
+		return false;
+	}
+	return has_mutable_items(expr->u.index.array);
 }
 
 static bool is_lvalue(struct expr *expr)
@@ -232,6 +309,7 @@ static bool is_lvalue(struct expr *expr)
 	case FLOAT_LIT_EXPR:
 	case CHAR_LIT_EXPR:
 	case STRING_LIT_EXPR:
+	case EMBED_EXPR:
 	case ARRAY_LIT_EXPR:
 	case LAMBDA_EXPR:
 		return false;
@@ -251,6 +329,9 @@ static bool is_lvalue(struct expr *expr)
 		return false;
 	case INDEX_EXPR:
 		return is_lvalue_index_expr(expr);
+	case SLICE_EXPR:
+	case BUILTIN_EXPR:
+		return false;
 	}
 	internal_error();
 }
@@ -326,6 +407,33 @@ static bool is_num_type(struct type *type)
 	return is_int_type(type) || is_float_type(type);
 }
 
+// Returns the type of each lane of a vector, or a scalar type as is
+struct type *get_lane_type(struct type *type)
+{
+	if (type->kind == VECTOR_TYPE) {
+		return type->u.vector.l;
+	}
+	return type;
+}
+
+// Returns the type of comparing values of `type`, which may be vectors
+static struct type *get_cmp_type(struct type *type)
+{
+	if (type->kind == VECTOR_TYPE) {
+		return get_vector_type(get_prim_type(BOOL_TYPE),
+				type->u.vector.len);
+	}
+	return get_prim_type(BOOL_TYPE);
+}
+
+// Bitwise operators also combine vectors of booleans, such as masks
+static bool is_bitwise_type(struct type *type)
+{
+	return is_unsigned_int_type(get_lane_type(type)) ||
+		(type->kind == VECTOR_TYPE &&
+		 type->u.vector.l->kind == BOOL_TYPE);
+}
+
 static void type_check(struct expr *);
 
 static void type_check_unary_op(struct expr *expr)
@@ -336,13 +444,13 @@ static void type_check_unary_op(struct expr *expr)
 	type_check(operand);
 	switch (op) {
 	case NEG_OP:
-		if (!is_num_type(operand->type)) {
+		if (!is_num_type(get_lane_type(operand->type))) {
 			compat_error(expr->lineno);
 		}
-		if (is_unsigned_int_type(operand->type)) {
+		if (is_unsigned_int_type(get_lane_type(operand->type))) {
 			compat_error(expr->lineno);
 		}
-		expr->type = dup_type(operand->type);
+		expr->type = operand->type;
 		break;
 	case PRE_INC_OP:
 	case POST_INC_OP:
@@ -354,45 +462,47 @@ static void type_check_unary_op(struct expr *expr)
 		if (!is_num_type(operand->type)) {
 			compat_error(expr->lineno);
 		}
-		expr->type = dup_type(operand->type);
+		expr->type = operand->type;
 		break;
 	case DEREF_OP: {
-		type_check(operand);
 		if (operand->type->kind != POINTER_TYPE) {
 			compat_error(expr->lineno);
 		}
-		expr->type = dup_type(operand->type->u.pointer.l);
+		expr->type = operand->type->u.pointer.l;
 		break;
 	}
 	case REF_OP: {
 		if (!is_lvalue(operand)) {
 			lvalue_error(expr->lineno);
 		}
-		expr->type = ALLOC_POINTER_TYPE(expr->lineno, operand->type);
+		expr->type = get_pointer_type(operand->type);
 		break;
 	}
 	case BIT_NOT_OP:
-		if (!is_unsigned_int_type(operand->type)) {
+		if (!is_unsigned_int_type(get_lane_type(operand->type))) {
 			compat_error(expr->lineno);
 		}
-		expr->type = dup_type(operand->type);
+		expr->type = operand->type;
 		break;
 	case LOG_NOT_OP:
-		if (operand->type->kind != BOOL_TYPE) {
+		if (get_lane_type(operand->type)->kind != BOOL_TYPE) {
 			compat_error(expr->lineno);
 		}
-		expr->type = ALLOC_BOOL_TYPE(expr->lineno);
+		expr->type = get_cmp_type(operand->type);
 		break;
 	}
 }
 
-static struct type *remove_const_and_volatile(struct type *type)
+// Also removes `restrict`, which only matters to code generation
+struct type *remove_const_and_volatile(struct type *type)
 {
 	switch (type->kind) {
 	case CONST_TYPE:
 		return remove_const_and_volatile(type->u.const_.type);
 	case VOLATILE_TYPE:
 		return remove_const_and_volatile(type->u.volatile_.type);
+	case RESTRICT_TYPE:
+		return remove_const_and_volatile(type->u.restrict_.type);
 	default:
 		return type;
 	}
@@ -418,6 +528,9 @@ static bool vecs_have_compat_types(Vec *types1, Vec *types2)
 
 static bool are_types_compat(struct type *type1, struct type *type2)
 {
+	if (type1 == type2) {
+		return true;
+	}
 	// TODO: Const and volatile checking
 	type1 = remove_const_and_volatile(type1);
 	type2 = remove_const_and_volatile(type2);
@@ -466,7 +579,7 @@ static bool are_types_compat(struct type *type1, struct type *type2)
 	}
 	case ARRAY_TYPE: {
 		struct type *subtype1, *subtype2;
-		unsigned len1, len2;
+		uint64_t len1, len2;
 
 		if (type2->kind != ARRAY_TYPE) {
 			return false;
@@ -514,23 +627,100 @@ static bool are_types_compat(struct type *type1, struct type *type2)
 		return are_types_compat(ret1, ret2) &&
 			vecs_have_compat_types(params1, params2);
 	}
+	case VECTOR_TYPE:
+		return type2->kind == VECTOR_TYPE &&
+			type1->u.vector.len == type2->u.vector.len &&
+			type1->u.vector.l->kind == type2->u.vector.l->kind;
 	case CONST_TYPE:
 	case VOLATILE_TYPE:
+	case RESTRICT_TYPE:
 		// NOTREACHED
 		internal_error();
 	}
 	internal_error();
 }
 
-static struct type *dup_stricter_type(struct type *type1, struct type *type2)
+/*
+ * Like are_types_compat(), but only in one direction. A fixed-size array
+ * converts to a slice, but not the other way around, and a slice can't drop
+ * the `const` of the items it refers to.
+ */
+static bool is_assignable(struct type *to_type, struct type *from_type)
+{
+	to_type = remove_const_and_volatile(to_type);
+	from_type = remove_const_and_volatile(from_type);
+	if (to_type->kind == ARRAY_TYPE && from_type->kind == ARRAY_TYPE &&
+			to_type->u.array.len != 0 &&
+			from_type->u.array.len == 0) {
+		return false;
+	}
+	if (to_type->kind == ARRAY_TYPE && from_type->kind == ARRAY_TYPE &&
+			to_type->u.array.len == 0 &&
+			from_type->u.array.l->kind == CONST_TYPE &&
+			to_type->u.array.l->kind != CONST_TYPE) {
+		return false;
+	}
+	return are_types_compat(to_type, from_type);
+}
+
+// Whether the fixed-size array `array` is stored in a `let` declaration
+static bool is_let_array(struct expr *array)
+{
+	struct symbol_info *sym_info;
+
+	while (array->kind == INDEX_EXPR && remove_const_and_volatile(
+				array->u.index.array->type)->u.array.len != 0) {
+		array = array->u.index.array;
+	}
+	if (array->kind != IDENT_EXPR) {
+		return false;
+	}
+	sym_info = lookup_symbol(sym_tbl, array->u.ident.name);
+	assert(sym_info != NULL && sym_info->kind == VALUE_SYM);
+	return sym_info->u.value.is_let;
+}
+
+/*
+ * Like is_assignable(), but the items of a `let` array can't change, so it
+ * only converts to a slice of `const` items.
+ */
+static bool is_expr_assignable(struct type *to_type, struct expr *expr)
+{
+	struct type *from_type;
+
+	to_type = remove_const_and_volatile(to_type);
+	from_type = remove_const_and_volatile(expr->type);
+	// Array literals also build vectors, lane by lane
+	if (to_type->kind == VECTOR_TYPE && expr->kind == ARRAY_LIT_EXPR) {
+		return from_type->u.array.len == to_type->u.vector.len &&
+			are_types_compat(to_type->u.vector.l,
+					from_type->u.array.l);
+	}
+	if (!is_assignable(to_type, from_type)) {
+		return false;
+	}
+	if (to_type->kind == ARRAY_TYPE && to_type->u.array.len == 0 &&
+			from_type->u.array.len != 0 &&
+			to_type->u.array.l->kind != CONST_TYPE) {
+		return !is_let_array(expr);
+	}
+	return true;
+}
+
+// Both types and the result are canonical
+static struct type *get_stricter_type(unsigned lineno, struct type *type1,
+		struct type *type2)
 {
 	if (!are_types_compat(type1, type2)) {
-		compat_error(type1->lineno);
+		compat_error(lineno);
+	}
+	if (type1 == type2) {
+		return type1;
 	}
 
 	switch (type1->kind) {
 	case UNSIZED_INT_TYPE:
-		return dup_type(type2);
+		return type2;
 	case U8_TYPE:
 	case U16_TYPE:
 	case U32_TYPE:
@@ -544,47 +734,53 @@ static struct type *dup_stricter_type(struct type *type1, struct type *type2)
 	case BOOL_TYPE:
 	case VOID_TYPE:
 	case CHAR_TYPE:
-		return dup_type(type1);
+	case VECTOR_TYPE:
+		return type1;
 	case ALIAS_TYPE:
 	case PARAM_TYPE:
 		internal_error(); // TODO: Stub
 	case ARRAY_TYPE: {
 		struct type *subtype1, *subtype2, *stricter_subtype;
-		unsigned len;
+		uint64_t len;
 
 		subtype1 = type1->u.array.l;
 		subtype2 = type2->u.array.l;
-		stricter_subtype = dup_stricter_type(subtype1, subtype2);
+		stricter_subtype = get_stricter_type(lineno, subtype1,
+				subtype2);
 		if (type1->u.array.len == 0) {
 			len = type2->u.array.len;
 		} else {
 			len = type1->u.array.len;
 		}
-		return ALLOC_ARRAY_TYPE(type1->lineno, stricter_subtype, len);
+		return get_array_type(stricter_subtype, len);
 	}
 	case POINTER_TYPE: {
 		struct type *subtype1, *subtype2, *stricter_subtype;
 
 		subtype1 = type1->u.pointer.l;
 		subtype2 = type2->u.pointer.l;
-		stricter_subtype = dup_stricter_type(subtype1, subtype2);
-		return ALLOC_POINTER_TYPE(type1->lineno, stricter_subtype);
+		stricter_subtype = get_stricter_type(lineno, subtype1,
+				subtype2);
+		return get_pointer_type(stricter_subtype);
 	}
 	case TUPLE_TYPE: {
 		Vec *types1, *types2, *strictest_types;
 		size_t i;
-		struct type *elem1, *elem2, *stricter_elem;
+		struct type *elem1, *elem2, *stricter_type;
 
 		types1 = type1->u.tuple.types;
 		types2 = type2->u.tuple.types;
-		strictest_types = alloc_vec(free_type);
+		strictest_types = alloc_vec(NULL);
 		for (i = 0; i < vec_len(types1); i++) {
 			elem1 = vec_get(types1, i);
 			elem2 = vec_get(types2, i);
-			stricter_elem = dup_stricter_type(elem1, elem2);
-			vec_push(strictest_types, stricter_elem);
+			stricter_type = get_stricter_type(lineno, elem1,
+					elem2);
+			vec_push(strictest_types, stricter_type);
 		}
-		return ALLOC_TUPLE_TYPE(type1->lineno, strictest_types);
+		stricter_type = get_tuple_type(strictest_types);
+		free_vec(strictest_types);
+		return stricter_type;
 	}
 	case STRUCT_TYPE:
 		internal_error(); // TODO: Stub
@@ -596,11 +792,11 @@ static struct type *dup_stricter_type(struct type *type1, struct type *type2)
 		subtype1 = type1->u.const_.type;
 		if (type2->kind == CONST_TYPE) {
 			subtype2 = type2->u.const_.type;
-			return ALLOC_CONST_TYPE(type1->lineno,
-					dup_stricter_type(subtype1, subtype2));
+			return get_const_type(get_stricter_type(lineno,
+						subtype1, subtype2));
 		} else {
-			return ALLOC_CONST_TYPE(type1->lineno,
-					dup_stricter_type(subtype1, type2));
+			return get_const_type(get_stricter_type(lineno,
+						subtype1, type2));
 		}
 	}
 	case VOLATILE_TYPE: {
@@ -609,13 +805,16 @@ static struct type *dup_stricter_type(struct type *type1, struct type *type2)
 		subtype1 = type1->u.volatile_.type;
 		if (type2->kind == VOLATILE_TYPE) {
 			subtype2 = type2->u.volatile_.type;
-			return ALLOC_VOLATILE_TYPE(type1->lineno,
-					dup_stricter_type(subtype1, subtype2));
+			return get_volatile_type(get_stricter_type(lineno,
+						subtype1, subtype2));
 		} else {
-			return ALLOC_VOLATILE_TYPE(type1->lineno,
-					dup_stricter_type(subtype1, type2));
+			return get_volatile_type(get_stricter_type(lineno,
+						subtype1, type2));
 		}
 	}
+	case RESTRICT_TYPE:
+		return get_stricter_type(lineno, type1->u.restrict_.type,
+				remove_const_and_volatile(type2));
 	}
 	internal_error();
 }
@@ -668,7 +867,7 @@ static bool type_is_convertible(struct type *from_type, struct type *to_type)
 		internal_error(); // TODO: Stub
 	case ARRAY_TYPE: {
 		struct type *from_subtype, *to_subtype;
-		unsigned from_len, to_len;
+		uint64_t from_len, to_len;
 
 		if (from_type->kind != ARRAY_TYPE) {
 			return false;
@@ -700,6 +899,11 @@ static bool type_is_convertible(struct type *from_type, struct type *to_type)
 		to_types = to_type->u.tuple.types;
 		return types_are_convertible(from_types, to_types);
 	}
+	case VECTOR_TYPE:
+		return from_type->kind == VECTOR_TYPE &&
+			from_type->u.vector.len == to_type->u.vector.len &&
+			from_type->u.vector.l->kind ==
+			to_type->u.vector.l->kind;
 	case STRUCT_TYPE:
 		internal_error(); // TODO: Stub
 	// TODO: Make sure this isn't problematic
@@ -739,6 +943,9 @@ static bool type_is_convertible(struct type *from_type, struct type *to_type)
 			return type_is_convertible(from_type, to_subtype);
 		}
 	}
+	case RESTRICT_TYPE:
+		return type_is_convertible(remove_const_and_volatile(from_type),
+				to_type->u.restrict_.type);
 	}
 	internal_error();
 }
@@ -750,56 +957,101 @@ static void ensure_bool_expr(struct expr *expr)
 	}
 }
 
+static bool may_refer_to_local_array(struct expr *, struct type *);
+static bool is_stack_closure(struct expr *);
+
+/*
+ * Only a local can hold a slice of a local array, and only if it was declared
+ * with one, so that every use of it is known to be such a slice.
+ */
+static void check_assigned_slice(struct expr *l, struct expr *r)
+{
+	struct symbol_info *sym_info;
+
+	if (!may_refer_to_local_array(r, l->type)) {
+		return;
+	}
+	if (l->kind == IDENT_EXPR) {
+		sym_info = lookup_symbol(sym_tbl, l->u.ident.name);
+		if (sym_info->u.value.is_stack_slice) {
+			return;
+		}
+	}
+	fatal_error(l->lineno, "Slice assigned may refer to a local array");
+}
+
+static void type_check_expected(struct expr *, struct type *);
+
+/*
+ * The value assigned is typed as the left side, so a lambda can be assigned.
+ * Like the slices of local arrays, a lambda that captures locals can only be
+ * assigned to a local that may already hold one.
+ */
 static void type_check_bin_op(struct expr *expr)
 {
 	enum bin_op op = expr->u.bin_op.op;
 	struct expr *l = expr->u.bin_op.l,
 	            *r = expr->u.bin_op.r;
 
+	if (op == ASSIGN_OP) {
+		escape_ok_expr = l;
+	}
 	type_check(l);
-	type_check(r);
+	if (op == ASSIGN_OP) {
+		if (is_stack_closure(l)) {
+			escape_ok_expr = r;
+		}
+		type_check_expected(r, l->type);
+	} else {
+		type_check(r);
+	}
 	switch (op) {
 	case ADD_OP:
 	case SUB_OP:
 	case MUL_OP:
 	case DIV_OP:
 	case MOD_OP:
-		if (!is_num_type(l->type)) {
+		if (!is_num_type(get_lane_type(l->type))) {
 			compat_error(expr->lineno);
 		}
 		if (!are_types_compat(l->type, r->type)) {
 			compat_error(expr->lineno);
 		}
-		expr->type = dup_stricter_type(l->type, r->type);
+		expr->type = get_stricter_type(expr->lineno, l->type, r->type);
 		break;
 	case LT_OP:
 	case GT_OP:
 	case LT_EQ_OP:
 	case GT_EQ_OP:
-		if (!is_num_type(l->type)) {
+		if (!is_num_type(get_lane_type(l->type))) {
 			compat_error(expr->lineno);
 		}
 		if (!are_types_compat(l->type, r->type)) {
 			compat_error(expr->lineno);
 		}
-		expr->type = ALLOC_BOOL_TYPE(expr->lineno);
+		expr->type = get_cmp_type(l->type);
 		break;
 	case EQ_OP:
 	case NOT_EQ_OP:
 		if (!are_types_compat(l->type, r->type)) {
 			compat_error(expr->lineno);
 		}
-		expr->type = ALLOC_BOOL_TYPE(expr->lineno);
+		expr->type = get_cmp_type(l->type);
 		break;
 	case BIT_AND_OP:
 	case BIT_OR_OP:
 	case BIT_XOR_OP:
+		if (!is_bitwise_type(l->type)) {
+			compat_error(expr->lineno);
+		}
+		expr->type = get_stricter_type(expr->lineno, l->type, r->type);
+		break;
 	case BIT_SHIFT_L_OP:
 	case BIT_SHIFT_R_OP:
-		if (!is_unsigned_int_type(l->type)) {
+		if (!is_unsigned_int_type(get_lane_type(l->type))) {
 			compat_error(expr->lineno);
 		}
-		expr->type = dup_stricter_type(l->type, r->type);
+		expr->type = get_stricter_type(expr->lineno, l->type, r->type);
 		break;
 	case LOG_AND_OP:
 	case LOG_OR_OP:
@@ -809,23 +1061,27 @@ static void type_check_bin_op(struct expr *expr)
 		if (!are_types_compat(l->type, r->type)) {
 			compat_error(expr->lineno);
 		}
-		expr->type = ALLOC_BOOL_TYPE(expr->lineno);
+		expr->type = get_prim_type(BOOL_TYPE);
 		break;
 	case ADD_ASSIGN_OP:
 	case SUB_ASSIGN_OP:
 	case MUL_ASSIGN_OP:
 	case DIV_ASSIGN_OP:
 	case MOD_ASSIGN_OP:
-		if (!is_num_type(l->type)) {
+		if (!is_num_type(get_lane_type(l->type))) {
 			compat_error(expr->lineno);
 		}
 		goto assign_op_common;
 	case BIT_AND_ASSIGN_OP:
 	case BIT_OR_ASSIGN_OP:
 	case BIT_XOR_ASSIGN_OP:
+		if (!is_bitwise_type(l->type)) {
+			compat_error(expr->lineno);
+		}
+		goto assign_op_common;
 	case BIT_SHIFT_L_ASSIGN_OP:
 	case BIT_SHIFT_R_ASSIGN_OP:
-		if (!is_unsigned_int_type(l->type)) {
+		if (!is_unsigned_int_type(get_lane_type(l->type))) {
 			compat_error(expr->lineno);
 		}
 		goto assign_op_common;
@@ -834,32 +1090,108 @@ static void type_check_bin_op(struct expr *expr)
 		if (!is_lvalue(l)) {
 			lvalue_error(expr->lineno);
 		}
-		if (!are_types_compat(l->type, r->type)) {
+		if (!is_expr_assignable(l->type, r)) {
 			compat_error(expr->lineno);
 		}
-		expr->type = ALLOC_VOID_TYPE(expr->lineno);
+		check_assigned_slice(l, r);
+		expr->type = get_prim_type(VOID_TYPE);
 		break;
 	}
 }
 
-static void type_check_lambda(struct expr *expr)
+/*
+ * A lambda takes its parameter types from the function type it is passed or
+ * assigned as. Locals of enclosing functions that it uses are captured by
+ * value into an environment on the stack, so a lambda with captures may only
+ * be called while that frame is live.
+ */
+static void type_check_lambda(struct expr *expr, struct type *type)
 {
-	(void) expr;
-#if 0
-	// TODO: This is broken
-	Vec *params;
-	size_t i;
-
+	struct lambda_scope scope;
+	struct type *saved_func_type, *param_type, *ret;
+	size_t saved_first_local_id, saved_npending_defers, i;
+	bool saved_in_defer, is_escape_ok;
+	Vec *params, *param_types;
+	struct expr *body;
+
+	assert(expr->kind == LAMBDA_EXPR);
+	type = intern_type(remove_const_and_volatile(type));
+	assert(type->kind == FUNC_TYPE);
 	params = expr->u.lambda.params;
+	param_types = type->u.func.params;
+	body = expr->u.lambda.body;
+	ret = type->u.func.ret;
+	if (vec_len(params) != vec_len(param_types)) {
+		fatal_error(expr->lineno, "Number of lambda parameters does "
+		                          "not match its type");
+	}
+	is_escape_ok = expr == escape_ok_expr;
+	scope.lambda = expr;
+	if (cur_lambda != NULL) {
+		scope.first_capture_id = cur_lambda->first_capture_id;
+	} else if (is_global_scope(sym_tbl)) {
+		scope.first_capture_id = nsyms;
+	} else {
+		scope.first_capture_id = cur_func_first_param_id;
+	}
+	scope.outer = cur_lambda;
+	free_vec(expr->u.lambda.captures);
+	expr->u.lambda.captures = alloc_vec(free_expr);
+	saved_func_type = cur_func_type;
+	saved_first_local_id = cur_func_first_local_id;
+	saved_npending_defers = npending_defers;
+	saved_in_defer = in_defer;
+
 	enter_new_scope(sym_tbl);
-	for (i = 0; i < vec_len(param_names); i++) {
-		insert_symbol(val_sym_tbl, vec_get(param_names, i),
-				vec_get(param_types, i));
+	expr->u.lambda.param_sym_id = nsyms;
+	for (i = 0; i < vec_len(params); i++) {
+		param_type = vec_get(param_types, i);
+		if (param_type->kind == RESTRICT_TYPE) {
+			param_type = param_type->u.restrict_.type;
+		}
+		insert_symbol(sym_tbl, vec_get(params, i),
+				alloc_param_sym_info(param_type));
+	}
+	cur_lambda = &scope;
+	cur_func_type = type;
+	cur_func_first_local_id = nsyms;
+	npending_defers = 0;
+	in_defer = false;
+	// A block body returns with `return`, like a function's body
+	type_check_expected(body, ret);
+	if (body->kind != BLOCK_EXPR && ret->kind != VOID_TYPE &&
+			!is_expr_assignable(ret, body)) {
+		fatal_error(body->lineno, "Type of lambda body is not "
+		                          "compatible with its return type");
+	}
+	if (body->kind != BLOCK_EXPR && may_refer_to_local_array(body, ret)) {
+		fatal_error(body->lineno, "Slice returned may refer to a "
+		                          "local array");
 	}
-	// TODO: Finish checking
 	leave_scope(sym_tbl);
-	expr->type = dup_type(type);
-#endif
+
+	cur_lambda = scope.outer;
+	cur_func_type = saved_func_type;
+	cur_func_first_local_id = saved_first_local_id;
+	npending_defers = saved_npending_defers;
+	in_defer = saved_in_defer;
+	if (vec_len(expr->u.lambda.captures) > 0 && !is_escape_ok) {
+		fatal_error(expr->lineno, "Lambda that captures locals can "
+		                          "only be called, passed to a "
+		                          "function or assigned to a local");
+	}
+	expr->type = type;
+}
+
+// Lambdas are only typed by where they are used
+static void type_check_expected(struct expr *expr, struct type *type)
+{
+	if (expr->kind == LAMBDA_EXPR &&
+			remove_const_and_volatile(type)->kind == FUNC_TYPE) {
+		type_check_lambda(expr, type);
+	} else {
+		type_check(expr);
+	}
 }
 
 static void type_check_exprs(Vec *exprs)
@@ -875,21 +1207,50 @@ static void type_check_array_lit(struct expr *expr)
 {
 	Vec *items;
 	struct expr *item, *first_item;
-	struct type *strictest_type, *tmp;
+	struct type *strictest_type;
 	size_t len, i;
 
 	items = expr->u.array_lit.val;
 	type_check_exprs(items);
 	len = vec_len(items);
 	first_item = vec_get(items, 0);
-	strictest_type = dup_type(first_item->type);
+	strictest_type = first_item->type;
 	for (i = 1; i < len; i++) {
 		item = vec_get(items, i);
-		tmp = strictest_type;
-		strictest_type = dup_stricter_type(strictest_type, item->type);
-		free(tmp);
+		strictest_type = get_stricter_type(item->lineno,
+				strictest_type, item->type);
+	}
+	expr->type = get_array_type(strictest_type, len);
+}
+
+// Adds a local used in a lambda to its captures and those of outer lambdas
+static void capture_var(struct expr *expr)
+{
+	struct lambda_scope *scope;
+	struct expr *capture;
+	Vec *captures;
+	size_t id, i;
+
+	id = expr->u.ident.sym_id;
+	for (scope = cur_lambda; scope != NULL; scope = scope->outer) {
+		if (id < scope->first_capture_id ||
+				id >= scope->lambda->u.lambda.param_sym_id) {
+			break;
+		}
+		captures = scope->lambda->u.lambda.captures;
+		for (i = 0; i < vec_len(captures); i++) {
+			capture = vec_get(captures, i);
+			if (capture->u.ident.sym_id == id) {
+				break;
+			}
+		}
+		if (i == vec_len(captures)) {
+			capture = ALLOC_IDENT_EXPR(expr->lineno,
+					xstrdup(expr->u.ident.name), id);
+			capture->type = expr->type;
+			vec_push(captures, capture);
+		}
 	}
-	expr->type = ALLOC_ARRAY_TYPE(expr->lineno, strictest_type, len);
 }
 
 static void type_check_ident(struct expr *expr)
@@ -908,7 +1269,15 @@ static void type_check_ident(struct expr *expr)
 		fatal_error(expr->lineno, "Name `%s` is the name of a type, "
 		                          "not a value", name);
 	}
-	expr->type = dup_type(sym_info->u.value.type);
+	expr->type = sym_info->u.value.type;
+	expr->u.ident.sym_id = sym_info->u.value.id;
+	capture_var(expr);
+	if (sym_info->u.value.is_stack_closure && expr != escape_ok_expr) {
+		fatal_error(expr->lineno, "`%s` may hold a lambda that "
+		                          "captures locals, so it can only be "
+		                          "called or passed to a function",
+		                          name);
+	}
 }
 
 static void check_compound_stmt(Vec *, bool);
@@ -923,7 +1292,7 @@ static void type_check_block(struct expr *expr)
 	enter_new_scope(sym_tbl);
 	check_compound_stmt(stmts, false);
 	leave_scope(sym_tbl);
-	expr->type = ALLOC_VOID_TYPE(expr->lineno);
+	expr->type = get_prim_type(VOID_TYPE);
 }
 
 static void type_check_if(struct expr *expr)
@@ -943,7 +1312,275 @@ static void type_check_if(struct expr *expr)
 		fatal_error(then->lineno, "Types of `then` and `else` "
 		                          "expressions are not compatible");
 	}
-	expr->type = dup_stricter_type(then->type, else_->type);
+	expr->type = get_stricter_type(expr->lineno, then->type,
+			else_->type);
+}
+
+// A value matched by a switch case
+struct case_val {
+	uint64_t val;
+	unsigned lineno;
+};
+
+// The values matched by the cases of a switch
+struct case_vals {
+	struct case_val *items;
+	size_t len, nalloc;
+};
+
+// Returns the number of bits that distinguish values of a switchable type
+unsigned get_switch_bits(struct type *type)
+{
+	switch (remove_const_and_volatile(type)->kind) {
+	case BOOL_TYPE:
+		return 1;
+	case U8_TYPE:
+	case I8_TYPE:
+		return 8;
+	case U16_TYPE:
+	case I16_TYPE:
+		return 16;
+	case U32_TYPE:
+	case I32_TYPE:
+	case CHAR_TYPE:
+		return 32;
+	default:
+		return 64;
+	}
+}
+
+static void add_case_val(struct case_vals *vals, struct expr *expr,
+		struct type *ctrl_type)
+{
+	unsigned bits;
+	uint64_t val;
+
+	bits = get_switch_bits(ctrl_type);
+	val = eval_pattern_const_expr(expr);
+	if (bits < 64) {
+		val &= ((uint64_t) 1 << bits) - 1;
+	}
+	if (vals->len == vals->nalloc) {
+		vals->nalloc = 2 * vals->nalloc + 8;
+		vals->items = xrealloc(vals->items,
+				vals->nalloc * sizeof(struct case_val));
+	}
+	vals->items[vals->len].val = val;
+	vals->items[vals->len].lineno = expr->lineno;
+	vals->len++;
+}
+
+static bool is_switchable_type(struct type *type)
+{
+	type = remove_const_and_volatile(type);
+	return is_int_type(type) || type->kind == CHAR_TYPE ||
+		type->kind == BOOL_TYPE;
+}
+
+/*
+ * Returns whether the pattern matches every value, such as `_`. The values of
+ * a scalar switch are added to `vals`, which is NULL when matching the items
+ * of a tuple or array.
+ */
+static bool check_switch_pattern(struct switch_pattern *pattern,
+		struct type *type, struct case_vals *vals)
+{
+	struct expr *expr;
+	Vec *patterns;
+	bool matches_all;
+	size_t i;
+
+	type = remove_const_and_volatile(type);
+	switch (pattern->kind) {
+	case UNDERSCORE_SWITCH_PATTERN:
+		return true;
+	case OR_SWITCH_PATTERN:
+		patterns = pattern->u.or.patterns;
+		matches_all = false;
+		for (i = 0; i < vec_len(patterns); i++) {
+			if (check_switch_pattern(vec_get(patterns, i), type,
+						vals)) {
+				matches_all = true;
+			}
+		}
+		return matches_all;
+	case EXPR_SWITCH_PATTERN:
+		expr = pattern->u.expr.expr;
+		type_check(expr);
+		if (!is_switchable_type(type) ||
+				!is_expr_assignable(type, expr)) {
+			break;
+		}
+		if (vals != NULL) {
+			add_case_val(vals, expr, type);
+		}
+		return false;
+	case ARRAY_SWITCH_PATTERN:
+		patterns = pattern->u.array.patterns;
+		if (type->kind != ARRAY_TYPE || type->u.array.len == 0) {
+			break;
+		}
+		if (vec_len(patterns) != type->u.array.len) {
+			fatal_error(pattern->lineno, "Number of items in "
+			                             "pattern does not match "
+			                             "the array length");
+		}
+		matches_all = true;
+		for (i = 0; i < vec_len(patterns); i++) {
+			if (!check_switch_pattern(vec_get(patterns, i),
+						type->u.array.l, NULL)) {
+				matches_all = false;
+			}
+		}
+		return matches_all;
+	case TUPLE_SWITCH_PATTERN:
+		patterns = pattern->u.tuple.patterns;
+		if (type->kind != TUPLE_TYPE || vec_len(patterns) !=
+				vec_len(type->u.tuple.types)) {
+			break;
+		}
+		matches_all = true;
+		for (i = 0; i < vec_len(patterns); i++) {
+			if (!check_switch_pattern(vec_get(patterns, i),
+						vec_get(type->u.tuple.types, i),
+						NULL)) {
+				matches_all = false;
+			}
+		}
+		return matches_all;
+	}
+	fatal_error(pattern->lineno, "Pattern does not match the type of the "
+	                             "switch value");
+}
+
+// Without a value to match, each case is guarded by a condition or `_`
+static bool check_switch_cond(struct switch_pattern *pattern)
+{
+	struct expr *cond;
+
+	if (pattern->kind == UNDERSCORE_SWITCH_PATTERN) {
+		return true;
+	}
+	assert(pattern->kind == EXPR_SWITCH_PATTERN);
+	cond = pattern->u.expr.expr;
+	type_check(cond);
+	ensure_bool_expr(cond);
+	return false;
+}
+
+static int compare_case_vals(const void *p1, const void *p2)
+{
+	const struct case_val *val1 = p1, *val2 = p2;
+
+	if (val1->val != val2->val) {
+		return val1->val < val2->val ? -1 : 1;
+	}
+	return (val1->lineno > val2->lineno) - (val1->lineno < val2->lineno);
+}
+
+// Rejects repeated values, and returns whether every value is matched
+static bool check_case_vals(struct case_vals *vals, struct type *ctrl_type)
+{
+	unsigned bits;
+	size_t i;
+
+	qsort(vals->items, vals->len, sizeof(struct case_val),
+			compare_case_vals);
+	for (i = 1; i < vals->len; i++) {
+		if (vals->items[i].val == vals->items[i - 1].val) {
+			fatal_error(vals->items[i].lineno, "Value is already "
+			                                   "matched by an "
+			                                   "earlier case");
+		}
+	}
+	bits = get_switch_bits(ctrl_type);
+	return bits < 64 && vals->len == (uint64_t) 1 << bits;
+}
+
+/*
+ * Returns whether the cases so far match every value. Values can't repeat, so
+ * fewer values than the type has can't cover it.
+ */
+static bool are_case_vals_exhaustive(struct case_vals *vals,
+		struct type *ctrl_type)
+{
+	unsigned bits;
+
+	bits = get_switch_bits(ctrl_type);
+	return bits < 64 && vals->len >= (uint64_t) 1 << bits &&
+		check_case_vals(vals, ctrl_type);
+}
+
+/*
+ * The cases are tried in order, so any after one matching every value are
+ * unreachable. Unless the cases cover every value, one of them must be `_`.
+ */
+static void type_check_switch(struct expr *expr)
+{
+	struct switch_case *case_;
+	struct case_vals vals;
+	struct expr *ctrl;
+	struct type *type;
+	Vec *cases;
+	bool is_match, is_exhaustive;
+	size_t i;
+
+	assert(expr->kind == SWITCH_EXPR);
+	ctrl = expr->u.switch_.ctrl;
+	cases = expr->u.switch_.cases;
+	is_match = false;
+	if (ctrl != NULL) {
+		type_check(ctrl);
+		is_match = is_match_type(ctrl->type);
+		if (!is_match && !is_switchable_type(ctrl->type)) {
+			fatal_error(ctrl->lineno, "Switch value must be an "
+			                          "integer, char, bool, tuple "
+			                          "or array");
+		}
+	}
+	if (vec_len(cases) == 0) {
+		fatal_error(expr->lineno, "Switch has no cases");
+	}
+	memset(&vals, 0, sizeof(vals));
+	is_exhaustive = false;
+	type = NULL;
+	for (i = 0; i < vec_len(cases); i++) {
+		case_ = vec_get(cases, i);
+		if (is_exhaustive) {
+			fatal_error(case_->lineno, "Switch case is "
+			                           "unreachable");
+		}
+		if (ctrl == NULL) {
+			is_exhaustive = check_switch_cond(case_->l);
+		} else if (is_match) {
+			is_exhaustive = check_switch_pattern(case_->l,
+					ctrl->type, NULL);
+		} else {
+			is_exhaustive = check_switch_pattern(case_->l,
+					ctrl->type, &vals) ||
+				are_case_vals_exhaustive(&vals, ctrl->type);
+		}
+		type_check(case_->r);
+		if (type != NULL && !are_types_compat(type, case_->r->type)) {
+			fatal_error(case_->r->lineno, "Types of switch cases "
+			                              "are not compatible");
+		}
+		type = type == NULL ? case_->r->type : get_stricter_type(
+				case_->r->lineno, type, case_->r->type);
+	}
+	if (is_match) {
+		// Also reports unreachable cases and unmatched values
+		expr->u.switch_.match = compile_match(expr);
+		is_exhaustive = true;
+	} else if (ctrl != NULL && check_case_vals(&vals, ctrl->type)) {
+		is_exhaustive = true;
+	}
+	free(vals.items);
+	if (!is_exhaustive) {
+		fatal_error(expr->lineno, "Switch needs a `_` case, since not "
+		                          "every value is matched");
+	}
+	expr->type = type;
 }
 
 static void type_check_tuple(struct expr *expr)
@@ -955,13 +1592,73 @@ static void type_check_tuple(struct expr *expr)
 	assert(expr->kind == TUPLE_EXPR);
 	items = expr->u.tuple.items;
 
-	types = alloc_vec(free_type);
+	types = alloc_vec(NULL);
 	for (i = 0; i < vec_len(items); i++) {
 		item = vec_get(items, i);
 		type_check(item);
 		vec_push(types, item->type);
 	}
-	expr->type = ALLOC_TUPLE_TYPE(expr->lineno, types);
+	expr->type = get_tuple_type(types);
+	free_vec(types);
+}
+
+/*
+ * Returns the variable whose storage an argument may refer to, such as `x`
+ * for `&x[i]` or for `x[2..]`, or NULL if unknown
+ */
+static const char *get_pointee_var(struct expr *arg)
+{
+	if (arg->kind == UNARY_OP_EXPR && arg->u.unary_op.op == REF_OP) {
+		arg = arg->u.unary_op.operand;
+	} else if (remove_const_and_volatile(arg->type)->kind != ARRAY_TYPE) {
+		return NULL;
+	}
+	while (arg->kind == INDEX_EXPR || arg->kind == SLICE_EXPR) {
+		if (arg->kind == INDEX_EXPR) {
+			arg = arg->u.index.array;
+		} else {
+			arg = arg->u.slice.array;
+		}
+	}
+	if (arg->kind != IDENT_EXPR) {
+		return NULL;
+	}
+	return arg->u.ident.name;
+}
+
+static bool may_args_alias(struct expr *arg1, struct expr *arg2)
+{
+	const char *var1, *var2;
+
+	if (arg1->kind == IDENT_EXPR && arg2->kind == IDENT_EXPR) {
+		return strcmp(arg1->u.ident.name, arg2->u.ident.name) == 0;
+	}
+	var1 = get_pointee_var(arg1);
+	var2 = get_pointee_var(arg2);
+	return var1 != NULL && var2 != NULL && strcmp(var1, var2) == 0;
+}
+
+// Rejects calls that plainly pass aliases of a `restrict` argument
+static void check_restrict_args(Vec *args, Vec *param_types)
+{
+	struct type *param_type;
+	struct expr *arg;
+	size_t i, j;
+
+	for (i = 0; i < vec_len(args); i++) {
+		param_type = vec_get(param_types, i);
+		if (param_type->kind != RESTRICT_TYPE) {
+			continue;
+		}
+		arg = vec_get(args, i);
+		for (j = 0; j < vec_len(args); j++) {
+			if (j != i && may_args_alias(arg, vec_get(args, j))) {
+				fatal_error(arg->lineno, "Argument passed as "
+				            "`restrict` aliases another "
+				            "argument");
+			}
+		}
+	}
 }
 
 static void type_check_func_call(struct expr *expr)
@@ -969,35 +1666,65 @@ static void type_check_func_call(struct expr *expr)
 	struct type *param_type, *return_type;
 	struct expr *func, *arg;
 	Vec *args, *param_types;
+	bool is_escape_ok;
 	size_t i;
 
 	assert(expr->kind == FUNC_CALL_EXPR);
 	func = expr->u.func_call.func;
 	args = expr->u.func_call.args;
+	is_escape_ok = expr == escape_ok_expr;
+	escape_ok_expr = func;
 	type_check(func);
-	type_check_exprs(args);
 	if (func->type->kind != FUNC_TYPE) {
 		fatal_error(expr->lineno,
 				"Expression is called but is not a function");
 	}
 	param_types = func->type->u.func.params;
+	if (vec_len(args) != vec_len(param_types)) {
+		fatal_error(expr->lineno, "Number of arguments does not match "
+		                          "the function's parameters");
+	}
 	for (i = 0; i < vec_len(args); i++) {
 		arg = vec_get(args, i);
 		param_type = vec_get(param_types, i);
+		// The callee cannot outlive the caller's frame
+		escape_ok_expr = arg;
+		type_check_expected(arg, param_type);
 		// TODO: are_types_compat() may be the wrong check (const)
-		if (!are_types_compat(arg->type, param_type)) {
+		if (!is_expr_assignable(param_type, arg)) {
 			fatal_error(arg->lineno, "Type of passed argument is "
 			                         "an unexpected type");
 		}
 	}
+	check_restrict_args(args, param_types);
 	return_type = func->type->u.func.ret;
-	expr->type = dup_type(return_type);
+	// It may return a function argument, which may capture locals
+	if (remove_const_and_volatile(return_type)->kind == FUNC_TYPE &&
+			!is_escape_ok) {
+		fatal_error(expr->lineno, "Function returned by a call can "
+		                          "only be called, passed to a "
+		                          "function or assigned to a local");
+	}
+	expr->type = return_type;
 }
 
+// The only field so far is the `len` of arrays and slices
 static void type_check_field_access_expr(struct expr *expr)
 {
-	(void) expr;
-	internal_error(); // TODO: Stub
+	struct expr *operand;
+	struct type *type;
+	char *field;
+
+	assert(expr->kind == FIELD_ACCESS_EXPR);
+	operand = expr->u.field_access.expr;
+	field = expr->u.field_access.field;
+	type_check(operand);
+	type = remove_const_and_volatile(operand->type);
+	if (type->kind != ARRAY_TYPE || strcmp(field, "len") != 0) {
+		fatal_error(expr->lineno, "Value has no field named `%s`",
+				field);
+	}
+	expr->type = get_prim_type(U64_TYPE);
 }
 
 static void type_check_index_expr(struct expr *expr)
@@ -1013,11 +1740,208 @@ static void type_check_index_expr(struct expr *expr)
 		fatal_error(index->lineno,
 			"Array is indexed with a non-integer type");
 	}
+	if (array->type->kind == VECTOR_TYPE) {
+		expr->type = array->type->u.vector.l;
+		return;
+	}
 	if (array->type->kind != ARRAY_TYPE) {
 		fatal_error(array->lineno,
 			"Value is indexed, but is not an array");
 	}
-	expr->type = dup_type(array->type->u.array.l);
+	// Reading a `const` item gives a plain value
+	expr->type = array->type->u.array.l;
+	if (expr->type->kind == CONST_TYPE) {
+		expr->type = expr->type->u.const_.type;
+	}
+}
+
+static void type_check_slice_bound(struct expr *bound)
+{
+	if (bound == NULL) {
+		return;
+	}
+	type_check(bound);
+	if (!is_int_type(bound->type)) {
+		fatal_error(bound->lineno,
+			"Array is sliced with a non-integer type");
+	}
+}
+
+static void type_check_slice_expr(struct expr *expr)
+{
+	struct type *item_type;
+	struct expr *array;
+
+	assert(expr->kind == SLICE_EXPR);
+	array = expr->u.slice.array;
+	type_check(array);
+	type_check_slice_bound(expr->u.slice.start);
+	type_check_slice_bound(expr->u.slice.end);
+	if (array->type->kind != ARRAY_TYPE) {
+		fatal_error(array->lineno,
+			"Value is sliced, but is not an array");
+	}
+	item_type = array->type->u.array.l;
+	if (array->type->u.array.len != 0 && is_let_array(array) &&
+			item_type->kind != CONST_TYPE) {
+		item_type = get_const_type(item_type);
+	}
+	expr->type = get_array_type(item_type, 0);
+}
+
+static NORETURN void builtin_error(struct expr *expr, const char *msg)
+{
+	fatal_error(expr->lineno, "Argument of builtin %s", msg);
+}
+
+static struct type *get_vector_arg_type(struct expr *arg)
+{
+	struct type *type;
+
+	type = remove_const_and_volatile(arg->type);
+	if (type->kind != VECTOR_TYPE) {
+		builtin_error(arg, "is not a vector");
+	}
+	return type;
+}
+
+// Checks the array and index of a vector load or store of `type`
+static void check_vector_access(struct expr *array, struct expr *index,
+		struct type *type)
+{
+	struct type *array_type;
+
+	// Vectors of booleans are packed in memory unlike arrays of them
+	if (!is_num_type(type->u.vector.l)) {
+		builtin_error(array, "is accessed as vectors of non-numbers");
+	}
+	array_type = remove_const_and_volatile(array->type);
+	if (array_type->kind != ARRAY_TYPE) {
+		builtin_error(array, "is not an array");
+	}
+	if (!are_types_compat(array_type->u.array.l, type->u.vector.l)) {
+		builtin_error(array, "has elements unlike the vector's lanes");
+	}
+	if (!is_int_type(index->type)) {
+		builtin_error(index, "is not an integer index");
+	}
+}
+
+static void check_vector_mask(struct expr *mask, struct type *type)
+{
+	struct type *mask_type;
+
+	mask_type = get_vector_arg_type(mask);
+	if (mask_type->u.vector.l->kind != BOOL_TYPE ||
+			mask_type->u.vector.len != type->u.vector.len) {
+		builtin_error(mask, "is not a mask as long as the vector");
+	}
+}
+
+// The mask of `@shuffle()` is an array literal of lane numbers
+static void check_shuffle_mask(struct expr *mask, struct type *type)
+{
+	Vec *items;
+	size_t len, i;
+
+	if (mask->kind != ARRAY_LIT_EXPR) {
+		builtin_error(mask, "is not an array literal of lanes");
+	}
+	items = mask->u.array_lit.val;
+	len = vec_len(items);
+	if (len < 2 || len > MAX_VECTOR_LEN) {
+		builtin_error(mask, "has an unsupported number of lanes");
+	}
+	for (i = 0; i < len; i++) {
+		if (eval_const_expr(vec_get(items, i)) >=
+				2 * type->u.vector.len) {
+			builtin_error(vec_get(items, i), "is out of range");
+		}
+	}
+}
+
+static void type_check_builtin(struct expr *expr)
+{
+	struct type *type, *lane_type;
+	struct expr *arg;
+	Vec *args;
+
+	assert(expr->kind == BUILTIN_EXPR);
+	args = expr->u.builtin.args;
+	type_check_exprs(args);
+	type = NULL;
+	if (expr->u.builtin.type != NULL) {
+		type = intern_type(expr->u.builtin.type);
+		if (type->kind != VECTOR_TYPE) {
+			fatal_error(expr->lineno, "Type of builtin is not a "
+			                          "vector type");
+		}
+	}
+	arg = vec_get(args, 0);
+	switch (expr->u.builtin.builtin) {
+	case SPLAT_BUILTIN:
+		// Float literals take the lane type, like in declarations
+		if (arg->kind == FLOAT_LIT_EXPR &&
+				is_float_type(type->u.vector.l)) {
+			arg->type = type->u.vector.l;
+		}
+		if (!is_expr_assignable(type->u.vector.l, arg)) {
+			builtin_error(arg, "is unlike the vector's lanes");
+		}
+		expr->type = type;
+		break;
+	case SHUFFLE_BUILTIN:
+		type = get_vector_arg_type(arg);
+		arg = vec_get(args, 1);
+		if (!are_types_compat(type, arg->type)) {
+			builtin_error(arg, "is unlike the first");
+		}
+		arg = vec_get(args, 2);
+		check_shuffle_mask(arg, type);
+		expr->type = get_vector_type(type->u.vector.l,
+				vec_len(arg->u.array_lit.val));
+		break;
+	case REDUCE_ADD_BUILTIN:
+	case REDUCE_MUL_BUILTIN:
+	case REDUCE_MIN_BUILTIN:
+	case REDUCE_MAX_BUILTIN:
+		lane_type = get_vector_arg_type(arg)->u.vector.l;
+		if (!is_num_type(lane_type)) {
+			builtin_error(arg, "does not have numeric lanes");
+		}
+		expr->type = lane_type;
+		break;
+	case REDUCE_AND_BUILTIN:
+	case REDUCE_OR_BUILTIN:
+	case REDUCE_XOR_BUILTIN:
+		type = get_vector_arg_type(arg);
+		if (!is_bitwise_type(type)) {
+			builtin_error(arg, "does not have unsigned or bool "
+			                   "lanes");
+		}
+		expr->type = type->u.vector.l;
+		break;
+	case LOAD_BUILTIN:
+	case MASKED_LOAD_BUILTIN:
+		check_vector_access(arg, vec_get(args, 1), type);
+		if (expr->u.builtin.builtin == MASKED_LOAD_BUILTIN) {
+			check_vector_mask(vec_get(args, 2), type);
+		}
+		expr->type = type;
+		break;
+	case STORE_BUILTIN:
+	case MASKED_STORE_BUILTIN:
+		type = get_vector_arg_type(vec_get(args, 2));
+		check_vector_access(arg, vec_get(args, 1), type);
+		if (!has_mutable_items(arg)) {
+			builtin_error(arg, "is stored to, but is not mutable");
+		}
+		if (expr->u.builtin.builtin == MASKED_STORE_BUILTIN) {
+			check_vector_mask(vec_get(args, 3), type);
+		}
+		expr->type = get_prim_type(VOID_TYPE);
+		break;
+	}
 }
 
 static void type_check(struct expr *expr)
@@ -1025,25 +1949,29 @@ static void type_check(struct expr *expr)
 	assert(expr->type == NULL);
 	switch (expr->kind) {
 	case BOOL_LIT_EXPR:
-		expr->type = ALLOC_BOOL_TYPE(expr->lineno);
+		expr->type = get_prim_type(BOOL_TYPE);
 		break;
 	case INT_LIT_EXPR:
-		expr->type = ALLOC_UNSIZED_INT_TYPE(expr->lineno);
+		expr->type = get_prim_type(UNSIZED_INT_TYPE);
 		break;
 	case FLOAT_LIT_EXPR:
 		// TODO: Fix this
-		expr->type = ALLOC_F64_TYPE(expr->lineno);
+		expr->type = get_prim_type(F64_TYPE);
 		break;
 	case CHAR_LIT_EXPR:
-		expr->type = ALLOC_CHAR_TYPE(expr->lineno);
+		expr->type = get_prim_type(CHAR_TYPE);
 		break;
-	case STRING_LIT_EXPR: {
-		unsigned len = expr->u.string_lit.len;
-
-		expr->type = ALLOC_ARRAY_TYPE(expr->lineno,
-				ALLOC_CHAR_TYPE(expr->lineno), len);
+	case STRING_LIT_EXPR:
+		// Strings are `str`, a slice of their read-only UTF-8 bytes
+		expr->type = get_array_type(get_const_type(
+					get_prim_type(U8_TYPE)), 0);
+		break;
+	case EMBED_EXPR:
+		// An empty file has length zero, so it becomes an empty slice
+		expr->type = get_array_type(get_const_type(
+					get_prim_type(U8_TYPE)),
+				expr->u.embed.len);
 		break;
-	}
 	case UNARY_OP_EXPR:
 		type_check_unary_op(expr);
 		break;
@@ -1051,8 +1979,8 @@ static void type_check(struct expr *expr)
 		type_check_bin_op(expr);
 		break;
 	case LAMBDA_EXPR:
-		type_check_lambda(expr);
-		break;
+		fatal_error(expr->lineno, "Type of lambda expression cannot "
+		                          "be inferred here");
 	case ARRAY_LIT_EXPR:
 		type_check_array_lit(expr);
 		break;
@@ -1066,7 +1994,8 @@ static void type_check(struct expr *expr)
 		type_check_if(expr);
 		break;
 	case SWITCH_EXPR:
-		internal_error(); // TODO: Stub
+		type_check_switch(expr);
+		break;
 	case TUPLE_EXPR:
 		type_check_tuple(expr);
 		break;
@@ -1079,6 +2008,12 @@ static void type_check(struct expr *expr)
 	case INDEX_EXPR:
 		type_check_index_expr(expr);
 		break;
+	case SLICE_EXPR:
+		type_check_slice_expr(expr);
+		break;
+	case BUILTIN_EXPR:
+		type_check_builtin(expr);
+		break;
 	}
 }
 
@@ -1106,11 +2041,18 @@ static void ensure_declarable_type(struct type *type)
 	case PARAM_TYPE:
 		internal_error(); // TODO: Stub
 	case ARRAY_TYPE:
-		ensure_declarable_type(type->u.array.l);
+		// Items can be `const`, as those of `str` are
+		if (type->u.array.l->kind == CONST_TYPE) {
+			ensure_declarable_type(type->u.array.l->u.const_.type);
+		} else {
+			ensure_declarable_type(type->u.array.l);
+		}
 		break;
 	case POINTER_TYPE:
 		ensure_declarable_type(type->u.pointer.l);
 		break;
+	case VECTOR_TYPE:
+		break;
 	case TUPLE_TYPE: {
 		Vec *types;
 		size_t i;
@@ -1121,11 +2063,14 @@ static void ensure_declarable_type(struct type *type)
 		}
 		break;
 	}
-	case STRUCT_TYPE:
 	case FUNC_TYPE:
+		break;
+	case STRUCT_TYPE:
 	case CONST_TYPE:
 	case VOLATILE_TYPE:
 		internal_error(); // TODO: Stub
+	case RESTRICT_TYPE:
+		fatal_error(type->lineno, "Only parameters can be `restrict`");
 	}
 }
 
@@ -1137,8 +2082,27 @@ static void ensure_not_declared(char *name, unsigned lineno)
 	}
 }
 
+static bool is_stack_closure(struct expr *expr)
+{
+	struct symbol_info *sym_info;
+
+	switch (expr->kind) {
+	case LAMBDA_EXPR:
+		return vec_len(expr->u.lambda.captures) > 0;
+	case IDENT_EXPR:
+		sym_info = lookup_symbol(sym_tbl, expr->u.ident.name);
+		return sym_info->u.value.is_stack_closure;
+	case FUNC_CALL_EXPR:
+		return remove_const_and_volatile(expr->type)->kind ==
+			FUNC_TYPE;
+	default:
+		return false;
+	}
+}
+
 static void check_data_decl(struct decl *decl)
 {
+	struct symbol_info *sym_info;
 	unsigned lineno;
 	bool is_let;
 	struct type *type;
@@ -1169,16 +2133,26 @@ static void check_data_decl(struct decl *decl)
 		                    "initializer", name);
 	}
 	if (init != NULL) {
-		type_check(init);
+		if (!is_global_scope(sym_tbl)) {
+			escape_ok_expr = init;
+		}
+		type_check_expected(init, type);
 		/*
 		 * TODO: are_types_compat() is problematic here; type must
 		 * always be stricter than init->type.
 		 */
-		if (!are_types_compat(type, init->type)) {
+		if (!is_expr_assignable(type, init)) {
 			compat_error(lineno);
 		}
 	}
-	insert_symbol(sym_tbl, name, alloc_val_sym_info(is_let, type));
+	sym_info = alloc_val_sym_info(is_let, type, decl);
+	sym_info->u.value.is_stack_closure = init != NULL &&
+		is_stack_closure(init);
+	sym_info->u.value.is_stack_slice = init != NULL &&
+		!is_global_scope(sym_tbl) &&
+		may_refer_to_local_array(init, type);
+	decl->u.data.sym_id = sym_info->u.value.id;
+	insert_symbol(sym_tbl, name, sym_info);
 }
 
 static void check_typedef_decl(struct decl *decl)
@@ -1272,6 +2246,237 @@ static void check_for_stmt(struct stmt *stmt)
 	leave_scope(sym_tbl);
 }
 
+// Whether a value of `type` may refer to memory in a stack frame
+static bool may_hold_ref(struct type *type)
+{
+	Vec *types;
+	size_t i;
+
+	type = remove_const_and_volatile(type);
+	switch (type->kind) {
+	case POINTER_TYPE:
+	case FUNC_TYPE: // Through a lambda's captures
+		return true;
+	case ARRAY_TYPE:
+		return type->u.array.len == 0 || may_hold_ref(type->u.array.l);
+	case TUPLE_TYPE:
+	case STRUCT_TYPE:
+		types = type->kind == TUPLE_TYPE ? type->u.tuple.types :
+			type->u.struct_.types;
+		for (i = 0; i < vec_len(types); i++) {
+			if (may_hold_ref(vec_get(types, i))) {
+				return true;
+			}
+		}
+		return false;
+	default:
+		return false;
+	}
+}
+
+// A tail call reuses the caller's frame, so it must pass values the same way
+static bool have_same_signature(struct type *type1, struct type *type2)
+{
+	Vec *params1, *params2;
+	size_t i;
+
+	params1 = type1->u.func.params;
+	params2 = type2->u.func.params;
+	if (vec_len(params1) != vec_len(params2) || !are_types_compat(
+				remove_const_and_volatile(type1->u.func.ret),
+				remove_const_and_volatile(type2->u.func.ret))) {
+		return false;
+	}
+	for (i = 0; i < vec_len(params1); i++) {
+		type1 = remove_const_and_volatile(vec_get(params1, i));
+		type2 = remove_const_and_volatile(vec_get(params2, i));
+		if (!are_types_compat(type1, type2)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Ids of parameters and of globals declared so far come before any locals
+static bool is_nonlocal_arg(struct expr *arg)
+{
+	return arg->kind == STRING_LIT_EXPR || (arg->kind == IDENT_EXPR &&
+			arg->u.ident.sym_id < cur_func_first_local_id);
+}
+
+// Function values are closures, which take an extra environment argument
+static bool is_func_name(struct expr *expr)
+{
+	struct symbol_info *sym_info;
+
+	if (expr->kind != IDENT_EXPR) {
+		return false;
+	}
+	sym_info = lookup_symbol(sym_tbl, expr->u.ident.name);
+	return expr->u.ident.sym_id < cur_func_first_param_id &&
+		sym_info->u.value.decl == NULL;
+}
+
+/*
+ * The caller's frame is gone when the callee of `become` runs, so arguments
+ * that may refer to memory must be parameters, globals or string literals.
+ */
+static void check_tail_call(struct stmt *stmt)
+{
+	struct expr *expr, *func, *arg;
+	Vec *args, *param_types;
+	size_t i;
+
+	expr = stmt->u.return_.expr;
+	if (npending_defers > 0) {
+		fatal_error(stmt->lineno, "`become` cannot be used while a "
+		                          "`defer` is pending");
+	}
+	if (cur_lambda != NULL) {
+		fatal_error(stmt->lineno, "`become` cannot be used in a "
+		                          "lambda");
+	}
+	if (expr->kind != FUNC_CALL_EXPR) {
+		fatal_error(stmt->lineno, "Only a function call can be used "
+		                          "with `become`");
+	}
+	func = expr->u.func_call.func;
+	if (!is_func_name(func)) {
+		fatal_error(stmt->lineno, "Function called with `become` "
+		                          "must be called by name");
+	}
+	if (!have_same_signature(func->type, cur_func_type)) {
+		fatal_error(stmt->lineno, "Function called with `become` "
+		                          "must have the caller's signature");
+	}
+	args = expr->u.func_call.args;
+	param_types = func->type->u.func.params;
+	for (i = 0; i < vec_len(args); i++) {
+		arg = vec_get(args, i);
+		if (may_hold_ref(vec_get(param_types, i)) &&
+				!is_nonlocal_arg(arg)) {
+			fatal_error(arg->lineno, "Argument of `become` "
+			            "may refer to the caller's locals");
+		}
+	}
+}
+
+// Whether a value of `type` may be or contain a slice
+static bool may_hold_slice(struct type *type)
+{
+	Vec *types;
+	size_t i;
+
+	type = remove_const_and_volatile(type);
+	switch (type->kind) {
+	case ARRAY_TYPE:
+		return type->u.array.len == 0 || may_hold_slice(type->u.array.l);
+	case TUPLE_TYPE:
+	case STRUCT_TYPE:
+		types = type->kind == TUPLE_TYPE ? type->u.tuple.types :
+			type->u.struct_.types;
+		for (i = 0; i < vec_len(types); i++) {
+			if (may_hold_slice(vec_get(types, i))) {
+				return true;
+			}
+		}
+		return false;
+	default:
+		return false;
+	}
+}
+
+// Whether the storage of the fixed-size array `expr` may be in this frame
+static bool is_local_array(struct expr *expr)
+{
+	struct type *type;
+
+	while (expr->kind == INDEX_EXPR) {
+		type = remove_const_and_volatile(expr->u.index.array->type);
+		if (type->u.array.len == 0) {
+			// An item of a slice is stored where the slice refers
+			return may_refer_to_local_array(expr->u.index.array,
+					type);
+		}
+		expr = expr->u.index.array;
+	}
+	// Only globals outlive the frame
+	return expr->kind != IDENT_EXPR ||
+		expr->u.ident.sym_id >= cur_func_first_param_id;
+}
+
+/*
+ * Returns true if `expr`, converted to `type`, may be or contain a slice of an
+ * array whose storage is in the current frame. A call may return a slice of
+ * any array it is passed.
+ */
+static bool may_refer_to_local_array(struct expr *expr, struct type *type)
+{
+	struct symbol_info *sym_info;
+	struct type *from_type;
+	struct switch_case *case_;
+	struct expr *item;
+	Vec *args, *param_types;
+	size_t i;
+
+	type = remove_const_and_volatile(type);
+	if (!may_hold_slice(type)) {
+		return false;
+	}
+	from_type = remove_const_and_volatile(expr->type);
+	// A fixed-size array converts to a slice of its storage
+	if (type->kind == ARRAY_TYPE && type->u.array.len == 0 &&
+			from_type->kind == ARRAY_TYPE &&
+			from_type->u.array.len != 0) {
+		return is_local_array(expr);
+	}
+	switch (expr->kind) {
+	case IDENT_EXPR:
+		sym_info = lookup_symbol(sym_tbl, expr->u.ident.name);
+		return sym_info->u.value.is_stack_slice;
+	case SLICE_EXPR:
+		return may_refer_to_local_array(expr->u.slice.array,
+				expr->type);
+	case INDEX_EXPR:
+		return may_refer_to_local_array(expr->u.index.array,
+				expr->u.index.array->type);
+	case IF_EXPR:
+		return may_refer_to_local_array(expr->u.if_.then, type) ||
+			may_refer_to_local_array(expr->u.if_.else_, type);
+	case SWITCH_EXPR:
+		for (i = 0; i < vec_len(expr->u.switch_.cases); i++) {
+			case_ = vec_get(expr->u.switch_.cases, i);
+			if (may_refer_to_local_array(case_->r, type)) {
+				return true;
+			}
+		}
+		return false;
+	case TUPLE_EXPR:
+		for (i = 0; i < vec_len(expr->u.tuple.items); i++) {
+			item = vec_get(expr->u.tuple.items, i);
+			if (may_refer_to_local_array(item, type->kind ==
+						TUPLE_TYPE ? vec_get(
+							type->u.tuple.types, i)
+						: item->type)) {
+				return true;
+			}
+		}
+		return false;
+	case FUNC_CALL_EXPR:
+		args = expr->u.func_call.args;
+		param_types = expr->u.func_call.func->type->u.func.params;
+		for (i = 0; i < vec_len(args); i++) {
+			if (may_refer_to_local_array(vec_get(args, i),
+						vec_get(param_types, i))) {
+				return true;
+			}
+		}
+		return false;
+	default:
+		return false;
+	}
+}
+
 static void check_return_stmt(struct stmt *stmt)
 {
 	struct type *return_type;
@@ -1279,6 +2484,10 @@ static void check_return_stmt(struct stmt *stmt)
 
 	assert(stmt->kind == RETURN_STMT);
 	expr = stmt->u.return_.expr;
+	if (in_defer) {
+		fatal_error(stmt->lineno, "Cannot return from a deferred "
+		                          "statement");
+	}
 	assert(cur_func_type->kind == FUNC_TYPE);
 	return_type = cur_func_type->u.func.ret;
 	if (expr == NULL) {
@@ -1287,17 +2496,24 @@ static void check_return_stmt(struct stmt *stmt)
 					"Returning void in a non-void fuction");
 		}
 	} else {
-		type_check(expr);
+		type_check_expected(expr, return_type);
 		/*
 		 * TODO: are_types_compat() does not recognize that return_type
 		 * must be at least as strict as expr->type.
 		 */
-		if (!are_types_compat(return_type, expr->type)) {
+		if (!is_expr_assignable(return_type, expr)) {
 			fatal_error(stmt->lineno,
 					"Type of value returned is not "
 					"compatible with the function's return "
 					"type");
 		}
+		if (may_refer_to_local_array(expr, return_type)) {
+			fatal_error(stmt->lineno, "Slice returned may refer "
+			                          "to a local array");
+		}
+	}
+	if (stmt->u.return_.is_tail) {
+		check_tail_call(stmt);
 	}
 }
 
@@ -1319,6 +2535,28 @@ static void check_continue_stmt(struct stmt *stmt, bool in_loop)
 }
 
 static void check_decl(struct decl *);
+static void check_stmt(struct stmt *, bool);
+
+/*
+ * A deferred statement runs whenever its scope is left, so it can't leave the
+ * scope itself, and anything it declared would never be seen
+ */
+static void check_defer_stmt(struct stmt *stmt)
+{
+	struct stmt *deferred;
+	bool was_in_defer;
+
+	assert(stmt->kind == DEFER_STMT);
+	deferred = stmt->u.defer.stmt;
+	if (deferred->kind == DECL_STMT || deferred->kind == DEFER_STMT) {
+		fatal_error(deferred->lineno, "Statement cannot be deferred");
+	}
+	was_in_defer = in_defer;
+	in_defer = true;
+	check_stmt(deferred, false);
+	in_defer = was_in_defer;
+	npending_defers++;
+}
 
 static void check_stmt(struct stmt *stmt, bool in_loop)
 {
@@ -1350,6 +2588,9 @@ static void check_stmt(struct stmt *stmt, bool in_loop)
 	case CONTINUE_STMT:
 		check_continue_stmt(stmt, in_loop);
 		break;
+	case DEFER_STMT:
+		check_defer_stmt(stmt);
+		break;
 	}
 }
 
@@ -1363,8 +2604,9 @@ static bool is_terminator_stmt(struct stmt *stmt)
 static void check_compound_stmt(Vec *stmts, bool in_loop)
 {
 	struct stmt *stmt;
-	size_t i;
+	size_t i, old_npending_defers;
 
+	old_npending_defers = npending_defers;
 	for (i = 0; i < vec_len(stmts); i++) {
 		stmt = vec_get(stmts, i);
 		check_stmt(stmt, in_loop);
@@ -1373,38 +2615,105 @@ static void check_compound_stmt(Vec *stmts, bool in_loop)
 				"Dead code after terminator statement");
 		}
 	}
+	// The scope's deferred statements run when it is left
+	npending_defers = old_npending_defers;
+}
+
+// At most one inlining attribute may be given, and not both `hot` and `cold`
+static void check_func_attrs(struct decl *decl)
+{
+	unsigned attrs, inline_attrs;
+
+	attrs = decl->u.func.attrs;
+	inline_attrs = attrs & (INLINE_ATTR | ALWAYS_INLINE_ATTR |
+			NOINLINE_ATTR);
+	if ((inline_attrs & (inline_attrs - 1)) != 0 ||
+			((attrs & HOT_ATTR) && (attrs & COLD_ATTR))) {
+		fatal_error(decl->lineno, "Conflicting attributes on `%s`",
+				decl->u.func.name);
+	}
+}
+
+/*
+ * Declares the function named in `decl`. A function may be declared by any
+ * number of prototypes with the same type, followed by at most one definition.
+ */
+static void declare_func(struct decl *decl)
+{
+	struct symbol_info *sym_info;
+	struct type *func_type;
+	char *func_name;
+	bool is_proto;
+
+	func_type = decl->u.func.type;
+	func_name = decl->u.func.name;
+	is_proto = decl->u.func.body_stmts == NULL;
+	sym_info = lookup_symbol(sym_tbl, func_name);
+	if (sym_info != NULL && sym_info->kind == VALUE_SYM &&
+			sym_info->u.value.is_proto) {
+		if (!are_types_compat(sym_info->u.value.type, func_type)) {
+			fatal_error(decl->lineno, "Type of `%s` does not match "
+			                          "its prototype", func_name);
+		}
+		sym_info->u.value.is_proto = is_proto;
+		decl->u.func.attrs |= sym_info->u.value.func_attrs;
+		check_func_attrs(decl);
+		sym_info->u.value.func_attrs = decl->u.func.attrs;
+		decl->u.func.sym_id = sym_info->u.value.id;
+		return;
+	}
+	ensure_not_declared(func_name, decl->lineno);
+	check_func_attrs(decl);
+	sym_info = alloc_val_sym_info(true, func_type, NULL);
+	sym_info->u.value.is_proto = is_proto;
+	sym_info->u.value.func_attrs = decl->u.func.attrs;
+	decl->u.func.sym_id = sym_info->u.value.id;
+	insert_symbol(sym_tbl, func_name, sym_info);
 }
 
 static void check_func_decl(struct decl *decl)
 {
 	struct type *func_type, *param_type;
-	char *func_name, *param_name;
+	char *param_name;
 	Vec *param_types, *param_names;
 	Vec *body_stmts;
 	size_t i, nparams;
 
 	assert(decl->kind == FUNC_DECL);
 	func_type = decl->u.func.type;
-	func_name = decl->u.func.name;
 	param_names = decl->u.func.param_names;
 	body_stmts = decl->u.func.body_stmts;
 	assert(func_type->kind == FUNC_TYPE);
 	param_types = func_type->u.func.params;
 
-	ensure_not_declared(func_name, decl->lineno);
 	if (!is_global_scope(sym_tbl)) {
 		fatal_error(decl->lineno, "Function defined with local scope");
 	}
-	insert_symbol(sym_tbl, func_name, alloc_val_sym_info(true, func_type));
+	declare_func(decl);
+	if (body_stmts == NULL) {
+		return;
+	}
 	cur_func_type = func_type;
 	enter_new_scope(sym_tbl);
+	decl->u.func.param_sym_id = nsyms;
+	cur_func_first_param_id = nsyms;
 	nparams = vec_len(param_types);
 	for (i = 0; i < nparams; i++) {
 		param_type = vec_get(param_types, i);
 		param_name = vec_get(param_names, i);
+		// In the body, a `restrict` pointer is a plain pointer
+		if (param_type->kind == RESTRICT_TYPE) {
+			param_type = param_type->u.restrict_.type;
+			if (remove_const_and_volatile(param_type)->kind !=
+					POINTER_TYPE) {
+				fatal_error(param_type->lineno, "Only "
+				            "pointers can be `restrict`");
+			}
+		}
 		insert_symbol(sym_tbl, param_name,
-				alloc_val_sym_info(true, param_type));
+				alloc_param_sym_info(param_type));
 	}
+	cur_func_first_local_id = nsyms;
 	check_compound_stmt(body_stmts, false);
 	leave_scope(sym_tbl);
 }
@@ -1432,6 +2741,7 @@ void check_ast(struct ast ast)
 	size_t i;
 
 	sym_tbl = alloc_symbol_table();
+	nsyms = 0;
 	enter_new_scope(sym_tbl); // Global scope
 	for (i = 0; i < vec_len(decls); i++) {
 		check_decl(vec_get(decls, i));
@@ -3,4 +3,7 @@ bool is_signed_int_type(struct type *);
 bool is_int_type(struct type *);
 bool is_float_type(struct type *);
 bool is_scalar_type(struct type *);
+struct type *remove_const_and_volatile(struct type *);
+struct type *get_lane_type(struct type *);
+unsigned get_switch_bits(struct type *);
 void check_ast(struct ast);
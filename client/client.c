@@ -0,0 +1,236 @@
+/*
+ * Thin client for `quoftc --server`. It forwards its arguments to the server
+ * and relays the server's diagnostics and exit status (see server.c). It does
+ * not link LLVM, so it starts much faster than the compiler itself. If no
+ * server is listening, it runs `quoftc` with the same arguments instead.
+ *
+ * Usage: quoftc-client [--socket=path] [quoftc argument ...]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define DEFAULT_SOCKET_FILE "quoftc.sock"
+#define SOCKET_PREFIX "--socket="
+#define COMPILER_NAME "quoftc"
+#define READ_SIZE 4096
+#define OUTPUT_FRAME 'o'
+#define STATUS_FRAME 's'
+
+static const char *argv0;
+
+static void sys_error(const char *what)
+{
+	fprintf(stderr, "%s: error: %s: %s\n", argv0, what, strerror(errno));
+	exit(EXIT_FAILURE);
+}
+
+static void *xmalloc(size_t size)
+{
+	void *p;
+
+	p = malloc(size);
+	if (p == NULL) {
+		sys_error("malloc");
+	}
+	return p;
+}
+
+static bool write_all(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t n;
+
+	while (len > 0) {
+		n = write(fd, p, len);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		p += n;
+		len -= n;
+	}
+	return true;
+}
+
+static char *get_cwd(void)
+{
+	char *cwd;
+	size_t size;
+
+	for (size = 256;; size *= 2) {
+		cwd = xmalloc(size);
+		if (getcwd(cwd, size) != NULL) {
+			return cwd;
+		}
+		free(cwd);
+		if (errno != ERANGE) {
+			sys_error("getcwd");
+		}
+	}
+}
+
+// Returns -1 if no server is listening on `socket_file`
+static int connect_to_server(const char *socket_file)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if (strlen(socket_file) >= sizeof(addr.sun_path)) {
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socket_file);
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		return -1;
+	}
+	if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+// The compiler's `argv[0]` is sent first, so its messages name `quoftc`
+static void send_request(int fd, int nargs, char *args[])
+{
+	char *cwd;
+	int i;
+	bool ok;
+
+	cwd = get_cwd();
+	ok = write_all(fd, cwd, strlen(cwd) + 1) &&
+		write_all(fd, COMPILER_NAME, sizeof(COMPILER_NAME));
+	free(cwd);
+	for (i = 0; ok && i < nargs; i++) {
+		ok = write_all(fd, args[i], strlen(args[i]) + 1);
+	}
+	if (!ok || shutdown(fd, SHUT_WR) != 0) {
+		sys_error("Failed to send compile request");
+	}
+}
+
+// Returns false if the connection is closed before `len` bytes are read
+static bool read_all(int fd, void *buf, size_t len)
+{
+	char *p = buf;
+	ssize_t n;
+
+	while (len > 0) {
+		n = read(fd, p, len);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			sys_error("read");
+		}
+		if (n == 0) {
+			return false;
+		}
+		p += n;
+		len -= n;
+	}
+	return true;
+}
+
+/*
+ * Relays the diagnostics in output frames to stderr and returns the exit
+ * status in the status frame that ends the response
+ */
+static int relay_response(int fd)
+{
+	unsigned char header[5];
+	char buf[READ_SIZE];
+	size_t len, n;
+
+	while (read_all(fd, header, sizeof(header))) {
+		len = (size_t) header[1] << 24 | (size_t) header[2] << 16 |
+			(size_t) header[3] << 8 | header[4];
+		if (header[0] == STATUS_FRAME && len == 1) {
+			if (!read_all(fd, buf, 1)) {
+				break;
+			}
+			return (unsigned char) buf[0];
+		}
+		if (header[0] != OUTPUT_FRAME) {
+			break;
+		}
+		for (; len > 0; len -= n) {
+			n = len < sizeof(buf) ? len : sizeof(buf);
+			if (!read_all(fd, buf, n)) {
+				goto closed;
+			}
+			fwrite(buf, 1, n, stderr);
+		}
+	}
+closed:
+	fprintf(stderr, "%s: error: Compile server closed the connection\n",
+			argv0);
+	return EXIT_FAILURE;
+}
+
+// Runs the compiler next to this program, or else the one in `PATH`
+static void exec_compiler(int nargs, char *args[])
+{
+	const char *slash;
+	char *path, **argv;
+	size_t dir_len;
+	int i;
+
+	argv = xmalloc((nargs + 2) * sizeof(char *));
+	for (i = 0; i < nargs; i++) {
+		argv[i + 1] = args[i];
+	}
+	argv[nargs + 1] = NULL;
+	slash = strrchr(argv0, '/');
+	if (slash != NULL) {
+		dir_len = slash - argv0 + 1;
+		path = xmalloc(dir_len + sizeof(COMPILER_NAME));
+		memcpy(path, argv0, dir_len);
+		strcpy(path + dir_len, COMPILER_NAME);
+		argv[0] = path;
+		execv(path, argv);
+	}
+	argv[0] = COMPILER_NAME;
+	execvp(COMPILER_NAME, argv);
+	sys_error(COMPILER_NAME);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *socket_file;
+	char **args;
+	int nargs, fd;
+
+	argv0 = argv[0];
+	socket_file = DEFAULT_SOCKET_FILE;
+	args = argv + 1;
+	nargs = argc - 1;
+	if (nargs > 0 && strncmp(args[0], SOCKET_PREFIX,
+				strlen(SOCKET_PREFIX)) == 0) {
+		socket_file = args[0] + strlen(SOCKET_PREFIX);
+		args++;
+		nargs--;
+	}
+	fd = connect_to_server(socket_file);
+	if (fd < 0) {
+		exec_compiler(nargs, args);
+	}
+	signal(SIGPIPE, SIG_IGN);
+	send_request(fd, nargs, args);
+	return relay_response(fd);
+}
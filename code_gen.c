@@ -2,56 +2,180 @@
 // TODO: Fix scoping
 
 #include <assert.h>
+#include <inttypes.h>
+#include <limits.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <llvm-c/Analysis.h>
+#include <llvm-c/BitReader.h>
+#include <llvm-c/BitWriter.h>
 #include <llvm-c/Core.h>
+#include <llvm-c/DebugInfo.h>
+#include <llvm-c/Linker.h>
 #include <llvm-c/TargetMachine.h>
+#include <llvm-c/Transforms/PassBuilder.h>
 #include "ds.h"
 #include "ast.h"
 #include "check_semantics.h"
+#include "eval.h"
 #include "lex.h"
+#include "match.h"
+#include "profile.h"
 #include "quoftc.h"
-#include "symbol_table.h"
+#include "types.h"
 #include "code_gen.h"
 
+#define MAX_SPEC_INSTRS 2000 // Added by the copies of one function
+
 struct symbol_info {
 	bool is_ptr;
 	LLVMValueRef val;
+	LLVMValueRef const_val; // Of a parameter bound by specialization
+	struct decl *func_decl; // Of a function, once its body is emitted
+	// Of a function in a `become` group (see emit_become_group())
+	bool is_defined; // Its definition has been reached
+	LLVMBasicBlockRef become_block; // Where a `become` of it jumps
+};
+
+// A copy of a function with some function parameters bound to constants
+struct func_spec {
+	struct decl *decl;
+	LLVMValueRef *const_args; // NULL for the parameters left unbound
+	LLVMValueRef func;
 };
 
-static struct symbol_table sym_tbl;
+static struct symbol_info *syms; // Indexed by the ids from check_ast()
+static size_t nsyms;
+static struct decl *cur_func_decl;
+static LLVMValueRef *cur_func_const_args; // Of a specialized copy
+static LLVMBasicBlockRef cur_func_entry_block; // Holds all allocas
+static LLVMBasicBlockRef cur_func_body_block; // After params are stored
 static LLVMBasicBlockRef cur_func_return_block;
 static LLVMValueRef cur_func_return_val_ptr;
+static struct type *cur_func_return_type;
+static LLVMBasicBlockRef cur_func_trap_block; // Created on first use
+static Vec *cur_func_defers; // Pending deferred statements, innermost last
+static size_t cur_loop_first_defer; // Index of the first in the loop body
+static LLVMMetadataRef cur_func_di_scope; // Created on first use
+static LLVMModuleRef cur_module;
+static HashTable *string_pool; // Maps string literals to their globals
+static HashTable *embed_pool; // Maps embedded file names to their globals
+static Vec *func_specs; // Of the current module
+static size_t nfunc_specs_emitted; // Later ones have no body yet
+static LLVMDIBuilderRef di_builder; // Only used for locations of loop hints
+static LLVMMetadataRef di_file;
+
+// Counters of an instrumented function, dumped when the program exits
+struct func_counters {
+	const char *func_name;
+	Vec *counters;
+};
+
+static Vec *module_counters; // With `-fprofile-generate`
+static Vec *cur_func_counters; // With `-fprofile-generate`
+static Vec *cur_func_branches; // With `-fprofile-use`
 
-static struct symbol_info *alloc_sym_info(bool is_ptr, LLVMValueRef val)
+static void set_symbol(size_t id, bool is_ptr, LLVMValueRef val)
 {
-	struct symbol_info *sym_info;
+	size_t old_nsyms;
+
+	if (id >= nsyms) {
+		old_nsyms = nsyms;
+		nsyms = 2 * id + 1;
+		syms = xrealloc(syms, nsyms * sizeof(*syms));
+		memset(syms + old_nsyms, 0,
+				(nsyms - old_nsyms) * sizeof(*syms));
+	}
+	syms[id].is_ptr = is_ptr;
+	syms[id].val = val;
+	syms[id].const_val = NULL;
+	syms[id].func_decl = NULL;
+	syms[id].is_defined = false;
+	syms[id].become_block = NULL;
+}
+
+static struct symbol_info *get_symbol(struct expr *expr)
+{
+	size_t id;
+
+	assert(expr->kind == IDENT_EXPR);
+	id = expr->u.ident.sym_id;
+	assert(id < nsyms && syms[id].val != NULL);
+	return &syms[id];
+}
+
+static LLVMValueRef get_or_add_func(LLVMModuleRef module, const char *name,
+		LLVMTypeRef type)
+{
+	LLVMValueRef func;
+
+	func = LLVMGetNamedFunction(module, name);
+	if (func == NULL) {
+		func = LLVMAddFunction(module, name, type);
+	}
+	return func;
+}
+
+static LLVMValueRef get_cur_func(LLVMBuilderRef builder)
+{
+	return LLVMGetBasicBlockParent(LLVMGetInsertBlock(builder));
+}
+
+static LLVMBasicBlockRef append_basic_block(LLVMBuilderRef builder,
+		const char *name)
+{
+	return LLVMAppendBasicBlock(get_cur_func(builder), name);
+}
+
+/*
+ * Allocas outside the entry block would take more stack each time they run,
+ * such as in a loop or after a tail call jumps back to the start.
+ */
+static LLVMValueRef build_entry_alloca(LLVMTypeRef type, const char *name)
+{
+	LLVMBuilderRef entry_builder;
+	LLVMValueRef first, alloca;
 
-	sym_info = NEW(struct symbol_info);
-	sym_info->is_ptr = is_ptr;
-	sym_info->val = val;
-	return sym_info;
+	entry_builder = LLVMCreateBuilder();
+	first = LLVMGetFirstInstruction(cur_func_entry_block);
+	if (first == NULL) {
+		LLVMPositionBuilderAtEnd(entry_builder, cur_func_entry_block);
+	} else {
+		LLVMPositionBuilderBefore(entry_builder, first);
+	}
+	alloca = LLVMBuildAlloca(entry_builder, type, name);
+	LLVMDisposeBuilder(entry_builder);
+	return alloca;
 }
 
+// Slices are a 64-bit length and a pointer to the first item
 static LLVMTypeRef get_fat_ptr_type(LLVMTypeRef item_type)
 {
 	LLVMTypeRef struct_item_types[2];
 
-	struct_item_types[0] = LLVMInt16Type();
+	struct_item_types[0] = LLVMInt64Type();
 	struct_item_types[1] = LLVMPointerType(item_type, 0);
 	return LLVMStructType(struct_item_types, ARRAY_LEN(struct_item_types),
 			false);
 }
 
 static LLVMTypeRef get_llvm_type(struct type *);
+static LLVMTypeRef get_llvm_type_at(struct type *, unsigned);
+
+static bool is_slice_type(struct type *type)
+{
+	type = remove_const_and_volatile(type);
+	return type->kind == ARRAY_TYPE && type->u.array.len == 0;
+}
 
 /*
  * The pointer returned from this function must be freed. It is okay to free
  * it after passing to an LLVM function.
  */
-static LLVMTypeRef *get_llvm_types(Vec *types)
+static LLVMTypeRef *get_llvm_types(Vec *types, unsigned lineno)
 {
 	LLVMTypeRef *llvm_types;
 	size_t i, ntypes;
@@ -59,12 +183,48 @@ static LLVMTypeRef *get_llvm_types(Vec *types)
 	ntypes = vec_len(types);
 	llvm_types = xmalloc(sizeof(LLVMTypeRef) * ntypes);
 	for (i = 0; i < ntypes; i++) {
-		llvm_types[i] = get_llvm_type(vec_get(types, i));
+		llvm_types[i] = get_llvm_type_at(vec_get(types, i), lineno);
 	}
 	return llvm_types;
 }
 
-static LLVMTypeRef get_llvm_type(struct type *type)
+// LLVM 14 array lengths are 32-bit, though ours are 64-bit
+static unsigned get_llvm_array_len(uint64_t len, unsigned lineno)
+{
+	if (len > UINT_MAX) {
+		fatal_error(lineno, "Array length %" PRIu64 " is greater than "
+		                    "the maximum of %u", len, UINT_MAX);
+	}
+	return len;
+}
+
+/*
+ * Functions called through closures take a pointer to their environment
+ * before their other parameters.
+ */
+static LLVMTypeRef get_llvm_func_type(struct type *type, bool has_env,
+		unsigned lineno)
+{
+	LLVMTypeRef func_type, ret, *params;
+	size_t nparams, i;
+
+	assert(type->kind == FUNC_TYPE);
+	nparams = vec_len(type->u.func.params);
+	params = xmalloc(sizeof(LLVMTypeRef) * (nparams + 1));
+	params[0] = LLVMPointerType(LLVMInt8Type(), 0);
+	for (i = 0; i < nparams; i++) {
+		params[i + 1] = get_llvm_type_at(vec_get(type->u.func.params,
+					i), lineno);
+	}
+	ret = get_llvm_type_at(type->u.func.ret, lineno);
+	func_type = LLVMFunctionType(ret, params + !has_env,
+			nparams + has_env, false);
+	free(params);
+	return func_type;
+}
+
+// Lowers a canonical type, reporting errors at `lineno`
+static LLVMTypeRef lower_type(struct type *type, unsigned lineno)
 {
 	switch (type->kind) {
 	case UNSIZED_INT_TYPE:
@@ -97,23 +257,25 @@ static LLVMTypeRef get_llvm_type(struct type *type)
 		// TODO: Resolve type
 	case ARRAY_TYPE: {
 		LLVMTypeRef item_type;
-		unsigned len;
+		uint64_t len;
 
-		item_type = get_llvm_type(type->u.array.l);
+		item_type = get_llvm_type_at(type->u.array.l, lineno);
 		len = type->u.array.len;
 		if (len == 0) {
 			return get_fat_ptr_type(item_type);
 		} else {
-			return LLVMArrayType(item_type, len);
+			return LLVMArrayType(item_type,
+					get_llvm_array_len(len, lineno));
 		}
 	}
 	case POINTER_TYPE:
-		return LLVMPointerType(get_llvm_type(type->u.pointer.l), 0);
+		return LLVMPointerType(get_llvm_type_at(type->u.pointer.l,
+					lineno), 0);
 	case TUPLE_TYPE: {
 		LLVMTypeRef tuple_type, *types;
 		size_t len;
 
-		types = get_llvm_types(type->u.tuple.types);
+		types = get_llvm_types(type->u.tuple.types, lineno);
 		len = vec_len(type->u.tuple.types);
 		tuple_type = LLVMStructType(types, len, false);
 		free(types);
@@ -123,32 +285,107 @@ static LLVMTypeRef get_llvm_type(struct type *type)
 		LLVMTypeRef struct_type, *types;
 		size_t len;
 
-		types = get_llvm_types(type->u.struct_.types);
+		types = get_llvm_types(type->u.struct_.types, lineno);
 		len = vec_len(type->u.struct_.types);
 		struct_type = LLVMStructType(types, len, false);
 		free(types);
 		return struct_type;
 	}
 	case FUNC_TYPE: {
-		LLVMTypeRef func_type, ret, *params;
-		size_t nparams;
+		// A closure: a function and the environment to call it with
+		LLVMTypeRef fields[2];
 
-		ret = get_llvm_type(type->u.func.ret);
-		params = get_llvm_types(type->u.func.params);
-		nparams = vec_len(type->u.func.params);
-		func_type = LLVMFunctionType(ret, params, nparams, false);
-		free(params);
-		return func_type;
+		fields[0] = LLVMPointerType(get_llvm_func_type(type, true,
+					lineno), 0);
+		fields[1] = LLVMPointerType(LLVMInt8Type(), 0);
+		return LLVMStructType(fields, ARRAY_LEN(fields), false);
 	}
 	case CONST_TYPE:
-		return get_llvm_type(type->u.const_.type);
+		return get_llvm_type_at(type->u.const_.type, lineno);
 	case VOLATILE_TYPE: // TODO: Volatile code gen
-		return get_llvm_type(type->u.volatile_.type);
+		return get_llvm_type_at(type->u.volatile_.type, lineno);
+	case RESTRICT_TYPE:
+		return get_llvm_type_at(type->u.restrict_.type, lineno);
+	case VECTOR_TYPE:
+		return LLVMVectorType(get_llvm_type_at(type->u.vector.l,
+					lineno), type->u.vector.len);
 	}
 	internal_error();
 }
 
+/*
+ * Lowered canonical types, indexed by type id. LLVM types live in the global
+ * context, so they outlive the module they were first made for.
+ */
+static LLVMTypeRef *llvm_type_cache;
+static size_t llvm_type_cache_len;
+
+static LLVMTypeRef get_llvm_type_at(struct type *type, unsigned lineno)
+{
+	LLVMTypeRef llvm_type;
+	size_t id, old_len;
+
+	type = intern_type(type);
+	id = type->id;
+	if (id < llvm_type_cache_len && llvm_type_cache[id] != NULL) {
+		return llvm_type_cache[id];
+	}
+	// Lowering the parts first may grow the cache
+	llvm_type = lower_type(type, lineno);
+	if (id >= llvm_type_cache_len) {
+		old_len = llvm_type_cache_len;
+		llvm_type_cache_len = 2 * id;
+		llvm_type_cache = xrealloc(llvm_type_cache,
+				llvm_type_cache_len * sizeof(LLVMTypeRef));
+		memset(llvm_type_cache + old_len, 0,
+			(llvm_type_cache_len - old_len) * sizeof(LLVMTypeRef));
+	}
+	llvm_type_cache[id] = llvm_type;
+	return llvm_type;
+}
+
+static LLVMTypeRef get_llvm_type(struct type *type)
+{
+	return get_llvm_type_at(type, type->lineno);
+}
+
+static LLVMMetadataRef md_string(const char *s)
+{
+	return LLVMMDStringInContext2(LLVMGetGlobalContext(), s, strlen(s));
+}
+
+static LLVMMetadataRef md_int(LLVMTypeRef type, uint64_t n)
+{
+	return LLVMValueAsMetadata(LLVMConstInt(type, n, false));
+}
+
+static LLVMMetadataRef md_node(LLVMMetadataRef *mds, size_t len)
+{
+	return LLVMMDNodeInContext2(LLVMGetGlobalContext(), mds, len);
+}
+
+/*
+ * Returns the size of what a pointer of `type` points to, or zero if it is
+ * unsized
+ */
+static uint64_t get_pointee_size(struct type *type)
+{
+	LLVMTypeRef llvm_type;
+
+	type = remove_const_and_volatile(type);
+	assert(type->kind == POINTER_TYPE);
+	llvm_type = get_llvm_type(type->u.pointer.l);
+	if (!LLVMTypeIsSized(llvm_type)) {
+		return 0;
+	}
+	return LLVMABISizeOfType(LLVMGetModuleDataLayout(cur_module),
+			llvm_type);
+}
+
 static LLVMValueRef emit_expr(LLVMBuilderRef, struct expr *);
+static LLVMValueRef emit_lambda_expr(LLVMBuilderRef, struct expr *);
+
+static LLVMValueRef emit_index_ptr(LLVMBuilderRef, struct expr *);
 
 static LLVMValueRef emit_lval(LLVMBuilderRef builder, struct expr *expr)
 {
@@ -162,17 +399,15 @@ static LLVMValueRef emit_lval(LLVMBuilderRef builder, struct expr *expr)
 	}
 	case IDENT_EXPR: {
 		struct symbol_info *sym_info;
-		char *name;
 
-		name = expr->u.ident.name;
-		sym_info = lookup_symbol(sym_tbl, name);
-		assert(sym_info != NULL);
+		sym_info = get_symbol(expr);
 		assert(sym_info->is_ptr);
-		assert(sym_info->val != NULL);
 		return sym_info->val;
 	}
 	case FIELD_ACCESS_EXPR:
 		internal_error(); // TODO: Stub
+	case INDEX_EXPR:
+		return emit_index_ptr(builder, expr);
 	default:
 		internal_error();
 	}
@@ -209,12 +444,32 @@ static LLVMValueRef emit_unary_op_expr(LLVMBuilderRef builder,
 		struct expr *expr)
 {
 	enum unary_op op = expr->u.unary_op.op;
-	LLVMValueRef operand = emit_expr(builder, expr->u.unary_op.operand);
+	LLVMValueRef operand;
 	LLVMTypeRef type = get_llvm_type(expr->type);
 	bool is_const_expr = (builder == NULL);
 
+	// These use the operand's address, so its value is not emitted
+	switch (op) {
+	case PRE_INC_OP:
+	case POST_INC_OP:
+	case PRE_DEC_OP:
+	case POST_DEC_OP:
+		return emit_inc_or_dec_expr(builder, expr);
+	case REF_OP:
+		return emit_lval(builder, expr->u.unary_op.operand);
+	default:
+		break;
+	}
+	operand = emit_expr(builder, expr->u.unary_op.operand);
 	switch (op) {
 	case NEG_OP:
+		if (is_float_type(get_lane_type(expr->type))) {
+			if (is_const_expr) {
+				return LLVMConstFNeg(operand);
+			} else {
+				return LLVMBuildFNeg(builder, operand, "neg");
+			}
+		}
 		if (is_const_expr) {
 			return LLVMConstNeg(operand);
 		} else {
@@ -224,11 +479,11 @@ static LLVMValueRef emit_unary_op_expr(LLVMBuilderRef builder,
 	case POST_INC_OP:
 	case PRE_DEC_OP:
 	case POST_DEC_OP:
-		return emit_inc_or_dec_expr(builder, expr);
+	case REF_OP:
+		// NOTREACHED
+		internal_error();
 	case DEREF_OP:
 		return LLVMBuildLoad(builder, operand, "loaded_val");
-	case REF_OP:
-		return operand;
 	case BIT_NOT_OP:
 		if (is_const_expr) {
 			return LLVMConstNot(operand);
@@ -238,7 +493,7 @@ static LLVMValueRef emit_unary_op_expr(LLVMBuilderRef builder,
 	case LOG_NOT_OP: {
 		LLVMValueRef zero_val;
 
-		zero_val = LLVMConstInt(type, 0, false);
+		zero_val = LLVMConstNull(type);
 		if (is_const_expr) {
 			return LLVMConstICmp(LLVMIntEQ, operand, zero_val);
 		} else {
@@ -530,6 +785,9 @@ static LLVMValueRef maybe_emit_int_promotion(LLVMBuilderRef builder,
 			"promoted_int");
 }
 
+static LLVMValueRef emit_converted_expr(LLVMBuilderRef, struct expr *,
+		struct type *);
+
 static LLVMValueRef emit_bin_op_expr(LLVMBuilderRef builder, struct expr *expr)
 {
 	LLVMValueRef l, r, old_val, new_val;
@@ -548,8 +806,14 @@ static LLVMValueRef emit_bin_op_expr(LLVMBuilderRef builder, struct expr *expr)
 	} else {
 		l = emit_expr(builder, l_expr);
 	}
-	r = emit_expr(builder, r_expr);
-	type = expr->type;
+	if (op == ASSIGN_OP) {
+		r = emit_converted_expr(builder, r_expr, l_type);
+	} else {
+		r = emit_expr(builder, r_expr);
+	}
+	// Operations depend on the operands' type, not on that of the result
+	type = l_type->kind == UNSIZED_INT_TYPE ? r_type : l_type;
+	type = get_lane_type(remove_const_and_volatile(type));
 	is_const_expr = (builder == NULL);
 	assert(is_assignment(op) ? !is_const_expr : true);
 
@@ -656,180 +920,1250 @@ static LLVMValueRef emit_bin_op_expr(LLVMBuilderRef builder, struct expr *expr)
 	internal_error();
 }
 
+static LLVMValueRef get_closure_val(LLVMValueRef func)
+{
+	LLVMValueRef fields[2];
+
+	fields[0] = func;
+	fields[1] = LLVMConstPointerNull(LLVMPointerType(LLVMInt8Type(), 0));
+	return LLVMConstStruct(fields, ARRAY_LEN(fields), false);
+}
+
+// Lets a named function be called as a closure, which passes an environment
+static LLVMValueRef get_func_thunk(LLVMValueRef func, struct type *type)
+{
+	LLVMValueRef thunk, call_val, *arg_vals;
+	LLVMBuilderRef builder;
+	const char *func_name;
+	char *thunk_name;
+	size_t len;
+	unsigned nargs, i;
+
+	func_name = LLVMGetValueName2(func, &len);
+	thunk_name = xmalloc(len + sizeof(".closure"));
+	sprintf(thunk_name, "%s.closure", func_name);
+	thunk = LLVMGetNamedFunction(cur_module, thunk_name);
+	if (thunk != NULL) {
+		free(thunk_name);
+		return thunk;
+	}
+	thunk = LLVMAddFunction(cur_module, thunk_name,
+			get_llvm_func_type(type, true, type->lineno));
+	free(thunk_name);
+	LLVMSetLinkage(thunk, LLVMInternalLinkage);
+	builder = LLVMCreateBuilder();
+	LLVMPositionBuilderAtEnd(builder, LLVMAppendBasicBlock(thunk,
+				"entry"));
+	nargs = vec_len(type->u.func.params);
+	arg_vals = xmalloc(sizeof(LLVMValueRef) * nargs);
+	for (i = 0; i < nargs; i++) {
+		arg_vals[i] = LLVMGetParam(thunk, i + 1);
+	}
+	call_val = LLVMBuildCall(builder, func, arg_vals, nargs, "");
+	LLVMSetTailCall(call_val, true);
+	if (type->u.func.ret->kind == VOID_TYPE) {
+		LLVMBuildRetVoid(builder);
+	} else {
+		LLVMBuildRet(builder, call_val);
+	}
+	free(arg_vals);
+	LLVMDisposeBuilder(builder);
+	return thunk;
+}
+
 static LLVMValueRef emit_ident_expr(LLVMBuilderRef builder, struct expr *expr)
 {
 	struct symbol_info *sym_info;
-	char *name;
 
-	assert(expr->kind == IDENT_EXPR);
-	name = expr->u.ident.name;
-	sym_info = lookup_symbol(sym_tbl, name);
-	assert(sym_info != NULL);
-	assert(sym_info->val != NULL);
-	assert(builder != NULL);
-	if (sym_info->is_ptr) {
+	sym_info = get_symbol(expr);
+	if (sym_info->const_val != NULL) {
+		return sym_info->const_val;
+	} else if (sym_info->is_ptr) {
+		assert(builder != NULL);
 		return LLVMBuildLoad(builder, sym_info->val, "var_val");
 	} else {
-		return sym_info->val;
+		return get_closure_val(get_func_thunk(sym_info->val,
+					expr->type));
 	}
 }
 
-static LLVMValueRef emit_array_lit_expr(LLVMBuilderRef builder,
-		struct expr *expr)
+static LLVMValueRef emit_const_expr(struct expr *);
+
+// Returns whether an array literal item can be emitted as a constant
+static bool is_const_item(struct expr *expr)
+{
+	Vec *items;
+	size_t i;
+
+	switch (expr->kind) {
+	case BOOL_LIT_EXPR:
+	case INT_LIT_EXPR:
+	case FLOAT_LIT_EXPR:
+	case CHAR_LIT_EXPR:
+		return true;
+	case UNARY_OP_EXPR:
+		return expr->u.unary_op.op == NEG_OP &&
+			expr->u.unary_op.operand->kind == INT_LIT_EXPR;
+	case ARRAY_LIT_EXPR:
+		items = expr->u.array_lit.val;
+		for (i = 0; i < vec_len(items); i++) {
+			if (!is_const_item(vec_get(items, i))) {
+				return false;
+			}
+		}
+		return true;
+	default:
+		return false;
+	}
+}
+
+static bool has_const_item(struct expr *expr)
 {
-	LLVMValueRef llvm_arr, llvm_elem_ptr, llvm_index[2];
-	struct expr *item;
 	Vec *items;
 	size_t i;
 
 	assert(expr->kind == ARRAY_LIT_EXPR);
 	items = expr->u.array_lit.val;
-	llvm_arr = LLVMBuildAlloca(builder, get_llvm_type(expr->type),
-			"array.alloca");
 	for (i = 0; i < vec_len(items); i++) {
-		item = vec_get(items, i);
-		llvm_index[0] = LLVMConstInt(LLVMInt32Type(), 0, false);
-		llvm_index[1] = LLVMConstInt(LLVMInt32Type(), i, false);
-		llvm_elem_ptr = LLVMBuildInBoundsGEP(builder, llvm_arr,
-				llvm_index, ARRAY_LEN(llvm_index),
-				"array.elem_ptr");
-		LLVMBuildStore(builder, emit_expr(builder, item),
-				llvm_elem_ptr);
+		if (is_const_item(vec_get(items, i))) {
+			return true;
+		}
 	}
-	return llvm_arr;
+	return false;
 }
 
-static void emit_compound_stmt(LLVMBuilderRef, Vec *, LLVMBasicBlockRef,
-		LLVMBasicBlockRef);
+static LLVMValueRef emit_const_val(struct expr *, struct type *);
 
-static LLVMValueRef emit_block_expr(LLVMBuilderRef builder, struct expr *expr)
+// The pointer returned from this function must be freed
+static LLVMValueRef *emit_const_vals(Vec *exprs, struct type *type,
+		Vec *types)
 {
-	Vec *stmts;
-
-	assert(expr->kind == BLOCK_EXPR);
-	stmts = expr->u.block.stmts;
+	LLVMValueRef *vals;
+	size_t i;
 
-	enter_new_scope(sym_tbl);
-	emit_compound_stmt(builder, stmts, NULL, NULL);
-	leave_scope(sym_tbl);
-	return NULL;
+	vals = xmalloc(sizeof(LLVMValueRef) * vec_len(exprs));
+	for (i = 0; i < vec_len(exprs); i++) {
+		if (types != NULL) {
+			type = vec_get(types, i);
+		}
+		vals[i] = emit_const_val(vec_get(exprs, i), type);
+	}
+	return vals;
 }
 
 /*
- * The pointer returned from this function must be freed. It is okay to free
- * it after passing to an LLVM function.
+ * Emits a pure expression as a constant of `type`. Arrays and tuples are built
+ * item by item, so they need no code at runtime.
  */
-static LLVMValueRef *emit_exprs(LLVMBuilderRef builder, Vec *exprs)
+static LLVMValueRef emit_const_val(struct expr *expr, struct type *type)
 {
-	LLVMValueRef *llvm_exprs;
-	size_t nexprs, i;
+	LLVMValueRef val, *vals;
+	struct expr *operand;
+	Vec *items;
 
-	nexprs = vec_len(exprs);
-	llvm_exprs = xmalloc(sizeof(LLVMValueRef) * nexprs);
-	for (i = 0; i < nexprs; i++) {
-		llvm_exprs[i] = emit_expr(builder, vec_get(exprs, i));
+	type = remove_const_and_volatile(type);
+	switch (expr->kind) {
+	case ARRAY_LIT_EXPR:
+		items = expr->u.array_lit.val;
+		if (type->kind == VECTOR_TYPE) {
+			vals = emit_const_vals(items, type->u.vector.l, NULL);
+			val = LLVMConstVector(vals, vec_len(items));
+			free(vals);
+			return val;
+		}
+		vals = emit_const_vals(items, type->u.array.l, NULL);
+		val = LLVMConstArray(get_llvm_type(type->u.array.l), vals,
+				vec_len(items));
+		free(vals);
+		return val;
+	case TUPLE_EXPR:
+		items = expr->u.tuple.items;
+		vals = emit_const_vals(items, NULL, type->u.tuple.types);
+		val = LLVMConstStruct(vals, vec_len(items), false);
+		free(vals);
+		return val;
+	case INT_LIT_EXPR:
+		// Unsized literals take the item type without truncation
+		return LLVMConstInt(get_llvm_type(type), expr->u.int_lit.val,
+				false);
+	case LAMBDA_EXPR:
+		// Lambdas at the top level have nothing to capture
+		return emit_lambda_expr(NULL, expr);
+	case UNARY_OP_EXPR:
+		operand = expr->u.unary_op.operand;
+		if (expr->u.unary_op.op != NEG_OP) {
+			break;
+		}
+		if (is_float_type(type)) {
+			return LLVMConstFNeg(emit_const_val(operand, type));
+		}
+		return LLVMConstNeg(emit_const_val(operand, type));
+	default:
+		break;
 	}
-	return llvm_exprs;
+	val = emit_const_expr(expr);
+	if (expr->type->kind == UNSIZED_INT_TYPE) {
+		val = LLVMConstIntCast(val, get_llvm_type(type),
+				is_signed_int_type(type));
+	}
+	return val;
 }
 
-static LLVMValueRef emit_func_call_expr(LLVMBuilderRef builder,
-		struct expr *expr)
+/*
+ * Emits the constant items of an array literal as a constant array of
+ * `item_type`. Items that aren't constant are left zero.
+ */
+static LLVMValueRef emit_const_array(struct expr *expr, struct type *item_type)
 {
-	LLVMValueRef call_val, func_val, *arg_vals;
-	struct expr *arg, *func;
-	struct type *param_type;
-	Vec *args, *params;
-	unsigned nargs, i;
+	LLVMValueRef array, *vals;
+	LLVMTypeRef llvm_item_type;
+	struct expr *item;
+	Vec *items;
+	size_t i, len;
 
-	assert(expr->kind == FUNC_CALL_EXPR);
-	args = expr->u.func_call.args;
-	func = expr->u.func_call.func;
-	assert(func->type->kind == FUNC_TYPE);
-	params = func->type->u.func.params;
-	nargs = vec_len(args);
-	arg_vals = emit_exprs(builder, args);
-	for (i = 0; i < nargs; i++) {
-		arg = vec_get(args, i);
-		param_type = vec_get(params, i);
-		arg_vals[i] = maybe_emit_int_promotion(builder, arg_vals[i],
-				param_type, arg->type);
+	assert(expr->kind == ARRAY_LIT_EXPR);
+	item_type = remove_const_and_volatile(item_type);
+	items = expr->u.array_lit.val;
+	len = vec_len(items);
+	llvm_item_type = get_llvm_type(item_type);
+	vals = xmalloc(sizeof(LLVMValueRef) * len);
+	for (i = 0; i < len; i++) {
+		item = vec_get(items, i);
+		if (is_const_item(item)) {
+			vals[i] = emit_const_val(item, item_type);
+		} else {
+			vals[i] = LLVMConstNull(llvm_item_type);
+		}
 	}
-	func_val = emit_expr(builder, func);
-	call_val = LLVMBuildCall(builder, func_val, arg_vals, nargs,
-			"call_ret");
-	free(arg_vals);
-	return call_val;
+	array = LLVMConstArray(llvm_item_type, vals, len);
+	free(vals);
+	return array;
 }
 
-static LLVMValueRef emit_index_expr(LLVMBuilderRef builder, struct expr *expr)
+// Adds a read-only global that may be merged with identical ones
+static LLVMValueRef add_const_global(LLVMModuleRef module, LLVMValueRef init,
+		const char *name)
 {
-	LLVMValueRef llvm_array, llvm_index[2], llvm_elem_ptr;
-	struct expr *array, *index;
+	LLVMValueRef global;
 
-	assert(expr->kind == INDEX_EXPR);
-	array = expr->u.index.array;
-	index = expr->u.index.index;
-	llvm_array = emit_lval(builder, array);
-	llvm_index[0] = LLVMConstInt(LLVMInt32Type(), 0, false);
-	llvm_index[1] = emit_expr(builder, index);
-	llvm_elem_ptr = LLVMBuildInBoundsGEP(builder, llvm_array,
-			llvm_index, ARRAY_LEN(llvm_index), "array.elem_ptr");
-	return LLVMBuildLoad(builder, llvm_elem_ptr, "index.load");
+	global = LLVMAddGlobal(module, LLVMTypeOf(init), name);
+	LLVMSetInitializer(global, init);
+	LLVMSetGlobalConstant(global, true);
+	LLVMSetLinkage(global, LLVMPrivateLinkage);
+	LLVMSetUnnamedAddress(global, LLVMGlobalUnnamedAddr);
+	return global;
 }
 
-static LLVMValueRef emit_expr(LLVMBuilderRef builder, struct expr *expr)
+// Returns a constant slice of the items in a global array
+static LLVMValueRef get_const_slice(struct type *type, LLVMValueRef items,
+		uint64_t len)
 {
-	LLVMTypeRef llvm_type = get_llvm_type(expr->type);
+	LLVMValueRef vals[2], llvm_index[2];
 
-	switch (expr->kind) {
-	case BOOL_LIT_EXPR: {
-		bool val = expr->u.bool_lit.val;
+	llvm_index[0] = LLVMConstInt(LLVMInt64Type(), 0, false);
+	llvm_index[1] = llvm_index[0];
+	vals[0] = LLVMConstInt(LLVMInt64Type(), len, false);
+	vals[1] = LLVMConstInBoundsGEP(items, llvm_index,
+			ARRAY_LEN(llvm_index));
+	return LLVMConstNamedStruct(get_llvm_type(type), vals,
+			ARRAY_LEN(vals));
+}
 
-		return LLVMConstInt(llvm_type, val, false);
-	}
-	case INT_LIT_EXPR: {
-		uint64_t val = expr->u.int_lit.val;
+/*
+ * Emits a string literal as a `str` slice of its bytes in a read-only global.
+ * Identical literals in a module share one global.
+ */
+static LLVMValueRef emit_string_lit_expr(struct expr *expr)
+{
+	LLVMValueRef bytes;
+	size_t len;
+	char *val;
 
-		return LLVMConstInt(llvm_type, val, false);
+	assert(expr->kind == STRING_LIT_EXPR);
+	val = expr->u.string_lit.val;
+	len = expr->u.string_lit.len;
+	bytes = hash_table_get(string_pool, val);
+	if (bytes == NULL) {
+		bytes = add_const_global(cur_module, LLVMConstString(val,
+					get_llvm_array_len(len, expr->lineno),
+					true), "str");
+		LLVMSetAlignment(bytes, 1);
+		hash_table_set(string_pool, val, bytes);
 	}
-	case FLOAT_LIT_EXPR: {
-		double val = expr->u.float_lit.val;
+	return get_const_slice(expr->type, bytes, len);
+}
 
-		return LLVMConstReal(llvm_type, val);
-	}
-	case CHAR_LIT_EXPR: {
-		uint32_t val = expr->u.char_lit.val;
+static LLVMValueRef get_embed_data(struct expr *expr)
+{
+	assert(expr->kind == EMBED_EXPR);
+	return LLVMConstString(expr->u.embed.data,
+			get_llvm_array_len(expr->u.embed.len, expr->lineno),
+			true);
+}
+
+/*
+ * Emits the bytes of a nonempty embedded file as a read-only global. Every
+ * embedding of a file in a module shares one global.
+ */
+static LLVMValueRef emit_embed_global(struct expr *expr)
+{
+	LLVMValueRef bytes;
 
-		return LLVMConstInt(llvm_type, val, false);
+	assert(expr->u.embed.len != 0);
+	bytes = hash_table_get(embed_pool, expr->u.embed.name);
+	if (bytes == NULL) {
+		bytes = add_const_global(cur_module, get_embed_data(expr),
+				"embed");
+		LLVMSetAlignment(bytes, 1);
+		hash_table_set(embed_pool, expr->u.embed.name, bytes);
 	}
-	case STRING_LIT_EXPR: {
-		char *val = expr->u.string_lit.val;
-		unsigned len = expr->u.string_lit.len;
+	return bytes;
+}
 
-		return LLVMConstString(val, len, true);
+// Emits an embedded file used as a value
+static LLVMValueRef emit_embed_expr(struct expr *expr)
+{
+	if (expr->u.embed.len == 0) {
+		return LLVMConstNull(get_llvm_type(expr->type));
 	}
-	case UNARY_OP_EXPR:
-		return emit_unary_op_expr(builder, expr);
-	case BIN_OP_EXPR:
-		return emit_bin_op_expr(builder, expr);
-	case LAMBDA_EXPR:
-		internal_error(); // TODO: Stub
-	case ARRAY_LIT_EXPR:
-		return emit_array_lit_expr(builder, expr);
-	case IDENT_EXPR:
-		return emit_ident_expr(builder, expr);
-	case BLOCK_EXPR:
-		return emit_block_expr(builder, expr);
-	case IF_EXPR:
-	case SWITCH_EXPR:
-	case TUPLE_EXPR:
-		internal_error(); // TODO: Stub
+	return get_embed_data(expr);
+}
+
+static LLVMValueRef emit_const_array_global(LLVMBuilderRef builder,
+		struct expr *expr, struct type *item_type)
+{
+	LLVMModuleRef module;
+
+	module = LLVMGetGlobalParent(get_cur_func(builder));
+	return add_const_global(module, emit_const_array(expr, item_type),
+			"array.lit");
+}
+
+/*
+ * Emits an array literal of `item_type` items into a new stack slot and
+ * returns a pointer to it. The constant items are copied from a read-only
+ * global, and only the others are stored one at a time.
+ */
+static LLVMValueRef emit_array_lit_expr(LLVMBuilderRef builder,
+		struct expr *expr, struct type *item_type)
+{
+	LLVMValueRef llvm_arr, llvm_elem_ptr, llvm_index[2], global, val;
+	LLVMTypeRef array_type;
+	unsigned align;
+	struct expr *item;
+	Vec *items;
+	size_t i;
+
+	assert(expr->kind == ARRAY_LIT_EXPR);
+	item_type = remove_const_and_volatile(item_type);
+	items = expr->u.array_lit.val;
+	array_type = LLVMArrayType(get_llvm_type(item_type), vec_len(items));
+	llvm_arr = build_entry_alloca(array_type, "array.alloca");
+	if (has_const_item(expr)) {
+		global = emit_const_array_global(builder, expr, item_type);
+		align = LLVMGetAlignment(llvm_arr);
+		LLVMSetAlignment(global, align);
+		LLVMBuildMemCpy(builder, llvm_arr, align, global, align,
+				LLVMSizeOf(array_type));
+	}
+	for (i = 0; i < vec_len(items); i++) {
+		item = vec_get(items, i);
+		if (is_const_item(item)) {
+			continue;
+		}
+		llvm_index[0] = LLVMConstInt(LLVMInt32Type(), 0, false);
+		llvm_index[1] = LLVMConstInt(LLVMInt32Type(), i, false);
+		llvm_elem_ptr = LLVMBuildInBoundsGEP(builder, llvm_arr,
+				llvm_index, ARRAY_LEN(llvm_index),
+				"array.elem_ptr");
+		if (item->kind == ARRAY_LIT_EXPR) {
+			val = LLVMBuildLoad(builder, emit_array_lit_expr(
+						builder, item,
+						item_type->u.array.l),
+					"array.val");
+		} else {
+			val = emit_converted_expr(builder, item, item_type);
+		}
+		LLVMBuildStore(builder, val, llvm_elem_ptr);
+	}
+	return llvm_arr;
+}
+
+/*
+ * Returns a pointer to a fixed-size array. Arrays that aren't stored anywhere
+ * are spilled to the stack.
+ */
+static LLVMValueRef emit_array_addr(LLVMBuilderRef builder, struct expr *expr)
+{
+	LLVMValueRef ptr;
+
+	switch (expr->kind) {
+	case ARRAY_LIT_EXPR:
+		return emit_array_lit_expr(builder, expr,
+				expr->type->u.array.l);
+	case EMBED_EXPR:
+		return emit_embed_global(expr);
+	case IDENT_EXPR:
+	case INDEX_EXPR:
+		return emit_lval(builder, expr);
+	case UNARY_OP_EXPR:
+		if (expr->u.unary_op.op == DEREF_OP) {
+			return emit_lval(builder, expr);
+		}
+		break;
+	default:
+		break;
+	}
+	ptr = build_entry_alloca(get_llvm_type(expr->type), "array.tmp");
+	LLVMBuildStore(builder, emit_expr(builder, expr), ptr);
+	return ptr;
+}
+
+static LLVMValueRef emit_first_item_ptr(LLVMBuilderRef builder,
+		LLVMValueRef array_ptr)
+{
+	LLVMValueRef llvm_index[2];
+
+	llvm_index[0] = LLVMConstInt(LLVMInt64Type(), 0, false);
+	llvm_index[1] = llvm_index[0];
+	return LLVMBuildInBoundsGEP(builder, array_ptr, llvm_index,
+			ARRAY_LEN(llvm_index), "ptr");
+}
+
+// Emits the length and item pointer of a fixed-size array or a slice
+static void emit_array_parts(LLVMBuilderRef builder, struct expr *expr,
+		LLVMValueRef *len, LLVMValueRef *ptr)
+{
+	LLVMValueRef llvm_array;
+	struct type *type;
+
+	type = remove_const_and_volatile(expr->type);
+	assert(type->kind == ARRAY_TYPE);
+	if (type->u.array.len == 0) {
+		llvm_array = emit_expr(builder, expr);
+		*len = LLVMBuildExtractValue(builder, llvm_array, 0, "len");
+		*ptr = LLVMBuildExtractValue(builder, llvm_array, 1, "ptr");
+		return;
+	}
+	*len = LLVMConstInt(LLVMInt64Type(), type->u.array.len, false);
+	*ptr = emit_first_item_ptr(builder, emit_array_addr(builder, expr));
+}
+
+static LLVMValueRef emit_slice_val(LLVMBuilderRef builder,
+		struct type *type, LLVMValueRef len, LLVMValueRef ptr)
+{
+	LLVMValueRef slice;
+
+	slice = LLVMGetUndef(get_llvm_type(type));
+	slice = LLVMBuildInsertValue(builder, slice, len, 0, "slice");
+	return LLVMBuildInsertValue(builder, slice, ptr, 1, "slice");
+}
+
+static LLVMValueRef emit_vector_lit(LLVMBuilderRef builder,
+		struct expr *expr, struct type *type)
+{
+	LLVMValueRef vector, lane;
+	Vec *items;
+	size_t i;
+
+	items = expr->u.array_lit.val;
+	vector = LLVMGetUndef(get_llvm_type(type));
+	for (i = 0; i < vec_len(items); i++) {
+		lane = emit_converted_expr(builder, vec_get(items, i),
+				type->u.vector.l);
+		vector = LLVMBuildInsertElement(builder, vector, lane,
+				LLVMConstInt(LLVMInt32Type(), i, false),
+				"vector");
+	}
+	return vector;
+}
+
+// Builds the tuple with the item types of `type`
+static LLVMValueRef emit_tuple_expr(LLVMBuilderRef builder, struct expr *expr,
+		struct type *type)
+{
+	LLVMValueRef tuple_val, item_val;
+	Vec *items;
+	size_t i;
+
+	assert(expr->kind == TUPLE_EXPR);
+	type = remove_const_and_volatile(type);
+	items = expr->u.tuple.items;
+	tuple_val = LLVMGetUndef(get_llvm_type(type));
+	for (i = 0; i < vec_len(items); i++) {
+		item_val = emit_converted_expr(builder, vec_get(items, i),
+				vec_get(type->u.tuple.types, i));
+		tuple_val = LLVMBuildInsertValue(builder, tuple_val, item_val,
+				i, "tuple.val");
+	}
+	return tuple_val;
+}
+
+/*
+ * Emits an expression converted to the type it is assigned to. Fixed-size
+ * arrays convert to slices without copying, and unsized integers are promoted.
+ */
+static LLVMValueRef emit_converted_expr(LLVMBuilderRef builder,
+		struct expr *expr, struct type *to_type)
+{
+	LLVMValueRef len, ptr;
+
+	to_type = remove_const_and_volatile(to_type);
+	if (expr->kind == TUPLE_EXPR && to_type->kind == TUPLE_TYPE) {
+		return emit_tuple_expr(builder, expr, to_type);
+	}
+	if (expr->kind == ARRAY_LIT_EXPR && to_type->kind == VECTOR_TYPE) {
+		return emit_vector_lit(builder, expr, to_type);
+	}
+	if (expr->kind == ARRAY_LIT_EXPR) {
+		// Build the literal with the items of the type assigned to
+		ptr = emit_array_lit_expr(builder, expr, to_type->u.array.l);
+		if (!is_slice_type(to_type)) {
+			return LLVMBuildLoad(builder, ptr, "array.val");
+		}
+		len = LLVMConstInt(LLVMInt64Type(),
+				vec_len(expr->u.array_lit.val), false);
+		return emit_slice_val(builder, to_type, len,
+				emit_first_item_ptr(builder, ptr));
+	}
+	if (is_slice_type(to_type) && !is_slice_type(expr->type)) {
+		emit_array_parts(builder, expr, &len, &ptr);
+		return emit_slice_val(builder, to_type, len, ptr);
+	}
+	return maybe_emit_int_promotion(builder, emit_expr(builder, expr),
+			to_type, expr->type);
+}
+
+static void emit_compound_stmt(LLVMBuilderRef, Vec *, LLVMBasicBlockRef,
+		LLVMBasicBlockRef);
+
+static LLVMValueRef emit_block_expr(LLVMBuilderRef builder, struct expr *expr)
+{
+	Vec *stmts;
+
+	assert(expr->kind == BLOCK_EXPR);
+	stmts = expr->u.block.stmts;
+
+	emit_compound_stmt(builder, stmts, NULL, NULL);
+	return NULL;
+}
+
+static LLVMValueRef emit_switch_expr(LLVMBuilderRef, struct expr *);
+
+static void free_func_spec(void *p)
+{
+	struct func_spec *spec = p;
+
+	free(spec->const_args);
+	free(spec);
+}
+
+static size_t count_instrs(LLVMValueRef func)
+{
+	LLVMBasicBlockRef block;
+	LLVMValueRef instr;
+	size_t ninstrs;
+
+	ninstrs = 0;
+	for (block = LLVMGetFirstBasicBlock(func); block != NULL;
+			block = LLVMGetNextBasicBlock(block)) {
+		for (instr = LLVMGetFirstInstruction(block); instr != NULL;
+				instr = LLVMGetNextInstruction(instr)) {
+			ninstrs++;
+		}
+	}
+	return ninstrs;
+}
+
+static void add_param_attrs(LLVMValueRef, struct decl *);
+static void add_annotated_attrs(LLVMValueRef, struct decl *);
+
+/*
+ * Returns the function to call with `arg_vals`. Constant function arguments,
+ * such as named functions and lambdas without captures, get a copy of the
+ * callee with them bound, so calls through them are direct and can be
+ * inlined. Calls with the same constants share a copy, and the copies of a
+ * function are limited to MAX_SPEC_INSTRS instructions in all.
+ */
+static LLVMValueRef get_func_spec(struct symbol_info *sym_info,
+		LLVMValueRef *arg_vals)
+{
+	LLVMValueRef *const_args;
+	struct func_spec *spec;
+	struct decl *decl;
+	Vec *params;
+	char *spec_name;
+	size_t nparams, nspecs, i, j;
+	bool has_const_arg;
+
+	decl = sym_info->func_decl;
+	// Profiles are matched to functions by name
+	if (decl == NULL || options.opt_level == 0 ||
+			options.profile_generate != NULL ||
+			options.profile_use != NULL) {
+		return sym_info->val;
+	}
+	params = decl->u.func.type->u.func.params;
+	nparams = vec_len(params);
+	const_args = xmalloc(sizeof(LLVMValueRef) * nparams);
+	has_const_arg = false;
+	for (i = 0; i < nparams; i++) {
+		const_args[i] = NULL;
+		// A bound parameter can't be assigned or changed by `become`
+		if (remove_const_and_volatile(vec_get(params, i))->kind ==
+				FUNC_TYPE && LLVMIsConstant(arg_vals[i]) &&
+				!(decl->u.func.param_effects[i] &
+					PARAM_REBOUND)) {
+			const_args[i] = arg_vals[i];
+			has_const_arg = true;
+		}
+	}
+	nspecs = 0;
+	for (i = 0; has_const_arg && i < vec_len(func_specs); i++) {
+		spec = vec_get(func_specs, i);
+		if (spec->decl != decl) {
+			continue;
+		}
+		nspecs++;
+		// Constants are uniqued, so equal ones are the same value
+		for (j = 0; j < nparams; j++) {
+			if (spec->const_args[j] != const_args[j]) {
+				break;
+			}
+		}
+		if (j == nparams) {
+			free(const_args);
+			return spec->func;
+		}
+	}
+	if (!has_const_arg || (nspecs + 1) * count_instrs(sym_info->val) >
+			MAX_SPEC_INSTRS) {
+		free(const_args);
+		return sym_info->val;
+	}
+	spec = NEW(struct func_spec);
+	spec->decl = decl;
+	spec->const_args = const_args;
+	spec_name = xmalloc(strlen(decl->u.func.name) + sizeof(".spec"));
+	sprintf(spec_name, "%s.spec", decl->u.func.name);
+	spec->func = LLVMAddFunction(cur_module, spec_name,
+			LLVMGlobalGetValueType(sym_info->val));
+	free(spec_name);
+	LLVMSetLinkage(spec->func, LLVMInternalLinkage);
+	add_param_attrs(spec->func, decl);
+	add_annotated_attrs(spec->func, decl);
+	vec_push(func_specs, spec);
+	return spec->func;
+}
+
+/*
+ * A pointer parameter may be passed anything, even an uninitialized pointer,
+ * so only the arguments of a call that are made with `&` are known to point to
+ * whole values. `first_index` is the index of the first argument.
+ */
+static void add_ref_arg_attrs(LLVMValueRef call_val, Vec *args,
+		unsigned first_index)
+{
+	LLVMAttributeRef attr;
+	struct expr *arg;
+	uint64_t size;
+	unsigned kind, i;
+
+	kind = LLVMGetEnumAttributeKindForName("dereferenceable", 15);
+	for (i = 0; i < vec_len(args); i++) {
+		arg = vec_get(args, i);
+		if (arg->kind != UNARY_OP_EXPR ||
+				arg->u.unary_op.op != REF_OP) {
+			continue;
+		}
+		size = get_pointee_size(arg->type);
+		if (size != 0) {
+			attr = LLVMCreateEnumAttribute(LLVMGetGlobalContext(),
+					kind, size);
+			LLVMAddCallSiteAttribute(call_val, first_index + i + 1,
+					attr);
+		}
+	}
+}
+
+static LLVMValueRef emit_func_call_expr(LLVMBuilderRef builder,
+		struct expr *expr)
+{
+	LLVMValueRef call_val, func_val, closure_val, *arg_vals;
+	struct expr *arg, *func;
+	struct type *param_type;
+	Vec *args, *params;
+	const char *name;
+	unsigned nargs, i;
+
+	assert(expr->kind == FUNC_CALL_EXPR);
+	args = expr->u.func_call.args;
+	func = expr->u.func_call.func;
+	assert(func->type->kind == FUNC_TYPE);
+	params = func->type->u.func.params;
+	nargs = vec_len(args);
+	// The first is left for the environment of a closure
+	arg_vals = xmalloc(sizeof(LLVMValueRef) * (nargs + 1));
+	for (i = 0; i < nargs; i++) {
+		arg = vec_get(args, i);
+		param_type = vec_get(params, i);
+		arg_vals[i + 1] = emit_converted_expr(builder, arg,
+				param_type);
+	}
+	// Values of type `void` can't be named
+	name = func->type->u.func.ret->kind == VOID_TYPE ? "" : "call_ret";
+	if (func->kind == IDENT_EXPR && !get_symbol(func)->is_ptr) {
+		func_val = get_func_spec(get_symbol(func), arg_vals + 1);
+		call_val = LLVMBuildCall(builder, func_val, arg_vals + 1,
+				nargs, name);
+		add_ref_arg_attrs(call_val, args, 0);
+	} else {
+		closure_val = emit_expr(builder, func);
+		func_val = LLVMBuildExtractValue(builder, closure_val, 0,
+				"closure.func");
+		arg_vals[0] = LLVMBuildExtractValue(builder, closure_val, 1,
+				"closure.env");
+		call_val = LLVMBuildCall(builder, func_val, arg_vals,
+				nargs + 1, name);
+		add_ref_arg_attrs(call_val, args, 1);
+	}
+	free(arg_vals);
+	return call_val;
+}
+
+static LLVMBasicBlockRef get_trap_block(LLVMBuilderRef builder)
+{
+	LLVMBuilderRef trap_builder;
+	LLVMValueRef func, trap_func;
+
+	if (cur_func_trap_block != NULL) {
+		return cur_func_trap_block;
+	}
+	func = get_cur_func(builder);
+	trap_func = get_or_add_func(LLVMGetGlobalParent(func), "llvm.trap",
+			LLVMFunctionType(LLVMVoidType(), NULL, 0, false));
+	cur_func_trap_block = LLVMAppendBasicBlock(func, "bounds.fail");
+	trap_builder = LLVMCreateBuilder();
+	LLVMPositionBuilderAtEnd(trap_builder, cur_func_trap_block);
+	LLVMBuildCall(trap_builder, trap_func, NULL, 0, "");
+	LLVMBuildUnreachable(trap_builder);
+	LLVMDisposeBuilder(trap_builder);
+	return cur_func_trap_block;
+}
+
+// Traps unless `in_bounds` is true
+static void emit_bounds_check(LLVMBuilderRef builder, LLVMValueRef in_bounds)
+{
+	LLVMBasicBlockRef ok_block;
+
+	ok_block = append_basic_block(builder, "bounds.ok");
+	LLVMBuildCondBr(builder, in_bounds, ok_block,
+			get_trap_block(builder));
+	LLVMPositionBuilderAtEnd(builder, ok_block);
+}
+
+// Emits an index or slice bound as a 64-bit integer
+static LLVMValueRef emit_index_val(LLVMBuilderRef builder, struct expr *index)
+{
+	return LLVMBuildIntCast2(builder, emit_expr(builder, index),
+			LLVMInt64Type(), is_signed_int_type(index->type),
+			"index");
+}
+
+/*
+ * Returns a pointer to the indexed element. With `-fbounds-check`, the index
+ * is checked unless it was proven to be in bounds. A negative index wraps to a
+ * huge unsigned one, so one unsigned comparison suffices.
+ */
+static LLVMValueRef emit_index_ptr(LLVMBuilderRef builder, struct expr *expr)
+{
+	LLVMValueRef llvm_array, llvm_index[2], llvm_len;
+	struct expr *array, *index;
+	bool needs_check;
+	uint64_t len;
+
+	assert(expr->kind == INDEX_EXPR);
+	array = expr->u.index.array;
+	index = expr->u.index.index;
+	len = array->type->u.array.len;
+	needs_check = options.bounds_check && !expr->u.index.is_in_bounds;
+	llvm_index[1] = emit_index_val(builder, index);
+	if (len == 0) {
+		llvm_array = emit_expr(builder, array);
+		if (needs_check) {
+			llvm_len = LLVMBuildExtractValue(builder, llvm_array,
+					0, "len");
+			emit_bounds_check(builder, LLVMBuildICmp(builder,
+						LLVMIntULT, llvm_index[1],
+						llvm_len, "in_bounds"));
+		}
+		llvm_array = LLVMBuildExtractValue(builder, llvm_array, 1,
+				"ptr");
+		return LLVMBuildInBoundsGEP(builder, llvm_array,
+				&llvm_index[1], 1, "array.elem_ptr");
+	}
+	llvm_array = emit_array_addr(builder, array);
+	if (needs_check) {
+		llvm_len = LLVMConstInt(LLVMInt64Type(), len, false);
+		emit_bounds_check(builder, LLVMBuildICmp(builder, LLVMIntULT,
+					llvm_index[1], llvm_len, "in_bounds"));
+	}
+	llvm_index[0] = LLVMConstInt(LLVMInt64Type(), 0, false);
+	return LLVMBuildInBoundsGEP(builder, llvm_array, llvm_index,
+			ARRAY_LEN(llvm_index), "array.elem_ptr");
+}
+
+// Lanes of vectors are extracted, since vectors aren't kept in memory
+static LLVMValueRef emit_lane_expr(LLVMBuilderRef builder, struct expr *expr)
+{
+	LLVMValueRef vector, index, len;
+	struct type *type;
+
+	type = expr->u.index.array->type;
+	vector = emit_expr(builder, expr->u.index.array);
+	index = emit_index_val(builder, expr->u.index.index);
+	if (options.bounds_check && !expr->u.index.is_in_bounds) {
+		len = LLVMConstInt(LLVMInt64Type(), type->u.vector.len, false);
+		emit_bounds_check(builder, LLVMBuildICmp(builder, LLVMIntULT,
+					index, len, "in_bounds"));
+	}
+	return LLVMBuildExtractElement(builder, vector, index, "lane");
+}
+
+static LLVMValueRef emit_index_expr(LLVMBuilderRef builder, struct expr *expr)
+{
+	if (expr->u.index.array->type->kind == VECTOR_TYPE) {
+		return emit_lane_expr(builder, expr);
+	}
+	return LLVMBuildLoad(builder, emit_index_ptr(builder, expr),
+			"index.load");
+}
+
+// Returns a vector with `val` in each lane of the vector type `type`
+static LLVMValueRef emit_splat(LLVMBuilderRef builder, LLVMValueRef val,
+		struct type *type)
+{
+	LLVMValueRef vector, zero, mask;
+	LLVMTypeRef mask_type;
+
+	mask_type = LLVMVectorType(LLVMInt32Type(), type->u.vector.len);
+	mask = LLVMConstNull(mask_type);
+	zero = LLVMConstInt(LLVMInt32Type(), 0, false);
+	vector = LLVMGetUndef(get_llvm_type(type));
+	if (builder == NULL) {
+		vector = LLVMConstInsertElement(vector, val, zero);
+		return LLVMConstShuffleVector(vector, vector, mask);
+	}
+	vector = LLVMBuildInsertElement(builder, vector, val, zero, "splat");
+	return LLVMBuildShuffleVector(builder, vector, vector, mask, "splat");
+}
+
+static LLVMValueRef emit_shuffle(LLVMBuilderRef builder, Vec *args)
+{
+	LLVMValueRef a, b, *lanes, mask;
+	Vec *items;
+	size_t len, i;
+
+	a = emit_expr(builder, vec_get(args, 0));
+	b = emit_expr(builder, vec_get(args, 1));
+	items = ((struct expr *) vec_get(args, 2))->u.array_lit.val;
+	len = vec_len(items);
+	lanes = xmalloc(len * sizeof(LLVMValueRef));
+	for (i = 0; i < len; i++) {
+		lanes[i] = LLVMConstInt(LLVMInt32Type(),
+				eval_const_expr(vec_get(items, i)), false);
+	}
+	mask = LLVMConstVector(lanes, len);
+	free(lanes);
+	return LLVMBuildShuffleVector(builder, a, b, mask, "shuffle");
+}
+
+// Returns the declaration of an intrinsic overloaded on `types`
+static LLVMValueRef get_intrinsic(LLVMBuilderRef builder, const char *name,
+		LLVMTypeRef *types, size_t ntypes)
+{
+	LLVMModuleRef module;
+	unsigned id;
+
+	module = LLVMGetGlobalParent(get_cur_func(builder));
+	id = LLVMLookupIntrinsicID(name, strlen(name));
+	assert(id != 0);
+	return LLVMGetIntrinsicDeclaration(module, id, types, ntypes);
+}
+
+static const char *get_reduce_intrinsic_name(enum builtin builtin,
+		struct type *lane_type)
+{
+	bool is_float, is_signed;
+
+	is_float = is_float_type(lane_type);
+	is_signed = is_signed_int_type(lane_type);
+	switch (builtin) {
+	case REDUCE_ADD_BUILTIN:
+		return is_float ? "llvm.vector.reduce.fadd" :
+			"llvm.vector.reduce.add";
+	case REDUCE_MUL_BUILTIN:
+		return is_float ? "llvm.vector.reduce.fmul" :
+			"llvm.vector.reduce.mul";
+	case REDUCE_MIN_BUILTIN:
+		return is_float ? "llvm.vector.reduce.fmin" : is_signed ?
+			"llvm.vector.reduce.smin" : "llvm.vector.reduce.umin";
+	case REDUCE_MAX_BUILTIN:
+		return is_float ? "llvm.vector.reduce.fmax" : is_signed ?
+			"llvm.vector.reduce.smax" : "llvm.vector.reduce.umax";
+	case REDUCE_AND_BUILTIN:
+		return "llvm.vector.reduce.and";
+	case REDUCE_OR_BUILTIN:
+		return "llvm.vector.reduce.or";
+	case REDUCE_XOR_BUILTIN:
+		return "llvm.vector.reduce.xor";
+	default:
+		internal_error();
+	}
+}
+
+static LLVMValueRef emit_reduce_and(LLVMBuilderRef builder,
+		LLVMValueRef vector)
+{
+	LLVMTypeRef vector_type;
+
+	vector_type = LLVMTypeOf(vector);
+	return LLVMBuildCall(builder, get_intrinsic(builder,
+				"llvm.vector.reduce.and", &vector_type, 1),
+			&vector, 1, "reduce");
+}
+
+/*
+ * Float sums and products are reduced in lane order from a start value, so
+ * they round the same as a loop would.
+ */
+static LLVMValueRef emit_reduce(LLVMBuilderRef builder, struct expr *expr)
+{
+	LLVMValueRef vector, func, args[2];
+	LLVMTypeRef vector_type, lane_type;
+	enum builtin builtin;
+	const char *name;
+
+	builtin = expr->u.builtin.builtin;
+	vector = emit_expr(builder, vec_get(expr->u.builtin.args, 0));
+	vector_type = LLVMTypeOf(vector);
+	lane_type = get_llvm_type(expr->type);
+	name = get_reduce_intrinsic_name(builtin, expr->type);
+	func = get_intrinsic(builder, name, &vector_type, 1);
+	if (!is_float_type(expr->type) || (builtin != REDUCE_ADD_BUILTIN &&
+				builtin != REDUCE_MUL_BUILTIN)) {
+		return LLVMBuildCall(builder, func, &vector, 1, "reduce");
+	}
+	if (builtin == REDUCE_ADD_BUILTIN) {
+		args[0] = LLVMConstReal(lane_type, -0.0);
+	} else {
+		args[0] = LLVMConstReal(lane_type, 1.0);
+	}
+	args[1] = vector;
+	return LLVMBuildCall(builder, func, args, ARRAY_LEN(args), "reduce");
+}
+
+static unsigned get_lane_size(struct type *type)
+{
+	switch (type->kind) {
+	case U8_TYPE:
+	case I8_TYPE:
+		return 1;
+	case U16_TYPE:
+	case I16_TYPE:
+		return 2;
+	case U32_TYPE:
+	case I32_TYPE:
+	case F32_TYPE:
+		return 4;
+	case U64_TYPE:
+	case I64_TYPE:
+	case F64_TYPE:
+		return 8;
+	default:
+		internal_error();
+	}
+}
+
+/*
+ * Returns a pointer to the vector at `array[index]`. With `-fbounds-check`,
+ * traps unless the whole vector is in the array, or with a mask, unless each
+ * enabled lane is.
+ */
+static LLVMValueRef emit_vector_ptr(LLVMBuilderRef builder, struct expr *array,
+		struct expr *index, struct type *type, LLVMValueRef mask)
+{
+	LLVMValueRef len, ptr, llvm_index, lanes, rest, *iota, in_bounds;
+	struct type *index_type;
+	uint64_t vector_len, i;
+
+	vector_len = type->u.vector.len;
+	emit_array_parts(builder, array, &len, &ptr);
+	llvm_index = emit_index_val(builder, index);
+	if (options.bounds_check) {
+		rest = LLVMBuildSub(builder, len, llvm_index, "rest");
+	}
+	if (options.bounds_check && mask == NULL) {
+		// `len - index` can't wrap once `index <= len`
+		in_bounds = LLVMBuildICmp(builder, LLVMIntULE, llvm_index, len,
+				"index_ok");
+		lanes = LLVMConstInt(LLVMInt64Type(), vector_len, false);
+		in_bounds = LLVMBuildAnd(builder, in_bounds,
+				LLVMBuildICmp(builder, LLVMIntULE, lanes, rest,
+					"lanes_ok"), "in_bounds");
+		emit_bounds_check(builder, in_bounds);
+	} else if (options.bounds_check) {
+		/*
+		 * Lane `i` is in bounds if `index < len` and `i < len - index`,
+		 * which can't wrap then. Only enabled lanes are checked, so
+		 * `index` may be past the end if every lane is disabled.
+		 */
+		in_bounds = LLVMBuildICmp(builder, LLVMIntULT, llvm_index, len,
+				"index_ok");
+		index_type = get_vector_type(get_prim_type(U64_TYPE),
+				vector_len);
+		iota = xmalloc(vector_len * sizeof(LLVMValueRef));
+		for (i = 0; i < vector_len; i++) {
+			iota[i] = LLVMConstInt(LLVMInt64Type(), i, false);
+		}
+		lanes = LLVMBuildICmp(builder, LLVMIntULT,
+				LLVMConstVector(iota, vector_len),
+				emit_splat(builder, rest, index_type),
+				"lanes_ok");
+		free(iota);
+		lanes = LLVMBuildAnd(builder, lanes, emit_splat(builder,
+					in_bounds, get_vector_type(
+						get_prim_type(BOOL_TYPE),
+						vector_len)), "lanes_ok");
+		lanes = LLVMBuildOr(builder, lanes,
+				LLVMBuildNot(builder, mask, "disabled"),
+				"lanes_ok");
+		emit_bounds_check(builder, emit_reduce_and(builder, lanes));
+	}
+	// A masked access may point past the end, but only reads enabled lanes
+	if (mask == NULL) {
+		ptr = LLVMBuildInBoundsGEP(builder, ptr, &llvm_index, 1,
+				"elem_ptr");
+	} else {
+		ptr = LLVMBuildGEP(builder, ptr, &llvm_index, 1, "elem_ptr");
+	}
+	return LLVMBuildBitCast(builder, ptr,
+			LLVMPointerType(get_llvm_type(type), 0), "vector_ptr");
+}
+
+// Loads or stores a vector with an alignment of only its lanes
+static LLVMValueRef emit_vector_access(LLVMBuilderRef builder,
+		struct expr *expr)
+{
+	LLVMValueRef ptr, val, mask, func, args[4];
+	LLVMTypeRef types[2];
+	enum builtin builtin;
+	struct type *type;
+	unsigned align;
+	Vec *args_;
+
+	builtin = expr->u.builtin.builtin;
+	args_ = expr->u.builtin.args;
+	mask = NULL;
+	val = NULL;
+	if (builtin == LOAD_BUILTIN || builtin == MASKED_LOAD_BUILTIN) {
+		type = expr->type;
+	} else {
+		type = remove_const_and_volatile(
+				((struct expr *) vec_get(args_, 2))->type);
+		val = emit_expr(builder, vec_get(args_, 2));
+	}
+	if (builtin == MASKED_LOAD_BUILTIN) {
+		mask = emit_expr(builder, vec_get(args_, 2));
+	} else if (builtin == MASKED_STORE_BUILTIN) {
+		mask = emit_expr(builder, vec_get(args_, 3));
+	}
+	ptr = emit_vector_ptr(builder, vec_get(args_, 0), vec_get(args_, 1),
+			type, mask);
+	align = get_lane_size(type->u.vector.l);
+	types[0] = get_llvm_type(type);
+	types[1] = LLVMTypeOf(ptr);
+	switch (builtin) {
+	case LOAD_BUILTIN:
+		val = LLVMBuildLoad(builder, ptr, "vector");
+		LLVMSetAlignment(val, align);
+		return val;
+	case STORE_BUILTIN:
+		LLVMSetAlignment(LLVMBuildStore(builder, val, ptr), align);
+		return NULL;
+	case MASKED_LOAD_BUILTIN:
+		// Disabled lanes are zero
+		func = get_intrinsic(builder, "llvm.masked.load", types,
+				ARRAY_LEN(types));
+		args[0] = ptr;
+		args[1] = LLVMConstInt(LLVMInt32Type(), align, false);
+		args[2] = mask;
+		args[3] = LLVMConstNull(types[0]);
+		return LLVMBuildCall(builder, func, args, 4, "vector");
+	case MASKED_STORE_BUILTIN:
+		func = get_intrinsic(builder, "llvm.masked.store", types,
+				ARRAY_LEN(types));
+		args[0] = val;
+		args[1] = ptr;
+		args[2] = LLVMConstInt(LLVMInt32Type(), align, false);
+		args[3] = mask;
+		LLVMBuildCall(builder, func, args, 4, "");
+		return NULL;
+	default:
+		internal_error();
+	}
+}
+
+static LLVMValueRef emit_builtin_expr(LLVMBuilderRef builder,
+		struct expr *expr)
+{
+	struct expr *arg;
+
+	assert(expr->kind == BUILTIN_EXPR);
+	arg = vec_get(expr->u.builtin.args, 0);
+	if (builder == NULL && expr->u.builtin.builtin != SPLAT_BUILTIN) {
+		fatal_error(expr->lineno, "Only `@splat()` may be used in "
+		                          "a constant expression");
+	}
+	switch (expr->u.builtin.builtin) {
+	case SPLAT_BUILTIN:
+		if (builder == NULL) {
+			return emit_splat(NULL, emit_const_val(arg,
+						expr->type->u.vector.l),
+					expr->type);
+		}
+		return emit_splat(builder, emit_converted_expr(builder, arg,
+					expr->type->u.vector.l), expr->type);
+	case SHUFFLE_BUILTIN:
+		return emit_shuffle(builder, expr->u.builtin.args);
+	case REDUCE_ADD_BUILTIN:
+	case REDUCE_MUL_BUILTIN:
+	case REDUCE_MIN_BUILTIN:
+	case REDUCE_MAX_BUILTIN:
+	case REDUCE_AND_BUILTIN:
+	case REDUCE_OR_BUILTIN:
+	case REDUCE_XOR_BUILTIN:
+		return emit_reduce(builder, expr);
+	case LOAD_BUILTIN:
+	case STORE_BUILTIN:
+	case MASKED_LOAD_BUILTIN:
+	case MASKED_STORE_BUILTIN:
+		return emit_vector_access(builder, expr);
+	}
+	internal_error();
+}
+
+/*
+ * Emits `a[start..end]` as a slice pointing into `a`, so nothing is copied.
+ * With `-fbounds-check`, traps unless `start <= end <= a.len`.
+ */
+static LLVMValueRef emit_slice_expr(LLVMBuilderRef builder, struct expr *expr)
+{
+	LLVMValueRef len, ptr, start, end, in_bounds;
+	struct expr *start_expr, *end_expr;
+
+	assert(expr->kind == SLICE_EXPR);
+	start_expr = expr->u.slice.start;
+	end_expr = expr->u.slice.end;
+	emit_array_parts(builder, expr->u.slice.array, &len, &ptr);
+	if (start_expr == NULL) {
+		start = LLVMConstInt(LLVMInt64Type(), 0, false);
+	} else {
+		start = emit_index_val(builder, start_expr);
+	}
+	if (end_expr == NULL) {
+		end = len;
+	} else {
+		end = emit_index_val(builder, end_expr);
+	}
+	if (options.bounds_check) {
+		in_bounds = LLVMBuildAnd(builder,
+				LLVMBuildICmp(builder, LLVMIntULE, start, end,
+					"start_ok"),
+				LLVMBuildICmp(builder, LLVMIntULE, end, len,
+					"end_ok"), "in_bounds");
+		emit_bounds_check(builder, in_bounds);
+	}
+	ptr = LLVMBuildInBoundsGEP(builder, ptr, &start, 1, "slice.ptr");
+	len = LLVMBuildSub(builder, end, start, "slice.len");
+	return emit_slice_val(builder, expr->type, len, ptr);
+}
+
+// Only arrays have fields, and the only one is `len`
+static LLVMValueRef emit_field_access_expr(LLVMBuilderRef builder,
+		struct expr *expr)
+{
+	struct expr *array;
+	struct type *type;
+
+	assert(expr->kind == FIELD_ACCESS_EXPR);
+	array = expr->u.field_access.expr;
+	type = remove_const_and_volatile(array->type);
+	assert(type->kind == ARRAY_TYPE);
+	assert(strcmp(expr->u.field_access.field, "len") == 0);
+	if (type->u.array.len != 0) {
+		return LLVMConstInt(LLVMInt64Type(), type->u.array.len, false);
+	}
+	return LLVMBuildExtractValue(builder, emit_expr(builder, array), 0,
+			"len");
+}
+
+static LLVMValueRef emit_expr(LLVMBuilderRef builder, struct expr *expr)
+{
+	switch (expr->kind) {
+	case BOOL_LIT_EXPR: {
+		bool val = expr->u.bool_lit.val;
+
+		return LLVMConstInt(get_llvm_type(expr->type), val, false);
+	}
+	case INT_LIT_EXPR: {
+		uint64_t val = expr->u.int_lit.val;
+
+		return LLVMConstInt(get_llvm_type(expr->type), val, false);
+	}
+	case FLOAT_LIT_EXPR: {
+		double val = expr->u.float_lit.val;
+
+		return LLVMConstReal(get_llvm_type(expr->type), val);
+	}
+	case CHAR_LIT_EXPR: {
+		uint32_t val = expr->u.char_lit.val;
+
+		return LLVMConstInt(get_llvm_type(expr->type), val, false);
+	}
+	case STRING_LIT_EXPR:
+		return emit_string_lit_expr(expr);
+	case EMBED_EXPR:
+		return emit_embed_expr(expr);
+	case UNARY_OP_EXPR:
+		return emit_unary_op_expr(builder, expr);
+	case BIN_OP_EXPR:
+		return emit_bin_op_expr(builder, expr);
+	case LAMBDA_EXPR:
+		return emit_lambda_expr(builder, expr);
+	case ARRAY_LIT_EXPR:
+		return LLVMBuildLoad(builder, emit_array_lit_expr(builder,
+					expr, expr->type->u.array.l),
+				"array.val");
+	case IDENT_EXPR:
+		return emit_ident_expr(builder, expr);
+	case BLOCK_EXPR:
+		return emit_block_expr(builder, expr);
+	case SWITCH_EXPR:
+		return emit_switch_expr(builder, expr);
+	case IF_EXPR:
+	case TUPLE_EXPR:
+		return emit_tuple_expr(builder, expr, expr->type);
 	case FUNC_CALL_EXPR:
 		return emit_func_call_expr(builder, expr);
 	case FIELD_ACCESS_EXPR:
-		internal_error(); // TODO: Stub
+		return emit_field_access_expr(builder, expr);
 	case INDEX_EXPR:
 		return emit_index_expr(builder, expr);
+	case SLICE_EXPR:
+		return emit_slice_expr(builder, expr);
+	case BUILTIN_EXPR:
+		return emit_builtin_expr(builder, expr);
 	}
 	internal_error();
 }
@@ -839,30 +2173,59 @@ static LLVMValueRef emit_const_expr(struct expr *expr)
 	return emit_expr(NULL, expr);
 }
 
+/*
+ * Emits a global slice initialized by an array literal. The items go in a
+ * separate private global, which stays writable because a `var` slice copied
+ * from this one may be written through.
+ */
+static LLVMValueRef emit_const_slice(LLVMModuleRef module, struct expr *expr,
+		struct type *type)
+{
+	LLVMValueRef items;
+	struct type *item_type;
+	size_t len;
+
+	item_type = remove_const_and_volatile(type)->u.array.l;
+	len = vec_len(expr->u.array_lit.val);
+	items = LLVMAddGlobal(module, LLVMArrayType(get_llvm_type(item_type),
+				len), "slice.items");
+	LLVMSetInitializer(items, emit_const_val(expr, type));
+	LLVMSetLinkage(items, LLVMPrivateLinkage);
+	return get_const_slice(type, items, len);
+}
+
 static void emit_global_data_decl(LLVMModuleRef module, struct decl *decl)
 {
 	bool is_let;
-	LLVMTypeRef type;
+	LLVMTypeRef llvm_type;
 	char *name;
 	struct expr *init_expr;
+	struct type *type;
 	LLVMValueRef global, init;
-	bool is_signed_int;
 
 	assert(decl->kind == DATA_DECL);
 	is_let = decl->u.data.is_let;
-	type = get_llvm_type(decl->u.data.type);
+	type = decl->u.data.type;
+	llvm_type = get_llvm_type(type);
 	name = decl->u.data.name;
 	init_expr = decl->u.data.init;
-	is_signed_int = is_signed_int_type(decl->u.data.type);
 
-	global = LLVMAddGlobal(module, type, name);
-	init = emit_const_expr(init_expr);
-	if (init_expr->type->kind == UNSIZED_INT_TYPE) {
-		init = LLVMConstIntCast(init, type, is_signed_int);
+	global = LLVMAddGlobal(module, llvm_type, name);
+	if (is_slice_type(type) && init_expr->kind == ARRAY_LIT_EXPR) {
+		init = emit_const_slice(module, init_expr, type);
+	} else if (is_slice_type(type) && init_expr->kind == EMBED_EXPR &&
+			init_expr->u.embed.len != 0) {
+		init = get_const_slice(type, emit_embed_global(init_expr),
+				init_expr->u.embed.len);
+	} else {
+		init = emit_const_val(init_expr, type);
 	}
 	LLVMSetInitializer(global, init);
-	LLVMSetGlobalConstant(global, is_let);
-	insert_symbol(sym_tbl, name, alloc_sym_info(true, global));
+	if (is_let) {
+		LLVMSetGlobalConstant(global, true);
+		LLVMSetUnnamedAddress(global, LLVMGlobalUnnamedAddr);
+	}
+	set_symbol(decl->u.data.sym_id, true, global);
 }
 
 static void emit_local_data_decl(LLVMBuilderRef builder, struct decl *decl)
@@ -870,7 +2233,7 @@ static void emit_local_data_decl(LLVMBuilderRef builder, struct decl *decl)
 	LLVMTypeRef llvm_type;
 	LLVMValueRef local_ptr, llvm_init;
 	struct expr *init;
-	struct type *type;
+	struct type *type, *item_type;
 	char *name;
 
 	assert(decl->kind == DATA_DECL);
@@ -878,65 +2241,344 @@ static void emit_local_data_decl(LLVMBuilderRef builder, struct decl *decl)
 	name = decl->u.data.name;
 	init = decl->u.data.init;
 	llvm_type = get_llvm_type(type);
-	if (init == NULL) {
-		llvm_init = NULL;
+	if (init != NULL && init->kind == ARRAY_LIT_EXPR &&
+			remove_const_and_volatile(type)->kind == ARRAY_TYPE &&
+			!is_slice_type(type)) {
+		item_type = remove_const_and_volatile(type)->u.array.l;
+		if (decl->u.data.is_let && is_const_item(init)) {
+			// Nothing writes to it, so use the constant in place
+			local_ptr = emit_const_array_global(builder, init,
+					item_type);
+		} else {
+			// Array literals emit their own alloca'd pointer
+			local_ptr = emit_array_lit_expr(builder, init,
+					item_type);
+		}
 	} else {
-		llvm_init = emit_expr(builder, init);
+		// Allocate space for variable and store initializer
+		local_ptr = build_entry_alloca(llvm_type, name);
+		if (init != NULL) {
+			llvm_init = emit_converted_expr(builder, init, type);
+			LLVMBuildStore(builder, llvm_init, local_ptr);
+		}
+	}
+	set_symbol(decl->u.data.sym_id, true, local_ptr);
+}
+
+static bool block_has_terminator(LLVMBasicBlockRef block)
+{
+	return LLVMGetBasicBlockTerminator(block) != NULL;
+}
+
+static bool cur_block_has_terminator(LLVMBuilderRef builder)
+{
+	LLVMBasicBlockRef cur_block;
+
+	cur_block = LLVMGetInsertBlock(builder);
+	return block_has_terminator(cur_block);
+}
+
+// Emits a branch unless it would be unreachable
+static void maybe_emit_branch(LLVMBuilderRef builder,
+		LLVMBasicBlockRef target_block)
+{
+	if (!cur_block_has_terminator(builder)) {
+		LLVMBuildBr(builder, target_block);
+	}
+}
+
+static LLVMValueRef add_counter(LLVMBuilderRef builder)
+{
+	LLVMValueRef counter;
+	LLVMModuleRef module;
+
+	module = LLVMGetGlobalParent(get_cur_func(builder));
+	counter = LLVMAddGlobal(module, LLVMInt64Type(), "prof.counter");
+	LLVMSetLinkage(counter, LLVMInternalLinkage);
+	LLVMSetInitializer(counter, LLVMConstNull(LLVMInt64Type()));
+	vec_push(cur_func_counters, counter);
+	return counter;
+}
+
+static void emit_counter_inc(LLVMBuilderRef builder, LLVMValueRef counter)
+{
+	LLVMValueRef count;
+
+	count = LLVMBuildLoad(builder, counter, "count");
+	count = LLVMBuildAdd(builder, count,
+			LLVMConstInt(LLVMInt64Type(), 1, false), "count");
+	LLVMBuildStore(builder, count, counter);
+}
+
+/*
+ * Emits a conditional branch unless it would be unreachable. With
+ * `-fprofile-generate`, each branch gets a pair of counters for its two edges.
+ */
+static void maybe_emit_cond_branch(LLVMBuilderRef builder,
+		LLVMValueRef cond_val, LLVMBasicBlockRef then_block,
+		LLVMBasicBlockRef else_block)
+{
+	LLVMValueRef counter, branch;
+
+	if (cur_block_has_terminator(builder)) {
+		return;
 	}
-	// Allocate space for variable and store initializer
-	if (is_scalar_type(type) || init == NULL) {
-		local_ptr = LLVMBuildAlloca(builder, llvm_type, name);
-		if (init != NULL) {
-			LLVMBuildStore(builder, llvm_init, local_ptr);
+	if (options.profile_generate != NULL) {
+		counter = add_counter(builder);
+		counter = LLVMBuildSelect(builder, cond_val, counter,
+				add_counter(builder), "counter");
+		emit_counter_inc(builder, counter);
+	}
+	branch = LLVMBuildCondBr(builder, cond_val, then_block, else_block);
+	if (options.profile_use != NULL) {
+		vec_push(cur_func_branches, branch);
+	}
+}
+
+// Adds the values a pattern matches as cases of `switch_val`
+static void add_switch_cases(LLVMValueRef switch_val,
+		struct switch_pattern *pattern, struct type *ctrl_type,
+		LLVMBasicBlockRef block)
+{
+	Vec *patterns;
+	size_t i;
+
+	switch (pattern->kind) {
+	case UNDERSCORE_SWITCH_PATTERN:
+		break;
+	case OR_SWITCH_PATTERN:
+		patterns = pattern->u.or.patterns;
+		for (i = 0; i < vec_len(patterns); i++) {
+			add_switch_cases(switch_val, vec_get(patterns, i),
+					ctrl_type, block);
 		}
-	} else {
-		// Array initializers emit their own alloca'd pointer
-		local_ptr = llvm_init;
+		break;
+	case EXPR_SWITCH_PATTERN:
+		LLVMAddCase(switch_val, emit_const_val(pattern->u.expr.expr,
+					ctrl_type), block);
+		break;
+	case ARRAY_SWITCH_PATTERN:
+	case TUPLE_SWITCH_PATTERN:
+		internal_error();
 	}
-	insert_symbol(sym_tbl, name, alloc_sym_info(true, local_ptr));
 }
 
-static LLVMValueRef get_cur_func(LLVMBuilderRef builder)
+static bool matches_all(struct switch_pattern *pattern)
 {
-	return LLVMGetBasicBlockParent(LLVMGetInsertBlock(builder));
+	Vec *patterns;
+	size_t i;
+
+	if (pattern->kind == OR_SWITCH_PATTERN) {
+		patterns = pattern->u.or.patterns;
+		for (i = 0; i < vec_len(patterns); i++) {
+			if (matches_all(vec_get(patterns, i))) {
+				return true;
+			}
+		}
+	}
+	return pattern->kind == UNDERSCORE_SWITCH_PATTERN;
 }
 
-static LLVMBasicBlockRef append_basic_block(LLVMBuilderRef builder,
+static LLVMBasicBlockRef append_unreachable_block(LLVMBuilderRef builder,
 		const char *name)
 {
-	return LLVMAppendBasicBlock(get_cur_func(builder), name);
+	LLVMBasicBlockRef block;
+	LLVMBuilderRef block_builder;
+
+	block = append_basic_block(builder, name);
+	block_builder = LLVMCreateBuilder();
+	LLVMPositionBuilderAtEnd(block_builder, block);
+	LLVMBuildUnreachable(block_builder);
+	LLVMDisposeBuilder(block_builder);
+	return block;
 }
 
-static bool block_has_terminator(LLVMBasicBlockRef block)
+/*
+ * Matches the value with an LLVM `switch`, which the backend lowers to a jump
+ * table, bit tests or a binary search, depending on how dense the cases are.
+ * The default is unreachable if the cases cover every value.
+ */
+static void emit_switch_dispatch(LLVMBuilderRef builder, struct expr *expr,
+		LLVMBasicBlockRef *case_blocks)
 {
-	return LLVMGetBasicBlockTerminator(block) != NULL;
+	LLVMBasicBlockRef default_block;
+	LLVMValueRef ctrl_val, switch_val;
+	struct switch_case *case_;
+	struct expr *ctrl;
+	Vec *cases;
+	size_t i;
+
+	ctrl = expr->u.switch_.ctrl;
+	cases = expr->u.switch_.cases;
+	ctrl_val = emit_expr(builder, ctrl);
+	default_block = NULL;
+	for (i = 0; i < vec_len(cases); i++) {
+		case_ = vec_get(cases, i);
+		if (matches_all(case_->l)) {
+			default_block = case_blocks[i];
+		}
+	}
+	if (default_block == NULL) {
+		default_block = append_unreachable_block(builder,
+				"switch.default");
+	}
+	switch_val = LLVMBuildSwitch(builder, ctrl_val, default_block,
+			vec_len(cases));
+	for (i = 0; i < vec_len(cases); i++) {
+		case_ = vec_get(cases, i);
+		add_switch_cases(switch_val, case_->l, ctrl->type,
+				case_blocks[i]);
+	}
 }
 
-static bool cur_block_has_terminator(LLVMBuilderRef builder)
+/*
+ * Each test of the decision tree is a `switch` on one scalar of the value,
+ * which branches straight to the blocks of its children. Returns the block of
+ * the node, which is emitted once however many tests branch to it.
+ */
+static LLVMBasicBlockRef emit_match_node(LLVMBuilderRef builder,
+		struct match_tree *tree, struct match_node *node,
+		LLVMValueRef ctrl_val, LLVMBasicBlockRef *case_blocks,
+		LLVMBasicBlockRef *node_blocks)
 {
-	LLVMBasicBlockRef cur_block;
+	LLVMBasicBlockRef block, default_block, *blocks;
+	LLVMValueRef val, switch_val;
+	LLVMTypeRef llvm_type;
+	struct match_pos *pos;
+	size_t i;
 
-	cur_block = LLVMGetInsertBlock(builder);
-	return block_has_terminator(cur_block);
+	if (node->kind == MATCH_LEAF) {
+		return case_blocks[node->case_index];
+	}
+	if (node_blocks[node->index] != NULL) {
+		return node_blocks[node->index];
+	}
+	block = append_basic_block(builder, "match.test");
+	node_blocks[node->index] = block;
+	blocks = xmalloc(node->nvals * sizeof(LLVMBasicBlockRef));
+	for (i = 0; i < node->nvals; i++) {
+		blocks[i] = emit_match_node(builder, tree, node->children[i],
+				ctrl_val, case_blocks, node_blocks);
+	}
+	if (node->default_ != NULL) {
+		default_block = emit_match_node(builder, tree, node->default_,
+				ctrl_val, case_blocks, node_blocks);
+	} else {
+		default_block = append_unreachable_block(builder,
+				"match.default");
+	}
+	LLVMPositionBuilderAtEnd(builder, block);
+	pos = &tree->positions[node->pos];
+	val = ctrl_val;
+	for (i = 0; i < pos->depth; i++) {
+		val = LLVMBuildExtractValue(builder, val, pos->path[i],
+				"match.item");
+	}
+	switch_val = LLVMBuildSwitch(builder, val, default_block,
+			node->nvals);
+	llvm_type = get_llvm_type(pos->type);
+	for (i = 0; i < node->nvals; i++) {
+		LLVMAddCase(switch_val, LLVMConstInt(llvm_type, node->vals[i],
+					false), blocks[i]);
+	}
+	free(blocks);
+	return block;
 }
 
-// Emits a branch unless it would be unreachable
-static void maybe_emit_branch(LLVMBuilderRef builder,
-		LLVMBasicBlockRef target_block)
+// Without a value to match, the conditions are tested in order
+static void emit_switch_conds(LLVMBuilderRef builder, struct expr *expr,
+		LLVMBasicBlockRef *case_blocks)
 {
-	if (!cur_block_has_terminator(builder)) {
-		LLVMBuildBr(builder, target_block);
+	LLVMBasicBlockRef next_block;
+	struct switch_case *case_;
+	Vec *cases;
+	size_t i;
+
+	cases = expr->u.switch_.cases;
+	for (i = 0; i < vec_len(cases); i++) {
+		case_ = vec_get(cases, i);
+		if (case_->l->kind == UNDERSCORE_SWITCH_PATTERN) {
+			maybe_emit_branch(builder, case_blocks[i]);
+			return;
+		}
+		next_block = append_basic_block(builder, "switch.next");
+		maybe_emit_cond_branch(builder, emit_expr(builder,
+					case_->l->u.expr.expr),
+				case_blocks[i], next_block);
+		LLVMPositionBuilderAtEnd(builder, next_block);
 	}
+	// NOTREACHED, since the last case is `_`
+	internal_error();
 }
 
-// Emits a conditional branch unless it would be unreachable
-static void maybe_emit_cond_branch(LLVMBuilderRef builder,
-		LLVMValueRef cond_val, LLVMBasicBlockRef then_block,
-		LLVMBasicBlockRef else_block)
+static LLVMValueRef emit_switch_expr(LLVMBuilderRef builder,
+		struct expr *expr)
 {
-	if (!cur_block_has_terminator(builder)) {
-		LLVMBuildCondBr(builder, cond_val, then_block, else_block);
+	LLVMBasicBlockRef *case_blocks, *incoming_blocks, *node_blocks;
+	LLVMBasicBlockRef end_block, block, root_block;
+	LLVMValueRef *incoming_vals, val, phi, ctrl_val;
+	struct switch_case *case_;
+	bool is_void;
+	size_t i, nincoming;
+	Vec *cases;
+
+	assert(expr->kind == SWITCH_EXPR);
+	cases = expr->u.switch_.cases;
+	is_void = remove_const_and_volatile(expr->type)->kind == VOID_TYPE;
+	case_blocks = xmalloc(sizeof(LLVMBasicBlockRef) * vec_len(cases));
+	for (i = 0; i < vec_len(cases); i++) {
+		case_blocks[i] = append_basic_block(builder, "switch.case");
+	}
+	end_block = append_basic_block(builder, "switch.end");
+	if (expr->u.switch_.match != NULL) {
+		ctrl_val = emit_expr(builder, expr->u.switch_.ctrl);
+		block = LLVMGetInsertBlock(builder);
+		node_blocks = xcalloc(vec_len(expr->u.switch_.match->nodes) *
+				sizeof(LLVMBasicBlockRef));
+		root_block = emit_match_node(builder, expr->u.switch_.match,
+				expr->u.switch_.match->root, ctrl_val,
+				case_blocks, node_blocks);
+		LLVMPositionBuilderAtEnd(builder, block);
+		LLVMBuildBr(builder, root_block);
+		free(node_blocks);
+	} else if (expr->u.switch_.ctrl != NULL) {
+		emit_switch_dispatch(builder, expr, case_blocks);
+	} else {
+		emit_switch_conds(builder, expr, case_blocks);
+	}
+	incoming_vals = xmalloc(sizeof(LLVMValueRef) * vec_len(cases));
+	incoming_blocks = xmalloc(sizeof(LLVMBasicBlockRef) * vec_len(cases));
+	nincoming = 0;
+	for (i = 0; i < vec_len(cases); i++) {
+		case_ = vec_get(cases, i);
+		LLVMPositionBuilderAtEnd(builder, case_blocks[i]);
+		if (is_void) {
+			emit_expr(builder, case_->r);
+		} else {
+			val = emit_converted_expr(builder, case_->r,
+					expr->type);
+			// The case may have left the function, as by `return`
+			if (!cur_block_has_terminator(builder)) {
+				incoming_vals[nincoming] = val;
+				incoming_blocks[nincoming] =
+					LLVMGetInsertBlock(builder);
+				nincoming++;
+			}
+		}
+		maybe_emit_branch(builder, end_block);
 	}
+	LLVMPositionBuilderAtEnd(builder, end_block);
+	phi = NULL;
+	if (!is_void) {
+		phi = LLVMBuildPhi(builder, get_llvm_type(expr->type),
+				"switch.val");
+		LLVMAddIncoming(phi, incoming_vals, incoming_blocks,
+				nincoming);
+	}
+	free(case_blocks);
+	free(incoming_vals);
+	free(incoming_blocks);
+	return phi;
 }
 
 static void emit_if_stmt(LLVMBuilderRef builder, struct stmt *stmt,
@@ -971,9 +2613,149 @@ static void emit_if_stmt(LLVMBuilderRef builder, struct stmt *stmt,
 	LLVMPositionBuilderAtEnd(builder, merge_block);
 }
 
+/*
+ * Returns the location of a loop for LLVM's diagnostics about its hints. Its
+ * compile unit emits no debug info, and its subprogram is not attached to the
+ * function, so only loop IDs refer to them.
+ */
+static LLVMMetadataRef get_loop_loc(LLVMBuilderRef builder, unsigned lineno)
+{
+	const char *filename, *func_name;
+	size_t func_name_len;
+
+	if (di_builder == NULL) {
+		di_builder = LLVMCreateDIBuilder(cur_module);
+		filename = get_filename();
+		di_file = LLVMDIBuilderCreateFile(di_builder, filename,
+				strlen(filename), "", 0);
+		LLVMDIBuilderCreateCompileUnit(di_builder,
+				LLVMDWARFSourceLanguageC99, di_file,
+				"quoftc", 6, options.opt_level > 0, "", 0, 0,
+				"", 0, LLVMDWARFEmissionNone, 0, false, false,
+				"", 0, "", 0);
+		LLVMAddModuleFlag(cur_module, LLVMModuleFlagBehaviorWarning,
+				"Debug Info Version", 18,
+				md_int(LLVMInt32Type(),
+					LLVMDebugMetadataVersion()));
+	}
+	if (cur_func_di_scope == NULL) {
+		func_name = LLVMGetValueName2(get_cur_func(builder),
+				&func_name_len);
+		cur_func_di_scope = LLVMDIBuilderCreateFunction(di_builder,
+				di_file, func_name, func_name_len, "", 0,
+				di_file, 0, LLVMDIBuilderCreateSubroutineType(
+					di_builder, di_file, NULL, 0,
+					LLVMDIFlagZero),
+				false, true, 0, LLVMDIFlagZero, true);
+	}
+	return LLVMDIBuilderCreateDebugLocation(LLVMGetGlobalContext(),
+			lineno, 0, cur_func_di_scope, NULL);
+}
+
+static LLVMMetadataRef loop_prop(const char *name)
+{
+	return md_node((LLVMMetadataRef[]) {md_string(name)}, 1);
+}
+
+static LLVMMetadataRef loop_int_prop(const char *name, LLVMTypeRef type,
+		uint64_t n)
+{
+	return md_node((LLVMMetadataRef[]) {md_string(name), md_int(type, n)},
+			2);
+}
+
+// A loop ID is a node whose first operand is itself
+static LLVMMetadataRef get_loop_id(LLVMBuilderRef builder,
+		struct loop_hints *hints, unsigned lineno)
+{
+	LLVMMetadataRef mds[5], loop_id;
+	size_t len;
+
+	len = 0;
+	mds[len++] = LLVMTemporaryMDNode(LLVMGetGlobalContext(), NULL, 0);
+	mds[len++] = get_loop_loc(builder, lineno);
+	switch (hints->vectorize) {
+	case DEFAULT_HINT:
+		break;
+	case ENABLE_HINT:
+		mds[len++] = loop_int_prop("llvm.loop.vectorize.enable",
+				LLVMInt1Type(), true);
+		if (hints->vectorize_width != 0) {
+			mds[len++] = loop_int_prop("llvm.loop.vectorize.width",
+					LLVMInt32Type(),
+					hints->vectorize_width);
+		}
+		break;
+	case DISABLE_HINT:
+		mds[len++] = loop_int_prop("llvm.loop.vectorize.width",
+				LLVMInt32Type(), 1);
+		break;
+	}
+	switch (hints->unroll) {
+	case DEFAULT_HINT:
+		break;
+	case ENABLE_HINT:
+		if (hints->unroll_count != 0) {
+			mds[len++] = loop_int_prop("llvm.loop.unroll.count",
+					LLVMInt32Type(), hints->unroll_count);
+		} else {
+			mds[len++] = loop_prop("llvm.loop.unroll.enable");
+		}
+		break;
+	case DISABLE_HINT:
+		mds[len++] = loop_prop("llvm.loop.unroll.disable");
+		break;
+	}
+	loop_id = md_node(mds, len);
+	LLVMMetadataReplaceAllUsesWith(mds[0], loop_id);
+	return loop_id;
+}
+
+/*
+ * Attaches `llvm.loop` metadata for `hints` to the latches of a loop, which
+ * are the branches to `header` from anywhere but `preheader`.
+ */
+static void emit_loop_hints(LLVMBuilderRef builder, struct loop_hints *hints,
+		unsigned lineno, LLVMBasicBlockRef header,
+		LLVMBasicBlockRef preheader)
+{
+	LLVMValueRef loop_id, branch;
+	LLVMUseRef use;
+
+	if (hints->vectorize == DEFAULT_HINT && hints->unroll == DEFAULT_HINT) {
+		return;
+	}
+	if (options.opt_level == 0) {
+		warn(lineno, "Loop hints have no effect without optimization");
+	}
+	loop_id = LLVMMetadataAsValue(LLVMGetGlobalContext(),
+			get_loop_id(builder, hints, lineno));
+	for (use = LLVMGetFirstUse(LLVMBasicBlockAsValue(header));
+			use != NULL; use = LLVMGetNextUse(use)) {
+		branch = LLVMGetUser(use);
+		if (LLVMGetInstructionParent(branch) != preheader) {
+			LLVMSetMetadata(branch, LLVMGetMDKindID("llvm.loop", 9),
+					loop_id);
+		}
+	}
+}
+
+// Deferred statements from outside the loop don't run on `break` or `continue`
+static void emit_loop_body(LLVMBuilderRef builder, Vec *stmts,
+		LLVMBasicBlockRef after_loop_block,
+		LLVMBasicBlockRef cond_loop_block)
+{
+	size_t old_first_defer;
+
+	old_first_defer = cur_loop_first_defer;
+	cur_loop_first_defer = vec_len(cur_func_defers);
+	emit_compound_stmt(builder, stmts, after_loop_block, cond_loop_block);
+	cur_loop_first_defer = old_first_defer;
+}
+
 static void emit_do_stmt(LLVMBuilderRef builder, struct stmt *stmt)
 {
-	LLVMBasicBlockRef do_block, cond_block, cont_block;
+	LLVMBasicBlockRef entry_block, do_block, cond_block, cont_block;
 	LLVMValueRef cond_val;
 	struct expr *cond;
 	Vec *stmts;
@@ -984,21 +2766,22 @@ static void emit_do_stmt(LLVMBuilderRef builder, struct stmt *stmt)
 	do_block = append_basic_block(builder, "do.start");
 	cond_block = append_basic_block(builder, "do.cond");
 	cont_block = append_basic_block(builder, "do.end");
+	entry_block = LLVMGetInsertBlock(builder);
 	maybe_emit_branch(builder, do_block);
 	LLVMPositionBuilderAtEnd(builder, do_block);
-	enter_new_scope(sym_tbl);
-	emit_compound_stmt(builder, stmts, cont_block, cond_block);
+	emit_loop_body(builder, stmts, cont_block, cond_block);
 	maybe_emit_branch(builder, cond_block);
 	LLVMPositionBuilderAtEnd(builder, cond_block);
 	cond_val = emit_expr(builder, cond);
 	maybe_emit_cond_branch(builder, cond_val, do_block, cont_block);
-	leave_scope(sym_tbl);
+	emit_loop_hints(builder, &stmt->u.do_.hints, stmt->lineno, do_block,
+			entry_block);
 	LLVMPositionBuilderAtEnd(builder, cont_block);
 }
 
 static void emit_while_stmt(LLVMBuilderRef builder, struct stmt *stmt)
 {
-	LLVMBasicBlockRef cond_block, while_block, cont_block;
+	LLVMBasicBlockRef entry_block, cond_block, while_block, cont_block;
 	LLVMValueRef cond_val;
 	struct expr *cond;
 	Vec *stmts;
@@ -1009,15 +2792,16 @@ static void emit_while_stmt(LLVMBuilderRef builder, struct stmt *stmt)
 	cond_block = append_basic_block(builder, "while.cond");
 	while_block = append_basic_block(builder, "while.start");
 	cont_block = append_basic_block(builder, "while.end");
+	entry_block = LLVMGetInsertBlock(builder);
 	maybe_emit_branch(builder, cond_block);
 	LLVMPositionBuilderAtEnd(builder, cond_block);
 	cond_val = emit_expr(builder, cond);
 	maybe_emit_cond_branch(builder, cond_val, while_block, cont_block);
 	LLVMPositionBuilderAtEnd(builder, while_block);
-	enter_new_scope(sym_tbl);
-	emit_compound_stmt(builder, stmts, cont_block, cond_block);
-	leave_scope(sym_tbl);
+	emit_loop_body(builder, stmts, cont_block, cond_block);
 	maybe_emit_branch(builder, cond_block);
+	emit_loop_hints(builder, &stmt->u.while_.hints, stmt->lineno,
+			cond_block, entry_block);
 	LLVMPositionBuilderAtEnd(builder, cont_block);
 }
 
@@ -1047,21 +2831,96 @@ static void emit_for_stmt(LLVMBuilderRef builder, struct stmt *stmt)
 	cond_val = emit_expr(builder, cond);
 	maybe_emit_cond_branch(builder, cond_val, for_block, cont_block);
 	LLVMPositionBuilderAtEnd(builder, for_block);
-	enter_new_scope(sym_tbl);
-	emit_compound_stmt(builder, stmts, cont_block, post_block);
-	leave_scope(sym_tbl);
+	emit_loop_body(builder, stmts, cont_block, post_block);
 	maybe_emit_branch(builder, post_block);
 	LLVMPositionBuilderAtEnd(builder, post_block);
 	emit_expr(builder, post);
 	maybe_emit_branch(builder, cond_block);
+	emit_loop_hints(builder, &stmt->u.for_.hints, stmt->lineno, cond_block,
+			init_block);
 	LLVMPositionBuilderAtEnd(builder, cont_block);
 }
 
+static void emit_stmt(LLVMBuilderRef, struct stmt *, LLVMBasicBlockRef,
+		LLVMBasicBlockRef);
+
+/*
+ * Emits the deferred statements pending since the `first`, innermost first.
+ * Each exit from a scope gets its own copy, so nothing is tracked at runtime.
+ */
+static void emit_deferred_stmts(LLVMBuilderRef builder, size_t first)
+{
+	size_t i;
+
+	for (i = vec_len(cur_func_defers); i-- > first;) {
+		if (cur_block_has_terminator(builder)) {
+			return;
+		}
+		emit_stmt(builder, vec_get(cur_func_defers, i), NULL, NULL);
+	}
+}
+
+/*
+ * A tail call stores the new arguments in the parameters of the function it
+ * calls and jumps to the start of its body. Only the bodies of the current
+ * function and the others in its `become` group are in the current LLVM
+ * function (see emit_become_group()). A specialized copy jumps back to its own
+ * body, since the parameters it binds are passed through unchanged (see
+ * get_func_spec()).
+ */
+static void emit_tail_call(LLVMBuilderRef builder, struct expr *expr)
+{
+	LLVMBasicBlockRef target_block;
+	LLVMValueRef *arg_vals;
+	struct decl *target;
+	struct expr *func;
+	Vec *args, *params;
+	size_t i, nargs, param_sym_id;
+
+	func = expr->u.func_call.func;
+	assert(func->kind == IDENT_EXPR);
+	target = cur_func_decl;
+	while (target->u.func.sym_id != func->u.ident.sym_id) {
+		target = target->u.func.become_next;
+		if (target == NULL || target == cur_func_decl) {
+			fatal_error(expr->lineno, "Function called with "
+			            "`become` must be defined in the same file");
+		}
+	}
+	target_block = target == cur_func_decl ? cur_func_body_block :
+		syms[target->u.func.sym_id].become_block;
+	args = expr->u.func_call.args;
+	params = func->type->u.func.params;
+	nargs = vec_len(args);
+	// All arguments are evaluated before any parameter changes
+	arg_vals = xmalloc(sizeof(LLVMValueRef) * nargs);
+	for (i = 0; i < nargs; i++) {
+		arg_vals[i] = emit_converted_expr(builder, vec_get(args, i),
+				vec_get(params, i));
+	}
+	param_sym_id = target->u.func.param_sym_id;
+	for (i = 0; i < nargs; i++) {
+		if (syms[param_sym_id + i].const_val == NULL) {
+			LLVMBuildStore(builder, arg_vals[i],
+					syms[param_sym_id + i].val);
+		}
+	}
+	free(arg_vals);
+	LLVMBuildBr(builder, target_block);
+}
+
 static void emit_return_stmt(LLVMBuilderRef builder, struct stmt *stmt)
 {
+	LLVMBasicBlockRef after_return_block;
 	struct expr *expr;
 
 	expr = stmt->u.return_.expr;
+	if (stmt->u.return_.is_tail && !cur_block_has_terminator(builder)) {
+		emit_tail_call(builder, expr);
+		after_return_block = append_basic_block(builder, "become.end");
+		LLVMPositionBuilderAtEnd(builder, after_return_block);
+		return;
+	}
 	if (expr != NULL) {
 		/*
 		 * The value in `cur_func_return_val_ptr` will be returned in a
@@ -1070,9 +2929,11 @@ static void emit_return_stmt(LLVMBuilderRef builder, struct stmt *stmt)
 		 *
 		 * TODO: Check this again
 		 */
-		LLVMBuildStore(builder, emit_expr(builder, expr),
+		LLVMBuildStore(builder, emit_converted_expr(builder, expr,
+					cur_func_return_type),
 				cur_func_return_val_ptr);
 	}
+	emit_deferred_stmts(builder, 0);
 	maybe_emit_branch(builder, cur_func_return_block);
 }
 
@@ -1083,6 +2944,7 @@ static void emit_break_stmt(LLVMBuilderRef builder, struct stmt *stmt,
 
 	assert(stmt->kind == BREAK_STMT);
 	assert(after_loop_block != NULL);
+	emit_deferred_stmts(builder, cur_loop_first_defer);
 	maybe_emit_branch(builder, after_loop_block);
 	after_break_block = append_basic_block(builder, "break.end");
 	LLVMPositionBuilderAtEnd(builder, after_break_block);
@@ -1095,6 +2957,7 @@ static void emit_continue_stmt(LLVMBuilderRef builder, struct stmt *stmt,
 
 	assert(stmt->kind == CONTINUE_STMT);
 	assert(cond_loop_block != NULL);
+	emit_deferred_stmts(builder, cur_loop_first_defer);
 	maybe_emit_branch(builder, cond_loop_block);
 	after_continue_block = append_basic_block(builder, "continue.end");
 	LLVMPositionBuilderAtEnd(builder, after_continue_block);
@@ -1132,6 +2995,9 @@ static void emit_stmt(LLVMBuilderRef builder, struct stmt *stmt,
 	case CONTINUE_STMT:
 		emit_continue_stmt(builder, stmt, cond_loop_block);
 		break;
+	case DEFER_STMT:
+		vec_push(cur_func_defers, stmt->u.defer.stmt);
+		break;
 	}
 }
 
@@ -1139,71 +3005,649 @@ static void emit_compound_stmt(LLVMBuilderRef builder, Vec *stmts,
 		LLVMBasicBlockRef after_loop_block,
 		LLVMBasicBlockRef cond_loop_block)
 {
-	size_t i;
+	size_t i, first_defer;
 
+	first_defer = vec_len(cur_func_defers);
 	for (i = 0; i < vec_len(stmts); i++) {
 		emit_stmt(builder, vec_get(stmts, i), after_loop_block,
 				cond_loop_block);
 	}
+	emit_deferred_stmts(builder, first_defer);
+	while (vec_len(cur_func_defers) > first_defer) {
+		vec_pop(cur_func_defers);
+	}
+}
+
+static unsigned get_prof_md_kind(void)
+{
+	return LLVMGetMDKindID("prof", 4);
+}
+
+static void add_func_attr(LLVMValueRef func, const char *name)
+{
+	LLVMAttributeRef attr;
+	unsigned kind;
+
+	kind = LLVMGetEnumAttributeKindForName(name, strlen(name));
+	assert(kind != 0);
+	attr = LLVMCreateEnumAttribute(LLVMGetGlobalContext(), kind, 0);
+	LLVMAddAttributeAtIndex(func, LLVMAttributeFunctionIndex, attr);
+}
+
+static void add_param_attr(LLVMValueRef func, unsigned i, const char *name,
+		uint64_t val)
+{
+	LLVMAttributeRef attr;
+	unsigned kind;
+
+	kind = LLVMGetEnumAttributeKindForName(name, strlen(name));
+	assert(kind != 0);
+	attr = LLVMCreateEnumAttribute(LLVMGetGlobalContext(), kind, val);
+	LLVMAddAttributeAtIndex(func, i + 1, attr);
+}
+
+/*
+ * Describes pointer parameters to LLVM. Whether they are read, written or
+ * escape is known only for definitions (see effects.c).
+ */
+static void add_param_attrs(LLVMValueRef func, struct decl *decl)
+{
+	struct type *param_type;
+	unsigned *effects;
+	Vec *param_types;
+	unsigned i;
+
+	param_types = decl->u.func.type->u.func.params;
+	effects = decl->u.func.param_effects;
+	for (i = 0; i < vec_len(param_types); i++) {
+		param_type = vec_get(param_types, i);
+		if (remove_const_and_volatile(param_type)->kind !=
+				POINTER_TYPE) {
+			continue;
+		}
+		if (param_type->kind == RESTRICT_TYPE) {
+			add_param_attr(func, i, "noalias", 0);
+		}
+		if (effects == NULL || (effects[i] & PARAM_ESCAPES)) {
+			continue;
+		}
+		add_param_attr(func, i, "nocapture", 0);
+		if (!(effects[i] & (READS_PARAM | WRITES_PARAM))) {
+			add_param_attr(func, i, "readnone", 0);
+		} else if (!(effects[i] & WRITES_PARAM)) {
+			add_param_attr(func, i, "readonly", 0);
+		}
+	}
+}
+
+// Maps annotations like `@noinline` to their LLVM attributes
+static void add_annotated_attrs(LLVMValueRef func, struct decl *decl)
+{
+	unsigned attrs;
+
+	attrs = decl->u.func.attrs;
+	if (attrs & INLINE_ATTR) {
+		add_func_attr(func, "inlinehint");
+	}
+	if (attrs & ALWAYS_INLINE_ATTR) {
+		add_func_attr(func, "alwaysinline");
+	}
+	if (attrs & NOINLINE_ATTR) {
+		add_func_attr(func, "noinline");
+	}
+	if (attrs & HOT_ATTR) {
+		add_func_attr(func, "hot");
+	}
+	if (attrs & COLD_ATTR) {
+		add_func_attr(func, "cold");
+	}
+}
+
+// Describes what calling a defined function may do (see effects.c)
+static void add_func_attrs(LLVMValueRef func, struct decl *decl)
+{
+	unsigned effects;
+
+	effects = decl->u.func.func_effects;
+	if (options.profile_generate != NULL) {
+		effects |= READS_MEMORY | WRITES_MEMORY; // Of the counters
+	}
+	// Nothing can unwind, since there are no exceptions
+	add_func_attr(func, "nounwind");
+	if (!(effects & (READS_MEMORY | WRITES_MEMORY))) {
+		add_func_attr(func, "readnone");
+	} else if (!(effects & WRITES_MEMORY)) {
+		add_func_attr(func, "readonly");
+	}
+	if (!(effects & MAY_SYNC)) {
+		add_func_attr(func, "nosync");
+	}
+	if (!(effects & MAY_NOT_RETURN)) {
+		add_func_attr(func, "willreturn");
+	}
+}
+
+// Branch weights are 32-bit, so large counts are scaled down
+static void set_branch_weights(LLVMValueRef branch, uint64_t taken,
+		uint64_t not_taken)
+{
+	LLVMMetadataRef mds[3];
+	uint64_t scale;
+
+	scale = (taken > not_taken ? taken : not_taken) / UINT32_MAX + 1;
+	mds[0] = md_string("branch_weights");
+	mds[1] = md_int(LLVMInt32Type(), taken / scale + 1);
+	mds[2] = md_int(LLVMInt32Type(), not_taken / scale + 1);
+	LLVMSetMetadata(branch, get_prof_md_kind(), LLVMMetadataAsValue(
+				LLVMGetGlobalContext(), md_node(mds, 3)));
+}
+
+// Attaches the entry count and branch weights from `-fprofile-use`
+static void apply_func_profile(LLVMValueRef func_val, struct decl *decl)
+{
+	struct func_profile *prof;
+	LLVMMetadataRef mds[2];
+	char *func_name;
+	size_t i;
+
+	func_name = decl->u.func.name;
+	prof = get_func_profile(func_name);
+	if (prof == NULL) {
+		return;
+	}
+	if (prof->ncounts != 1 + 2 * vec_len(cur_func_branches)) {
+		warn(decl->lineno, "Profile of `%s` is out of date and was "
+				"ignored", func_name);
+		return;
+	}
+	mds[0] = md_string("function_entry_count");
+	mds[1] = md_int(LLVMInt64Type(), prof->counts[0]);
+	LLVMGlobalSetMetadata(func_val, get_prof_md_kind(), md_node(mds, 2));
+	if (prof->counts[0] == 0 && !(decl->u.func.attrs & HOT_ATTR)) {
+		add_func_attr(func_val, "cold");
+	}
+	for (i = 0; i < vec_len(cur_func_branches); i++) {
+		set_branch_weights(vec_get(cur_func_branches, i),
+				prof->counts[1 + 2 * i],
+				prof->counts[2 + 2 * i]);
+	}
+}
+
+static void add_func_counters(const char *func_name, Vec *counters)
+{
+	struct func_counters *func_counters;
+
+	func_counters = NEW(struct func_counters);
+	func_counters->func_name = func_name;
+	func_counters->counters = counters;
+	vec_push(module_counters, func_counters);
+}
+
+static void free_func_counters(void *p)
+{
+	struct func_counters *func_counters = p;
+
+	free_vec(func_counters->counters);
+	free(func_counters);
+}
+
+// Moves the return block last and returns the stored value from it
+static void emit_return_block(LLVMBuilderRef builder, LLVMValueRef func_val)
+{
+	LLVMBasicBlockRef last_block;
+	LLVMValueRef return_val;
+
+	last_block = LLVMGetLastBasicBlock(func_val);
+	maybe_emit_branch(builder, cur_func_return_block);
+	LLVMMoveBasicBlockAfter(cur_func_return_block, last_block);
+	LLVMPositionBuilderAtEnd(builder, cur_func_return_block);
+	if (cur_func_return_type->kind == VOID_TYPE) {
+		LLVMBuildRetVoid(builder);
+	} else {
+		return_val = LLVMBuildLoad(builder, cur_func_return_val_ptr,
+				"return_val");
+		LLVMBuildRet(builder, return_val);
+	}
+}
+
+/*
+ * Emits the body of a lambda as an internal function. Its captures are
+ * read through the environment it is passed first.
+ */
+static LLVMValueRef emit_lambda_func(struct expr *expr, LLVMTypeRef env_type)
+{
+	LLVMValueRef func_val, env_val, ptr_val, indices[2];
+	LLVMBuilderRef builder;
+	struct symbol_info *saved_syms;
+	struct expr *capture, *body;
+	struct type *type, *param_type;
+	Vec *captures;
+	size_t i, id;
+
+	type = expr->type;
+	captures = expr->u.lambda.captures;
+	body = expr->u.lambda.body;
+	func_val = LLVMAddFunction(cur_module, "lambda",
+			get_llvm_func_type(type, true, expr->lineno));
+	LLVMSetLinkage(func_val, LLVMInternalLinkage);
+	cur_func_decl = NULL;
+	cur_func_const_args = NULL;
+	cur_func_return_block = LLVMAppendBasicBlock(func_val, "return");
+	cur_func_return_type = type->u.func.ret;
+	cur_func_trap_block = NULL;
+	cur_func_di_scope = NULL;
+	cur_func_defers = alloc_vec(NULL);
+	cur_loop_first_defer = 0;
+	builder = LLVMCreateBuilder();
+	cur_func_entry_block = LLVMAppendBasicBlock(func_val, "entry");
+	LLVMPositionBuilderAtEnd(builder, cur_func_entry_block);
+
+	env_val = LLVMBuildBitCast(builder, LLVMGetParam(func_val, 0),
+			LLVMPointerType(env_type, 0), "env");
+	saved_syms = xmalloc(sizeof(*saved_syms) * vec_len(captures));
+	indices[0] = LLVMConstInt(LLVMInt32Type(), 0, false);
+	for (i = 0; i < vec_len(captures); i++) {
+		capture = vec_get(captures, i);
+		saved_syms[i] = *get_symbol(capture);
+		indices[1] = LLVMConstInt(LLVMInt32Type(), i, false);
+		ptr_val = LLVMBuildInBoundsGEP(builder, env_val, indices,
+				ARRAY_LEN(indices), "capture_ptr");
+		set_symbol(capture->u.ident.sym_id, true, ptr_val);
+	}
+	for (i = 0; i < vec_len(type->u.func.params); i++) {
+		param_type = vec_get(type->u.func.params, i);
+		ptr_val = LLVMBuildAlloca(builder, get_llvm_type(param_type),
+				"param_ptr");
+		LLVMBuildStore(builder, LLVMGetParam(func_val, i + 1),
+				ptr_val);
+		set_symbol(expr->u.lambda.param_sym_id + i, true, ptr_val);
+	}
+	if (cur_func_return_type->kind != VOID_TYPE) {
+		cur_func_return_val_ptr = LLVMBuildAlloca(builder,
+				get_llvm_type(cur_func_return_type),
+				"return_val_ptr");
+	}
+	cur_func_body_block = LLVMAppendBasicBlock(func_val, "body");
+	LLVMBuildBr(builder, cur_func_body_block);
+	LLVMPositionBuilderAtEnd(builder, cur_func_body_block);
+	if (body->kind == BLOCK_EXPR) {
+		emit_compound_stmt(builder, body->u.block.stmts, NULL, NULL);
+	} else if (cur_func_return_type->kind == VOID_TYPE) {
+		emit_expr(builder, body);
+	} else {
+		LLVMBuildStore(builder, emit_converted_expr(builder, body,
+					cur_func_return_type),
+				cur_func_return_val_ptr);
+	}
+	emit_return_block(builder, func_val);
+
+	for (i = 0; i < vec_len(captures); i++) {
+		id = ((struct expr *) vec_get(captures, i))->u.ident.sym_id;
+		syms[id] = saved_syms[i];
+	}
+	free(saved_syms);
+	free_vec(cur_func_defers);
+	LLVMDisposeBuilder(builder);
+	return func_val;
+}
+
+/*
+ * A lambda is a closure over an environment holding copies of its captures.
+ * The environment is on the stack, which the checker ensures outlives it.
+ */
+static LLVMValueRef emit_lambda_expr(LLVMBuilderRef builder, struct expr *expr)
+{
+	LLVMBasicBlockRef saved_entry_block, saved_body_block;
+	LLVMBasicBlockRef saved_return_block, saved_trap_block;
+	LLVMValueRef saved_return_val_ptr, func_val, closure_val, env_val;
+	LLVMValueRef ptr_val, indices[2], *saved_const_args;
+	LLVMTypeRef env_type, *capture_types;
+	struct type *saved_return_type;
+	struct decl *saved_func_decl;
+	LLVMMetadataRef saved_di_scope;
+	Vec *saved_defers, *captures;
+	size_t saved_loop_first_defer, ncaptures, i;
+
+	assert(expr->kind == LAMBDA_EXPR);
+	captures = expr->u.lambda.captures;
+	ncaptures = vec_len(captures);
+	capture_types = xmalloc(sizeof(LLVMTypeRef) * (ncaptures + 1));
+	for (i = 0; i < ncaptures; i++) {
+		capture_types[i] = get_llvm_type(((struct expr *)
+					vec_get(captures, i))->type);
+	}
+	env_type = LLVMStructType(capture_types, ncaptures, false);
+	free(capture_types);
+
+	saved_func_decl = cur_func_decl;
+	saved_const_args = cur_func_const_args;
+	saved_entry_block = cur_func_entry_block;
+	saved_body_block = cur_func_body_block;
+	saved_return_block = cur_func_return_block;
+	saved_trap_block = cur_func_trap_block;
+	saved_return_val_ptr = cur_func_return_val_ptr;
+	saved_return_type = cur_func_return_type;
+	saved_defers = cur_func_defers;
+	saved_loop_first_defer = cur_loop_first_defer;
+	saved_di_scope = cur_func_di_scope;
+	func_val = emit_lambda_func(expr, env_type);
+	cur_func_decl = saved_func_decl;
+	cur_func_const_args = saved_const_args;
+	cur_func_entry_block = saved_entry_block;
+	cur_func_body_block = saved_body_block;
+	cur_func_return_block = saved_return_block;
+	cur_func_trap_block = saved_trap_block;
+	cur_func_return_val_ptr = saved_return_val_ptr;
+	cur_func_return_type = saved_return_type;
+	cur_func_defers = saved_defers;
+	cur_loop_first_defer = saved_loop_first_defer;
+	cur_func_di_scope = saved_di_scope;
+
+	closure_val = get_closure_val(func_val);
+	if (ncaptures == 0) {
+		return closure_val;
+	}
+	env_val = build_entry_alloca(env_type, "env");
+	indices[0] = LLVMConstInt(LLVMInt32Type(), 0, false);
+	for (i = 0; i < ncaptures; i++) {
+		indices[1] = LLVMConstInt(LLVMInt32Type(), i, false);
+		ptr_val = LLVMBuildInBoundsGEP(builder, env_val, indices,
+				ARRAY_LEN(indices), "capture_ptr");
+		LLVMBuildStore(builder, emit_ident_expr(builder,
+					vec_get(captures, i)), ptr_val);
+	}
+	env_val = LLVMBuildBitCast(builder, env_val,
+			LLVMPointerType(LLVMInt8Type(), 0), "env");
+	return LLVMBuildInsertValue(builder, closure_val, env_val, 1,
+			"closure");
 }
 
-// TODO: Add comments and maybe split this
-static void emit_func_decl(LLVMModuleRef module, struct decl *decl)
+/*
+ * Emits the body of `decl` into `func_val`. Function parameters with a
+ * constant in `const_args` are bound to it instead of the passed value.
+ */
+static void emit_func_body(LLVMValueRef func_val, struct decl *decl,
+		LLVMValueRef *const_args)
 {
-	LLVMTypeRef func_type, llvm_param_type;
-	LLVMValueRef func_val, param_val, param_ptr_val, return_val;
-	LLVMBasicBlockRef entry_block, last_block;
+	LLVMValueRef param_val, param_ptr_val;
 	LLVMBuilderRef builder;
 	struct type *return_type, *param_type;
-	Vec *param_types, *param_names, *body_stmts;
-	char *func_name, *param_name;
-	size_t i;
+	Vec *param_types;
+	size_t i, param_sym_id;
 
-	assert(decl->kind == FUNC_DECL);
-	func_type = get_llvm_type(decl->u.func.type);
-	func_name = decl->u.func.name;
-	param_names = decl->u.func.param_names;
-	body_stmts = decl->u.func.body_stmts;
-	assert(decl->u.func.type->kind == FUNC_TYPE);
 	return_type = decl->u.func.type->u.func.ret;
 	param_types = decl->u.func.type->u.func.params;
-
-	func_val = LLVMAddFunction(module, func_name, func_type);
-	insert_symbol(sym_tbl, func_name, alloc_sym_info(false, func_val));
+	param_sym_id = decl->u.func.param_sym_id;
+	add_func_attrs(func_val, decl);
+	cur_func_decl = decl;
+	cur_func_const_args = const_args;
 	cur_func_return_block = LLVMAppendBasicBlock(func_val, "return");
+	cur_func_return_type = return_type;
+	cur_func_trap_block = NULL;
+	cur_func_di_scope = NULL;
+	cur_func_defers = alloc_vec(NULL);
+	cur_loop_first_defer = 0;
 	builder = LLVMCreateBuilder();
-	entry_block = LLVMAppendBasicBlock(func_val, "entry");
-	LLVMPositionBuilderAtEnd(builder, entry_block);
-	enter_new_scope(sym_tbl);
-	for (i = 0; i < vec_len(param_names); i++) {
+	cur_func_entry_block = LLVMAppendBasicBlock(func_val, "entry");
+	LLVMPositionBuilderAtEnd(builder, cur_func_entry_block);
+	if (options.profile_generate != NULL) {
+		cur_func_counters = alloc_vec(NULL);
+		emit_counter_inc(builder, add_counter(builder));
+	}
+	if (options.profile_use != NULL) {
+		cur_func_branches = alloc_vec(NULL);
+	}
+	for (i = 0; i < vec_len(param_types); i++) {
 		param_type = vec_get(param_types, i);
-		llvm_param_type = get_llvm_type(param_type);
-		param_name = vec_get(param_names, i);
-		param_ptr_val = LLVMBuildAlloca(builder, llvm_param_type,
-				"param_ptr");
+		param_ptr_val = LLVMBuildAlloca(builder,
+				get_llvm_type(param_type), "param_ptr");
 		param_val = LLVMGetParam(func_val, i);
+		if (const_args != NULL && const_args[i] != NULL) {
+			param_val = const_args[i];
+		}
 		LLVMBuildStore(builder, param_val, param_ptr_val);
-		insert_symbol(sym_tbl, param_name,
-				alloc_sym_info(true, param_ptr_val));
+		set_symbol(param_sym_id + i, true, param_ptr_val);
+		if (const_args != NULL) {
+			syms[param_sym_id + i].const_val = const_args[i];
+		}
 	}
 	if (return_type->kind != VOID_TYPE) {
 		cur_func_return_val_ptr = LLVMBuildAlloca(builder,
 				get_llvm_type(return_type), "return_val_ptr");
 	}
-	emit_compound_stmt(builder, body_stmts, NULL, NULL);
-	last_block = LLVMGetLastBasicBlock(func_val);
+	cur_func_body_block = LLVMAppendBasicBlock(func_val, "body");
+	LLVMBuildBr(builder, cur_func_body_block);
+	LLVMPositionBuilderAtEnd(builder, cur_func_body_block);
+	emit_compound_stmt(builder, decl->u.func.body_stmts, NULL, NULL);
+	emit_return_block(builder, func_val);
+	if (options.profile_generate != NULL) {
+		add_func_counters(decl->u.func.name, cur_func_counters);
+	}
+	if (options.profile_use != NULL) {
+		apply_func_profile(func_val, decl);
+		free_vec(cur_func_branches);
+	}
+	free_vec(cur_func_defers);
+	LLVMDisposeBuilder(builder);
+}
+
+// Emits the bodies of copies asked for so far, which may ask for more
+static void emit_func_specs(void)
+{
+	struct func_spec *spec;
+
+	while (nfunc_specs_emitted < vec_len(func_specs)) {
+		spec = vec_get(func_specs, nfunc_specs_emitted++);
+		emit_func_body(spec->func, spec->decl, spec->const_args);
+	}
+}
+
+// Emits the body of a function of a `become` group into the group's function
+static void emit_group_member(LLVMBuilderRef builder, struct decl *decl)
+{
+	size_t id;
+
+	id = decl->u.func.sym_id;
+	cur_func_decl = decl;
+	cur_func_defers = alloc_vec(NULL);
+	cur_loop_first_defer = 0;
+	LLVMPositionBuilderAtEnd(builder, syms[id].become_block);
+	if (options.profile_generate != NULL) {
+		cur_func_counters = alloc_vec(NULL);
+		emit_counter_inc(builder, add_counter(builder));
+	}
+	if (options.profile_use != NULL) {
+		cur_func_branches = alloc_vec(NULL);
+	}
+	cur_func_body_block = append_basic_block(builder, "body");
+	LLVMBuildBr(builder, cur_func_body_block);
+	LLVMPositionBuilderAtEnd(builder, cur_func_body_block);
+	emit_compound_stmt(builder, decl->u.func.body_stmts, NULL, NULL);
 	maybe_emit_branch(builder, cur_func_return_block);
-	LLVMMoveBasicBlockAfter(cur_func_return_block, last_block);
-	LLVMPositionBuilderAtEnd(builder, cur_func_return_block);
-	if (return_type->kind == VOID_TYPE) {
+	if (options.profile_generate != NULL) {
+		add_func_counters(decl->u.func.name, cur_func_counters);
+	}
+	if (options.profile_use != NULL) {
+		apply_func_profile(syms[id].val, decl);
+		free_vec(cur_func_branches);
+	}
+	free_vec(cur_func_defers);
+}
+
+// Emits a function of a `become` group as a call of the group's function
+static void emit_group_entry(LLVMValueRef group_val, struct decl *decl,
+		unsigned index)
+{
+	LLVMValueRef func_val, call_val, *arg_vals;
+	LLVMBuilderRef builder;
+	unsigned nparams, i;
+
+	func_val = syms[decl->u.func.sym_id].val;
+	add_func_attrs(func_val, decl);
+	builder = LLVMCreateBuilder();
+	LLVMPositionBuilderAtEnd(builder, LLVMAppendBasicBlock(func_val,
+				"entry"));
+	nparams = LLVMCountParams(func_val);
+	arg_vals = xmalloc(sizeof(LLVMValueRef) * (nparams + 1));
+	arg_vals[0] = LLVMConstInt(LLVMInt32Type(), index, false);
+	for (i = 0; i < nparams; i++) {
+		arg_vals[i + 1] = LLVMGetParam(func_val, i);
+	}
+	call_val = LLVMBuildCall(builder, group_val, arg_vals, nparams + 1,
+			"");
+	free(arg_vals);
+	if (decl->u.func.type->u.func.ret->kind == VOID_TYPE) {
 		LLVMBuildRetVoid(builder);
 	} else {
-		return_val = LLVMBuildLoad(builder, cur_func_return_val_ptr,
-				"return_val");
-		LLVMBuildRet(builder, return_val);
+		LLVMBuildRet(builder, call_val);
+	}
+	LLVMDisposeBuilder(builder);
+}
+
+/*
+ * Functions that call each other with `become` have their bodies emitted into
+ * one internal function, so that a `become` of any of them is a jump like one
+ * of the current function. `become` needs the caller's signature, so they all
+ * take the same parameters. The group's function takes the index of the body
+ * to start in first, and each function of the group just calls it.
+ */
+static void emit_become_group(LLVMModuleRef module, struct decl *first)
+{
+	LLVMBasicBlockRef default_block, enter_block;
+	LLVMTypeRef func_type, *param_types;
+	LLVMValueRef group_val, switch_val;
+	LLVMBuilderRef builder;
+	struct decl *decl;
+	char *group_name;
+	unsigned nparams, nmembers, i, j;
+	size_t param_sym_id;
+
+	func_type = LLVMGlobalGetValueType(syms[first->u.func.sym_id].val);
+	nparams = LLVMCountParamTypes(func_type);
+	param_types = xmalloc(sizeof(LLVMTypeRef) * (nparams + 1));
+	param_types[0] = LLVMInt32Type();
+	LLVMGetParamTypes(func_type, param_types + 1);
+	group_name = xmalloc(strlen(first->u.func.name) + sizeof(".group"));
+	sprintf(group_name, "%s.group", first->u.func.name);
+	group_val = LLVMAddFunction(module, group_name, LLVMFunctionType(
+				LLVMGetReturnType(func_type), param_types,
+				nparams + 1, false));
+	free(group_name);
+	LLVMSetLinkage(group_val, LLVMInternalLinkage);
+	add_func_attr(group_val, "nounwind");
+
+	cur_func_const_args = NULL;
+	cur_func_return_block = LLVMAppendBasicBlock(group_val, "return");
+	cur_func_return_type = first->u.func.type->u.func.ret;
+	cur_func_trap_block = NULL;
+	cur_func_di_scope = NULL;
+	builder = LLVMCreateBuilder();
+	cur_func_entry_block = LLVMAppendBasicBlock(group_val, "entry");
+	LLVMPositionBuilderAtEnd(builder, cur_func_entry_block);
+	if (cur_func_return_type->kind != VOID_TYPE) {
+		cur_func_return_val_ptr = LLVMBuildAlloca(builder,
+				get_llvm_type(cur_func_return_type),
+				"return_val_ptr");
+	}
+	// Any body may jump to any other, so all their parameters come first
+	nmembers = 0;
+	decl = first;
+	do {
+		param_sym_id = decl->u.func.param_sym_id;
+		for (i = 0; i < nparams; i++) {
+			set_symbol(param_sym_id + i, true, LLVMBuildAlloca(
+						builder, param_types[i + 1],
+						"param_ptr"));
+		}
+		syms[decl->u.func.sym_id].become_block =
+			LLVMAppendBasicBlock(group_val, "start");
+		nmembers++;
+		decl = decl->u.func.become_next;
+	} while (decl != first);
+	free(param_types);
+	default_block = LLVMAppendBasicBlock(group_val, "dispatch.default");
+	switch_val = LLVMBuildSwitch(builder, LLVMGetParam(group_val, 0),
+			default_block, nmembers);
+	LLVMPositionBuilderAtEnd(builder, default_block);
+	LLVMBuildUnreachable(builder);
+	decl = first;
+	for (i = 0; i < nmembers; i++) {
+		enter_block = LLVMAppendBasicBlock(group_val, "enter");
+		LLVMAddCase(switch_val, LLVMConstInt(LLVMInt32Type(), i, false),
+				enter_block);
+		LLVMPositionBuilderAtEnd(builder, enter_block);
+		param_sym_id = decl->u.func.param_sym_id;
+		for (j = 0; j < nparams; j++) {
+			LLVMBuildStore(builder, LLVMGetParam(group_val, j + 1),
+					syms[param_sym_id + j].val);
+		}
+		LLVMBuildBr(builder, syms[decl->u.func.sym_id].become_block);
+		decl = decl->u.func.become_next;
 	}
+	for (i = 0; i < nmembers; i++) {
+		emit_group_member(builder, decl);
+		decl = decl->u.func.become_next;
+	}
+	emit_return_block(builder, group_val);
 	LLVMDisposeBuilder(builder);
-	leave_scope(sym_tbl);
+	for (i = 0; i < nmembers; i++) {
+		emit_group_entry(group_val, decl, i);
+		decl = decl->u.func.become_next;
+	}
+}
+
+// Whether the definitions of every function in the group of `decl` are reached
+static bool is_group_defined(struct decl *decl)
+{
+	struct decl *p;
+	size_t id;
+
+	p = decl;
+	do {
+		id = p->u.func.sym_id;
+		if (id >= nsyms || !syms[id].is_defined) {
+			return false;
+		}
+		p = p->u.func.become_next;
+	} while (p != decl);
+	return true;
+}
+
+static void emit_func_decl(LLVMModuleRef module, struct decl *decl)
+{
+	LLVMValueRef func_val;
+	char *func_name;
+
+	assert(decl->kind == FUNC_DECL);
+	assert(decl->u.func.type->kind == FUNC_TYPE);
+	func_name = decl->u.func.name;
+	func_val = LLVMGetNamedFunction(module, func_name);
+	if (func_val == NULL) {
+		func_val = LLVMAddFunction(module, func_name,
+				get_llvm_func_type(decl->u.func.type, false,
+					decl->lineno));
+		set_symbol(decl->u.func.sym_id, false, func_val);
+	}
+	add_param_attrs(func_val, decl);
+	add_annotated_attrs(func_val, decl);
+	if (decl->u.func.body_stmts == NULL) {
+		return;
+	}
+	/*
+	 * A group is emitted at its last definition, after the functions that
+	 * any of its bodies call are declared
+	 */
+	if (decl->u.func.become_next != NULL) {
+		syms[decl->u.func.sym_id].is_defined = true;
+		if (is_group_defined(decl)) {
+			emit_become_group(module, decl);
+			emit_func_specs();
+		}
+		return;
+	}
+	emit_func_body(func_val, decl, NULL);
+	syms[decl->u.func.sym_id].func_decl = decl;
+	emit_func_specs();
 }
 
 static void emit_global_decl(LLVMModuleRef module, struct decl *decl)
@@ -1220,48 +3664,85 @@ static void emit_global_decl(LLVMModuleRef module, struct decl *decl)
 	}
 }
 
-static LLVMModuleRef emit_ast(struct ast ast)
+static NORETURN void llvm_error(const char *errmsg)
 {
-	LLVMModuleRef module;
-	Vec *decls = ast.decls;
-	size_t i;
+	fprintf(stderr, "%s: LLVM error:\n%s\n", argv0, errmsg);
+	exit(EXIT_FAILURE);
+}
 
-	sym_tbl = alloc_symbol_table();
-	enter_new_scope(sym_tbl); // Global scope
-	module = LLVMModuleCreateWithName(get_filename());
-	for (i = 0; i < vec_len(decls); i++) {
-		emit_global_decl(module, vec_get(decls, i));
+// Returns the message after a `file:line:column: ` prefix, or NULL if none
+static char *skip_diag_loc(char *desc, int *file_len, unsigned *lineno)
+{
+	char *p, *col;
+	size_t line_len, col_len;
+
+	for (p = strchr(desc, ':'); p != NULL; p = strchr(p + 1, ':')) {
+		line_len = strspn(p + 1, "0123456789");
+		col = p + 1 + line_len;
+		if (line_len == 0 || *col != ':') {
+			continue;
+		}
+		col_len = strspn(col + 1, "0123456789");
+		if (col_len > 0 && strncmp(col + 1 + col_len, ": ", 2) == 0) {
+			*file_len = p - desc;
+			*lineno = strtoul(p + 1, NULL, 10);
+			return col + 1 + col_len + 2;
+		}
 	}
-	free_symbol_table(sym_tbl);
-	return module;
+	return NULL;
 }
 
-static NORETURN void llvm_error(const char *errmsg)
+// Reports LLVM's warnings, such as about loop hints it could not honor
+static void handle_llvm_diagnostic(LLVMDiagnosticInfoRef info, void *unused)
 {
-	fprintf(stderr, "%s: LLVM error:\n%s\n", argv0, errmsg);
-	exit(EXIT_FAILURE);
+	char *desc, *msg;
+	int file_len;
+	unsigned lineno;
+
+	(void) unused;
+	desc = LLVMGetDiagInfoDescription(info);
+	switch (LLVMGetDiagInfoSeverity(info)) {
+	case LLVMDSError:
+		llvm_error(desc);
+	case LLVMDSWarning:
+		msg = skip_diag_loc(desc, &file_len, &lineno);
+		if (msg == NULL) {
+			fprintf(stderr, "%s: warning: %s\n", argv0, desc);
+		} else if (lineno == 0) {
+			fprintf(stderr, "%s: warning: %s\n", argv0, msg);
+		} else {
+			fprintf(stderr, "%.*s:%u: warning: %s\n", file_len,
+					desc, lineno, msg);
+		}
+		break;
+	case LLVMDSRemark:
+	case LLVMDSNote:
+		break;
+	}
+	LLVMDisposeMessage(desc);
 }
 
-static void compile_module(char *target_file, LLVMModuleRef module)
+// Indexed by code generation level, and shared by every module
+static LLVMTargetMachineRef target_machines[LLVMCodeGenLevelAggressive + 1];
+
+static LLVMTargetMachineRef create_target_machine(LLVMCodeGenOptLevel level)
 {
+	static bool are_targets_initialized;
+	LLVMTargetMachineRef target_machine;
 	char *target_triplet;
 	const char *cpu, *features;
 	LLVMTargetRef target;
 	bool failed;
 	char *errmsg;
-	LLVMTargetMachineRef target_machine;
-#if 0
-	LLVMTargetDataRef data_layout;
-#endif
-#if 0
-	LLVMDumpModule(module);
-#endif
-	LLVMVerifyModule(module, LLVMAbortProcessAction, NULL);
-	LLVMInitializeAllTargetInfos();
-	LLVMInitializeAllTargets();
-	LLVMInitializeAllTargetMCs();
-	LLVMInitializeAllAsmParsers();
-	LLVMInitializeAllAsmPrinters();
+
+	if (!are_targets_initialized) {
+		LLVMInitializeAllTargetInfos();
+		LLVMInitializeAllTargets();
+		LLVMInitializeAllTargetMCs();
+		LLVMInitializeAllAsmParsers();
+		LLVMInitializeAllAsmPrinters();
+		are_targets_initialized = true;
+	}
 	target_triplet = LLVMGetDefaultTargetTriple();
 	failed = LLVMGetTargetFromTriple(target_triplet, &target, &errmsg);
 	if (failed) {
@@ -1270,28 +3751,427 @@ static void compile_module(char *target_file, LLVMModuleRef module)
 	cpu = "generic";
 	features = "";
 	target_machine = LLVMCreateTargetMachine(target, target_triplet, cpu,
-			features, LLVMCodeGenLevelDefault, LLVMRelocDefault,
-			LLVMCodeModelDefault);
-#if 0
-TODO: Add data layout to module
-	data_layout = LLVMCreateDataLayout(target_machine);
-	LLVMSetDataLayout(module, data_layout);
-#endif
+			features, level, LLVMRelocPIC, LLVMCodeModelDefault);
+	LLVMDisposeMessage(target_triplet);
+	return target_machine;
+}
+
+static LLVMCodeGenOptLevel get_code_gen_level(void)
+{
+	if (options.opt_level >= 3) {
+		return LLVMCodeGenLevelAggressive;
+	} else {
+		return LLVMCodeGenLevelDefault;
+	}
+}
+
+static LLVMTargetMachineRef get_target_machine_at(LLVMCodeGenOptLevel level)
+{
+	if (target_machines[level] == NULL) {
+		target_machines[level] = create_target_machine(level);
+	}
+	return target_machines[level];
+}
+
+static LLVMTargetMachineRef get_target_machine(void)
+{
+	return get_target_machine_at(get_code_gen_level());
+}
+
+// Creates the target machine of every `-O` level ahead of time
+void init_code_gen(void)
+{
+	get_target_machine_at(LLVMCodeGenLevelDefault);
+	get_target_machine_at(LLVMCodeGenLevelAggressive);
+}
+
+static void set_module_target(LLVMModuleRef module)
+{
+	LLVMTargetMachineRef target_machine;
+	LLVMTargetDataRef data_layout;
+	char *target_triplet;
+
+	target_machine = get_target_machine();
+	target_triplet = LLVMGetTargetMachineTriple(target_machine);
 	LLVMSetTarget(module, target_triplet);
-	failed = LLVMTargetMachineEmitToFile(target_machine, module,
-			target_file, LLVMObjectFile, &errmsg);
+	LLVMDisposeMessage(target_triplet);
+	data_layout = LLVMCreateTargetDataLayout(target_machine);
+	LLVMSetModuleDataLayout(module, data_layout);
+	LLVMDisposeTargetData(data_layout);
+}
+
+// Emits a line of the profile for each instrumented function
+static void emit_profile_dump(LLVMBuilderRef builder, LLVMModuleRef module,
+		LLVMValueRef fp)
+{
+	struct func_counters *func_counters;
+	LLVMTypeRef fprintf_type, params[2];
+	LLVMValueRef fprintf_func, *args;
+	size_t i, j, ncounters;
+	char *fmt;
+
+	params[0] = LLVMPointerType(LLVMInt8Type(), 0);
+	params[1] = params[0];
+	fprintf_type = LLVMFunctionType(LLVMInt32Type(), params, 2, true);
+	fprintf_func = get_or_add_func(module, "fprintf", fprintf_type);
+	for (i = 0; i < vec_len(module_counters); i++) {
+		func_counters = vec_get(module_counters, i);
+		ncounters = vec_len(func_counters->counters);
+		fmt = xmalloc(strlen(func_counters->func_name) + 32 +
+				ncounters * 5);
+		sprintf(fmt, "%s %zu", func_counters->func_name, ncounters);
+		args = xmalloc(sizeof(LLVMValueRef) * (ncounters + 2));
+		args[0] = fp;
+		for (j = 0; j < ncounters; j++) {
+			strcat(fmt, " %llu");
+			args[j + 2] = LLVMBuildLoad(builder,
+					vec_get(func_counters->counters, j),
+					"count");
+		}
+		strcat(fmt, "\n");
+		args[1] = LLVMBuildGlobalStringPtr(builder, fmt, "prof.fmt");
+		LLVMBuildCall(builder, fprintf_func, args, ncounters + 2, "");
+		free(args);
+		free(fmt);
+	}
+}
+
+/*
+ * Emits the runtime of `-fprofile-generate`. A constructor registers a
+ * function with `atexit()` that appends the counters to the profile.
+ */
+static void emit_profile_runtime(LLVMModuleRef module)
+{
+	LLVMTypeRef void_func_type, ptr_type, params[2], ctor_fields[3],
+		    ctor_type;
+	LLVMValueRef dump_func, init_func, fp, args[2], ctor_vals[3], ctor,
+		     ctors;
+	LLVMBasicBlockRef entry_block, write_block, return_block;
+	LLVMBuilderRef builder;
+
+	ptr_type = LLVMPointerType(LLVMInt8Type(), 0);
+	void_func_type = LLVMFunctionType(LLVMVoidType(), NULL, 0, false);
+	dump_func = LLVMAddFunction(module, "prof.dump", void_func_type);
+	LLVMSetLinkage(dump_func, LLVMInternalLinkage);
+	builder = LLVMCreateBuilder();
+	entry_block = LLVMAppendBasicBlock(dump_func, "entry");
+	write_block = LLVMAppendBasicBlock(dump_func, "write");
+	return_block = LLVMAppendBasicBlock(dump_func, "return");
+	LLVMPositionBuilderAtEnd(builder, entry_block);
+	params[0] = ptr_type;
+	params[1] = ptr_type;
+	args[0] = LLVMBuildGlobalStringPtr(builder, options.profile_generate,
+			"prof.path");
+	args[1] = LLVMBuildGlobalStringPtr(builder, "a", "prof.mode");
+	fp = LLVMBuildCall(builder, get_or_add_func(module, "fopen",
+				LLVMFunctionType(ptr_type, params, 2, false)),
+			args, 2, "fp");
+	LLVMBuildCondBr(builder, LLVMBuildIsNull(builder, fp, "failed"),
+			return_block, write_block);
+	LLVMPositionBuilderAtEnd(builder, write_block);
+	emit_profile_dump(builder, module, fp);
+	LLVMBuildCall(builder, get_or_add_func(module, "fclose",
+				LLVMFunctionType(LLVMInt32Type(), params, 1,
+					false)),
+			&fp, 1, "");
+	LLVMBuildBr(builder, return_block);
+	LLVMPositionBuilderAtEnd(builder, return_block);
+	LLVMBuildRetVoid(builder);
+
+	init_func = LLVMAddFunction(module, "prof.init", void_func_type);
+	LLVMSetLinkage(init_func, LLVMInternalLinkage);
+	LLVMPositionBuilderAtEnd(builder, LLVMAppendBasicBlock(init_func,
+				"entry"));
+	params[0] = LLVMPointerType(void_func_type, 0);
+	LLVMBuildCall(builder, get_or_add_func(module, "atexit",
+				LLVMFunctionType(LLVMInt32Type(), params, 1,
+					false)),
+			&dump_func, 1, "");
+	LLVMBuildRetVoid(builder);
+	LLVMDisposeBuilder(builder);
+
+	ctor_fields[0] = LLVMInt32Type();
+	ctor_fields[1] = params[0];
+	ctor_fields[2] = ptr_type;
+	ctor_type = LLVMStructType(ctor_fields, 3, false);
+	ctor_vals[0] = LLVMConstInt(LLVMInt32Type(), 65535, false);
+	ctor_vals[1] = init_func;
+	ctor_vals[2] = LLVMConstNull(ptr_type);
+	ctor = LLVMConstStruct(ctor_vals, 3, false);
+	ctors = LLVMAddGlobal(module, LLVMArrayType(ctor_type, 1),
+			"llvm.global_ctors");
+	LLVMSetLinkage(ctors, LLVMAppendingLinkage);
+	LLVMSetInitializer(ctors, LLVMConstArray(ctor_type, &ctor, 1));
+}
+
+// Lets LLVM tell hot code from cold code with `-fprofile-use`
+static void add_profile_summary(LLVMModuleRef module)
+{
+	struct profile_summary summary;
+	LLVMMetadataRef fields[8], pair[2], cutoffs[NUM_PROFILE_CUTOFFS],
+			cutoff[3];
+	static const char *const names[] = {
+		"TotalCount", "MaxCount", "MaxInternalCount",
+		"MaxFunctionCount", "NumCounts", "NumFunctions"
+	};
+	uint64_t vals[ARRAY_LEN(names)];
+	size_t i;
+
+	summary = get_profile_summary();
+	vals[0] = summary.total_count;
+	vals[1] = summary.max_count;
+	vals[2] = summary.max_internal_count;
+	vals[3] = summary.max_function_count;
+	vals[4] = summary.ncounts;
+	vals[5] = summary.nfuncs;
+	pair[0] = md_string("ProfileFormat");
+	pair[1] = md_string("InstrProf");
+	fields[0] = md_node(pair, 2);
+	for (i = 0; i < ARRAY_LEN(names); i++) {
+		pair[0] = md_string(names[i]);
+		pair[1] = md_int(LLVMInt64Type(), vals[i]);
+		fields[i + 1] = md_node(pair, 2);
+	}
+	for (i = 0; i < NUM_PROFILE_CUTOFFS; i++) {
+		cutoff[0] = md_int(LLVMInt32Type(),
+				summary.cutoffs[i].cutoff);
+		cutoff[1] = md_int(LLVMInt64Type(),
+				summary.cutoffs[i].min_count);
+		cutoff[2] = md_int(LLVMInt32Type(),
+				summary.cutoffs[i].ncounts);
+		cutoffs[i] = md_node(cutoff, 3);
+	}
+	pair[0] = md_string("DetailedSummary");
+	pair[1] = md_node(cutoffs, NUM_PROFILE_CUTOFFS);
+	fields[7] = md_node(pair, 2);
+	LLVMAddModuleFlag(module, LLVMModuleFlagBehaviorError,
+			"ProfileSummary", 14, md_node(fields, 8));
+}
+
+static LLVMModuleRef emit_ast(struct ast ast)
+{
+	LLVMModuleRef module;
+	Vec *decls = ast.decls;
+	size_t i;
+
+	module = LLVMModuleCreateWithName(get_filename());
+	set_module_target(module);
+	cur_module = module;
+	string_pool = alloc_hash_table();
+	embed_pool = alloc_hash_table();
+	func_specs = alloc_vec(free_func_spec);
+	nfunc_specs_emitted = 0;
+	module_counters = alloc_vec(free_func_counters);
+	for (i = 0; i < vec_len(decls); i++) {
+		emit_global_decl(module, vec_get(decls, i));
+	}
+	if (options.profile_generate != NULL) {
+		emit_profile_runtime(module);
+	}
+	if (options.profile_use != NULL) {
+		add_profile_summary(module);
+	}
+	if (di_builder != NULL) {
+		LLVMDIBuilderFinalize(di_builder);
+		LLVMDisposeDIBuilder(di_builder);
+		di_builder = NULL;
+	}
+	free_vec(module_counters);
+	free_vec(func_specs);
+	free_hash_table(embed_pool);
+	free_hash_table(string_pool);
+	free(syms);
+	syms = NULL;
+	nsyms = 0;
+	return module;
+}
+
+// Whether `val` is named in the comma-separated `-fexport` list
+static bool is_exported_symbol(LLVMValueRef val)
+{
+	const char *name, *sym, *end;
+	size_t len;
+
+	name = LLVMGetValueName2(val, &len);
+	for (sym = options.lto_exports; ; sym = end + 1) {
+		end = strchr(sym, ',');
+		if (end == NULL) {
+			end = sym + strlen(sym);
+		}
+		if ((size_t) (end - sym) == len &&
+				strncmp(sym, name, len) == 0) {
+			return true;
+		}
+		if (*end == '\0') {
+			return false;
+		}
+	}
+}
+
+static void internalize_value(LLVMValueRef val)
+{
+	if (!LLVMIsDeclaration(val) &&
+			LLVMGetLinkage(val) == LLVMExternalLinkage &&
+			!is_exported_symbol(val)) {
+		LLVMSetLinkage(val, LLVMInternalLinkage);
+	}
+}
+
+/*
+ * Gives every definition of the linked program that is not exported internal
+ * linkage, so that the LTO pipeline can drop the ones left unused
+ */
+static void internalize_module(LLVMModuleRef module)
+{
+	LLVMValueRef val;
+
+	for (val = LLVMGetFirstFunction(module); val != NULL;
+			val = LLVMGetNextFunction(val)) {
+		internalize_value(val);
+	}
+	for (val = LLVMGetFirstGlobal(module); val != NULL;
+			val = LLVMGetNextGlobal(val)) {
+		internalize_value(val);
+	}
+}
+
+/*
+ * Runs the standard optimization pipeline for the selected `-O` level. After
+ * linking, the LTO pipeline is used instead so that the merged module is
+ * optimized as a whole. Without optimization, only `@always_inline` functions
+ * are inlined.
+ */
+static void optimize_module(LLVMModuleRef module, bool is_linked)
+{
+	LLVMPassBuilderOptionsRef pass_opts;
+	LLVMErrorRef err;
+	char pipeline[32];
+
+	// Without an sym list, any external definition may be linked to
+	if (is_linked && options.lto_exports != NULL) {
+		internalize_module(module);
+	}
+	if (options.opt_level == 0) {
+		strcpy(pipeline, "always-inline");
+	} else {
+		sprintf(pipeline, "%s<O%u>", is_linked ? "lto" : "default",
+				options.opt_level);
+	}
+	LLVMContextSetDiagnosticHandler(LLVMGetGlobalContext(),
+			handle_llvm_diagnostic, NULL);
+	pass_opts = LLVMCreatePassBuilderOptions();
+	err = LLVMRunPasses(module, pipeline, get_target_machine(),
+			pass_opts);
+	LLVMDisposePassBuilderOptions(pass_opts);
+	if (err != NULL) {
+		llvm_error(LLVMGetErrorMessage(err));
+	}
+}
+
+static void emit_module(const char *target_file, LLVMModuleRef module)
+{
+	bool failed;
+	char *errmsg;
+
+	switch (options.emit) {
+	case EMIT_OBJ:
+	case EMIT_ASM:
+		failed = LLVMTargetMachineEmitToFile(get_target_machine(),
+				module,
+				(char *) target_file,
+				options.emit == EMIT_OBJ ? LLVMObjectFile
+				                         : LLVMAssemblyFile,
+				&errmsg);
+		break;
+	case EMIT_LLVM_IR:
+		failed = LLVMPrintModuleToFile(module, target_file, &errmsg);
+		break;
+	case EMIT_BITCODE:
+		failed = LLVMWriteBitcodeToFile(module, target_file) != 0;
+		errmsg = "Failed to write bitcode";
+		break;
+	default:
+		internal_error();
+	}
 	if (failed) {
 		llvm_error(errmsg);
 	}
-	LLVMDisposeTargetMachine(target_machine);
-	LLVMDisposeMessage(target_triplet);
 }
 
-void compile_ast(char *target_file, struct ast ast)
+static void compile_module(const char *target_file, LLVMModuleRef module,
+		bool is_linked)
+{
+	LLVMVerifyModule(module, LLVMAbortProcessAction, NULL);
+	optimize_module(module, is_linked);
+	emit_module(target_file, module);
+}
+
+static LLVMModuleRef load_bitcode_file(const char *filename)
+{
+	LLVMMemoryBufferRef buf;
+	LLVMModuleRef module;
+	char *errmsg;
+
+	if (LLVMCreateMemoryBufferWithContentsOfFile(filename, &buf,
+				&errmsg)) {
+		fprintf(stderr, "%s: error: %s: %s\n", argv0, filename,
+				errmsg);
+		exit(EXIT_FAILURE);
+	}
+	if (LLVMParseBitcode2(buf, &module)) {
+		fprintf(stderr, "%s: error: %s: Invalid bitcode file\n",
+				argv0, filename);
+		exit(EXIT_FAILURE);
+	}
+	LLVMDisposeMemoryBuffer(buf);
+	return module;
+}
+
+void compile_ast(const char *target_file, struct ast ast)
 {
 	LLVMModuleRef module;
 
 	module = emit_ast(ast);
-	compile_module(target_file, module);
+	compile_module(target_file, module, false);
+	LLVMDisposeModule(module);
+}
+
+void compile_bitcode_file(const char *target_file, const char *filename)
+{
+	LLVMModuleRef module;
+
+	module = load_bitcode_file(filename);
+	compile_module(target_file, module, false);
 	LLVMDisposeModule(module);
 }
+
+// Module that every input is merged into when compiling with `-flto`
+static LLVMModuleRef linked_module;
+
+static void link_module(LLVMModuleRef module)
+{
+	if (linked_module == NULL) {
+		linked_module = module;
+	} else if (LLVMLinkModules2(linked_module, module)) {
+		fprintf(stderr, "%s: error: Failed to link modules\n", argv0);
+		exit(EXIT_FAILURE);
+	}
+}
+
+void link_ast(struct ast ast)
+{
+	link_module(emit_ast(ast));
+}
+
+void link_bitcode_file(const char *filename)
+{
+	link_module(load_bitcode_file(filename));
+}
+
+void compile_linked_modules(const char *target_file)
+{
+	assert(linked_module != NULL);
+	compile_module(target_file, linked_module, true);
+	LLVMDisposeModule(linked_module);
+	linked_module = NULL;
+}
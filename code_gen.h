@@ -1 +1,6 @@
-void compile_ast(char *target_file, struct ast);
+void init_code_gen(void);
+void compile_ast(const char *target_file, struct ast);
+void compile_bitcode_file(const char *target_file, const char *);
+void link_ast(struct ast);
+void link_bitcode_file(const char *);
+void compile_linked_modules(const char *target_file);
@@ -0,0 +1,630 @@
+/*
+ * Infers how each function uses its pointer parameters, so that code
+ * generation can tell LLVM which ones are only read through or never escape.
+ * A parameter escapes if it is used other than by dereferencing it, such as by
+ * passing it to a function, storing it, or slicing the array it points to.
+ * Since pointers can only be made with `&`, these facts hold for any caller.
+ *
+ * Also infers what calling each function may do, so that LLVM can remove,
+ * combine or hoist calls to functions that only compute a value. Only globals
+ * and memory reached through pointers and slices can outlive a call. The
+ * effects of the functions a function calls are added to its own until none
+ * change, and a function only surely returns if everything it calls does,
+ * which is never the case for recursive functions.
+ *
+ * Last, functions that call each other with `become` are linked into groups,
+ * which code generation emits as one function so that each `become` is a jump.
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "ds.h"
+#include "quoftc.h"
+#include "ast.h"
+#include "check_semantics.h"
+#include "effects.h"
+
+static size_t func_id, first_param_id, nparams; // Of the current function
+static unsigned *param_effects;
+static bool in_lambda; // Lambdas may capture parameters
+static unsigned func_effects; // Of the current function, without its callees
+static Vec *callees; // Defined functions the current function calls
+static Vec *become_targets; // Other functions it calls with `become`
+static struct decl **global_decls; // By symbol id; function definitions win
+static size_t nglobal_decls;
+
+// A function definition, and what calling it may do
+struct func_node {
+	struct decl *decl;
+	unsigned effects; // Of its body alone
+	Vec *callees, *become_targets;
+};
+
+static const unsigned unknown_effects = READS_MEMORY | WRITES_MEMORY |
+	MAY_SYNC | MAY_NOT_RETURN;
+
+static void scan_expr(struct expr *);
+static void scan_exprs(Vec *);
+static void scan_stmts(Vec *);
+
+// Notes an effect on the parameter named by `expr`, if it names one
+static void add_effect(struct expr *expr, unsigned effect)
+{
+	size_t id;
+
+	if (expr->kind != IDENT_EXPR) {
+		return;
+	}
+	id = expr->u.ident.sym_id;
+	if (id < first_param_id || id >= first_param_id + nparams) {
+		return;
+	}
+	param_effects[id - first_param_id] |= in_lambda ?
+		PARAM_ESCAPES | (effect & PARAM_REBOUND) : effect;
+}
+
+// Calls in lambdas do not happen when the enclosing function runs
+static void add_func_effect(unsigned effect)
+{
+	if (!in_lambda) {
+		func_effects |= effect;
+	}
+}
+
+// Returns the effect of accessing memory as `effect` accesses a parameter
+static unsigned get_mem_effect(unsigned effect)
+{
+	return (effect & READS_PARAM ? READS_MEMORY : 0) |
+		(effect & WRITES_PARAM ? WRITES_MEMORY : 0);
+}
+
+static struct decl *get_global_decl(struct expr *expr)
+{
+	size_t id;
+
+	if (expr->kind != IDENT_EXPR) {
+		return NULL;
+	}
+	id = expr->u.ident.sym_id;
+	return id < nglobal_decls ? global_decls[id] : NULL;
+}
+
+// Notes an access of the variable named by `expr`
+static void add_var_effect(struct expr *expr, unsigned effect)
+{
+	struct decl *decl;
+
+	if (expr->type->kind == VOLATILE_TYPE) {
+		add_func_effect(READS_MEMORY | WRITES_MEMORY | MAY_SYNC);
+		return;
+	}
+	decl = get_global_decl(expr);
+	// Constant globals cannot change, so reading them is not an effect
+	if (decl == NULL || decl->kind != DATA_DECL || decl->u.data.is_let) {
+		return;
+	}
+	add_func_effect(get_mem_effect(effect));
+}
+
+static bool is_slice(struct type *type)
+{
+	type = remove_const_and_volatile(type);
+	return type->kind == ARRAY_TYPE && type->u.array.len == 0;
+}
+
+// Notes the effects of indexing the array `expr` in place
+static void add_index_effect(struct expr *expr, unsigned effect)
+{
+	if (is_slice(expr->type)) {
+		add_func_effect(get_mem_effect(effect));
+	}
+}
+
+// Bounds checks trap on failure, so a checked access may not return
+static void add_check_effect(bool is_checked)
+{
+	if (options.bounds_check && is_checked) {
+		add_func_effect(MAY_NOT_RETURN);
+	}
+}
+
+static bool is_deref(struct expr *expr)
+{
+	return expr->kind == UNARY_OP_EXPR &&
+		expr->u.unary_op.op == DEREF_OP;
+}
+
+// Scans the pointer of a dereference that accesses memory as `effect`
+static void scan_deref(struct expr *expr, unsigned effect)
+{
+	struct expr *operand;
+
+	operand = expr->u.unary_op.operand;
+	add_func_effect(get_mem_effect(effect));
+	if (operand->kind == IDENT_EXPR) {
+		add_effect(operand, effect);
+	} else {
+		scan_expr(operand);
+	}
+}
+
+// Scans an array that is indexed or measured in place, not copied
+static void scan_array(struct expr *expr, unsigned effect)
+{
+	if (is_deref(expr)) {
+		scan_deref(expr, effect);
+	} else if (expr->kind == INDEX_EXPR) {
+		add_index_effect(expr->u.index.array, effect);
+		add_check_effect(!expr->u.index.is_in_bounds);
+		scan_array(expr->u.index.array, effect);
+		scan_expr(expr->u.index.index);
+	} else if (expr->kind == IDENT_EXPR) {
+		add_var_effect(expr, effect);
+		add_effect(expr, PARAM_ESCAPES);
+	} else {
+		scan_expr(expr);
+	}
+}
+
+// Scans a place that is assigned, incremented or has its address taken
+static void scan_lval(struct expr *expr, unsigned effect)
+{
+	if (is_deref(expr)) {
+		scan_deref(expr, effect);
+	} else if (expr->kind == INDEX_EXPR) {
+		add_index_effect(expr->u.index.array, effect);
+		add_check_effect(!expr->u.index.is_in_bounds);
+		scan_lval(expr->u.index.array, effect);
+		scan_expr(expr->u.index.index);
+	} else if (expr->kind == IDENT_EXPR) {
+		add_var_effect(expr, effect);
+		add_effect(expr, PARAM_ESCAPES | PARAM_REBOUND);
+	} else {
+		scan_expr(expr);
+	}
+}
+
+// An array read whole may become a slice of its storage
+static bool is_fixed_array(struct type *type)
+{
+	type = remove_const_and_volatile(type);
+	return type->kind == ARRAY_TYPE && type->u.array.len != 0;
+}
+
+static void scan_unary_op_expr(struct expr *expr)
+{
+	struct expr *operand;
+
+	operand = expr->u.unary_op.operand;
+	switch (expr->u.unary_op.op) {
+	case DEREF_OP:
+		add_func_effect(READS_MEMORY);
+		if (operand->kind == IDENT_EXPR) {
+			add_effect(operand, is_fixed_array(expr->type) ?
+					PARAM_ESCAPES : READS_PARAM);
+		} else {
+			scan_expr(operand);
+		}
+		break;
+	case PRE_INC_OP:
+	case POST_INC_OP:
+	case PRE_DEC_OP:
+	case POST_DEC_OP:
+		scan_lval(operand, READS_PARAM | WRITES_PARAM);
+		break;
+	case REF_OP:
+		scan_lval(operand, PARAM_ESCAPES);
+		break;
+	default:
+		scan_expr(operand);
+		break;
+	}
+}
+
+static void scan_bin_op_expr(struct expr *expr)
+{
+	enum bin_op op;
+
+	op = expr->u.bin_op.op;
+	if (op == ASSIGN_OP) {
+		scan_lval(expr->u.bin_op.l, WRITES_PARAM);
+	} else if (op > ASSIGN_OP) {
+		scan_lval(expr->u.bin_op.l, READS_PARAM | WRITES_PARAM);
+	} else {
+		scan_expr(expr->u.bin_op.l);
+	}
+	scan_expr(expr->u.bin_op.r);
+}
+
+static void scan_builtin_expr(struct expr *expr)
+{
+	Vec *args;
+	size_t i;
+
+	args = expr->u.builtin.args;
+	switch (expr->u.builtin.builtin) {
+	case LOAD_BUILTIN:
+	case MASKED_LOAD_BUILTIN:
+		add_index_effect(vec_get(args, 0), READS_PARAM);
+		add_check_effect(true);
+		scan_array(vec_get(args, 0), READS_PARAM);
+		break;
+	case STORE_BUILTIN:
+	case MASKED_STORE_BUILTIN:
+		add_index_effect(vec_get(args, 0), WRITES_PARAM);
+		add_check_effect(true);
+		scan_array(vec_get(args, 0), WRITES_PARAM);
+		break;
+	default:
+		scan_exprs(args);
+		return;
+	}
+	for (i = 1; i < vec_len(args); i++) {
+		scan_expr(vec_get(args, i));
+	}
+}
+
+// Direct calls of defined functions are resolved once all are scanned
+static void scan_func_call_expr(struct expr *expr)
+{
+	struct decl *decl;
+
+	decl = get_global_decl(expr->u.func_call.func);
+	if (decl != NULL && decl->kind == FUNC_DECL &&
+			decl->u.func.body_stmts != NULL) {
+		if (!in_lambda) {
+			vec_push(callees, decl);
+		}
+	} else {
+		add_func_effect(unknown_effects);
+	}
+	scan_expr(expr->u.func_call.func);
+	scan_exprs(expr->u.func_call.args);
+}
+
+static void scan_expr(struct expr *expr)
+{
+	bool outer_in_lambda;
+	size_t i;
+
+	if (expr == NULL) {
+		return;
+	}
+	switch (expr->kind) {
+	case BOOL_LIT_EXPR:
+	case INT_LIT_EXPR:
+	case FLOAT_LIT_EXPR:
+	case CHAR_LIT_EXPR:
+	case STRING_LIT_EXPR:
+	case EMBED_EXPR:
+		break;
+	case IDENT_EXPR:
+		add_var_effect(expr, READS_PARAM);
+		add_effect(expr, PARAM_ESCAPES);
+		break;
+	case UNARY_OP_EXPR:
+		scan_unary_op_expr(expr);
+		break;
+	case BIN_OP_EXPR:
+		scan_bin_op_expr(expr);
+		break;
+	case LAMBDA_EXPR:
+		outer_in_lambda = in_lambda;
+		in_lambda = true;
+		scan_expr(expr->u.lambda.body);
+		in_lambda = outer_in_lambda;
+		break;
+	case ARRAY_LIT_EXPR:
+		scan_exprs(expr->u.array_lit.val);
+		break;
+	case BLOCK_EXPR:
+		scan_stmts(expr->u.block.stmts);
+		break;
+	case IF_EXPR:
+		scan_expr(expr->u.if_.cond);
+		scan_expr(expr->u.if_.then);
+		scan_expr(expr->u.if_.else_);
+		break;
+	case SWITCH_EXPR:
+		scan_expr(expr->u.switch_.ctrl);
+		for (i = 0; i < vec_len(expr->u.switch_.cases); i++) {
+			struct switch_case *case_ =
+				vec_get(expr->u.switch_.cases, i);
+
+			// Without a value to match, patterns are conditions
+			if (case_->l->kind == EXPR_SWITCH_PATTERN) {
+				scan_expr(case_->l->u.expr.expr);
+			}
+			scan_expr(case_->r);
+		}
+		break;
+	case TUPLE_EXPR:
+		scan_exprs(expr->u.tuple.items);
+		break;
+	case FUNC_CALL_EXPR:
+		scan_func_call_expr(expr);
+		break;
+	case FIELD_ACCESS_EXPR:
+		scan_array(expr->u.field_access.expr, READS_PARAM);
+		break;
+	case INDEX_EXPR:
+		scan_array(expr, READS_PARAM);
+		break;
+	case SLICE_EXPR:
+		add_check_effect(true);
+		// The slice refers to the storage of the array
+		scan_lval(expr->u.slice.array, PARAM_ESCAPES);
+		scan_expr(expr->u.slice.start);
+		scan_expr(expr->u.slice.end);
+		break;
+	case BUILTIN_EXPR:
+		scan_builtin_expr(expr);
+		break;
+	}
+}
+
+static void scan_exprs(Vec *exprs)
+{
+	size_t i;
+
+	for (i = 0; i < vec_len(exprs); i++) {
+		scan_expr(vec_get(exprs, i));
+	}
+}
+
+/*
+ * A `become` of the current function changes each parameter not passed
+ * itself. Other defined functions it becomes join its group.
+ */
+static void scan_tail_call(struct expr *expr)
+{
+	struct decl *decl;
+	struct expr *arg;
+	size_t i;
+
+	if (in_lambda || expr->u.func_call.func->kind != IDENT_EXPR) {
+		return;
+	}
+	if (expr->u.func_call.func->u.ident.sym_id != func_id) {
+		decl = get_global_decl(expr->u.func_call.func);
+		if (decl != NULL && decl->kind == FUNC_DECL &&
+				decl->u.func.body_stmts != NULL) {
+			vec_push(become_targets, decl);
+		}
+		return;
+	}
+	for (i = 0; i < vec_len(expr->u.func_call.args); i++) {
+		arg = vec_get(expr->u.func_call.args, i);
+		if (arg->kind != IDENT_EXPR ||
+				arg->u.ident.sym_id != first_param_id + i) {
+			param_effects[i] |= PARAM_REBOUND;
+		}
+	}
+}
+
+static void scan_stmt(struct stmt *stmt)
+{
+	switch (stmt->kind) {
+	case DECL_STMT:
+		assert(stmt->u.decl.decl->kind == DATA_DECL);
+		scan_expr(stmt->u.decl.decl->u.data.init);
+		break;
+	case EXPR_STMT:
+		scan_expr(stmt->u.expr.expr);
+		break;
+	case IF_STMT:
+		scan_expr(stmt->u.if_.cond);
+		scan_stmts(stmt->u.if_.then_stmts);
+		scan_stmts(stmt->u.if_.else_stmts);
+		break;
+	case DO_STMT:
+		add_func_effect(MAY_NOT_RETURN);
+		scan_stmts(stmt->u.do_.stmts);
+		scan_expr(stmt->u.do_.cond);
+		break;
+	case WHILE_STMT:
+		add_func_effect(MAY_NOT_RETURN);
+		scan_expr(stmt->u.while_.cond);
+		scan_stmts(stmt->u.while_.stmts);
+		break;
+	case FOR_STMT:
+		add_func_effect(MAY_NOT_RETURN);
+		scan_expr(stmt->u.for_.init);
+		scan_expr(stmt->u.for_.cond);
+		scan_expr(stmt->u.for_.post);
+		scan_stmts(stmt->u.for_.stmts);
+		break;
+	case RETURN_STMT:
+		if (stmt->u.return_.is_tail) {
+			scan_tail_call(stmt->u.return_.expr);
+		}
+		scan_expr(stmt->u.return_.expr);
+		break;
+	case BREAK_STMT:
+	case CONTINUE_STMT:
+		break;
+	case DEFER_STMT:
+		scan_stmt(stmt->u.defer.stmt);
+		break;
+	}
+}
+
+static void scan_stmts(Vec *stmts)
+{
+	size_t i;
+
+	if (stmts == NULL) {
+		return;
+	}
+	for (i = 0; i < vec_len(stmts); i++) {
+		scan_stmt(vec_get(stmts, i));
+	}
+}
+
+static struct func_node *infer_func_effects(struct decl *decl)
+{
+	struct func_node *node;
+
+	assert(decl->kind == FUNC_DECL);
+	func_id = decl->u.func.sym_id;
+	first_param_id = decl->u.func.param_sym_id;
+	nparams = vec_len(decl->u.func.param_names);
+	// One more, since calloc() may return NULL for zero bytes
+	param_effects = xcalloc((nparams + 1) * sizeof(unsigned));
+	in_lambda = false;
+	func_effects = 0;
+	callees = alloc_vec(NULL);
+	become_targets = alloc_vec(NULL);
+	scan_stmts(decl->u.func.body_stmts);
+	decl->u.func.param_effects = param_effects;
+	node = NEW(struct func_node);
+	node->decl = decl;
+	node->effects = func_effects;
+	node->callees = callees;
+	node->become_targets = become_targets;
+	return node;
+}
+
+static void free_func_node(void *p)
+{
+	struct func_node *node = p;
+
+	free_vec(node->callees);
+	free_vec(node->become_targets);
+	free(node);
+}
+
+// Sets the effects of each function, including those of what it calls
+static void add_callee_effects(Vec *nodes)
+{
+	struct func_node *node;
+	struct decl *callee;
+	unsigned effects;
+	bool changed;
+	size_t i, j;
+
+	// Whether a function may not return starts set and only gets cleared,
+	// so that recursion keeps it set
+	for (i = 0; i < vec_len(nodes); i++) {
+		node = vec_get(nodes, i);
+		node->decl->u.func.func_effects = node->effects |
+			MAY_NOT_RETURN;
+	}
+	do {
+		changed = false;
+		for (i = 0; i < vec_len(nodes); i++) {
+			node = vec_get(nodes, i);
+			effects = node->effects;
+			for (j = 0; j < vec_len(node->callees); j++) {
+				callee = vec_get(node->callees, j);
+				effects |= callee->u.func.func_effects;
+			}
+			if (effects != node->decl->u.func.func_effects) {
+				node->decl->u.func.func_effects = effects;
+				changed = true;
+			}
+		}
+	} while (changed);
+}
+
+static bool is_in_group(struct decl *decl, struct decl *member)
+{
+	struct decl *p;
+
+	p = decl;
+	do {
+		if (p == member) {
+			return true;
+		}
+		p = p->u.func.become_next;
+	} while (p != decl);
+	return false;
+}
+
+/*
+ * Links the functions that call each other with `become` into cycles through
+ * `become_next`. Joining two cycles only takes swapping one link of each.
+ */
+static void link_become_groups(Vec *nodes)
+{
+	struct func_node *node;
+	struct decl *decl, *target, *next;
+	size_t i, j;
+
+	for (i = 0; i < vec_len(nodes); i++) {
+		node = vec_get(nodes, i);
+		decl = node->decl;
+		for (j = 0; j < vec_len(node->become_targets); j++) {
+			target = vec_get(node->become_targets, j);
+			if (decl->u.func.become_next == NULL) {
+				decl->u.func.become_next = decl;
+			}
+			if (target->u.func.become_next == NULL) {
+				target->u.func.become_next = target;
+			}
+			if (!is_in_group(decl, target)) {
+				next = decl->u.func.become_next;
+				decl->u.func.become_next =
+					target->u.func.become_next;
+				target->u.func.become_next = next;
+			}
+		}
+	}
+}
+
+// Maps the ids of global variables and functions to their declarations
+static void map_global_decls(Vec *decls)
+{
+	struct decl *decl;
+	size_t i, id;
+
+	nglobal_decls = 1;
+	for (i = 0; i < vec_len(decls); i++) {
+		decl = vec_get(decls, i);
+		if (decl->kind == FUNC_DECL) {
+			id = decl->u.func.sym_id;
+		} else if (decl->kind == DATA_DECL) {
+			id = decl->u.data.sym_id;
+		} else {
+			continue;
+		}
+		if (id >= nglobal_decls) {
+			nglobal_decls = id + 1;
+		}
+	}
+	global_decls = xcalloc(nglobal_decls * sizeof(struct decl *));
+	for (i = 0; i < vec_len(decls); i++) {
+		decl = vec_get(decls, i);
+		if (decl->kind == DATA_DECL) {
+			global_decls[decl->u.data.sym_id] = decl;
+		} else if (decl->kind == FUNC_DECL &&
+				(global_decls[decl->u.func.sym_id] == NULL ||
+				 decl->u.func.body_stmts != NULL)) {
+			global_decls[decl->u.func.sym_id] = decl;
+		}
+	}
+}
+
+void infer_effects(struct ast ast)
+{
+	struct decl *decl;
+	Vec *nodes;
+	size_t i;
+
+	map_global_decls(ast.decls);
+	nodes = alloc_vec(free_func_node);
+	for (i = 0; i < vec_len(ast.decls); i++) {
+		decl = vec_get(ast.decls, i);
+		if (decl->kind == FUNC_DECL &&
+				decl->u.func.body_stmts != NULL) {
+			vec_push(nodes, infer_func_effects(decl));
+		}
+	}
+	add_callee_effects(nodes);
+	link_become_groups(nodes);
+	free_vec(nodes);
+	free(global_decls);
+}
@@ -0,0 +1 @@
+void infer_effects(struct ast);
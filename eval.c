@@ -61,6 +61,25 @@ static uint64_t eval_bin_op_const_expr(struct expr *expr)
 	}
 }
 
+// Also takes the other scalar literals and negation, as switch patterns may
+uint64_t eval_pattern_const_expr(struct expr *expr)
+{
+	switch (expr->kind) {
+	case BOOL_LIT_EXPR:
+		return expr->u.bool_lit.val;
+	case CHAR_LIT_EXPR:
+		return expr->u.char_lit.val;
+	case UNARY_OP_EXPR:
+		if (expr->u.unary_op.op == NEG_OP) {
+			return -eval_pattern_const_expr(
+					expr->u.unary_op.operand);
+		}
+		return eval_const_expr(expr);
+	default:
+		return eval_const_expr(expr);
+	}
+}
+
 uint64_t eval_const_expr(struct expr *expr)
 {
 	switch (expr->kind) {
@@ -68,6 +87,7 @@ uint64_t eval_const_expr(struct expr *expr)
 	case FLOAT_LIT_EXPR:
 	case CHAR_LIT_EXPR:
 	case STRING_LIT_EXPR:
+	case EMBED_EXPR:
 	case LAMBDA_EXPR:
 	case ARRAY_LIT_EXPR:
 	case IDENT_EXPR:
@@ -78,6 +98,8 @@ uint64_t eval_const_expr(struct expr *expr)
 	case FUNC_CALL_EXPR:
 	case FIELD_ACCESS_EXPR:
 	case INDEX_EXPR:
+	case SLICE_EXPR:
+	case BUILTIN_EXPR:
 		eval_error(expr);
 	case INT_LIT_EXPR:
 		return expr->u.int_lit.val;
@@ -1 +1,2 @@
 uint64_t eval_const_expr(struct expr *);
+uint64_t eval_pattern_const_expr(struct expr *);
@@ -8,6 +8,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -20,7 +21,6 @@
 #include "utf8.h"
 #include "lex.h"
 
-#define MAX_LINENO 65536
 #define MAX_NUM_CHARS 128 // TODO: Maybe change this?
 
 static const char *filename;
@@ -34,9 +34,9 @@ const char *get_filename(void)
 
 static void inc_lineno(void)
 {
-	if (lineno == MAX_LINENO) {
-		fatal_error(lineno, "Source file longer than %d lines",
-				MAX_LINENO);
+	if (lineno == UINT_MAX) {
+		fatal_error(lineno, "Source file longer than %u lines",
+				UINT_MAX);
 	}
 	lineno++;
 }
@@ -135,40 +135,30 @@ invalid:
 	fatal_error(lineno, "Invalid char literal");
 }
 
-static void init_string_lit_tok(struct tok *tok, char val[MAX_STRING_SIZE + 1],
-		unsigned len)
-{
-	tok->kind = STRING_LIT;
-	tok->lineno = lineno;
-	strcpy(tok->u.string_lit.val, val);
-	tok->u.string_lit.len = len;
-}
-
+// String literal tokens point into the source, so they can be any length
 static void lex_string_lit(struct tok *tok)
 {
-	char text[MAX_STRING_SIZE + 1], *p;
-	unsigned len;
+	const char *start;
 
 	assert(*inp == '"');
-	inp++;
-	p = text;
-	len = 0;
-	do {
-		// TODO: Fix this
-		if (len == MAX_STRING_SIZE) {
-			fatal_error(lineno, "String literal is longer than the "
-		                            "maximum allowed length of %d "
-			                    "bytes", MAX_STRING_SIZE);
+	tok->kind = STRING_LIT;
+	tok->lineno = lineno;
+	start = ++inp;
+	while (*inp != '"') {
+		if (*inp == '\0') {
+			fatal_error(tok->lineno, "End of file in string literal");
 		}
-		*p++ = *inp++;
-		len++;
-	} while (*inp != '"');
+		if (*inp == '\n') {
+			inc_lineno();
+		}
+		inp++;
+	}
+	tok->u.string_lit.val = start;
+	tok->u.string_lit.len = inp - start;
 	inp++;
-	*p = '\0';
-	if (!is_valid_utf8(text)) {
-		fatal_error(lineno, "Invalid string literal");
+	if (!is_valid_utf8(start, tok->u.string_lit.len)) {
+		fatal_error(tok->lineno, "Invalid string literal");
 	}
-	init_string_lit_tok(tok, text, len);
 }
 
 static enum tok_kind lookup_keyword(const char *keyword)
@@ -183,6 +173,7 @@ static enum tok_kind lookup_keyword(const char *keyword)
 		K("impure", IMPURE);
 		K("const", CONST);
 		K("volatile", VOLATILE);
+		K("restrict", RESTRICT);
 		K("typedef", TYPEDEF);
 		K("true", TRUE);
 		K("false", FALSE);
@@ -197,6 +188,8 @@ static enum tok_kind lookup_keyword(const char *keyword)
 		K("continue", CONTINUE);
 		K("defer", DEFER);
 		K("return", RETURN);
+		K("become", BECOME);
+		K("embed", EMBED);
 		K("U8", U8);
 		K("U16", U16);
 		K("U32", U32);
@@ -210,6 +203,7 @@ static enum tok_kind lookup_keyword(const char *keyword)
 		K("bool", BOOL);
 		K("void", VOID);
 		K("char", CHAR);
+		K("str", STR);
 		K("_", UNDERSCORE);
 #undef K
 	}
@@ -240,6 +234,34 @@ static void init_basic_tok(struct tok *tok, enum tok_kind kind)
 	tok->lineno = lineno;
 }
 
+// Vector types are named like `F32x8`, a scalar type and a lane count
+static bool init_vector_tok(struct tok *tok, char *ident)
+{
+	enum tok_kind elem;
+	char *x;
+
+	x = strchr(ident, 'x');
+	if (x == NULL || !isdigit(x[1]) || x[1] == '0' ||
+			strspn(x + 1, "0123456789") != strlen(x + 1)) {
+		return false;
+	}
+	*x = '\0';
+	elem = lookup_keyword(ident);
+	*x = 'x';
+	if (elem < U8 || elem > BOOL) {
+		return false;
+	}
+	tok->kind = VECTOR;
+	tok->lineno = lineno;
+	tok->u.vector.elem = elem;
+	errno = 0;
+	tok->u.vector.len = strtoull(x + 1, NULL, 10);
+	if (errno != 0) {
+		tok->u.vector.len = UINT64_MAX;
+	}
+	return true;
+}
+
 static void lex_ident(struct tok *tok)
 {
 	int i;
@@ -257,10 +279,10 @@ static void lex_ident(struct tok *tok)
 	}
 	ident[i] = '\0';
 	tok_kind = lookup_keyword(ident);
-	if (tok_kind == INVALID_TOK) {
-		init_ident_tok(tok, ident);
-	} else {
+	if (tok_kind != INVALID_TOK) {
 		init_basic_tok(tok, tok_kind);
+	} else if (!init_vector_tok(tok, ident)) {
+		init_ident_tok(tok, ident);
 	}
 }
 
@@ -329,7 +351,8 @@ static void lex_num_lit_with_base(struct tok *tok, int base)
 	is_valid_digit = get_is_valid_digit_func(base);
 	i = 0;
 	found_radix_point = false;
-	while (is_valid_digit(*inp) || *inp == '.') {
+	// A `..` after an integer is a range, not a radix point
+	while (is_valid_digit(*inp) || (*inp == '.' && inp[1] != '.')) {
 		if (*inp == '.') {
 			if (found_radix_point) {
 				fatal_error(lineno, "Floating point literal "
@@ -398,6 +421,9 @@ static void lex_num_lit(struct tok *tok)
 			lex_num_lit_with_base(tok, 16);
 			return;
 		case '.':
+			if (inp[1] == '.') {
+				break;
+			}
 			inp--;
 			lex_num_lit_with_base(tok, 10);
 			return;
@@ -414,7 +440,7 @@ static void lex_num_lit(struct tok *tok)
 
 static bool is_op_char(int c)
 {
-	return strchr("+-*/%<>=!&|^~.:;,[](){}", c) != NULL;
+	return strchr("+-*/%<>=!&|^~.:;,[](){}@\\", c) != NULL;
 }
 
 static void lex_op_0__(struct tok *tok, enum tok_kind kind)
@@ -450,6 +476,18 @@ static void lex_op_2__(struct tok *tok, enum tok_kind kind,
 	}
 }
 
+static void lex_op_3__(struct tok *tok, enum tok_kind kind,
+		int c1, enum tok_kind kind1, int c2, enum tok_kind kind2,
+		int c3, enum tok_kind kind3)
+{
+	if (inp[1] == c3) {
+		inp += 2;
+		init_basic_tok(tok, kind3);
+	} else {
+		lex_op_2__(tok, kind, c1, kind1, c2, kind2);
+	}
+}
+
 static void lex_op(struct tok *tok)
 {
 	switch (*inp) {
@@ -457,7 +495,8 @@ static void lex_op(struct tok *tok)
 		lex_op_2__(tok, PLUS, '+', PLUS_PLUS, '=', PLUS_EQ);
 		break;
 	case '-':
-		lex_op_2__(tok, MINUS, '-', MINUS_MINUS, '=', MINUS_EQ);
+		lex_op_3__(tok, MINUS, '-', MINUS_MINUS, '=', MINUS_EQ,
+				'>', ARROW);
 		break;
 	case '*':
 		lex_op_1__(tok, STAR, '=', STAR_EQ);
@@ -469,13 +508,13 @@ static void lex_op(struct tok *tok)
 		lex_op_1__(tok, PERCENT, '=', PERCENT_EQ);
 		break;
 	case '<':
-		lex_op_2__(tok, LT, '<', LT_LT, '=', LT_EQ);
+		lex_op_3__(tok, LT, '<', LT_LT, '=', LT_EQ, '-', BACK_ARROW);
 		break;
 	case '>':
 		lex_op_2__(tok, GT, '>', GT_GT, '=', GT_EQ);
 		break;
 	case '=':
-		lex_op_1__(tok, EQ, '=', EQ_EQ);
+		lex_op_2__(tok, EQ, '=', EQ_EQ, '>', BIG_ARROW);
 		break;
 	case '!':
 		lex_op_1__(tok, BANG, '=', BANG_EQ);
@@ -493,7 +532,7 @@ static void lex_op(struct tok *tok)
 		lex_op_0__(tok, TILDE);
 		break;
 	case '.':
-		lex_op_0__(tok, DOT);
+		lex_op_1__(tok, DOT, '.', DOT_DOT);
 		break;
 	case ':':
 		lex_op_0__(tok, COLON);
@@ -522,6 +561,12 @@ static void lex_op(struct tok *tok)
 	case '}':
 		lex_op_0__(tok, CLOSE_BRACE);
 		break;
+	case '@':
+		lex_op_0__(tok, AT);
+		break;
+	case '\\':
+		lex_op_0__(tok, BACKSLASH);
+		break;
 	default:
 		internal_error();
 	}
@@ -535,6 +580,7 @@ const char *tok_to_str(enum tok_kind kind)
 		[IMPURE] = "`impure`",
 		[CONST] = "`const`",
 		[VOLATILE] = "`volatile`",
+		[RESTRICT] = "`restrict`",
 		[IDENT] = "an identifier",
 		[TYPEDEF] = "`typedef`",
 		[TRUE] = "`true`",
@@ -587,6 +633,8 @@ const char *tok_to_str(enum tok_kind kind)
 		[CONTINUE] = "`continue`",
 		[DEFER] = "`defer`",
 		[RETURN] = "`return`",
+		[BECOME] = "`become`",
+		[EMBED] = "`embed`",
 		[U8] = "`U8`",
 		[U16] = "`U16`",
 		[U32] = "`U32`",
@@ -600,7 +648,10 @@ const char *tok_to_str(enum tok_kind kind)
 		[BOOL] = "`bool`",
 		[VOID] = "`void`",
 		[CHAR] = "`char`",
+		[STR] = "`str`",
+		[VECTOR] = "a vector type",
 		[DOT] = "`.`",
+		[DOT_DOT] = "`..`",
 		[COLON] = "`:`",
 		[SEMICOLON] = "`;`",
 		[COMMA] = "`,`",
@@ -609,6 +660,7 @@ const char *tok_to_str(enum tok_kind kind)
 		[BIG_ARROW] = "`=>`",
 		[BACKSLASH] = "`\\`",
 		[UNDERSCORE] = "`_`",
+		[AT] = "`@`",
 		[OPEN_BRACKET] = "`[`",
 		[CLOSE_BRACKET] = "`]`",
 		[OPEN_PAREN] = "`(`",
@@ -676,6 +728,54 @@ void init_lex(const char *filename_)
 	lineno = 1;
 }
 
+/*
+ * Maps a file named by `embed()`. A relative name is relative to the directory
+ * of the source file. Returns NULL for an empty file, which can't be mapped.
+ */
+char *map_embedded_file(const char *name, unsigned embed_lineno, size_t *len)
+{
+	const char *slash;
+	char *path, *data;
+	struct stat stat;
+	size_t dir_len;
+	int fd;
+
+	slash = strrchr(filename, '/');
+	if (name[0] == '/' || slash == NULL) {
+		path = xstrdup(name);
+	} else {
+		dir_len = slash - filename + 1;
+		path = xmalloc(dir_len + strlen(name) + 1);
+		memcpy(path, filename, dir_len);
+		strcpy(path + dir_len, name);
+	}
+	fd = open(path, O_RDONLY);
+	if (fd == -1 || fstat(fd, &stat) == -1) {
+		goto error;
+	}
+	*len = stat.st_size;
+	data = NULL;
+	if (*len != 0) {
+		data = mmap(NULL, *len, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED) {
+			goto error;
+		}
+	}
+	close(fd);
+	free(path);
+	return data;
+error:
+	fatal_error(embed_lineno, "Failed to embed `%s`: %s", path,
+			strerror(errno));
+}
+
+void unmap_embedded_file(char *data, size_t len)
+{
+	if (data != NULL && munmap(data, len) == -1) {
+		internal_error();
+	}
+}
+
 void cleanup_lex(void)
 {
 	if (munmap(inp_origin, file_len + 1) == -1) {
@@ -1,12 +1,11 @@
 #define MAX_IDENT_SIZE 512
-#define MAX_STRING_SIZE 1024 // TODO: Make this unlimited
 
 enum tok_kind {
 	INVALID_TOK,
 
 	LET, VAR,
 	IMPURE,
-	CONST, VOLATILE,
+	CONST, VOLATILE, RESTRICT,
 	IDENT,
 	TYPEDEF,
 
@@ -23,15 +22,16 @@ enum tok_kind {
 	AMP_EQ, PIPE_EQ, CARET_EQ, LT_LT_EQ, GT_GT_EQ,
 
 	IF, THEN, ELSE, DO, WHILE, FOR, SWITCH,
-	BREAK, CONTINUE, DEFER, RETURN,
+	BREAK, CONTINUE, DEFER, RETURN, BECOME,
+	EMBED,
 
 	U8, U16, U32, U64,
 	I8, I16, I32, I64,
 	F32, F64,
-	BOOL, VOID, CHAR,
+	BOOL, VOID, CHAR, STR, VECTOR,
 
-	DOT, COLON, SEMICOLON, COMMA, ARROW, BACK_ARROW, BIG_ARROW,
-	BACKSLASH, UNDERSCORE,
+	DOT, DOT_DOT, COLON, SEMICOLON, COMMA, ARROW, BACK_ARROW, BIG_ARROW,
+	BACKSLASH, UNDERSCORE, AT,
 
 	OPEN_BRACKET, CLOSE_BRACKET,
 	OPEN_PAREN, CLOSE_PAREN,
@@ -45,12 +45,16 @@ struct tok {
 	union {
 		uint32_t char_lit;
 		struct {
-			char val[MAX_STRING_SIZE + 1];
-			unsigned len;
+			const char *val; // Points into the source, unterminated
+			size_t len;
 		} string_lit;
 		uint64_t int_lit;
 		double float_lit;
 		char ident[MAX_IDENT_SIZE + 1];
+		struct {
+			enum tok_kind elem; // `U8` through `bool`
+			uint64_t len;
+		} vector;
 	} u;
 };
 
@@ -58,4 +62,6 @@ const char *get_filename(void);
 const char *tok_to_str(enum tok_kind);
 void lex(struct tok *);
 void init_lex(const char *);
+char *map_embedded_file(const char *, unsigned, size_t *);
+void unmap_embedded_file(char *, size_t);
 void cleanup_lex(void);
@@ -7,13 +7,24 @@
 #include <string.h>
 #include "ds.h"
 #include "ast.h"
+#include "bounds.h"
 #include "check_semantics.h"
 #include "code_gen.h"
+#include "effects.h"
 #include "lex.h"
 #include "parse.h"
+#include "profile.h"
 #include "quoftc.h"
+#include "server.h"
+
+#define DEFAULT_PROFILE_FILE "default.qfprof"
+#define DEFAULT_SOCKET_FILE "quoftc.sock"
 
 const char *argv0;
+struct options options;
+
+static const char *target_file, **source_files;
+static int nsource_files;
 
 PRINTF(2, 3) void warn(unsigned lineno, const char *fmt, ...)
 {
@@ -73,24 +84,260 @@ char *xstrdup(const char *s)
 	return strcpy(xmalloc(strlen(s) + 1), s);
 }
 
-static void compile_file(char *target_file, const char *source_file)
+// Copies the first `len` bytes of `s` to a new NUL-terminated string
+char *xstrndup(const char *s, size_t len)
+{
+	char *dup;
+
+	dup = memcpy(xmalloc(len + 1), s, len);
+	dup[len] = '\0';
+	return dup;
+}
+
+static bool has_suffix(const char *s, const char *suffix)
+{
+	size_t len, suffix_len;
+
+	len = strlen(s);
+	suffix_len = strlen(suffix);
+	return len >= suffix_len && strcmp(s + len - suffix_len, suffix) == 0;
+}
+
+static bool is_bitcode_file(const char *filename)
+{
+	return has_suffix(filename, ".bc");
+}
+
+static struct ast parse_and_check_file(const char *source_file)
 {
 	struct ast ast;
 
 	ast = parse_file(source_file);
 	check_ast(ast);
+	// Indices proven in bounds cannot trap, which matters for effects
+	if (options.bounds_check) {
+		prove_indices_in_bounds(ast);
+	}
+	infer_effects(ast);
+	return ast;
+}
+
+static void compile_file(const char *target_file, const char *source_file)
+{
+	struct ast ast;
+
+	if (is_bitcode_file(source_file)) {
+		compile_bitcode_file(target_file, source_file);
+		return;
+	}
+	ast = parse_and_check_file(source_file);
 	compile_ast(target_file, ast);
 	free_ast(ast);
 }
 
-int main(int argc, const char *argv[])
+static void link_file(const char *source_file)
+{
+	struct ast ast;
+
+	if (is_bitcode_file(source_file)) {
+		link_bitcode_file(source_file);
+		return;
+	}
+	ast = parse_and_check_file(source_file);
+	link_ast(ast);
+	free_ast(ast);
+}
+
+static const char *get_emit_suffix(void)
+{
+	switch (options.emit) {
+	case EMIT_OBJ:
+		return ".o";
+	case EMIT_ASM:
+		return ".s";
+	case EMIT_LLVM_IR:
+		return ".ll";
+	case EMIT_BITCODE:
+		return ".bc";
+	}
+	internal_error();
+}
+
+// Replaces the extension of `source_file` with one matching `--emit`
+static char *get_default_target_file(const char *source_file)
+{
+	const char *suffix, *dot;
+	char *target_file;
+	size_t len;
+
+	suffix = get_emit_suffix();
+	dot = strrchr(source_file, '.');
+	if (dot == NULL || strchr(dot, '/') != NULL) {
+		len = strlen(source_file);
+	} else {
+		len = dot - source_file;
+	}
+	target_file = xmalloc(len + strlen(suffix) + 1);
+	memcpy(target_file, source_file, len);
+	strcpy(target_file + len, suffix);
+	return target_file;
+}
+
+static NORETURN void usage(void)
+{
+	fprintf(stderr, "Usage: %s [-o target] [-O0|-O1|-O2|-O3] [-flto] "
+	                "[-fexport=symbol,...]\n"
+	                "       [-fbounds-check]\n"
+	                "       [--emit=obj|asm|llvm-ir|bitcode]\n"
+	                "       [-fprofile-generate[=profile]] "
+	                "[-fprofile-use[=profile]]\n"
+	                "       filename...\n"
+	                "       %s --server[=socket]\n", argv0, argv0);
+	exit(EXIT_FAILURE);
+}
+
+/*
+ * Parses `name` or `name=path`, returning `default_path` for the former and
+ * NULL if `arg` is neither
+ */
+static const char *parse_path_option(const char *arg, const char *name,
+		const char *default_path)
+{
+	size_t len;
+
+	len = strlen(name);
+	if (strncmp(arg, name, len) != 0) {
+		return NULL;
+	}
+	if (arg[len] == '\0') {
+		return default_path;
+	}
+	if (arg[len] == '=' && arg[len + 1] != '\0') {
+		return arg + len + 1;
+	}
+	return NULL;
+}
+
+static void parse_emit_option(const char *kind)
 {
-	char target_file[] = "a.out";
+	if (strcmp(kind, "obj") == 0) {
+		options.emit = EMIT_OBJ;
+	} else if (strcmp(kind, "asm") == 0) {
+		options.emit = EMIT_ASM;
+	} else if (strcmp(kind, "llvm-ir") == 0) {
+		options.emit = EMIT_LLVM_IR;
+	} else if (strcmp(kind, "bitcode") == 0) {
+		options.emit = EMIT_BITCODE;
+	} else {
+		usage();
+	}
+}
+
+static void parse_args(int argc, const char *argv[])
+{
+	const char *path;
+	int i;
 
+	memset(&options, 0, sizeof(options));
+	target_file = NULL;
+	free(source_files);
+	source_files = xmalloc(sizeof(char *) * argc);
+	nsource_files = 0;
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-o") == 0) {
+			if (++i == argc) {
+				usage();
+			}
+			target_file = argv[i];
+		} else if (strncmp(argv[i], "--emit=", 7) == 0) {
+			parse_emit_option(argv[i] + 7);
+		} else if (strcmp(argv[i], "-flto") == 0) {
+			options.lto = true;
+		} else if (strncmp(argv[i], "-fexport=", 9) == 0) {
+			options.lto_exports = argv[i] + 9;
+		} else if (strcmp(argv[i], "-fbounds-check") == 0) {
+			options.bounds_check = true;
+		} else if (strncmp(argv[i], "-O", 2) == 0 &&
+				IN_RANGE(argv[i][2], '0', '3') &&
+				argv[i][3] == '\0') {
+			options.opt_level = argv[i][2] - '0';
+		} else if ((path = parse_path_option(argv[i],
+						"-fprofile-generate",
+						DEFAULT_PROFILE_FILE))) {
+			options.profile_generate = path;
+		} else if ((path = parse_path_option(argv[i],
+						"-fprofile-use",
+						DEFAULT_PROFILE_FILE))) {
+			options.profile_use = path;
+		} else if ((path = parse_path_option(argv[i], "--server",
+						DEFAULT_SOCKET_FILE))) {
+			options.server_socket = path;
+		} else if (argv[i][0] == '-') {
+			usage();
+		} else {
+			source_files[nsource_files++] = argv[i];
+		}
+	}
+}
+
+static void compile_files(void)
+{
+	char *default_target_file;
+	int i;
+
+	if (nsource_files == 0 || (options.profile_generate != NULL &&
+				options.profile_use != NULL)) {
+		usage();
+	}
+	if (options.profile_use != NULL) {
+		read_profile(options.profile_use);
+	}
+	if (options.lto) {
+		for (i = 0; i < nsource_files; i++) {
+			link_file(source_files[i]);
+		}
+		compile_linked_modules(target_file == NULL ? "a.out"
+		                                           : target_file);
+	} else if (nsource_files == 1) {
+		compile_file(target_file == NULL ? "a.out" : target_file,
+				source_files[0]);
+	} else {
+		if (target_file != NULL) {
+			fprintf(stderr, "%s: error: Cannot use -o with "
+			                "multiple files without -flto\n",
+			                argv0);
+			exit(EXIT_FAILURE);
+		}
+		for (i = 0; i < nsource_files; i++) {
+			default_target_file =
+				get_default_target_file(source_files[i]);
+			compile_file(default_target_file, source_files[i]);
+			free(default_target_file);
+		}
+	}
+}
+
+// Compiles as a client asked the server to, with the client's arguments
+void compile_args(int argc, const char *argv[])
+{
 	argv0 = argv[0];
-	if (argc != 2) {
-		fprintf(stderr, "Usage: %s filename\n", argv0);
-		exit(EXIT_FAILURE);
+	parse_args(argc, argv);
+	if (options.server_socket != NULL) {
+		usage();
+	}
+	compile_files();
+}
+
+int main(int argc, const char *argv[])
+{
+	argv0 = argv[0];
+	parse_args(argc, argv);
+	if (options.server_socket != NULL) {
+		if (nsource_files != 0) {
+			usage();
+		}
+		run_server(options.server_socket);
 	}
-	compile_file(target_file, argv[1]);
+	compile_files();
+	free(source_files);
 }
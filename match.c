@@ -0,0 +1,613 @@
+/*
+ * Compiles a switch on a tuple or array to a decision tree, which tests the
+ * scalar parts of the value one at a time. The cases are first flattened into
+ * rows giving the values matched at each position, with a row for each
+ * alternative of an `|` of tuple or array patterns.
+ *
+ * A node tests a position that its first row needs, preferring one that the
+ * most rows test, and each child keeps the rows that can still match. So no
+ * position is tested twice on a path, and cases share the tests they have in
+ * common. A leaf selects the case of its first row, which is the first row
+ * matching every value that reaches it, so a row that no leaf selects only
+ * matches values that earlier rows match.
+ *
+ * The node for a set of rows is built once for each set of positions that
+ * are already tested and still matter to those rows, and is shared by every
+ * path reaching it. Otherwise, cases that test positions independently of
+ * each other would copy the same subtrees again and again.
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ds.h"
+#include "quoftc.h"
+#include "ast.h"
+#include "check_semantics.h"
+#include "eval.h"
+#include "match.h"
+
+// The values a row matches at a position, or any value if `vals` is NULL
+struct cell {
+	uint64_t *vals;
+	size_t nvals;
+};
+
+struct row {
+	struct cell *cells; // One per position
+	size_t case_index;
+	unsigned lineno;
+	bool is_used; // Selected by a leaf
+};
+
+// Patterns still to be flattened into a row
+struct pending {
+	struct {
+		struct switch_pattern *pattern;
+		struct type *type;
+		size_t pos; // The first the pattern covers
+	} *items;
+	size_t len, nalloc;
+};
+
+static struct match_pos *positions;
+static size_t npositions, nalloc_positions;
+static struct row *rows;
+static size_t nrows, nalloc_rows;
+static bool *is_tested; // By position, on the path being built
+static bool is_exhaustive;
+static HashTable *built_nodes; // Maps the keys of subproblems to nodes
+static Vec *nodes, *node_keys;
+
+// Whether a switch on the type matches its items one by one
+bool is_match_type(struct type *type)
+{
+	type = remove_const_and_volatile(type);
+	return type->kind == TUPLE_TYPE ||
+		(type->kind == ARRAY_TYPE && type->u.array.len != 0);
+}
+
+static size_t get_item_count(struct type *type)
+{
+	if (type->kind == TUPLE_TYPE) {
+		return vec_len(type->u.tuple.types);
+	}
+	return type->u.array.len;
+}
+
+static struct type *get_item_type(struct type *type, size_t i)
+{
+	if (type->kind == TUPLE_TYPE) {
+		return vec_get(type->u.tuple.types, i);
+	}
+	return type->u.array.l;
+}
+
+static Vec *get_item_patterns(struct switch_pattern *pattern)
+{
+	if (pattern->kind == TUPLE_SWITCH_PATTERN) {
+		return pattern->u.tuple.patterns;
+	}
+	assert(pattern->kind == ARRAY_SWITCH_PATTERN);
+	return pattern->u.array.patterns;
+}
+
+static size_t count_positions(struct type *type)
+{
+	size_t i, n;
+
+	type = remove_const_and_volatile(type);
+	if (!is_match_type(type)) {
+		return 1;
+	}
+	if (type->kind == ARRAY_TYPE) {
+		return type->u.array.len * count_positions(type->u.array.l);
+	}
+	n = 0;
+	for (i = 0; i < get_item_count(type); i++) {
+		n += count_positions(get_item_type(type, i));
+	}
+	return n;
+}
+
+// Takes ownership of `path`, which has `depth` item indices
+static void add_positions(struct type *type, size_t *path, size_t depth)
+{
+	struct match_pos *pos;
+	size_t *item_path, i, j;
+
+	type = remove_const_and_volatile(type);
+	if (is_match_type(type)) {
+		for (i = 0; i < get_item_count(type); i++) {
+			item_path = xmalloc((depth + 1) * sizeof(size_t));
+			for (j = 0; j < depth; j++) {
+				item_path[j] = path[j];
+			}
+			item_path[depth] = i;
+			add_positions(get_item_type(type, i), item_path,
+					depth + 1);
+		}
+		free(path);
+		return;
+	}
+	if (npositions == nalloc_positions) {
+		nalloc_positions = 2 * nalloc_positions + 8;
+		positions = xrealloc(positions,
+				nalloc_positions * sizeof(struct match_pos));
+	}
+	pos = &positions[npositions++];
+	pos->path = path;
+	pos->depth = depth;
+	pos->type = type;
+}
+
+static uint64_t eval_pattern_val(struct expr *expr, struct type *type)
+{
+	unsigned bits;
+	uint64_t val;
+
+	bits = get_switch_bits(type);
+	val = eval_pattern_const_expr(expr);
+	if (bits < 64) {
+		val &= ((uint64_t) 1 << bits) - 1;
+	}
+	return val;
+}
+
+// Returns whether the pattern of a scalar matches every value
+static bool add_cell_vals(struct cell *cell, struct switch_pattern *pattern,
+		struct type *type)
+{
+	Vec *patterns;
+	bool matches_all;
+	size_t i;
+
+	switch (pattern->kind) {
+	case UNDERSCORE_SWITCH_PATTERN:
+		return true;
+	case OR_SWITCH_PATTERN:
+		patterns = pattern->u.or.patterns;
+		matches_all = false;
+		for (i = 0; i < vec_len(patterns); i++) {
+			if (add_cell_vals(cell, vec_get(patterns, i), type)) {
+				matches_all = true;
+			}
+		}
+		return matches_all;
+	case EXPR_SWITCH_PATTERN:
+		cell->vals = xrealloc(cell->vals,
+				(cell->nvals + 1) * sizeof(uint64_t));
+		cell->vals[cell->nvals++] = eval_pattern_val(
+				pattern->u.expr.expr, type);
+		return false;
+	case ARRAY_SWITCH_PATTERN:
+	case TUPLE_SWITCH_PATTERN:
+		break;
+	}
+	internal_error();
+}
+
+static void push_pending(struct pending *pending,
+		struct switch_pattern *pattern, struct type *type, size_t pos)
+{
+	if (pending->len == pending->nalloc) {
+		pending->nalloc = 2 * pending->nalloc + 8;
+		pending->items = xrealloc(pending->items,
+				pending->nalloc * sizeof(*pending->items));
+	}
+	pending->items[pending->len].pattern = pattern;
+	pending->items[pending->len].type = type;
+	pending->items[pending->len].pos = pos;
+	pending->len++;
+}
+
+static struct cell *copy_cells(struct cell *cells)
+{
+	struct cell *copy;
+	size_t i, size;
+
+	copy = xmalloc(npositions * sizeof(struct cell));
+	for (i = 0; i < npositions; i++) {
+		copy[i] = cells[i];
+		if (cells[i].vals != NULL) {
+			size = cells[i].nvals * sizeof(uint64_t);
+			copy[i].vals = memcpy(xmalloc(size), cells[i].vals,
+					size);
+		}
+	}
+	return copy;
+}
+
+static void free_cells(struct cell *cells)
+{
+	size_t i;
+
+	for (i = 0; i < npositions; i++) {
+		free(cells[i].vals);
+	}
+	free(cells);
+}
+
+static void add_row(struct cell *cells, size_t case_index, unsigned lineno)
+{
+	if (nrows == nalloc_rows) {
+		nalloc_rows = 2 * nalloc_rows + 8;
+		rows = xrealloc(rows, nalloc_rows * sizeof(struct row));
+	}
+	rows[nrows].cells = cells;
+	rows[nrows].case_index = case_index;
+	rows[nrows].lineno = lineno;
+	rows[nrows].is_used = false;
+	nrows++;
+}
+
+/*
+ * Adds the rows of a case, splitting it at each `|` of tuple or array
+ * patterns. Takes ownership of `cells` and `pending`.
+ */
+static void add_rows(struct cell *cells, struct pending *pending,
+		size_t case_index, unsigned lineno)
+{
+	struct switch_pattern *pattern, *alt;
+	struct pending alt_pending;
+	struct type *type;
+	Vec *patterns;
+	size_t i, pos;
+
+	while (pending->len > 0) {
+		pending->len--;
+		pattern = pending->items[pending->len].pattern;
+		type = remove_const_and_volatile(
+				pending->items[pending->len].type);
+		pos = pending->items[pending->len].pos;
+		if (!is_match_type(type)) {
+			if (add_cell_vals(&cells[pos], pattern, type)) {
+				free(cells[pos].vals);
+				cells[pos].vals = NULL;
+				cells[pos].nvals = 0;
+			}
+			continue;
+		}
+		switch (pattern->kind) {
+		case UNDERSCORE_SWITCH_PATTERN:
+			break;
+		case ARRAY_SWITCH_PATTERN:
+		case TUPLE_SWITCH_PATTERN:
+			// Pushed in reverse, so rows split in source order
+			patterns = get_item_patterns(pattern);
+			pos += count_positions(type);
+			for (i = vec_len(patterns); i-- > 0;) {
+				pos -= count_positions(get_item_type(type, i));
+				push_pending(pending, vec_get(patterns, i),
+						get_item_type(type, i), pos);
+			}
+			break;
+		case OR_SWITCH_PATTERN:
+			patterns = pattern->u.or.patterns;
+			for (i = 0; i < vec_len(patterns); i++) {
+				alt = vec_get(patterns, i);
+				alt_pending.len = pending->len;
+				alt_pending.nalloc = pending->len;
+				alt_pending.items = xmalloc(pending->len *
+						sizeof(*pending->items));
+				memcpy(alt_pending.items, pending->items,
+						pending->len *
+						sizeof(*pending->items));
+				push_pending(&alt_pending, alt, type, pos);
+				add_rows(copy_cells(cells), &alt_pending,
+						case_index, alt->lineno);
+			}
+			free_cells(cells);
+			free(pending->items);
+			return;
+		case EXPR_SWITCH_PATTERN:
+			internal_error();
+		}
+	}
+	free(pending->items);
+	add_row(cells, case_index, lineno);
+}
+
+static bool cell_matches(struct cell *cell, uint64_t val)
+{
+	size_t i;
+
+	if (cell->vals == NULL) {
+		return true;
+	}
+	for (i = 0; i < cell->nvals; i++) {
+		if (cell->vals[i] == val) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Returns `npositions` if the first row matches whatever is left untested
+static size_t choose_pos(size_t *row_indices, size_t n)
+{
+	struct cell *first_cells;
+	size_t pos, best_pos, count, best_count, i;
+
+	first_cells = rows[row_indices[0]].cells;
+	best_pos = npositions;
+	best_count = 0;
+	for (pos = 0; pos < npositions; pos++) {
+		if (is_tested[pos] || first_cells[pos].vals == NULL) {
+			continue;
+		}
+		count = 0;
+		for (i = 0; i < n; i++) {
+			if (rows[row_indices[i]].cells[pos].vals != NULL) {
+				count++;
+			}
+		}
+		if (count > best_count) {
+			best_pos = pos;
+			best_count = count;
+		}
+	}
+	return best_pos;
+}
+
+static int compare_vals(const void *p1, const void *p2)
+{
+	uint64_t val1 = *(const uint64_t *) p1, val2 = *(const uint64_t *) p2;
+
+	return (val1 > val2) - (val1 < val2);
+}
+
+// Sets the values a test branches on, which are those any row names
+static void add_test_vals(struct match_node *node, size_t *row_indices,
+		size_t n)
+{
+	struct cell *cell;
+	size_t i, j, len;
+
+	node->nvals = 0;
+	node->vals = NULL;
+	for (i = 0; i < n; i++) {
+		cell = &rows[row_indices[i]].cells[node->pos];
+		node->vals = xrealloc(node->vals, (node->nvals + cell->nvals) *
+				sizeof(uint64_t));
+		for (j = 0; j < cell->nvals; j++) {
+			node->vals[node->nvals++] = cell->vals[j];
+		}
+	}
+	qsort(node->vals, node->nvals, sizeof(uint64_t), compare_vals);
+	len = 0;
+	for (i = 0; i < node->nvals; i++) {
+		if (len == 0 || node->vals[i] != node->vals[len - 1]) {
+			node->vals[len++] = node->vals[i];
+		}
+	}
+	node->nvals = len;
+}
+
+static bool covers_type(struct match_node *node)
+{
+	unsigned bits;
+
+	bits = get_switch_bits(positions[node->pos].type);
+	return bits < 64 && node->nvals == (uint64_t) 1 << bits;
+}
+
+/*
+ * Identifies the rows and the tested positions that some of them test, which
+ * are all the node built for the rows depends on
+ */
+static char *get_subproblem_key(size_t *row_indices, size_t n)
+{
+	char *key, *p;
+	size_t pos, i;
+
+	key = xmalloc((n + npositions + 1) * (2 * sizeof(size_t) + 1) + 1);
+	p = key;
+	for (i = 0; i < n; i++) {
+		p += sprintf(p, "%zx,", row_indices[i]);
+	}
+	*p++ = '|';
+	for (pos = 0; pos < npositions; pos++) {
+		if (!is_tested[pos]) {
+			continue;
+		}
+		for (i = 0; i < n; i++) {
+			if (rows[row_indices[i]].cells[pos].vals != NULL) {
+				p += sprintf(p, "%zx,", pos);
+				break;
+			}
+		}
+	}
+	*p = '\0';
+	return key;
+}
+
+static struct match_node *build_node(size_t *, size_t);
+
+// Returns NULL if no row is left to match
+static struct match_node *get_node(size_t *row_indices, size_t n)
+{
+	struct match_node *node;
+	char *key;
+
+	if (n == 0) {
+		return NULL;
+	}
+	key = get_subproblem_key(row_indices, n);
+	node = hash_table_get(built_nodes, key);
+	if (node != NULL) {
+		free(key);
+		return node;
+	}
+	node = build_node(row_indices, n);
+	hash_table_set(built_nodes, key, node);
+	vec_push(node_keys, key);
+	return node;
+}
+
+static struct match_node *build_node(size_t *row_indices, size_t n)
+{
+	struct match_node *node;
+	struct cell *cell;
+	size_t *sub_indices, nsub, i, j;
+
+	node = NEWC(struct match_node);
+	node->index = vec_len(nodes);
+	vec_push(nodes, node);
+	node->pos = choose_pos(row_indices, n);
+	if (node->pos == npositions) {
+		rows[row_indices[0]].is_used = true;
+		node->kind = MATCH_LEAF;
+		node->case_index = rows[row_indices[0]].case_index;
+		return node;
+	}
+	node->kind = MATCH_TEST;
+	add_test_vals(node, row_indices, n);
+	node->children = xmalloc(node->nvals * sizeof(struct match_node *));
+	sub_indices = xmalloc(n * sizeof(size_t));
+	is_tested[node->pos] = true;
+	for (i = 0; i < node->nvals; i++) {
+		nsub = 0;
+		for (j = 0; j < n; j++) {
+			cell = &rows[row_indices[j]].cells[node->pos];
+			if (cell_matches(cell, node->vals[i])) {
+				sub_indices[nsub++] = row_indices[j];
+			}
+		}
+		node->children[i] = get_node(sub_indices, nsub);
+	}
+	if (!covers_type(node)) {
+		nsub = 0;
+		for (j = 0; j < n; j++) {
+			cell = &rows[row_indices[j]].cells[node->pos];
+			if (cell->vals == NULL) {
+				sub_indices[nsub++] = row_indices[j];
+			}
+		}
+		node->default_ = get_node(sub_indices, nsub);
+		if (node->default_ == NULL) {
+			is_exhaustive = false;
+		}
+	}
+	is_tested[node->pos] = false;
+	free(sub_indices);
+	return node;
+}
+
+static void check_rows_used(Vec *cases)
+{
+	struct switch_case *case_;
+	bool *is_case_used;
+	size_t i;
+
+	is_case_used = xcalloc(vec_len(cases) * sizeof(bool));
+	for (i = 0; i < nrows; i++) {
+		if (rows[i].is_used) {
+			is_case_used[rows[i].case_index] = true;
+		}
+	}
+	for (i = 0; i < vec_len(cases); i++) {
+		case_ = vec_get(cases, i);
+		if (!is_case_used[i]) {
+			fatal_error(case_->lineno, "Switch case is "
+			                           "unreachable");
+		}
+	}
+	free(is_case_used);
+	for (i = 0; i < nrows; i++) {
+		if (!rows[i].is_used) {
+			fatal_error(rows[i].lineno, "Pattern only matches "
+			                            "values matched earlier");
+		}
+	}
+}
+
+// Frees the node alone, since its children can be shared
+static void free_match_node(void *p)
+{
+	struct match_node *node = p;
+
+	free(node->vals);
+	free(node->children);
+	free(node);
+}
+
+/*
+ * Reports cases that can't be reached, and values that no case matches. The
+ * patterns must already be type checked.
+ */
+struct match_tree *compile_match(struct expr *expr)
+{
+	struct match_tree *tree;
+	struct switch_case *case_;
+	struct pending pending;
+	struct type *ctrl_type;
+	size_t *row_indices, i;
+	Vec *cases;
+
+	assert(expr->kind == SWITCH_EXPR);
+	ctrl_type = expr->u.switch_.ctrl->type;
+	cases = expr->u.switch_.cases;
+	assert(is_match_type(ctrl_type));
+
+	add_positions(ctrl_type, NULL, 0);
+	for (i = 0; i < vec_len(cases); i++) {
+		case_ = vec_get(cases, i);
+		memset(&pending, 0, sizeof(pending));
+		push_pending(&pending, case_->l, ctrl_type, 0);
+		add_rows(xcalloc(npositions * sizeof(struct cell)), &pending,
+				i, case_->lineno);
+	}
+	row_indices = xmalloc(nrows * sizeof(size_t));
+	for (i = 0; i < nrows; i++) {
+		row_indices[i] = i;
+	}
+	is_tested = xcalloc(npositions * sizeof(bool));
+	is_exhaustive = true;
+	built_nodes = alloc_hash_table();
+	nodes = alloc_vec(free_match_node);
+	node_keys = alloc_vec(free);
+
+	tree = NEW(struct match_tree);
+	tree->root = get_node(row_indices, nrows);
+	tree->positions = positions;
+	tree->npositions = npositions;
+	tree->nodes = nodes;
+	check_rows_used(cases);
+	if (!is_exhaustive) {
+		fatal_error(expr->lineno, "Switch needs a `_` case, since not "
+		                          "every value is matched");
+	}
+
+	for (i = 0; i < nrows; i++) {
+		free_cells(rows[i].cells);
+	}
+	free(rows);
+	free(row_indices);
+	free(is_tested);
+	free_hash_table(built_nodes);
+	free_vec(node_keys);
+	rows = NULL;
+	nrows = nalloc_rows = 0;
+	positions = NULL;
+	npositions = nalloc_positions = 0;
+	return tree;
+}
+
+void free_match_tree(struct match_tree *tree)
+{
+	size_t i;
+
+	if (tree == NULL) {
+		return;
+	}
+	for (i = 0; i < tree->npositions; i++) {
+		free(tree->positions[i].path);
+	}
+	free(tree->positions);
+	free_vec(tree->nodes);
+	free(tree);
+}
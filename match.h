@@ -0,0 +1,32 @@
+// A scalar part of a matched value, reached through tuple and array items
+struct match_pos {
+	size_t *path; // Item indices from the outermost value
+	size_t depth;
+	struct type *type;
+};
+
+// Either selects a case, or switches on the value at one position
+struct match_node {
+	enum {
+		MATCH_LEAF, MATCH_TEST
+	} kind;
+	size_t index; // In the tree's nodes
+	size_t case_index; // Of a leaf
+	size_t pos; // Tested by a test
+	uint64_t *vals; // Sorted, each with a child
+	struct match_node **children;
+	size_t nvals;
+	struct match_node *default_; // NULL if the values cover the type
+};
+
+// Decision tree for a switch on a tuple or array
+struct match_tree {
+	struct match_pos *positions;
+	size_t npositions;
+	Vec *nodes; // Each once, since a node can have several parents
+	struct match_node *root;
+};
+
+bool is_match_type(struct type *);
+struct match_tree *compile_match(struct expr *);
+void free_match_tree(struct match_tree *);
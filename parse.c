@@ -1,5 +1,6 @@
 // LL(1) parser
 
+#include <inttypes.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -12,7 +13,6 @@
 #include "parse.h"
 
 #define MAX_FUNC_ARGS 127
-#define MAX_ARRAY_LEN 65536
 
 static struct tok cur_tok, lookahead_tok;
 
@@ -56,7 +56,9 @@ static NORETURN void expected_either_error(enum tok_kind expected1,
 }
 
 static struct type *parse_type(void);
+static Vec *parse_func_call_args(void);
 static struct switch_pattern *parse_switch_pattern(void);
+static struct expr *parse_pattern_expr(void);
 static struct expr *parse_expr(void);
 static struct stmt *parse_stmt(void);
 
@@ -110,17 +112,67 @@ static struct type *parse_array_type_suffix(struct type *type)
 	} else {
 		array_len_expr = parse_expr();
 		array_len = eval_const_expr(array_len_expr);
-		if (array_len > MAX_ARRAY_LEN) {
-			fatal_error(array_len_expr->lineno,
-					"Specified array length is greater "
-					"than %d", MAX_ARRAY_LEN);
-		}
 		free(array_len_expr);
 		expect_tok(CLOSE_BRACKET);
 	}
 	return ALLOC_ARRAY_TYPE(lineno, type, array_len);
 }
 
+// Parses a vector type like `F32x8`
+static struct type *parse_vector_type(void)
+{
+	unsigned lineno;
+	uint64_t len;
+	struct type *elem;
+
+	lineno = cur_tok.lineno;
+	expect_tok_no_consume(VECTOR);
+	len = cur_tok.u.vector.len;
+	if (len < 2 || len > MAX_VECTOR_LEN) {
+		fatal_error(lineno, "Vector length must be between 2 and %d",
+				MAX_VECTOR_LEN);
+	}
+	switch (cur_tok.u.vector.elem) {
+	case U8:
+		elem = ALLOC_U8_TYPE(lineno);
+		break;
+	case U16:
+		elem = ALLOC_U16_TYPE(lineno);
+		break;
+	case U32:
+		elem = ALLOC_U32_TYPE(lineno);
+		break;
+	case U64:
+		elem = ALLOC_U64_TYPE(lineno);
+		break;
+	case I8:
+		elem = ALLOC_I8_TYPE(lineno);
+		break;
+	case I16:
+		elem = ALLOC_I16_TYPE(lineno);
+		break;
+	case I32:
+		elem = ALLOC_I32_TYPE(lineno);
+		break;
+	case I64:
+		elem = ALLOC_I64_TYPE(lineno);
+		break;
+	case F32:
+		elem = ALLOC_F32_TYPE(lineno);
+		break;
+	case F64:
+		elem = ALLOC_F64_TYPE(lineno);
+		break;
+	case BOOL:
+		elem = ALLOC_BOOL_TYPE(lineno);
+		break;
+	default:
+		internal_error();
+	}
+	consume_tok();
+	return ALLOC_VECTOR_TYPE(lineno, elem, len);
+}
+
 static struct type *parse_type_suffix(struct type *type)
 {
 	unsigned lineno;
@@ -195,6 +247,13 @@ static struct type *parse_type(void)
 		expect_tok(GT);
 		type = ALLOC_VOLATILE_TYPE(lineno, type);
 		break;
+	case RESTRICT:
+		consume_tok();
+		expect_tok(LT);
+		type = parse_type();
+		expect_tok(GT);
+		type = ALLOC_RESTRICT_TYPE(lineno, type);
+		break;
 	case U8:
 		consume_tok();
 		type = ALLOC_U8_TYPE(lineno);
@@ -247,6 +306,15 @@ static struct type *parse_type(void)
 		consume_tok();
 		type = ALLOC_CHAR_TYPE(lineno);
 		break;
+	case STR:
+		// A UTF-8 byte string is a `const<U8>[]` slice
+		consume_tok();
+		type = ALLOC_ARRAY_TYPE(lineno, ALLOC_CONST_TYPE(lineno,
+					ALLOC_U8_TYPE(lineno)), 0);
+		break;
+	case VECTOR:
+		type = parse_vector_type();
+		break;
 	default:
 		fatal_error(lineno, "Expected a primary type, instead got %s",
 				tok_to_str(cur_tok.kind));
@@ -274,8 +342,9 @@ static struct expr *parse_lambda_expr(void)
 	lineno = cur_tok.lineno;
 	expect_tok(BACKSLASH);
 	params = alloc_vec(free);
-	while (accept_tok(IDENT)) {
+	while (cur_tok.kind == IDENT) {
 		vec_push(params, xstrdup(cur_tok.u.ident));
+		consume_tok();
 		if (vec_len(params) > MAX_FUNC_ARGS) {
 			fatal_error(lineno, "Lambda expression has more than "
 			                    "%d parameters", MAX_FUNC_ARGS);
@@ -285,6 +354,103 @@ static struct expr *parse_lambda_expr(void)
 	return ALLOC_LAMBDA_EXPR(lineno, params, parse_expr());
 }
 
+/*
+ * Parses `embed("file")`. The file is mapped rather than lexed, so embedding
+ * it costs no more than copying it into the object file.
+ */
+static struct expr *parse_embed_expr(void)
+{
+	unsigned lineno;
+	char *name, *data;
+	size_t len;
+
+	lineno = cur_tok.lineno;
+	expect_tok(EMBED);
+	expect_tok(OPEN_PAREN);
+	expect_tok_no_consume(STRING_LIT);
+	name = xstrndup(cur_tok.u.string_lit.val, cur_tok.u.string_lit.len);
+	consume_tok();
+	expect_tok(CLOSE_PAREN);
+	data = map_embedded_file(name, lineno, &len);
+	return ALLOC_EMBED_EXPR(lineno, name, data, len);
+}
+
+static const struct builtin_info {
+	const char *name;
+	enum builtin builtin;
+	int nargs; // Not counting the vector type argument
+	bool has_type; // Whether the first argument is a vector type
+} builtins[] = {
+	{"splat", SPLAT_BUILTIN, 1, true},
+	{"shuffle", SHUFFLE_BUILTIN, 3, false},
+	{"reduce_add", REDUCE_ADD_BUILTIN, 1, false},
+	{"reduce_mul", REDUCE_MUL_BUILTIN, 1, false},
+	{"reduce_min", REDUCE_MIN_BUILTIN, 1, false},
+	{"reduce_max", REDUCE_MAX_BUILTIN, 1, false},
+	{"reduce_and", REDUCE_AND_BUILTIN, 1, false},
+	{"reduce_or", REDUCE_OR_BUILTIN, 1, false},
+	{"reduce_xor", REDUCE_XOR_BUILTIN, 1, false},
+	{"load", LOAD_BUILTIN, 2, true},
+	{"store", STORE_BUILTIN, 3, false},
+	{"masked_load", MASKED_LOAD_BUILTIN, 3, true},
+	{"masked_store", MASKED_STORE_BUILTIN, 4, false}
+};
+
+// Returns NULL if `name` is not a builtin
+static const struct builtin_info *lookup_builtin(const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < ARRAY_LEN(builtins); i++) {
+		if (strcmp(builtins[i].name, name) == 0) {
+			return &builtins[i];
+		}
+	}
+	return NULL;
+}
+
+static bool is_builtin_call(void)
+{
+	return cur_tok.kind == AT && lookahead_tok.kind == IDENT &&
+		lookup_builtin(lookahead_tok.u.ident) != NULL;
+}
+
+// Parses a builtin call like `@splat(F32x8, x)` or `@reduce_add(v)`
+static struct expr *parse_builtin_expr(void)
+{
+	unsigned lineno;
+	const struct builtin_info *info;
+	struct type *type;
+	Vec *args;
+
+	lineno = cur_tok.lineno;
+	expect_tok(AT);
+	expect_tok_no_consume(IDENT);
+	info = lookup_builtin(cur_tok.u.ident);
+	if (info == NULL) {
+		fatal_error(lineno, "Unknown builtin `@%s`", cur_tok.u.ident);
+	}
+	consume_tok();
+	if (info->has_type) {
+		expect_tok(OPEN_PAREN);
+		type = parse_type();
+		args = alloc_vec(free_expr);
+		while (accept_tok(COMMA)) {
+			vec_push(args, parse_expr());
+		}
+		expect_tok(CLOSE_PAREN);
+	} else {
+		type = NULL;
+		args = parse_func_call_args();
+	}
+	if (vec_len(args) != (size_t) info->nargs) {
+		fatal_error(lineno, "`@%s` takes %d argument%s%s", info->name,
+				info->nargs, info->nargs == 1 ? "" : "s",
+				info->has_type ? " after its type" : "");
+	}
+	return ALLOC_BUILTIN_EXPR(lineno, info->builtin, type, args);
+}
+
 static struct expr *parse_array_lit_expr(void)
 {
 	unsigned lineno;
@@ -295,10 +461,6 @@ static struct expr *parse_array_lit_expr(void)
 	items = alloc_vec(free_expr);
 	do {
 		vec_push(items, parse_expr());
-		if (vec_len(items) > MAX_ARRAY_LEN) {
-			fatal_error(lineno, "Array literal has more than %d "
-			                    "items", MAX_ARRAY_LEN);
-		}
 	} while (accept_tok(COMMA));
 	expect_tok(CLOSE_BRACKET);
 	return ALLOC_ARRAY_LIT_EXPR(lineno, items);
@@ -403,7 +565,7 @@ static struct switch_pattern *parse_primary_switch_pattern(void)
 	case OPEN_PAREN:
 		return parse_tuple_switch_pattern();
 	default:
-		return ALLOC_EXPR_SWITCH_PATTERN(lineno, parse_expr());
+		return ALLOC_EXPR_SWITCH_PATTERN(lineno, parse_pattern_expr());
 	}
 }
 
@@ -426,14 +588,26 @@ static struct switch_pattern *parse_switch_pattern(void)
 	return ALLOC_OR_SWITCH_PATTERN(lineno, patterns);
 }
 
-static struct switch_case *parse_switch_case(void)
+// Without a value to match, each case is guarded by a condition or `_`
+static struct switch_pattern *parse_switch_cond(void)
+{
+	unsigned lineno;
+
+	lineno = cur_tok.lineno;
+	if (accept_tok(UNDERSCORE)) {
+		return ALLOC_UNDERSCORE_SWITCH_PATTERN(lineno);
+	}
+	return ALLOC_EXPR_SWITCH_PATTERN(lineno, parse_expr());
+}
+
+static struct switch_case *parse_switch_case(bool has_ctrl)
 {
 	unsigned lineno;
 	struct switch_pattern *l;
 	struct expr *r;
 
 	lineno = cur_tok.lineno;
-	l = parse_switch_pattern();
+	l = has_ctrl ? parse_switch_pattern() : parse_switch_cond();
 	expect_tok(BIG_ARROW);
 	r = parse_expr();
 	return ALLOC_SWITCH_CASE(lineno, l, r);
@@ -447,12 +621,16 @@ static struct expr *parse_switch_expr(void)
 
 	lineno = cur_tok.lineno;
 	expect_tok(SWITCH);
-	ctrl = cur_tok.kind == OPEN_PAREN ? parse_paren_expr() : NULL;
+	ctrl = cur_tok.kind == OPEN_PAREN ? parse_tuple_or_paren_expr() : NULL;
 	expect_tok(OPEN_BRACE);
 	cases = alloc_vec(free_switch_case);
+	// Cases are separated by commas, and may end with one
 	while (!accept_tok(CLOSE_BRACE)) {
-		// TODO: The case list may need a delimiter
-		vec_push(cases, parse_switch_case());
+		vec_push(cases, parse_switch_case(ctrl != NULL));
+		if (!accept_tok(COMMA)) {
+			expect_tok(CLOSE_BRACE);
+			break;
+		}
 	}
 	return ALLOC_SWITCH_EXPR(lineno, ctrl, cases);
 }
@@ -494,12 +672,16 @@ static struct expr *parse_primary_expr(void)
 		return ALLOC_CHAR_LIT_EXPR(lineno, val);
 	}
 	case STRING_LIT: {
-		char *str = xstrdup(cur_tok.u.string_lit.val);
-		unsigned len = cur_tok.u.string_lit.len;
+		size_t len = cur_tok.u.string_lit.len;
+		char *str = xstrndup(cur_tok.u.string_lit.val, len);
 
 		consume_tok();
 		return ALLOC_STRING_LIT_EXPR(lineno, str, len);
 	}
+	case EMBED:
+		return parse_embed_expr();
+	case AT:
+		return parse_builtin_expr();
 	case BACKSLASH:
 		return parse_lambda_expr();
 	case OPEN_BRACKET:
@@ -538,14 +720,28 @@ static Vec *parse_func_call_args(void)
 	return args;
 }
 
+// Parses `array[index]` or a slice `array[start..end]` with optional bounds
 static struct expr *parse_index_expr(struct expr *array)
 {
 	unsigned lineno;
-	struct expr *index;
+	struct expr *index, *end;
 
 	lineno = cur_tok.lineno;
 	expect_tok(OPEN_BRACKET);
-	index = parse_expr();
+	if (cur_tok.kind == DOT_DOT) {
+		index = NULL;
+	} else {
+		index = parse_expr();
+	}
+	if (accept_tok(DOT_DOT)) {
+		if (cur_tok.kind == CLOSE_BRACKET) {
+			end = NULL;
+		} else {
+			end = parse_expr();
+		}
+		expect_tok(CLOSE_BRACKET);
+		return ALLOC_SLICE_EXPR(lineno, array, index, end);
+	}
 	expect_tok(CLOSE_BRACKET);
 	return ALLOC_INDEX_EXPR(lineno, array, index);
 }
@@ -556,30 +752,38 @@ static struct expr *parse_postfix_unary_expr(void)
 	struct expr *operand;
 
 	operand = parse_primary_expr();
-	lineno = cur_tok.lineno;
-	switch (cur_tok.kind) {
-	case PLUS_PLUS:
-		consume_tok();
-		return ALLOC_UNARY_OP_EXPR(lineno, POST_INC_OP, operand);
-	case MINUS_MINUS:
-		consume_tok();
-		return ALLOC_UNARY_OP_EXPR(lineno, POST_DEC_OP, operand);
-	case OPEN_PAREN:
-		return ALLOC_FUNC_CALL_EXPR(lineno, operand,
-				parse_func_call_args());
-	case DOT: {
-		char *field;
+	for (;;) {
+		lineno = cur_tok.lineno;
+		switch (cur_tok.kind) {
+		case PLUS_PLUS:
+			consume_tok();
+			return ALLOC_UNARY_OP_EXPR(lineno, POST_INC_OP,
+					operand);
+		case MINUS_MINUS:
+			consume_tok();
+			return ALLOC_UNARY_OP_EXPR(lineno, POST_DEC_OP,
+					operand);
+		case OPEN_PAREN:
+			operand = ALLOC_FUNC_CALL_EXPR(lineno, operand,
+					parse_func_call_args());
+			break;
+		case DOT: {
+			char *field;
 
-		consume_tok();
-		expect_tok_no_consume(IDENT);
-		field = xstrdup(cur_tok.u.ident);
-		consume_tok();
-		return ALLOC_FIELD_ACCESS_EXPR(lineno, operand, field);
-	}
-	case OPEN_BRACKET:
-		  return parse_index_expr(operand);
-	default:
-		return operand;
+			consume_tok();
+			expect_tok_no_consume(IDENT);
+			field = xstrdup(cur_tok.u.ident);
+			consume_tok();
+			operand = ALLOC_FIELD_ACCESS_EXPR(lineno, operand,
+					field);
+			break;
+		}
+		case OPEN_BRACKET:
+			operand = parse_index_expr(operand);
+			break;
+		default:
+			return operand;
+		}
 	}
 }
 
@@ -630,7 +834,6 @@ static bool is_bin_op(enum tok_kind tok_kind)
 	case PLUS_EQ: case MINUS_EQ:
 	case STAR_EQ: case SLASH_EQ: case PERCENT_EQ:
 	case AMP_EQ: case PIPE_EQ: case CARET_EQ: case LT_LT_EQ: case GT_GT_EQ:
-	case DOT:
 		return true;
 	default:
 		return false;
@@ -852,6 +1055,13 @@ static struct expr *parse_expr(void)
 	return parse_expr__(parse_unary_expr(), 0);
 }
 
+// Stops before `|`, which separates the alternatives of a pattern
+static struct expr *parse_pattern_expr(void)
+{
+	return parse_expr__(parse_unary_expr(),
+			get_bin_op_prec(BIT_OR_OP) + 1);
+}
+
 static struct decl *parse_decl(void);
 
 static struct stmt *parse_decl_stmt(void)
@@ -890,7 +1100,95 @@ static struct stmt *parse_if_stmt(void)
 	return ALLOC_IF_STMT(lineno, cond, then_stmts, else_stmts);
 }
 
-static struct stmt *parse_do_stmt(void)
+static bool accept_ident(const char *name)
+{
+	if (cur_tok.kind == IDENT && strcmp(cur_tok.u.ident, name) == 0) {
+		consume_tok();
+		return true;
+	}
+	return false;
+}
+
+static unsigned parse_loop_hint_count(void)
+{
+	unsigned lineno;
+	struct expr *expr;
+	uint64_t count;
+
+	lineno = cur_tok.lineno;
+	expr = parse_expr();
+	count = eval_const_expr(expr);
+	free_expr(expr);
+	if (count == 0 || count > UINT32_MAX) {
+		fatal_error(lineno, "Loop hint count must be between 1 and %"
+		                    PRIu32, UINT32_MAX);
+	}
+	return count;
+}
+
+static unsigned parse_vectorize_width(void)
+{
+	unsigned lineno, width;
+
+	lineno = cur_tok.lineno;
+	if (!accept_ident("width")) {
+		fatal_error(lineno, "Expected `width`, instead got %s",
+				tok_to_str(cur_tok.kind));
+	}
+	expect_tok(EQ);
+	width = parse_loop_hint_count();
+	if ((width & (width - 1)) != 0) {
+		fatal_error(lineno, "Vectorization width must be a power of "
+		                    "two");
+	}
+	return width;
+}
+
+static void set_loop_hint(unsigned lineno, enum loop_hint *hint,
+		enum loop_hint val)
+{
+	if (*hint != DEFAULT_HINT) {
+		fatal_error(lineno, "Conflicting loop hints");
+	}
+	*hint = val;
+}
+
+// Parses annotations like `@vectorize(width=8) @unroll(4)` before a loop
+static struct loop_hints parse_loop_hints(void)
+{
+	struct loop_hints hints;
+	unsigned lineno;
+
+	memset(&hints, 0, sizeof(hints));
+	while (cur_tok.kind == AT) {
+		lineno = cur_tok.lineno;
+		consume_tok();
+		expect_tok_no_consume(IDENT);
+		if (accept_ident("vectorize")) {
+			set_loop_hint(lineno, &hints.vectorize, ENABLE_HINT);
+			if (accept_tok(OPEN_PAREN)) {
+				hints.vectorize_width = parse_vectorize_width();
+				expect_tok(CLOSE_PAREN);
+			}
+		} else if (accept_ident("novectorize")) {
+			set_loop_hint(lineno, &hints.vectorize, DISABLE_HINT);
+		} else if (accept_ident("unroll")) {
+			set_loop_hint(lineno, &hints.unroll, ENABLE_HINT);
+			if (accept_tok(OPEN_PAREN)) {
+				hints.unroll_count = parse_loop_hint_count();
+				expect_tok(CLOSE_PAREN);
+			}
+		} else if (accept_ident("nounroll")) {
+			set_loop_hint(lineno, &hints.unroll, DISABLE_HINT);
+		} else {
+			fatal_error(lineno, "Unknown loop hint `@%s`",
+					cur_tok.u.ident);
+		}
+	}
+	return hints;
+}
+
+static struct stmt *parse_do_stmt(struct loop_hints hints)
 {
 	unsigned lineno;
 	Vec *stmts;
@@ -902,10 +1200,10 @@ static struct stmt *parse_do_stmt(void)
 	expect_tok(WHILE);
 	cond = parse_paren_expr();
 	expect_tok(SEMICOLON);
-	return ALLOC_DO_STMT(lineno, stmts, cond);
+	return ALLOC_DO_STMT(lineno, stmts, cond, hints);
 }
 
-static struct stmt *parse_while_stmt(void)
+static struct stmt *parse_while_stmt(struct loop_hints hints)
 {
 	unsigned lineno;
 	Vec *stmts;
@@ -915,10 +1213,10 @@ static struct stmt *parse_while_stmt(void)
 	expect_tok(WHILE);
 	cond = parse_paren_expr();
 	stmts = parse_compound_stmt();
-	return ALLOC_WHILE_STMT(lineno, stmts, cond);
+	return ALLOC_WHILE_STMT(lineno, stmts, cond, hints);
 }
 
-static struct stmt *parse_for_stmt(void)
+static struct stmt *parse_for_stmt(struct loop_hints hints)
 {
 	unsigned lineno;
 	struct expr *init, *cond, *post;
@@ -946,7 +1244,26 @@ static struct stmt *parse_for_stmt(void)
 		expect_tok(CLOSE_PAREN);
 	}
 	stmts = parse_compound_stmt();
-	return ALLOC_FOR_STMT(lineno, init, cond, post, stmts);
+	return ALLOC_FOR_STMT(lineno, init, cond, post, stmts, hints);
+}
+
+static struct stmt *parse_hinted_loop_stmt(void)
+{
+	struct loop_hints hints;
+
+	hints = parse_loop_hints();
+	switch (cur_tok.kind) {
+	case DO:
+		return parse_do_stmt(hints);
+	case WHILE:
+		return parse_while_stmt(hints);
+	case FOR:
+		return parse_for_stmt(hints);
+	default:
+		fatal_error(cur_tok.lineno, "Expected a loop after loop hints, "
+		                            "instead got %s",
+		                            tok_to_str(cur_tok.kind));
+	}
 }
 
 static struct stmt *parse_return_stmt(void)
@@ -962,7 +1279,29 @@ static struct stmt *parse_return_stmt(void)
 		expr = parse_expr();
 		expect_tok(SEMICOLON);
 	}
-	return ALLOC_RETURN_STMT(lineno, expr);
+	return ALLOC_RETURN_STMT(lineno, expr, false);
+}
+
+// `become f(x);` returns the result of a call that replaces the caller
+static struct stmt *parse_become_stmt(void)
+{
+	unsigned lineno;
+	struct expr *expr;
+
+	lineno = cur_tok.lineno;
+	expect_tok(BECOME);
+	expr = parse_expr();
+	expect_tok(SEMICOLON);
+	return ALLOC_RETURN_STMT(lineno, expr, true);
+}
+
+static struct stmt *parse_defer_stmt(void)
+{
+	unsigned lineno;
+
+	lineno = cur_tok.lineno;
+	expect_tok(DEFER);
+	return ALLOC_DEFER_STMT(lineno, parse_stmt());
 }
 
 static struct stmt *parse_break_stmt(void)
@@ -998,6 +1337,8 @@ static struct stmt *parse_expr_stmt(void)
 
 static struct stmt *parse_stmt(void)
 {
+	static const struct loop_hints no_hints;
+
 	switch (cur_tok.kind) {
 	case LET:
 	case VAR:
@@ -1005,13 +1346,22 @@ static struct stmt *parse_stmt(void)
 	case IF:
 		return parse_if_stmt();
 	case DO:
-		return parse_do_stmt();
+		return parse_do_stmt(no_hints);
 	case WHILE:
-		return parse_while_stmt();
+		return parse_while_stmt(no_hints);
 	case FOR:
-		return parse_for_stmt();
+		return parse_for_stmt(no_hints);
+	case AT:
+		if (is_builtin_call()) {
+			return parse_expr_stmt();
+		}
+		return parse_hinted_loop_stmt();
 	case RETURN:
 		return parse_return_stmt();
+	case BECOME:
+		return parse_become_stmt();
+	case DEFER:
+		return parse_defer_stmt();
 	case BREAK:
 		return parse_break_stmt();
 	case CONTINUE:
@@ -1081,14 +1431,43 @@ static struct decl *parse_typedef(void)
 	return ALLOC_TYPEDEF_DECL(lineno, name, params, type);
 }
 
+// Parses annotations like `@inline @hot` before a function
+static unsigned parse_func_attrs(void)
+{
+	unsigned lineno, attrs;
+
+	attrs = 0;
+	while (cur_tok.kind == AT) {
+		lineno = cur_tok.lineno;
+		consume_tok();
+		expect_tok_no_consume(IDENT);
+		if (accept_ident("inline")) {
+			attrs |= INLINE_ATTR;
+		} else if (accept_ident("always_inline")) {
+			attrs |= ALWAYS_INLINE_ATTR;
+		} else if (accept_ident("noinline")) {
+			attrs |= NOINLINE_ATTR;
+		} else if (accept_ident("hot")) {
+			attrs |= HOT_ATTR;
+		} else if (accept_ident("cold")) {
+			attrs |= COLD_ATTR;
+		} else {
+			fatal_error(lineno, "Unknown function attribute `@%s`",
+					cur_tok.u.ident);
+		}
+	}
+	return attrs;
+}
+
 static struct decl *parse_func_decl(void)
 {
-	unsigned lineno;
+	unsigned lineno, attrs;
 	struct type *type, *return_type;
 	char *name;
 	Vec *param_types, *param_names;
 	Vec *body_stmts;
 
+	attrs = parse_func_attrs();
 	return_type = parse_type();
 	expect_tok_no_consume(IDENT);
 	lineno = cur_tok.lineno;
@@ -1108,9 +1487,14 @@ static struct decl *parse_func_decl(void)
 		} while (accept_tok(COMMA));
 	}
 	expect_tok(CLOSE_PAREN);
-	body_stmts = parse_compound_stmt();
+	if (accept_tok(SEMICOLON)) {
+		body_stmts = NULL; // Prototype
+	} else {
+		body_stmts = parse_compound_stmt();
+	}
 	type = ALLOC_FUNC_TYPE(lineno, return_type, param_types);
-	return ALLOC_FUNC_DECL(lineno, type, name, param_names, body_stmts);
+	return ALLOC_FUNC_DECL(lineno, type, name, param_names, body_stmts,
+			attrs);
 }
 
 static struct decl *parse_decl(void)
@@ -0,0 +1,188 @@
+/*
+ * Reads profiles written by programs compiled with `-fprofile-generate`. Each
+ * line of a profile is a function name, the number of counters and the
+ * counters themselves. Every run of the program appends its counts, so the
+ * counts of all runs are summed here.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ds.h"
+#include "quoftc.h"
+#include "profile.h"
+
+#define PROFILE_DELIMS " \t\n"
+
+static const uint32_t cutoffs[NUM_PROFILE_CUTOFFS] = {
+	10000, 100000, 200000, 300000, 400000, 500000, 600000, 700000,
+	800000, 900000, 950000, 990000, 999000, 999900, 999990, 999999
+};
+
+static HashTable *func_profiles;
+static Vec *func_profile_list;
+
+static NORETURN void profile_error(const char *filename, const char *msg)
+{
+	fprintf(stderr, "%s: error: %s: %s\n", argv0, filename, msg);
+	exit(EXIT_FAILURE);
+}
+
+static char *read_file(const char *filename)
+{
+	char *buf;
+	long len;
+	FILE *fp;
+
+	fp = fopen(filename, "r");
+	if (fp == NULL || fseek(fp, 0, SEEK_END) != 0 ||
+			(len = ftell(fp)) < 0 || fseek(fp, 0, SEEK_SET) != 0) {
+		profile_error(filename, strerror(errno));
+	}
+	buf = xmalloc(len + 1);
+	if (fread(buf, 1, len, fp) != (size_t) len) {
+		profile_error(filename, "Failed to read profile");
+	}
+	buf[len] = '\0';
+	fclose(fp);
+	return buf;
+}
+
+static bool parse_count(uint64_t *count, const char *s)
+{
+	char *end;
+
+	if (s == NULL || *s < '0' || *s > '9') {
+		return false;
+	}
+	errno = 0;
+	*count = strtoull(s, &end, 10);
+	return *end == '\0' && errno == 0;
+}
+
+static void add_func_profile(char *name, struct func_profile *prof)
+{
+	struct func_profile *old_prof;
+	size_t i;
+
+	old_prof = hash_table_get(func_profiles, name);
+	if (old_prof == NULL) {
+		hash_table_set(func_profiles, xstrdup(name), prof);
+		vec_push(func_profile_list, prof);
+		return;
+	}
+	if (old_prof->ncounts == prof->ncounts) {
+		for (i = 0; i < prof->ncounts; i++) {
+			old_prof->counts[i] += prof->counts[i];
+		}
+	} else {
+		// The function changed between runs, so keep the newer counts
+		free(old_prof->counts);
+		*old_prof = *prof;
+		prof->counts = NULL;
+	}
+	free(prof->counts);
+	free(prof);
+}
+
+void read_profile(const char *filename)
+{
+	struct func_profile *prof;
+	uint64_t ncounts;
+	char *buf, *name;
+	size_t i;
+
+	func_profiles = alloc_hash_table();
+	func_profile_list = alloc_vec(NULL);
+	buf = read_file(filename);
+	for (name = strtok(buf, PROFILE_DELIMS); name != NULL;
+			name = strtok(NULL, PROFILE_DELIMS)) {
+		if (!parse_count(&ncounts, strtok(NULL, PROFILE_DELIMS)) ||
+				ncounts == 0 || ncounts > SIZE_MAX /
+				sizeof(uint64_t)) {
+			profile_error(filename, "Malformed profile");
+		}
+		prof = NEW(struct func_profile);
+		prof->ncounts = ncounts;
+		prof->counts = xmalloc(sizeof(uint64_t) * ncounts);
+		for (i = 0; i < ncounts; i++) {
+			if (!parse_count(&prof->counts[i],
+						strtok(NULL, PROFILE_DELIMS))) {
+				profile_error(filename, "Malformed profile");
+			}
+		}
+		add_func_profile(name, prof);
+	}
+	free(buf);
+}
+
+// Returns NULL if the function has no profile or no profile was read
+struct func_profile *get_func_profile(const char *func_name)
+{
+	if (func_profiles == NULL) {
+		return NULL;
+	}
+	return hash_table_get(func_profiles, func_name);
+}
+
+static int cmp_counts_desc(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+	return (x < y) - (x > y);
+}
+
+static uint64_t max(uint64_t x, uint64_t y)
+{
+	return x > y ? x : y;
+}
+
+struct profile_summary get_profile_summary(void)
+{
+	struct profile_summary summary = {0};
+	struct func_profile *prof;
+	uint64_t *counts, desired, sum;
+	size_t i, j, ncounts;
+
+	for (i = 0; i < vec_len(func_profile_list); i++) {
+		summary.ncounts += ((struct func_profile *)
+				vec_get(func_profile_list, i))->ncounts;
+	}
+	counts = xmalloc(sizeof(uint64_t) * (summary.ncounts + 1));
+	ncounts = 0;
+	for (i = 0; i < vec_len(func_profile_list); i++) {
+		prof = vec_get(func_profile_list, i);
+		summary.max_function_count = max(summary.max_function_count,
+				prof->counts[0]);
+		for (j = 0; j < prof->ncounts; j++) {
+			if (j != 0) {
+				summary.max_internal_count = max(
+						summary.max_internal_count,
+						prof->counts[j]);
+			}
+			summary.total_count += prof->counts[j];
+			counts[ncounts++] = prof->counts[j];
+		}
+	}
+	summary.max_count = max(summary.max_function_count,
+			summary.max_internal_count);
+	summary.nfuncs = vec_len(func_profile_list);
+	qsort(counts, ncounts, sizeof(uint64_t), cmp_counts_desc);
+	sum = 0;
+	j = 0;
+	for (i = 0; i < NUM_PROFILE_CUTOFFS; i++) {
+		desired = summary.total_count / 1000000 * cutoffs[i] +
+			summary.total_count % 1000000 * cutoffs[i] / 1000000;
+		while (sum < desired && j < ncounts) {
+			sum += counts[j++];
+		}
+		summary.cutoffs[i].cutoff = cutoffs[i];
+		summary.cutoffs[i].min_count = j == 0 ? 0 : counts[j - 1];
+		summary.cutoffs[i].ncounts = j;
+	}
+	free(counts);
+	return summary;
+}
@@ -0,0 +1,24 @@
+#define NUM_PROFILE_CUTOFFS 16
+
+// Execution counts of one function, written by `-fprofile-generate`
+struct func_profile {
+	size_t ncounts;
+	uint64_t *counts; // Entry count, then a (taken, not taken) pair per branch
+};
+
+struct profile_cutoff {
+	uint32_t cutoff; // Parts per million of the total count
+	uint64_t min_count;
+	uint64_t ncounts;
+};
+
+// Summary of a whole profile, used by LLVM to classify hot and cold code
+struct profile_summary {
+	uint64_t total_count, max_count, max_internal_count,
+		 max_function_count, ncounts, nfuncs;
+	struct profile_cutoff cutoffs[NUM_PROFILE_CUTOFFS];
+};
+
+void read_profile(const char *filename);
+struct func_profile *get_func_profile(const char *func_name);
+struct profile_summary get_profile_summary(void);
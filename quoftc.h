@@ -24,5 +24,23 @@ MALLOC void *xmalloc(size_t);
 MALLOC void *xcalloc(size_t);
 void *xrealloc(void *, size_t);
 char *xstrdup(const char *);
+char *xstrndup(const char *, size_t);
+void compile_args(int argc, const char *argv[]);
+
+enum emit_kind {
+	EMIT_OBJ, EMIT_ASM, EMIT_LLVM_IR, EMIT_BITCODE
+};
+
+// Command line options
+struct options {
+	enum emit_kind emit;
+	bool lto, bounds_check;
+	unsigned opt_level;
+	const char *profile_generate, *profile_use; // Profile paths or NULL
+	const char *server_socket; // Socket path or NULL
+	// Comma-separated definitions kept external by `-flto`, NULL for all
+	const char *lto_exports;
+};
 
 extern const char *argv0;
+extern struct options options;
@@ -0,0 +1,277 @@
+/*
+ * A compile server that keeps LLVM's targets and target machines initialized
+ * between compiles. Clients (see client/client.c) forward their command lines
+ * to it over a Unix domain socket.
+ *
+ * A client sends its working directory and arguments as NUL-terminated
+ * strings and then shuts down its side of the socket. The server forks a
+ * handler for each connection, which forks a child to compile with stdout and
+ * stderr sent to a pipe. The handler answers with frames of a kind byte, a
+ * 4-byte big-endian length and data: an output frame for each chunk read from
+ * the pipe, and then a status frame holding the child's exit status. A child
+ * killed by a signal gets the status 128 plus the signal number.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "ds.h"
+#include "quoftc.h"
+#include "ast.h"
+#include "code_gen.h"
+#include "server.h"
+
+#define READ_SIZE 4096
+#define OUTPUT_FRAME 'o'
+#define STATUS_FRAME 's'
+
+static NORETURN void sys_error(const char *what)
+{
+	fprintf(stderr, "%s: error: %s: %s\n", argv0, what, strerror(errno));
+	exit(EXIT_FAILURE);
+}
+
+static bool write_all(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t n;
+
+	while (len > 0) {
+		n = write(fd, p, len);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		p += n;
+		len -= n;
+	}
+	return true;
+}
+
+// Reads `fd` until end of file into a buffer that must be freed
+static char *read_all(int fd, size_t *len)
+{
+	char *buf;
+	size_t nalloc;
+	ssize_t n;
+
+	nalloc = READ_SIZE;
+	buf = xmalloc(nalloc);
+	*len = 0;
+	for (;;) {
+		if (*len == nalloc) {
+			nalloc *= 2;
+			buf = xrealloc(buf, nalloc);
+		}
+		n = read(fd, buf + *len, nalloc - *len);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			sys_error("read");
+		}
+		if (n == 0) {
+			return buf;
+		}
+		*len += n;
+	}
+}
+
+static struct sockaddr_un get_socket_addr(const char *socket_file)
+{
+	struct sockaddr_un addr;
+
+	if (strlen(socket_file) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "%s: error: Socket path `%s` is too long\n",
+				argv0, socket_file);
+		exit(EXIT_FAILURE);
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socket_file);
+	return addr;
+}
+
+// Compiles as the request read from `conn_fd` asks, with output to `out_fd`
+static NORETURN void compile_request(int conn_fd, int out_fd)
+{
+	char *request, *p;
+	const char **args;
+	size_t len, nargs;
+
+	request = read_all(conn_fd, &len);
+	close(conn_fd);
+	if (dup2(out_fd, STDOUT_FILENO) < 0 ||
+			dup2(out_fd, STDERR_FILENO) < 0) {
+		_exit(EXIT_FAILURE);
+	}
+	close(out_fd);
+	if (len == 0 || request[len - 1] != '\0') {
+		fprintf(stderr, "%s: error: Malformed compile request\n",
+				argv0);
+		exit(EXIT_FAILURE);
+	}
+	args = xmalloc(len * sizeof(char *));
+	nargs = 0;
+	for (p = request; p < request + len; p += strlen(p) + 1) {
+		args[nargs++] = p;
+	}
+	// The first string is the client's working directory
+	if (nargs < 2) {
+		fprintf(stderr, "%s: error: Malformed compile request\n",
+				argv0);
+		exit(EXIT_FAILURE);
+	}
+	if (chdir(args[0]) != 0) {
+		sys_error(args[0]);
+	}
+	compile_args(nargs - 1, args + 1);
+	fflush(stdout);
+	_exit(EXIT_SUCCESS);
+}
+
+static bool send_frame(int conn_fd, char kind, const char *data,
+		uint32_t len)
+{
+	unsigned char header[5];
+
+	header[0] = kind;
+	header[1] = len >> 24;
+	header[2] = len >> 16;
+	header[3] = len >> 8;
+	header[4] = len;
+	return write_all(conn_fd, header, sizeof(header)) &&
+		write_all(conn_fd, data, len);
+}
+
+// Relays the output of a compiling child and then its exit status
+static NORETURN void serve_request(int conn_fd)
+{
+	char buf[READ_SIZE], status;
+	int pipe_fds[2], wstatus;
+	ssize_t n;
+	pid_t pid;
+
+	if (pipe(pipe_fds) != 0) {
+		_exit(EXIT_FAILURE);
+	}
+	pid = fork();
+	if (pid == 0) {
+		close(pipe_fds[0]);
+		compile_request(conn_fd, pipe_fds[1]);
+	}
+	close(pipe_fds[1]);
+	if (pid < 0) {
+		_exit(EXIT_FAILURE);
+	}
+	for (;;) {
+		n = read(pipe_fds[0], buf, sizeof(buf));
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			break;
+		}
+		// Keep draining the pipe even if the client hung up
+		send_frame(conn_fd, OUTPUT_FRAME, buf, n);
+	}
+	while (waitpid(pid, &wstatus, 0) < 0) {
+		if (errno != EINTR) {
+			_exit(EXIT_FAILURE);
+		}
+	}
+	if (WIFEXITED(wstatus)) {
+		status = WEXITSTATUS(wstatus);
+	} else if (WIFSIGNALED(wstatus)) {
+		status = 128 + WTERMSIG(wstatus);
+	} else {
+		status = EXIT_FAILURE;
+	}
+	send_frame(conn_fd, STATUS_FRAME, &status, 1);
+	_exit(EXIT_SUCCESS);
+}
+
+/*
+ * Replaces a stale socket left by a server that did not exit cleanly. A
+ * socket that a server still accepts connections on is left alone.
+ */
+static void remove_stale_socket(const char *socket_file,
+		struct sockaddr_un *addr)
+{
+	struct stat st;
+	int fd;
+
+	if (lstat(socket_file, &st) != 0 || !S_ISSOCK(st.st_mode)) {
+		return;
+	}
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		sys_error("socket");
+	}
+	if (connect(fd, (struct sockaddr *) addr, sizeof(*addr)) == 0) {
+		fprintf(stderr, "%s: error: A server is already listening on "
+		                "`%s`\n", argv0, socket_file);
+		exit(EXIT_FAILURE);
+	}
+	if (errno == ECONNREFUSED) {
+		unlink(socket_file);
+	}
+	close(fd);
+}
+
+NORETURN void run_server(const char *socket_file)
+{
+	struct sockaddr_un addr;
+	int server_fd, conn_fd;
+	pid_t pid;
+
+	init_code_gen();
+	addr = get_socket_addr(socket_file);
+	server_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (server_fd < 0) {
+		sys_error("socket");
+	}
+	remove_stale_socket(socket_file, &addr);
+	if (bind(server_fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+		sys_error(socket_file);
+	}
+	if (listen(server_fd, SOMAXCONN) != 0) {
+		sys_error("listen");
+	}
+	// Children are reaped automatically, and clients may hang up early
+	signal(SIGCHLD, SIG_IGN);
+	signal(SIGPIPE, SIG_IGN);
+	for (;;) {
+		conn_fd = accept(server_fd, NULL, NULL);
+		if (conn_fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) {
+				continue;
+			}
+			sys_error("accept");
+		}
+		pid = fork();
+		if (pid == 0) {
+			close(server_fd);
+			signal(SIGCHLD, SIG_DFL);
+			serve_request(conn_fd);
+		}
+		if (pid < 0) {
+			perror(argv0);
+		}
+		close(conn_fd);
+	}
+}
@@ -0,0 +1 @@
+NORETURN void run_server(const char *socket_file);
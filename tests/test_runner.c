@@ -0,0 +1,1086 @@
+/*
+ * Compiles, links and runs every test program concurrently on a pool of
+ * worker processes. Each phase of a test runs in its own child process with a
+ * timeout. Per-test compile, link and run times are recorded and written as a
+ * summary to stderr and, optionally, as JSON.
+ *
+ * Usage: test_runner [-j jobs] [-t timeout] [-n runs] [-c compiler]
+ *                    [-o results.json] [test.qf ...]
+ *
+ * Tests may start with comment lines holding directives:
+ *   `// flags: ...` compiles the test with those extra compiler flags.
+ *   `// profile-round-trip` builds and runs the test with
+ *   `-fprofile-generate`, then builds and runs it again with `-fprofile-use`
+ *   on the profile that was written. Only the IR of the second build is
+ *   checked.
+ *   `// expect: status` makes the test pass only if it ends with `status`
+ *   instead, e.g. `compile_error`, or `trap` for a runtime check failing.
+ *   `// ir-contains: text` also emits the LLVM IR of the test, with the same
+ *   flags, and fails the test if no line has `text`. `// ir-lacks: text`
+ *   fails it if a line has `text` instead. `{{.*}}` in `text` matches
+ *   anything, and functions have their attributes written out in place of
+ *   their attribute groups, so `@f({{.*}}readnone` matches a read-none `f`.
+ *   `// sources: file...` compiles those files, relative to the directory of
+ *   the test, together with it.
+ *   `// output-contains: text` fails the test if `text` is not in what the
+ *   compiler and the test wrote.
+ *   `// server` compiles the test through `quoftc-client` and a compile
+ *   server, which the runner starts once on a socket that a killed server
+ *   left behind. The runner also checks that a second server refuses to
+ *   take over the socket while the first one listens on it.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_TIMEOUT 10.0 // Seconds per phase
+#define POLL_INTERVAL_NS 1000000
+#define MAX_FLAGS 8
+#define MAX_SOURCES 4
+#define MAX_IR_CHECKS 8
+#define FLAGS_PREFIX "// flags:"
+#define PROFILE_ROUND_TRIP_DIRECTIVE "// profile-round-trip"
+#define EXPECT_PREFIX "// expect:"
+#define IR_CONTAINS_PREFIX "// ir-contains:"
+#define IR_LACKS_PREFIX "// ir-lacks:"
+#define IR_GAP "{{.*}}"
+#define SOURCES_PREFIX "// sources:"
+#define OUTPUT_CONTAINS_PREFIX "// output-contains:"
+#define SERVER_DIRECTIVE "// server"
+
+enum phase {
+	COMPILE_PHASE, IR_PHASE, LINK_PHASE, RUN_PHASE, DONE_PHASE
+};
+
+enum status {
+	PASSED, COMPILE_FAILED, LINK_FAILED, RUN_FAILED, CRASHED, TRAPPED,
+	TIMED_OUT, UNEXPECTED_PASS, NUM_STATUSES
+};
+
+struct test {
+	const char *src;
+	char *obj, *bin, *log;
+	char *sources[MAX_SOURCES + 1]; // Extra sources, NULL-terminated
+	char *ir; // The IR file if it is checked, NULL otherwise
+	struct {
+		char *text;
+		bool is_present; // Whether `text` must be in the IR or not
+	} ir_checks[MAX_IR_CHECKS];
+	size_t nir_checks;
+	char *output_text; // That the log must contain, or NULL
+	bool uses_server;
+	char *flags[MAX_FLAGS + 1]; // Extra compiler flags, NULL-terminated
+	char *profile; // With a profile round trip, NULL otherwise
+	char *profile_flag; // The `-fprofile-*` flag of the current build
+	bool using_profile; // Whether the second build of a round trip is done
+	enum phase phase;
+	enum status status, expected_status;
+	int signal; // Only valid if `status` is `CRASHED` or `TRAPPED`
+	pid_t pid;
+	bool timed_out;
+	double phase_start;
+	double compile_time, link_time, run_time, min_run_time;
+	unsigned runs_left;
+};
+
+static const char *argv0;
+static const char *compiler = "./quoftc";
+static const char *client = "./quoftc-client";
+static char work_dir[] = "/tmp/quoft-tests.XXXXXX";
+static char *run_test_obj;
+static char *server_socket, *server_log, *socket_flag;
+static pid_t server_pid = -1;
+static double timeout = DEFAULT_TIMEOUT;
+static unsigned nruns = 1;
+
+static void die(const char *fmt, ...)
+{
+	va_list ap;
+
+	fprintf(stderr, "%s: error: ", argv0);
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fputc('\n', stderr);
+	exit(EXIT_FAILURE);
+}
+
+static void *xmalloc(size_t size)
+{
+	void *p;
+
+	p = malloc(size);
+	if (p == NULL) {
+		die("%s", strerror(errno));
+	}
+	return p;
+}
+
+static void *xcalloc(size_t nmemb, size_t size)
+{
+	void *p;
+
+	p = calloc(nmemb, size);
+	if (p == NULL) {
+		die("%s", strerror(errno));
+	}
+	return p;
+}
+
+static void *xrealloc(void *p, size_t size)
+{
+	p = realloc(p, size);
+	if (p == NULL) {
+		die("%s", strerror(errno));
+	}
+	return p;
+}
+
+static char *xstrdup(const char *s)
+{
+	return strcpy(xmalloc(strlen(s) + 1), s);
+}
+
+// Returns `work_dir/name.suffix` where `name` is the base name of `src`
+static char *work_path(const char *src, const char *suffix)
+{
+	const char *base;
+	char *path;
+	size_t len;
+
+	base = strrchr(src, '/');
+	base = base == NULL ? src : base + 1;
+	len = strlen(work_dir) + strlen(base) + strlen(suffix) + 3;
+	path = xmalloc(len);
+	snprintf(path, len, "%s/%s.%s", work_dir, base, suffix);
+	return path;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Starts `argv` with stdout and stderr appended to `log_path`
+static pid_t spawn(char *const argv[], const char *log_path)
+{
+	pid_t pid;
+	int fd;
+
+	pid = fork();
+	if (pid == -1) {
+		die("fork: %s", strerror(errno));
+	}
+	if (pid == 0) {
+		fd = open(log_path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+		if (fd == -1 || dup2(fd, STDOUT_FILENO) == -1 ||
+				dup2(fd, STDERR_FILENO) == -1) {
+			_exit(127);
+		}
+		close(fd);
+		execvp(argv[0], argv);
+		fprintf(stderr, "%s: %s\n", argv[0], strerror(errno));
+		_exit(127);
+	}
+	return pid;
+}
+
+static void start_phase(struct test *test)
+{
+	char *argv[MAX_FLAGS + MAX_SOURCES + 9];
+	size_t i, j;
+
+	switch (test->phase) {
+	case COMPILE_PHASE:
+	case IR_PHASE:
+		i = 0;
+		if (test->uses_server) {
+			argv[i++] = (char *) client;
+			argv[i] = socket_flag;
+		} else {
+			argv[i] = (char *) compiler;
+		}
+		for (j = 0; test->flags[j] != NULL; j++) {
+			argv[++i] = test->flags[j];
+		}
+		if (test->profile_flag != NULL) {
+			argv[++i] = test->profile_flag;
+		}
+		if (test->phase == IR_PHASE) {
+			argv[++i] = "--emit=llvm-ir";
+		}
+		argv[i + 1] = "-o";
+		argv[i + 2] = test->phase == IR_PHASE ? test->ir : test->obj;
+		argv[i + 3] = (char *) test->src;
+		for (j = 0; test->sources[j] != NULL; j++) {
+			argv[i + 4 + j] = test->sources[j];
+		}
+		argv[i + 4 + j] = NULL;
+		break;
+	case LINK_PHASE:
+		argv[0] = "gcc";
+		argv[1] = test->obj;
+		argv[2] = run_test_obj;
+		argv[3] = "-o";
+		argv[4] = test->bin;
+		argv[5] = NULL;
+		break;
+	case RUN_PHASE:
+		argv[0] = test->bin;
+		argv[1] = NULL;
+		break;
+	case DONE_PHASE:
+		abort();
+	}
+	test->timed_out = false;
+	test->phase_start = now();
+	test->pid = spawn(argv, test->log);
+}
+
+// Returns `flag=path` in a new string
+static char *path_flag(const char *flag, const char *path)
+{
+	char *s;
+
+	s = xmalloc(strlen(flag) + strlen(path) + 2);
+	sprintf(s, "%s=%s", flag, path);
+	return s;
+}
+
+static void append_to_log(const char *path, const char *msg)
+{
+	FILE *fp;
+
+	fp = fopen(path, "a");
+	if (fp != NULL) {
+		fprintf(fp, "%s\n", msg);
+		fclose(fp);
+	}
+}
+
+// Returns whether the log of the test has the text it must contain
+static bool check_output(struct test *test)
+{
+	char line[4096], msg[512];
+	bool found;
+	FILE *fp;
+
+	if (test->output_text == NULL) {
+		return true;
+	}
+	found = false;
+	fp = fopen(test->log, "r");
+	if (fp != NULL) {
+		while (!found && fgets(line, sizeof(line), fp) != NULL) {
+			found = strstr(line, test->output_text) != NULL;
+		}
+		fclose(fp);
+	}
+	if (!found) {
+		snprintf(msg, sizeof(msg), "The output lacks `%s`",
+				test->output_text);
+		append_to_log(test->log, msg);
+	}
+	return found;
+}
+
+static void finish_test(struct test *test, enum status status)
+{
+	if (status == test->expected_status) {
+		status = check_output(test) ? PASSED : RUN_FAILED;
+	} else if (status == PASSED) {
+		status = UNEXPECTED_PASS;
+	}
+	test->status = status;
+	test->phase = DONE_PHASE;
+	test->pid = -1;
+}
+
+// Returns whether `line` has the pieces of `text` between gaps, in order
+static bool line_matches(const char *line, const char *text)
+{
+	const char *gap;
+	size_t len;
+
+	for (;;) {
+		gap = strstr(text, IR_GAP);
+		len = gap == NULL ? strlen(text) : (size_t) (gap - text);
+		while (strncmp(line, text, len) != 0) {
+			if (*line++ == '\0') {
+				return false;
+			}
+		}
+		if (gap == NULL) {
+			return true;
+		}
+		line += len;
+		text = gap + strlen(IR_GAP);
+	}
+}
+
+/*
+ * Reads the attribute groups of the IR, which are numbered from 0, such as
+ * `attributes #0 = { nounwind }`. Returns their attributes by number.
+ */
+static char **read_attr_groups(FILE *fp, size_t *ngroups)
+{
+	char line[4096], **groups, *attrs;
+	size_t nalloc;
+	unsigned num;
+	int start;
+
+	groups = NULL;
+	*ngroups = nalloc = 0;
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		start = -1;
+		if (sscanf(line, "attributes #%u = {%n", &num, &start) != 1 ||
+				start == -1 || strstr(line, " }") == NULL) {
+			continue;
+		}
+		if (num >= nalloc) {
+			nalloc = 2 * num + 8;
+			groups = xrealloc(groups, nalloc * sizeof(char *));
+		}
+		for (; *ngroups <= num; (*ngroups)++) {
+			groups[*ngroups] = NULL;
+		}
+		attrs = line + start + strspn(line + start, " ");
+		*strstr(attrs, " }") = '\0';
+		free(groups[num]);
+		groups[num] = xstrdup(attrs);
+	}
+	rewind(fp);
+	return groups;
+}
+
+// Writes `line` to `buf` with the attribute group of a function written out
+static void expand_attr_group(const char *line, char **groups, size_t ngroups,
+		char *buf, size_t size)
+{
+	const char *ref;
+	unsigned long num;
+	char *end;
+
+	ref = strrchr(line, '#');
+	if ((strncmp(line, "define ", 7) != 0 &&
+				strncmp(line, "declare ", 8) != 0) ||
+			ref == NULL || ref == line || ref[-1] != ' ') {
+		snprintf(buf, size, "%s", line);
+		return;
+	}
+	num = strtoul(ref + 1, &end, 10);
+	if (end == ref + 1 || num >= ngroups || groups[num] == NULL) {
+		snprintf(buf, size, "%s", line);
+		return;
+	}
+	snprintf(buf, size, "%.*s%s%s", (int) (ref - line), line, groups[num],
+			end);
+}
+
+/*
+ * Returns whether the IR file of the test passes its checks, noting the first
+ * that fails in the log
+ */
+static bool check_ir(struct test *test)
+{
+	char line[4096], expanded[8192], msg[512], **groups;
+	bool found[MAX_IR_CHECKS] = {false};
+	size_t ngroups, i;
+	FILE *fp;
+
+	fp = fopen(test->ir, "r");
+	if (fp == NULL) {
+		append_to_log(test->log, "No IR was written");
+		return false;
+	}
+	groups = read_attr_groups(fp, &ngroups);
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		expand_attr_group(line, groups, ngroups, expanded,
+				sizeof(expanded));
+		for (i = 0; i < test->nir_checks; i++) {
+			if (line_matches(expanded, test->ir_checks[i].text)) {
+				found[i] = true;
+			}
+		}
+	}
+	fclose(fp);
+	for (i = 0; i < ngroups; i++) {
+		free(groups[i]);
+	}
+	free(groups);
+	for (i = 0; i < test->nir_checks; i++) {
+		if (found[i] != test->ir_checks[i].is_present) {
+			snprintf(msg, sizeof(msg), "The IR %s `%s`",
+					found[i] ? "has" : "lacks",
+					test->ir_checks[i].text);
+			append_to_log(test->log, msg);
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Starts the second build of a profile round trip, which uses the profile
+ * written by the runs of the first. Returns false if no profile was written.
+ */
+static bool start_profile_use(struct test *test)
+{
+	struct stat st;
+
+	if (stat(test->profile, &st) == -1 || st.st_size == 0) {
+		append_to_log(test->log, "No profile was written");
+		return false;
+	}
+	free(test->profile_flag);
+	test->profile_flag = path_flag("-fprofile-use", test->profile);
+	test->using_profile = true;
+	test->phase = COMPILE_PHASE;
+	test->runs_left = nruns;
+	test->run_time = test->min_run_time = 0;
+	return true;
+}
+
+/*
+ * Records the result of the phase whose process exited with `wstatus`.
+ * Returns true if the test needs another phase to be started.
+ */
+static bool end_phase(struct test *test, int wstatus)
+{
+	double elapsed;
+	bool ok;
+
+	elapsed = now() - test->phase_start;
+	ok = WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == 0;
+	if (test->timed_out) {
+		finish_test(test, TIMED_OUT);
+		return false;
+	}
+	switch (test->phase) {
+	case COMPILE_PHASE:
+		test->compile_time = elapsed;
+		if (!ok) {
+			finish_test(test, COMPILE_FAILED);
+			return false;
+		}
+		test->phase = test->ir != NULL && (test->profile == NULL ||
+				test->using_profile) ? IR_PHASE : LINK_PHASE;
+		return true;
+	case IR_PHASE:
+		test->compile_time += elapsed;
+		if (!ok) {
+			finish_test(test, COMPILE_FAILED);
+			return false;
+		}
+		if (!check_ir(test)) {
+			finish_test(test, RUN_FAILED);
+			return false;
+		}
+		test->phase = LINK_PHASE;
+		return true;
+	case LINK_PHASE:
+		test->link_time = elapsed;
+		if (!ok) {
+			finish_test(test, LINK_FAILED);
+			return false;
+		}
+		test->phase = RUN_PHASE;
+		return true;
+	case RUN_PHASE:
+		test->run_time += elapsed;
+		if (test->min_run_time == 0 || elapsed < test->min_run_time) {
+			test->min_run_time = elapsed;
+		}
+		if (WIFSIGNALED(wstatus)) {
+			test->signal = WTERMSIG(wstatus);
+			// `llvm.trap` raises SIGILL on x86 and SIGTRAP elsewhere
+			finish_test(test, test->signal == SIGILL ||
+					test->signal == SIGTRAP ? TRAPPED
+					                        : CRASHED);
+			return false;
+		}
+		if (!ok) {
+			finish_test(test, RUN_FAILED);
+			return false;
+		}
+		if (--test->runs_left > 0) {
+			return true;
+		}
+		if (test->profile != NULL && !test->using_profile) {
+			if (start_profile_use(test)) {
+				return true;
+			}
+			finish_test(test, RUN_FAILED);
+			return false;
+		}
+		finish_test(test, PASSED);
+		return false;
+	case DONE_PHASE:
+		break;
+	}
+	abort();
+}
+
+static const char *status_to_str(enum status status)
+{
+	static const char *names[] = {
+		[PASSED] = "pass",
+		[COMPILE_FAILED] = "compile_error",
+		[LINK_FAILED] = "link_error",
+		[RUN_FAILED] = "fail",
+		[CRASHED] = "crash",
+		[TRAPPED] = "trap",
+		[TIMED_OUT] = "timeout",
+		[UNEXPECTED_PASS] = "unexpected_pass"
+	};
+
+	return names[status];
+}
+
+static void dump_log(const char *path)
+{
+	char buf[4096];
+	size_t n;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		return;
+	}
+	while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+		fwrite(buf, 1, n, stderr);
+	}
+	fclose(fp);
+}
+
+static void report_test(struct test *test)
+{
+	fprintf(stderr, "%-13s %s (compile %.1f ms, link %.1f ms, "
+			"run %.1f ms)\n", status_to_str(test->status),
+			test->src, test->compile_time * 1e3,
+			test->link_time * 1e3, test->min_run_time * 1e3);
+	if (test->status == CRASHED || test->status == TRAPPED) {
+		fprintf(stderr, "  killed by signal %d\n", test->signal);
+	}
+	if (test->status != PASSED) {
+		dump_log(test->log);
+	}
+}
+
+static void run_tests(struct test *tests, size_t ntests, unsigned njobs)
+{
+	size_t next, ndone, nrunning, i;
+	struct timespec interval;
+	int wstatus;
+	pid_t pid;
+	double t;
+
+	interval.tv_sec = 0;
+	interval.tv_nsec = POLL_INTERVAL_NS;
+	next = ndone = nrunning = 0;
+	while (ndone < ntests) {
+		while (nrunning < njobs && next < ntests) {
+			start_phase(&tests[next++]);
+			nrunning++;
+		}
+		pid = waitpid(-1, &wstatus, WNOHANG);
+		if (pid == -1) {
+			die("waitpid: %s", strerror(errno));
+		}
+		if (pid == 0) {
+			t = now();
+			for (i = 0; i < next; i++) {
+				if (tests[i].pid > 0 && !tests[i].timed_out &&
+						t - tests[i].phase_start >
+						timeout) {
+					tests[i].timed_out = true;
+					kill(tests[i].pid, SIGKILL);
+				}
+			}
+			nanosleep(&interval, NULL);
+			continue;
+		}
+		for (i = 0; i < next && tests[i].pid != pid; i++)
+			;
+		if (i == next) {
+			continue;
+		}
+		if (end_phase(&tests[i], wstatus)) {
+			start_phase(&tests[i]);
+		} else {
+			report_test(&tests[i]);
+			nrunning--;
+			ndone++;
+		}
+	}
+}
+
+static void write_json_string(FILE *fp, const char *s)
+{
+	fputc('"', fp);
+	for (; *s != '\0'; s++) {
+		if (*s == '"' || *s == '\\') {
+			fputc('\\', fp);
+		}
+		fputc(*s, fp);
+	}
+	fputc('"', fp);
+}
+
+static void write_json(const char *path, struct test *tests, size_t ntests,
+		double total_time)
+{
+	size_t i, npassed;
+	FILE *fp;
+
+	fp = fopen(path, "w");
+	if (fp == NULL) {
+		die("%s: %s", path, strerror(errno));
+	}
+	npassed = 0;
+	fprintf(fp, "{\n\t\"tests\": [\n");
+	for (i = 0; i < ntests; i++) {
+		npassed += tests[i].status == PASSED;
+		fprintf(fp, "\t\t{\"name\": ");
+		write_json_string(fp, tests[i].src);
+		fprintf(fp, ", \"status\": \"%s\", \"compile_ms\": %.3f, "
+				"\"link_ms\": %.3f, \"run_ms\": %.3f, "
+				"\"min_run_ms\": %.3f, \"runs\": %u}%s\n",
+				status_to_str(tests[i].status),
+				tests[i].compile_time * 1e3,
+				tests[i].link_time * 1e3,
+				tests[i].run_time * 1e3,
+				tests[i].min_run_time * 1e3,
+				nruns - tests[i].runs_left,
+				i + 1 < ntests ? "," : "");
+	}
+	fprintf(fp, "\t],\n\t\"summary\": {\"total\": %zu, \"passed\": %zu, "
+			"\"failed\": %zu, \"wall_ms\": %.3f}\n}\n",
+			ntests, npassed, ntests - npassed, total_time * 1e3);
+	fclose(fp);
+}
+
+static void read_flags(struct test *test, char *line)
+{
+	size_t nflags;
+	char *flag;
+
+	nflags = 0;
+	flag = strtok(line + strlen(FLAGS_PREFIX), " \t\n");
+	while (flag != NULL) {
+		if (nflags == MAX_FLAGS) {
+			die("%s: too many flags", test->src);
+		}
+		test->flags[nflags++] = xstrdup(flag);
+		flag = strtok(NULL, " \t\n");
+	}
+}
+
+static void read_ir_check(struct test *test, char *line, size_t prefix_len,
+		bool is_present)
+{
+	char *text;
+
+	if (test->nir_checks == MAX_IR_CHECKS) {
+		die("%s: too many IR checks", test->src);
+	}
+	text = line + prefix_len;
+	text += strspn(text, " \t");
+	text[strcspn(text, "\n")] = '\0';
+	if (*text == '\0') {
+		die("%s: no IR text", test->src);
+	}
+	if (test->ir == NULL) {
+		test->ir = work_path(test->src, "ll");
+	}
+	test->ir_checks[test->nir_checks].text = xstrdup(text);
+	test->ir_checks[test->nir_checks].is_present = is_present;
+	test->nir_checks++;
+}
+
+static void read_output_check(struct test *test, char *line)
+{
+	char *text;
+
+	if (test->output_text != NULL) {
+		die("%s: too many output checks", test->src);
+	}
+	text = line + strlen(OUTPUT_CONTAINS_PREFIX);
+	text += strspn(text, " \t");
+	text[strcspn(text, "\n")] = '\0';
+	if (*text == '\0') {
+		die("%s: no output text", test->src);
+	}
+	test->output_text = xstrdup(text);
+}
+
+// Reads extra sources, which are relative to the directory of the test
+static void read_sources(struct test *test, char *line)
+{
+	const char *slash;
+	size_t nsources, dir_len;
+	char *name, *path;
+
+	slash = strrchr(test->src, '/');
+	dir_len = slash == NULL ? 0 : slash - test->src + 1;
+	nsources = 0;
+	name = strtok(line + strlen(SOURCES_PREFIX), " \t\n");
+	while (name != NULL) {
+		if (nsources == MAX_SOURCES) {
+			die("%s: too many sources", test->src);
+		}
+		path = xmalloc(dir_len + strlen(name) + 1);
+		memcpy(path, test->src, dir_len);
+		strcpy(path + dir_len, name);
+		test->sources[nsources++] = path;
+		name = strtok(NULL, " \t\n");
+	}
+}
+
+static void read_expected_status(struct test *test, char *line)
+{
+	enum status status;
+	char *name;
+
+	name = strtok(line + strlen(EXPECT_PREFIX), " \t\n");
+	for (status = 0; status < NUM_STATUSES; status++) {
+		if (name != NULL && status != UNEXPECTED_PASS &&
+				strcmp(name, status_to_str(status)) == 0) {
+			test->expected_status = status;
+			return;
+		}
+	}
+	die("%s: unknown expected status", test->src);
+}
+
+// Reads the directives from the leading comment lines of the test
+static void read_directives(struct test *test)
+{
+	char line[256];
+	FILE *fp;
+
+	fp = fopen(test->src, "r");
+	if (fp == NULL) {
+		return; // The compiler will report the error
+	}
+	while (fgets(line, sizeof(line), fp) != NULL &&
+			strncmp(line, "//", 2) == 0) {
+		if (strncmp(line, FLAGS_PREFIX, strlen(FLAGS_PREFIX)) == 0) {
+			read_flags(test, line);
+		} else if (strncmp(line, EXPECT_PREFIX,
+					strlen(EXPECT_PREFIX)) == 0) {
+			read_expected_status(test, line);
+		} else if (strncmp(line, IR_CONTAINS_PREFIX,
+					strlen(IR_CONTAINS_PREFIX)) == 0) {
+			read_ir_check(test, line, strlen(IR_CONTAINS_PREFIX),
+					true);
+		} else if (strncmp(line, IR_LACKS_PREFIX,
+					strlen(IR_LACKS_PREFIX)) == 0) {
+			read_ir_check(test, line, strlen(IR_LACKS_PREFIX),
+					false);
+		} else if (strncmp(line, SOURCES_PREFIX,
+					strlen(SOURCES_PREFIX)) == 0) {
+			read_sources(test, line);
+		} else if (strncmp(line, OUTPUT_CONTAINS_PREFIX,
+					strlen(OUTPUT_CONTAINS_PREFIX)) == 0) {
+			read_output_check(test, line);
+		} else if (strcmp(line, SERVER_DIRECTIVE "\n") == 0) {
+			test->uses_server = true;
+		} else if (strcmp(line, PROFILE_ROUND_TRIP_DIRECTIVE "\n")
+				== 0) {
+			test->profile = work_path(test->src, "qfprof");
+			test->profile_flag = path_flag("-fprofile-generate",
+					test->profile);
+		}
+	}
+	fclose(fp);
+}
+
+static void cleanup(struct test *tests, size_t ntests)
+{
+	size_t i, j;
+
+	for (i = 0; i < ntests; i++) {
+		for (j = 0; tests[i].flags[j] != NULL; j++) {
+			free(tests[i].flags[j]);
+		}
+		unlink(tests[i].obj);
+		unlink(tests[i].bin);
+		unlink(tests[i].log);
+		if (tests[i].profile != NULL) {
+			unlink(tests[i].profile);
+		}
+		for (j = 0; tests[i].sources[j] != NULL; j++) {
+			free(tests[i].sources[j]);
+		}
+		for (j = 0; j < tests[i].nir_checks; j++) {
+			free(tests[i].ir_checks[j].text);
+		}
+		if (tests[i].ir != NULL) {
+			unlink(tests[i].ir);
+		}
+		free(tests[i].output_text);
+	}
+	if (server_socket != NULL) {
+		unlink(server_socket);
+		unlink(server_log);
+	}
+	unlink(run_test_obj);
+	rmdir(work_dir);
+}
+
+static void compile_run_test_obj(const char *run_test_src)
+{
+	char *argv[] = {
+		"gcc", "-c", (char *) run_test_src, "-o", run_test_obj, NULL
+	};
+	int wstatus;
+
+	if (waitpid(spawn(argv, "/dev/null"), &wstatus, 0) == -1 ||
+			!WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != 0) {
+		die("failed to compile %s", run_test_src);
+	}
+}
+
+// Leaves a socket file that nothing listens on, as a killed server would
+static void leave_stale_socket(struct sockaddr_un *addr)
+{
+	int fd;
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1 || bind(fd, (struct sockaddr *) addr, sizeof(*addr)) ==
+			-1) {
+		die("%s: %s", server_socket, strerror(errno));
+	}
+	close(fd);
+}
+
+static bool is_listening(struct sockaddr_un *addr)
+{
+	bool ok;
+	int fd;
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1) {
+		die("socket: %s", strerror(errno));
+	}
+	ok = connect(fd, (struct sockaddr *) addr, sizeof(*addr)) == 0;
+	close(fd);
+	return ok;
+}
+
+// Returns whether `pid` exits within the timeout, killing it if not
+static bool wait_with_timeout(pid_t pid, int *wstatus)
+{
+	struct timespec interval;
+	double start;
+	pid_t ret;
+
+	interval.tv_sec = 0;
+	interval.tv_nsec = POLL_INTERVAL_NS;
+	start = now();
+	while ((ret = waitpid(pid, wstatus, WNOHANG)) == 0) {
+		if (now() - start > timeout) {
+			kill(pid, SIGKILL);
+			waitpid(pid, wstatus, 0);
+			return false;
+		}
+		nanosleep(&interval, NULL);
+	}
+	return ret == pid;
+}
+
+// Returns whether the server was still running
+static bool stop_server(void)
+{
+	bool was_running;
+	int wstatus;
+
+	was_running = waitpid(server_pid, &wstatus, WNOHANG) == 0;
+	if (was_running) {
+		kill(server_pid, SIGTERM);
+		waitpid(server_pid, &wstatus, 0);
+	}
+	return was_running;
+}
+
+/*
+ * Starts the compile server on a stale socket, which it must replace, and
+ * checks that a second server started on the socket exits with an error
+ */
+static void start_server(void)
+{
+	struct sockaddr_un addr;
+	struct timespec interval;
+	char *argv[3];
+	double start;
+	int wstatus;
+
+	server_socket = work_path("quoftc", "sock");
+	server_log = work_path("quoftc", "log");
+	socket_flag = path_flag("--socket", server_socket);
+	if (strlen(server_socket) >= sizeof(addr.sun_path)) {
+		die("%s: socket path too long", server_socket);
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, server_socket);
+	leave_stale_socket(&addr);
+
+	argv[0] = (char *) compiler;
+	argv[1] = path_flag("--server", server_socket);
+	argv[2] = NULL;
+	server_pid = spawn(argv, server_log);
+	interval.tv_sec = 0;
+	interval.tv_nsec = POLL_INTERVAL_NS;
+	start = now();
+	while (!is_listening(&addr)) {
+		if (waitpid(server_pid, &wstatus, WNOHANG) != 0 ||
+				now() - start > timeout) {
+			stop_server();
+			dump_log(server_log);
+			die("the compile server did not replace a stale socket");
+		}
+		nanosleep(&interval, NULL);
+	}
+	if (!wait_with_timeout(spawn(argv, server_log), &wstatus) ||
+			!WIFEXITED(wstatus) || WEXITSTATUS(wstatus) == 0) {
+		stop_server();
+		dump_log(server_log);
+		die("a second compile server did not refuse a socket in use");
+	}
+	free(argv[1]);
+}
+
+static unsigned default_njobs(void)
+{
+#ifdef _SC_NPROCESSORS_ONLN
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (n > 0) {
+		return n;
+	}
+#endif
+	return 4;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: %s [-j jobs] [-t timeout] [-n runs] "
+			"[-c compiler] [-o results.json] [test.qf ...]\n",
+			argv0);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *json_path;
+	struct test *tests;
+	size_t ntests, npassed, i;
+	unsigned njobs;
+	bool failed;
+	glob_t globbuf;
+	char **srcs;
+	double start;
+	int argi;
+
+	argv0 = argv[0];
+	json_path = NULL;
+	njobs = default_njobs();
+	for (argi = 1; argi < argc && argv[argi][0] == '-'; argi++) {
+		if (argi + 1 == argc || argv[argi][2] != '\0') {
+			usage();
+		}
+		switch (argv[argi][1]) {
+		case 'j':
+			njobs = strtoul(argv[++argi], NULL, 10);
+			break;
+		case 't':
+			timeout = strtod(argv[++argi], NULL);
+			break;
+		case 'n':
+			nruns = strtoul(argv[++argi], NULL, 10);
+			break;
+		case 'c':
+			compiler = argv[++argi];
+			break;
+		case 'o':
+			json_path = argv[++argi];
+			break;
+		default:
+			usage();
+		}
+	}
+	if (njobs == 0 || nruns == 0 || timeout <= 0) {
+		usage();
+	}
+	if (argi < argc) {
+		srcs = &argv[argi];
+		ntests = argc - argi;
+	} else {
+		if (glob("tests/*.qf", 0, NULL, &globbuf) != 0) {
+			die("no tests found");
+		}
+		srcs = globbuf.gl_pathv;
+		ntests = globbuf.gl_pathc;
+	}
+	if (mkdtemp(work_dir) == NULL) {
+		die("mkdtemp: %s", strerror(errno));
+	}
+	run_test_obj = work_path("run_test", "o");
+	compile_run_test_obj("tests/run_test.c");
+	tests = xcalloc(ntests, sizeof(struct test));
+	for (i = 0; i < ntests; i++) {
+		tests[i].src = srcs[i];
+		tests[i].obj = work_path(srcs[i], "o");
+		tests[i].bin = work_path(srcs[i], "bin");
+		tests[i].log = work_path(srcs[i], "log");
+		tests[i].phase = COMPILE_PHASE;
+		tests[i].pid = -1;
+		tests[i].runs_left = nruns;
+		read_directives(&tests[i]);
+		if (tests[i].uses_server && server_pid == -1) {
+			start_server();
+		}
+	}
+	start = now();
+	run_tests(tests, ntests, njobs);
+	start = now() - start;
+	npassed = 0;
+	for (i = 0; i < ntests; i++) {
+		npassed += tests[i].status == PASSED;
+	}
+	fprintf(stderr, "%zu/%zu tests passed in %.2f s (%u jobs)\n",
+			npassed, ntests, start, njobs);
+	// The client compiles by itself if no server is listening
+	failed = npassed != ntests;
+	if (server_pid != -1 && !stop_server()) {
+		fprintf(stderr, "%s: error: the compile server exited during "
+				"the tests\n", argv0);
+		failed = true;
+	}
+	if (json_path != NULL) {
+		write_json(json_path, tests, ntests, start);
+	}
+	cleanup(tests, ntests);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,465 @@
+/*
+ * Interning of types. Primitive types are singletons, and composite types are
+ * kept in a hash table keyed by their kind and the addresses of their
+ * canonical parts, so building the same type twice gives the same node.
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ds.h"
+#include "quoftc.h"
+#include "ast.h"
+#include "types.h"
+
+#define MIN_TYPE_TBL_SIZE 256 // A power of two
+
+static struct type prim_types[CHAR_TYPE + 1];
+static size_t ntypes = ARRAY_LEN(prim_types); // Ids are counted from one
+
+// Open addressing table of composite types, which are never freed
+static struct type **type_tbl;
+static size_t type_tbl_size, ntbl_types;
+
+// FNV-1a, one word at a time
+static uint64_t hash_word(uint64_t hash, uint64_t word)
+{
+	return (hash ^ word) * UINT64_C(0x100000001b3);
+}
+
+static uint64_t hash_str(uint64_t hash, const char *s)
+{
+	while (*s != '\0') {
+		hash = hash_word(hash, (unsigned char) *s++);
+	}
+	return hash_word(hash, 0);
+}
+
+static uint64_t hash_types(uint64_t hash, Vec *types)
+{
+	size_t i;
+
+	hash = hash_word(hash, vec_len(types));
+	for (i = 0; i < vec_len(types); i++) {
+		hash = hash_word(hash, (uintptr_t) vec_get(types, i));
+	}
+	return hash;
+}
+
+// The parts of `type` are canonical, so they are hashed by address
+static uint64_t hash_type(struct type *type)
+{
+	uint64_t hash;
+	size_t i;
+
+	hash = hash_word(UINT64_C(0xcbf29ce484222325), type->kind);
+	switch (type->kind) {
+	case ALIAS_TYPE:
+		return hash_str(hash, type->u.alias.name);
+	case PARAM_TYPE:
+		hash = hash_str(hash, type->u.param.name);
+		return hash_types(hash, type->u.param.params);
+	case ARRAY_TYPE:
+		hash = hash_word(hash, (uintptr_t) type->u.array.l);
+		return hash_word(hash, type->u.array.len);
+	case POINTER_TYPE:
+		return hash_word(hash, (uintptr_t) type->u.pointer.l);
+	case TUPLE_TYPE:
+		return hash_types(hash, type->u.tuple.types);
+	case STRUCT_TYPE:
+		hash = hash_types(hash, type->u.struct_.types);
+		for (i = 0; i < vec_len(type->u.struct_.names); i++) {
+			hash = hash_str(hash,
+					vec_get(type->u.struct_.names, i));
+		}
+		return hash;
+	case FUNC_TYPE:
+		hash = hash_word(hash, (uintptr_t) type->u.func.ret);
+		return hash_types(hash, type->u.func.params);
+	case CONST_TYPE:
+		return hash_word(hash, (uintptr_t) type->u.const_.type);
+	case VOLATILE_TYPE:
+		return hash_word(hash, (uintptr_t) type->u.volatile_.type);
+	case RESTRICT_TYPE:
+		return hash_word(hash, (uintptr_t) type->u.restrict_.type);
+	case VECTOR_TYPE:
+		hash = hash_word(hash, (uintptr_t) type->u.vector.l);
+		return hash_word(hash, type->u.vector.len);
+	default:
+		internal_error(); // Primitive types aren't in the table
+	}
+}
+
+static bool have_same_types(Vec *types1, Vec *types2)
+{
+	size_t i;
+
+	if (vec_len(types1) != vec_len(types2)) {
+		return false;
+	}
+	for (i = 0; i < vec_len(types1); i++) {
+		if (vec_get(types1, i) != vec_get(types2, i)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool have_same_names(Vec *names1, Vec *names2)
+{
+	size_t i;
+
+	for (i = 0; i < vec_len(names1); i++) {
+		if (strcmp(vec_get(names1, i), vec_get(names2, i)) != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Compares two types whose parts are canonical
+static bool are_types_same(struct type *type1, struct type *type2)
+{
+	if (type1->kind != type2->kind) {
+		return false;
+	}
+	switch (type1->kind) {
+	case ALIAS_TYPE:
+		return strcmp(type1->u.alias.name, type2->u.alias.name) == 0;
+	case PARAM_TYPE:
+		return strcmp(type1->u.param.name, type2->u.param.name) == 0 &&
+			have_same_types(type1->u.param.params,
+					type2->u.param.params);
+	case ARRAY_TYPE:
+		return type1->u.array.l == type2->u.array.l &&
+			type1->u.array.len == type2->u.array.len;
+	case POINTER_TYPE:
+		return type1->u.pointer.l == type2->u.pointer.l;
+	case TUPLE_TYPE:
+		return have_same_types(type1->u.tuple.types,
+				type2->u.tuple.types);
+	case STRUCT_TYPE:
+		return have_same_types(type1->u.struct_.types,
+				type2->u.struct_.types) &&
+			have_same_names(type1->u.struct_.names,
+					type2->u.struct_.names);
+	case FUNC_TYPE:
+		return type1->u.func.ret == type2->u.func.ret &&
+			have_same_types(type1->u.func.params,
+					type2->u.func.params);
+	case CONST_TYPE:
+		return type1->u.const_.type == type2->u.const_.type;
+	case VOLATILE_TYPE:
+		return type1->u.volatile_.type == type2->u.volatile_.type;
+	case RESTRICT_TYPE:
+		return type1->u.restrict_.type == type2->u.restrict_.type;
+	case VECTOR_TYPE:
+		return type1->u.vector.l == type2->u.vector.l &&
+			type1->u.vector.len == type2->u.vector.len;
+	default:
+		internal_error();
+	}
+}
+
+// Returns the slot of the table that holds `type` or would hold it
+static struct type **find_type_slot(struct type *type)
+{
+	size_t i;
+
+	i = hash_type(type) & (type_tbl_size - 1);
+	while (type_tbl[i] != NULL && !are_types_same(type_tbl[i], type)) {
+		i = (i + 1) & (type_tbl_size - 1);
+	}
+	return &type_tbl[i];
+}
+
+static void grow_type_tbl(void)
+{
+	struct type **old_tbl;
+	size_t old_size, i;
+
+	old_tbl = type_tbl;
+	old_size = type_tbl_size;
+	type_tbl_size = old_size == 0 ? MIN_TYPE_TBL_SIZE : 2 * old_size;
+	type_tbl = xcalloc(sizeof(struct type *) * type_tbl_size);
+	for (i = 0; i < old_size; i++) {
+		if (old_tbl[i] != NULL) {
+			*find_type_slot(old_tbl[i]) = old_tbl[i];
+		}
+	}
+	free(old_tbl);
+}
+
+// Returns the stored type equal to `key`, which is only read
+static struct type *lookup_type(struct type *key)
+{
+	if (type_tbl == NULL) {
+		grow_type_tbl();
+	}
+	return *find_type_slot(key);
+}
+
+// `type` must not be stored yet
+static struct type *add_type(struct type *type)
+{
+	// Keep the load factor at most one half
+	if (2 * (ntbl_types + 1) > type_tbl_size) {
+		grow_type_tbl();
+	}
+	*find_type_slot(type) = type;
+	ntbl_types++;
+	type->id = ++ntypes;
+	return type;
+}
+
+// The items are canonical types, which the copy does not own
+static Vec *copy_types(Vec *types)
+{
+	Vec *copy;
+	size_t i;
+
+	copy = alloc_vec(NULL);
+	for (i = 0; i < vec_len(types); i++) {
+		vec_push(copy, vec_get(types, i));
+	}
+	return copy;
+}
+
+static Vec *intern_types(Vec *types)
+{
+	Vec *canon_types;
+	size_t i;
+
+	canon_types = alloc_vec(NULL);
+	for (i = 0; i < vec_len(types); i++) {
+		vec_push(canon_types, intern_type(vec_get(types, i)));
+	}
+	return canon_types;
+}
+
+struct type *get_prim_type(enum type_kind kind)
+{
+	assert(kind <= CHAR_TYPE);
+	prim_types[kind].kind = kind;
+	prim_types[kind].id = kind + 1;
+	return &prim_types[kind];
+}
+
+/*
+ * The lookup keys below are stack nodes that only borrow their parts, and a
+ * node is allocated only for a type that isn't stored yet
+ */
+
+static struct type *get_alias_type(const char *name)
+{
+	struct type key = {.kind = ALIAS_TYPE};
+	struct type *type;
+
+	key.u.alias.name = (char *) name;
+	type = lookup_type(&key);
+	if (type == NULL) {
+		type = add_type(ALLOC_ALIAS_TYPE(0, xstrdup(name)));
+	}
+	return type;
+}
+
+// The params of these functions must already be canonical
+
+static struct type *get_param_type(const char *name, Vec *params)
+{
+	struct type key = {.kind = PARAM_TYPE};
+	struct type *type;
+
+	key.u.param.name = (char *) name;
+	key.u.param.params = params;
+	type = lookup_type(&key);
+	if (type == NULL) {
+		type = add_type(ALLOC_PARAM_TYPE(0, xstrdup(name),
+					copy_types(params)));
+	}
+	return type;
+}
+
+struct type *get_array_type(struct type *l, uint64_t len)
+{
+	struct type key = {.kind = ARRAY_TYPE, .u.array = {l, len}};
+	struct type *type;
+
+	type = lookup_type(&key);
+	if (type == NULL) {
+		type = add_type(ALLOC_ARRAY_TYPE(0, l, len));
+	}
+	return type;
+}
+
+struct type *get_pointer_type(struct type *l)
+{
+	struct type key = {.kind = POINTER_TYPE, .u.pointer = {l}};
+	struct type *type;
+
+	type = lookup_type(&key);
+	if (type == NULL) {
+		type = add_type(ALLOC_POINTER_TYPE(0, l));
+	}
+	return type;
+}
+
+// `types` is not kept, so the caller may free it
+struct type *get_tuple_type(Vec *types)
+{
+	struct type key = {.kind = TUPLE_TYPE, .u.tuple = {types}};
+	struct type *type;
+
+	type = lookup_type(&key);
+	if (type == NULL) {
+		type = add_type(ALLOC_TUPLE_TYPE(0, copy_types(types)));
+	}
+	return type;
+}
+
+static struct type *get_struct_type(Vec *types, Vec *names)
+{
+	struct type key = {.kind = STRUCT_TYPE, .u.struct_ = {types, names}};
+	struct type *type;
+	Vec *names_copy;
+	size_t i;
+
+	type = lookup_type(&key);
+	if (type == NULL) {
+		names_copy = alloc_vec(free);
+		for (i = 0; i < vec_len(names); i++) {
+			vec_push(names_copy, xstrdup(vec_get(names, i)));
+		}
+		type = add_type(ALLOC_STRUCT_TYPE(0, copy_types(types),
+					names_copy));
+	}
+	return type;
+}
+
+static struct type *get_func_type(struct type *ret, Vec *params)
+{
+	struct type key = {.kind = FUNC_TYPE, .u.func = {ret, params}};
+	struct type *type;
+
+	type = lookup_type(&key);
+	if (type == NULL) {
+		type = add_type(ALLOC_FUNC_TYPE(0, ret, copy_types(params)));
+	}
+	return type;
+}
+
+struct type *get_const_type(struct type *subtype)
+{
+	struct type key = {.kind = CONST_TYPE, .u.const_ = {subtype}};
+	struct type *type;
+
+	type = lookup_type(&key);
+	if (type == NULL) {
+		type = add_type(ALLOC_CONST_TYPE(0, subtype));
+	}
+	return type;
+}
+
+struct type *get_volatile_type(struct type *subtype)
+{
+	struct type key = {.kind = VOLATILE_TYPE, .u.volatile_ = {subtype}};
+	struct type *type;
+
+	type = lookup_type(&key);
+	if (type == NULL) {
+		type = add_type(ALLOC_VOLATILE_TYPE(0, subtype));
+	}
+	return type;
+}
+
+struct type *get_restrict_type(struct type *subtype)
+{
+	struct type key = {.kind = RESTRICT_TYPE, .u.restrict_ = {subtype}};
+	struct type *type;
+
+	type = lookup_type(&key);
+	if (type == NULL) {
+		type = add_type(ALLOC_RESTRICT_TYPE(0, subtype));
+	}
+	return type;
+}
+
+struct type *get_vector_type(struct type *l, uint64_t len)
+{
+	struct type key = {.kind = VECTOR_TYPE, .u.vector = {l, len}};
+	struct type *type;
+
+	type = lookup_type(&key);
+	if (type == NULL) {
+		type = add_type(ALLOC_VECTOR_TYPE(0, l, len));
+	}
+	return type;
+}
+
+// Returns the canonical type equal to `type`, which is left as is
+struct type *intern_type(struct type *type)
+{
+	struct type *canon_type;
+	Vec *types;
+
+	if (type->id != 0) {
+		return type;
+	}
+	switch (type->kind) {
+	case UNSIZED_INT_TYPE:
+	case U8_TYPE:
+	case U16_TYPE:
+	case U32_TYPE:
+	case U64_TYPE:
+	case I8_TYPE:
+	case I16_TYPE:
+	case I32_TYPE:
+	case I64_TYPE:
+	case F32_TYPE:
+	case F64_TYPE:
+	case BOOL_TYPE:
+	case VOID_TYPE:
+	case CHAR_TYPE:
+		return get_prim_type(type->kind);
+	case ALIAS_TYPE:
+		return get_alias_type(type->u.alias.name);
+	case PARAM_TYPE:
+		types = intern_types(type->u.param.params);
+		canon_type = get_param_type(type->u.param.name, types);
+		free_vec(types);
+		return canon_type;
+	case ARRAY_TYPE:
+		return get_array_type(intern_type(type->u.array.l),
+				type->u.array.len);
+	case POINTER_TYPE:
+		return get_pointer_type(intern_type(type->u.pointer.l));
+	case TUPLE_TYPE:
+		types = intern_types(type->u.tuple.types);
+		canon_type = get_tuple_type(types);
+		free_vec(types);
+		return canon_type;
+	case STRUCT_TYPE:
+		types = intern_types(type->u.struct_.types);
+		canon_type = get_struct_type(types, type->u.struct_.names);
+		free_vec(types);
+		return canon_type;
+	case FUNC_TYPE:
+		types = intern_types(type->u.func.params);
+		canon_type = get_func_type(intern_type(type->u.func.ret),
+				types);
+		free_vec(types);
+		return canon_type;
+	case CONST_TYPE:
+		return get_const_type(intern_type(type->u.const_.type));
+	case VOLATILE_TYPE:
+		return get_volatile_type(intern_type(type->u.volatile_.type));
+	case RESTRICT_TYPE:
+		return get_restrict_type(intern_type(type->u.restrict_.type));
+	case VECTOR_TYPE:
+		return get_vector_type(intern_type(type->u.vector.l),
+				type->u.vector.len);
+	}
+	internal_error();
+}
@@ -0,0 +1,15 @@
+/*
+ * Canonical types. Each distinct type exists once, so types from these
+ * functions are equal exactly when their pointers are. They have no line
+ * number and are never freed.
+ */
+
+struct type *get_prim_type(enum type_kind);
+struct type *get_array_type(struct type *, uint64_t);
+struct type *get_pointer_type(struct type *);
+struct type *get_tuple_type(Vec *);
+struct type *get_const_type(struct type *);
+struct type *get_volatile_type(struct type *);
+struct type *get_restrict_type(struct type *);
+struct type *get_vector_type(struct type *, uint64_t);
+struct type *intern_type(struct type *);
@@ -56,17 +56,22 @@ invalid:
 	return 0;
 }
 
-bool is_valid_utf8(const char *s)
+/*
+ * Checks the first `len` bytes of `s`. The bytes after them must not all be
+ * UTF-8 continuation bytes, so that a truncated sequence is caught.
+ */
+bool is_valid_utf8(const char *s, size_t len)
 {
 	uint32_t code_point;
 	int nbytes;
 
-	do {
+	while (len != 0) {
 		nbytes = str_to_code_point(&code_point, s);
-		if (nbytes == 0) {
+		if (nbytes == 0 || (size_t) nbytes > len) {
 			return false;
 		}
 		s += nbytes;
-	} while (code_point != '\0');
+		len -= nbytes;
+	}
 	return true;
 }
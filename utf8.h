@@ -1,3 +1,3 @@
 bool is_valid_code_point(uint32_t);
 int str_to_code_point(uint32_t *, const char *);
-bool is_valid_utf8(const char *);
+bool is_valid_utf8(const char *, size_t);
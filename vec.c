@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include "ds.h"
 #include "quoftc.h"
@@ -42,8 +43,10 @@ void free_vec(Vec *vec)
 	if (vec == NULL) {
 		return;
 	}
-	for (i = 0; i < vec->len; i++) {
-		vec->free_item(vec_get(vec, i));
+	if (vec->free_item != NULL) {
+		for (i = 0; i < vec->len; i++) {
+			vec->free_item(vec_get(vec, i));
+		}
 	}
 	free(vec->data);
 	free(vec);
@@ -74,7 +77,10 @@ Vec *vec_push(Vec *vec, void *val)
 void vec_pop(Vec *vec)
 {
 	assert(vec->len != 0);
-	vec->free_item(vec->data[--vec->len]);
+	vec->len--;
+	if (vec->free_item != NULL) {
+		vec->free_item(vec->data[vec->len]);
+	}
 }
 
 void *vec_top(Vec *vec)